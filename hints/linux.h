@@ -29,6 +29,7 @@
 /* definitions from sys/quota.h */
 #define USRQUOTA  0             /* element used for user quotas */
 #define GRPQUOTA  1             /* element used for group quotas */
+#define PRJQUOTA  2             /* element used for project quotas */
 extern int quotactl(int, const char *, uid_t, caddr_t);
 
 
@@ -57,9 +58,10 @@ struct dqblk {
 /* you can use this switch to hard-wire the quota API if it's not identified correctly */
 /* #define LINUX_API_VERSION 1 */  /* API range [1..3] */
 
-int linuxquota_query( const char * dev, int uid, int isgrp, struct dqblk * dqb );
-int linuxquota_setqlim( const char * dev, int uid, int isgrp, struct dqblk * dqb );
-int linuxquota_sync( const char * dev, int isgrp );
+int linuxquota_query( const char * dev, int uid, int qtype, struct dqblk * dqb );
+int linuxquota_query_next( const char * dev, int id, int qtype, int * next_id, struct dqblk * dqb );
+int linuxquota_setqlim( const char * dev, int uid, int qtype, struct dqblk * dqb );
+int linuxquota_sync( const char * dev, int qtype );
 
 
 #define Q_DIV(X) (X)
@@ -101,4 +103,9 @@ int linuxquota_sync( const char * dev, int isgrp );
 #define QX_DIV(X) ((X) / 2)
 #define QX_MUL(X) ((X) * 2)
 #include "src/quotaio_xfs.h"
+/* optional: usage scan of XFS via bulkstat, see Quota.scan_usage() */
+#define XFS_BULKSTAT
 
+
+/* optional: embedded rquotad server, see class FsQuota.RquotaServer */
+#define RQUOTA_SERVER
@@ -79,6 +79,10 @@
    i.e. you want to operate on the local host only */
 /* #define NO_RPC /**/
 
+/* define for including the embedded rquotad server (class RquotaServer);
+   requires POSIX threads and NO_RPC undefined */
+/* #define RQUOTA_SERVER /**/
+
 /* This is for systems that lack librpcsvc and don't have xdr_getquota_args
    et. al. in libc either. If you do have /usr/include/rpcsvc/rquota.x
    you can generate these routines with rpcgen, too */
@@ -0,0 +1 @@
+hints/linux.h
\ No newline at end of file
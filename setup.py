@@ -12,7 +12,7 @@
 # GNU General Public License for more details.
 # ----------------------------------------------------------------------------
 
-from setuptools import setup, Extension
+from setuptools import setup, Extension, Command
 from distutils.command.install import install
 
 import os
@@ -100,6 +100,12 @@ if re.match(r"^SunOS", osr):
         #print("Configured without VxFS support", file=sys.stderr)
         pass
 
+# check whether static trace probes (USDT) are supported, e.g. via package
+# "systemtap-sdt-dev"; without the header, the probes are omitted
+if os.path.isfile('/usr/include/sys/sdt.h'):
+    extradef += [('HAVE_SYS_SDT_H', 1)]
+    print("Configured with static trace probes (sys/sdt.h)", file=sys.stderr)
+
 # check whether we are using the NetBSD quota library
 match1 = re.match(r"^NetBSD 5\.99\.(\d+)", osr)
 match2 = re.match(r"^NetBSD (\d)", osr)
@@ -115,7 +121,20 @@ if (   (match1 and (int(match1.group(1)) >= 59))
 #   so there's a risk symbols are resolved from libc while compiling against tirpc headers;
 #   therefore we do not use tirpc when rpc headers are present outside tirpc
 if re.match(r"^Linux", osr):
-    extrasrc += ["src/linuxapi.c"]
+    extrasrc += ["src/linuxapi.c", "src/rquotasrv.c", "src/qbulkstat.c"]
+    extralibs += ["pthread"]
+
+    # Btrfs qgroups are accessed via ioctls defined in the kernel headers
+    if os.path.isfile('/usr/include/linux/btrfs_tree.h'):
+        extradef += [('BTRFS_QGROUPS', 1)]
+        extrasrc += ["src/qbtrfs.c"]
+
+    # usage tracking requires fanotify with file handles and names (Linux 5.9)
+    if os.path.isfile('/usr/include/linux/fanotify.h'):
+        with open('/usr/include/linux/fanotify.h') as fh:
+            if 'FAN_REPORT_DFID_NAME' in fh.read():
+                extradef += [('FANOTIFY_TRACKING', 1)]
+                extrasrc += ["src/qtrack.c"]
 
     if os.path.isdir('/usr/include/tirpc') and not os.path.isfile('/usr/include/rpc/rpc.h'):
         print("Configured to use tirpc library instead of rpcsvc", file=sys.stderr)
@@ -154,9 +173,29 @@ class MyClean(install):
             if re.match(r"^.*\.so$", name):
                 os.remove(os.path.join(MyClean.cwd, name))
         self.rmfile('core')
+        # files created by build_quotasim
+        self.rmfile('tests/quotasim.so')
         # files created by sdist stage
         self.rmtree('dist')
 
+# Optional command for building the quotactl simulator for tests (Linux only),
+# see description in tests/quotasim.c
+class BuildQuotaSim(Command):
+    description = "build LD_PRELOAD library tests/quotasim.so"
+    user_options = []
+    def initialize_options(self):
+        pass
+    def finalize_options(self):
+        pass
+    def run(self):
+        from distutils.ccompiler import new_compiler
+        from distutils.sysconfig import customize_compiler
+        cc = new_compiler()
+        customize_compiler(cc)
+        objs = cc.compile(['tests/quotasim.c'], output_dir='build/quotasim',
+                          extra_preargs=['-fPIC'])
+        cc.link_shared_object(objs, 'tests/quotasim.so', libraries=['dl', 'pthread'])
+
 # ----------------------------------------------------------------------------
 # Finally execute the setup command
 
@@ -181,7 +220,7 @@ if (sys.version_info[0] == 3) and (sys.version_info[1] < 8):
     extradef += [('NAMED_TUPLE_GC_BUG', 1)]
 
 ext = Extension('FsQuota',
-                sources       = ['src/FsQuota.c'] + extrasrc,
+                sources       = ['src/FsQuota.c', 'src/qstats.c', 'src/qtrace.c', 'src/qsnap.c', 'src/qdelta.c', 'src/qfilter.c', 'src/qagg.c', 'src/qsketch.c', 'src/qwatch.c', 'src/qprefetch.c', 'src/qnames.c', 'src/qpathid.c', 'src/qtree.c', 'src/qusage.c', 'src/qdu.c', 'src/qtop.c'] + extrasrc,
                 include_dirs  = ['.'] + extrainc,
                 define_macros = extradef,
                 libraries     = extralibs,
@@ -217,6 +256,6 @@ setup(name='FsQuota',
       keywords="file-system, quota, quotactl, mtab, getmntent",
       platforms=['posix'],
       ext_modules=[ext],
-      cmdclass={'clean': MyClean},
+      cmdclass={'clean': MyClean, 'build_quotasim': BuildQuotaSim},
       python_requires='>=3.2',
      )
@@ -17,6 +17,26 @@
 
 #include "myconfig.h"
 
+// Helper modules in src/ do not access the Python interpreter state, so that
+// their functions can be called while the GIL is released. Unless noted in
+// the header, functions return NULL or -1 and set errno upon error.
+#include "src/qstats.h"
+#include "src/qprobes.h"
+#include "src/qtrace.h"
+#include "src/qsnap.h"
+#include "src/qdelta.h"
+#include "src/qfilter.h"
+#include "src/qagg.h"
+#include "src/qsketch.h"
+#include "src/qwatch.h"
+#include "src/qprefetch.h"
+#include "src/qnames.h"
+#include "src/qpathid.h"
+#include "src/qtree.h"
+#include "src/qusage.h"
+#include "src/qdu.h"
+#include "src/qtop.h"
+
 #ifdef AFSQUOTA
 #include "include/afsquota.h"
 #endif
@@ -25,6 +45,24 @@
 #include "include/vxquotactl.h"
 #endif
 
+#ifdef BTRFS_QGROUPS
+#include "src/qbtrfs.h"
+#endif
+
+#ifdef XFS_BULKSTAT
+#include "src/qbulkstat.h"
+#endif
+
+#ifdef FANOTIFY_TRACKING
+#include "src/qtrack.h"
+#endif
+
+#ifdef RQUOTA_SERVER
+#include <pthread.h>
+#include "structmember.h"
+#include "src/rquotasrv.h"
+#endif
+
 #if defined (NAMED_TUPLE_GC_BUG)
 static PyTypeObject FsQuota_QuotaQueryTypeBuf;
 static PyTypeObject FsQuota_MntTabTypeBuf;
@@ -66,6 +104,23 @@ typedef struct
 } T_MY_MNTENT_STATE;
 
 
+//
+// This data structure defines the implementation-independent container used
+// internally for returning results from quota queries via sub-functions.
+//
+typedef struct
+{
+    uint64_t bhard;
+    uint64_t bsoft;
+    uint64_t bcur;
+    time_t   btime;
+    uint64_t fhard;
+    uint64_t fsoft;
+    uint64_t fcur;
+    time_t   ftime;
+} T_QUOTA_QUERY_RESULT;
+
+
 #ifndef NO_RPC
 // ----------------------------------------------------------------------------
 //
@@ -84,54 +139,63 @@ typedef struct
 #define RPC_DEFAULT_TIMEOUT     4000
 #define RPC_AUTH_UGID_NON_INIT  -1
 
+// Increment the given RPC counter in the process-wide statistics and in
+// those of the calling object, if any
+#define QSTAT_RPC_INC(P_STATS, CNT) \
+    do { \
+        QSTAT_INC(qstat_backend[QSTAT_BE_RPC].rpc.CNT); \
+        if ((P_STATS) != NULL) \
+            QSTAT_INC((P_STATS)->CNT); \
+    } while (0)
+
 //
-// This data structure defines the implementation-independent container used
-// internally for returning results from quota queries via RPC sub-functions.
+// Get IP address of the remote host; by default the port is determined via
+// remote portmap daemon; different ports and protocols can be configured.
+// Note this function is not reentrant, so it must be called while holding
+// the GIL.
 //
-typedef struct
+
+static int
+rpc_resolve_host(const char *host, const T_QUOTA_RPC_OPT * opt,
+                 struct sockaddr_in * remaddr, char ** p_errstr)
 {
-    uint64_t bhard;
-    uint64_t bsoft;
-    uint64_t bcur;
-    time_t   btime;
-    uint64_t fhard;
-    uint64_t fsoft;
-    uint64_t fcur;
-    time_t   ftime;
-} T_QUOTA_RPC_RESULT;
+    struct hostent *hp;
+
+    hp = gethostbyname(host);
+    if (hp == NULL)
+    {
+        *p_errstr = clnt_sperrno(RPC_UNKNOWNHOST);
+        return -1;
+    }
+
+    memset(remaddr, 0, sizeof(*remaddr));
+    memcpy((char *)&remaddr->sin_addr, (char *)hp->h_addr, hp->h_length);
+    remaddr->sin_family = AF_INET;
+    remaddr->sin_port = htons(opt->port);
+
+    return 0;
+}
 
 //
-// Execute RPC to remote host
+// Execute RPC to remote host; p_stats may be NULL when the call is not made
+// on behalf of a Quota instance.
 //
 
 static int
-callaurpc(char *host, int prognum, int versnum, int procnum,
+callaurpc(const struct sockaddr_in * p_remaddr, int prognum, int versnum, int procnum,
           xdrproc_t inproc, char *in, xdrproc_t outproc, char *out,
-          const T_QUOTA_RPC_OPT * opt, char ** p_errstr)
+          const T_QUOTA_RPC_OPT * opt, T_QSTAT_RPC * p_stats, char ** p_errstr)
 {
-    struct sockaddr_in remaddr;
-    struct hostent *hp;
+    struct sockaddr_in remaddr = *p_remaddr;  // copy as port may be modified
     enum clnt_stat clnt_stat;
     struct timeval rep_time, timeout;
     CLIENT *client;
     int socket = RPC_ANYSOCK;
 
-    //
-    //  Get IP address; by default the port is determined via remote
-    //  portmap daemon; different ports and protocols can be configured
-    //
-    hp = gethostbyname(host);
-    if (hp == NULL)
-    {
-        *p_errstr = clnt_sperrno(RPC_UNKNOWNHOST);
-        return -1;
-    }
+    QPROBE4(rpc__entry, ntohl(remaddr.sin_addr.s_addr), prognum, versnum, procnum);
 
     rep_time.tv_sec = opt->timeout / 1000;
     rep_time.tv_usec = (opt->timeout % 1000) * 1000;
-    memcpy((char *)&remaddr.sin_addr, (char *)hp->h_addr, hp->h_length);
-    remaddr.sin_family = AF_INET;
-    remaddr.sin_port = htons(opt->port);
 
     //
     //  Create client RPC handle
@@ -150,12 +214,16 @@ callaurpc(char *host, int prognum, int versnum, int procnum,
 
     if (client == NULL)
     {
+        QSTAT_RPC_INC(p_stats, connect_errors);
+        QPROBE5(rpc__return, ntohl(remaddr.sin_addr.s_addr), prognum, versnum, procnum,
+                (int)rpc_createerr.cf_stat);
         if (rpc_createerr.cf_stat != RPC_SUCCESS)
             *p_errstr = clnt_sperrno(rpc_createerr.cf_stat);
         else  // should never happen (may be due to inconsistent symbol resolution)
             *p_errstr = "RPC creation failed for unknown reasons";
         return -1;
     }
+    QSTAT_RPC_INC(p_stats, connects);
 
     //
     //  Create an authentication handle
@@ -177,6 +245,11 @@ callaurpc(char *host, int prognum, int versnum, int procnum,
     timeout.tv_usec = (opt->timeout % 1000) * 1000;
     clnt_stat = clnt_call(client, procnum,
                           inproc, in, outproc, out, timeout);
+    QSTAT_RPC_INC(p_stats, calls);
+    if (clnt_stat == RPC_TIMEDOUT)
+    {
+        QSTAT_RPC_INC(p_stats, timeouts);
+    }
 
     if (client->cl_auth)
     {
@@ -185,6 +258,8 @@ callaurpc(char *host, int prognum, int versnum, int procnum,
     }
     clnt_destroy(client);
 
+    QPROBE5(rpc__return, ntohl(remaddr.sin_addr.s_addr), prognum, versnum, procnum, (int)clnt_stat);
+
     if (clnt_stat != RPC_SUCCESS)
     {
         *p_errstr = clnt_sperrno(clnt_stat);
@@ -198,16 +273,15 @@ callaurpc(char *host, int prognum, int versnum, int procnum,
 }
 
 //
-// Fetch quota limits for NFS mount via RPC
+// Fetch raw quota RPC reply from the remote host
 //
 
 static int
-getnfsquota( char *hostp, char *fsnamep, int uid, int is_grpquota,
-             const T_QUOTA_RPC_OPT * opt, char ** rpc_err_str,
-             T_QUOTA_RPC_RESULT *rslt )
+getnfsquota_rpc( const struct sockaddr_in * hostp, char *fsnamep, int uid, int is_grpquota,
+                 const T_QUOTA_RPC_OPT * opt, T_QSTAT_RPC * p_stats, char ** rpc_err_str,
+                 struct getquota_rslt * p_gq_rslt )
 {
     struct getquota_args gq_args;
-    struct getquota_rslt gq_rslt;
 #ifdef USE_EXT_RQUOTA
     ext_getquota_args ext_gq_args;
 
@@ -220,8 +294,8 @@ getnfsquota( char *hostp, char *fsnamep, int uid, int is_grpquota,
 
     if (callaurpc(hostp, RQUOTAPROG, EXT_RQUOTAVERS, RQUOTAPROC_GETQUOTA,
                   (xdrproc_t)xdr_ext_getquota_args, (char*) &ext_gq_args,
-                  (xdrproc_t)xdr_getquota_rslt, (char*) &gq_rslt,
-                  opt, rpc_err_str) != 0)
+                  (xdrproc_t)xdr_getquota_rslt, (char*) p_gq_rslt,
+                  opt, p_stats, rpc_err_str) != 0)
 #endif
     {
         if (!is_grpquota)
@@ -232,11 +306,14 @@ getnfsquota( char *hostp, char *fsnamep, int uid, int is_grpquota,
             //
             gq_args.gqa_pathp = fsnamep;
             gq_args.gqa_uid = uid;
+#ifdef USE_EXT_RQUOTA
+            QSTAT_RPC_INC(p_stats, fallbacks);
+#endif
 
             if (callaurpc(hostp, RQUOTAPROG, RQUOTAVERS, RQUOTAPROC_GETQUOTA,
                           (xdrproc_t)xdr_getquota_args, (char*) &gq_args,
-                          (xdrproc_t)xdr_getquota_rslt, (char*) &gq_rslt,
-                          opt, rpc_err_str) != 0)
+                          (xdrproc_t)xdr_getquota_rslt, (char*) p_gq_rslt,
+                          opt, p_stats, rpc_err_str) != 0)
             {
                 return -1;
             }
@@ -249,6 +326,24 @@ getnfsquota( char *hostp, char *fsnamep, int uid, int is_grpquota,
             return -1;
         }
     }
+    return 0;
+}
+
+//
+// Fetch quota limits for NFS mount via RPC
+//
+
+static int
+getnfsquota( const struct sockaddr_in * hostp, char *fsnamep, int uid, int is_grpquota,
+             const T_QUOTA_RPC_OPT * opt, T_QSTAT_RPC * p_stats, char ** rpc_err_str,
+             T_QUOTA_QUERY_RESULT *rslt )
+{
+    struct getquota_rslt gq_rslt;
+
+    if (getnfsquota_rpc(hostp, fsnamep, uid, is_grpquota, opt, p_stats, rpc_err_str, &gq_rslt) != 0)
+    {
+        return -1;
+    }
 
     switch (gq_rslt.GQR_STATUS)
     {
@@ -407,8 +502,21 @@ typedef enum
     QUOTA_DEV_VXFS,
     QUOTA_DEV_AFS,
     QUOTA_DEV_JFS2,
+    QUOTA_DEV_BTRFS,
 } T_QUOTA_DEV_FS_TYPE;
 
+//
+// Project quotas are supported by XFS; on Linux also by regular file systems
+// such as ext4 via the generic quotactl interface (kernel 4.5 and later).
+// For Btrfs, qgroups of subvolumes are presented as project quotas.
+//
+#ifdef Q_CTL_V3
+#define QUOTA_DEV_HAS_PRJQUOTA(T)  (((T) == QUOTA_DEV_XFS) || ((T) == QUOTA_DEV_REGULAR) || \
+                                    ((T) == QUOTA_DEV_BTRFS))
+#else
+#define QUOTA_DEV_HAS_PRJQUOTA(T)  ((T) == QUOTA_DEV_XFS)
+#endif
+
 //
 // Container for instance state variables
 //
@@ -421,11 +529,54 @@ typedef struct
     T_QUOTA_DEV_FS_TYPE m_dev_fs_type;  // file system types that need special handling
 #ifndef NO_RPC
     T_QUOTA_RPC_OPT m_rpc_opt;          // container for parameters set via rpc_opt()
+#endif
+    T_QSTAT_SET m_stats;                // performance counters of this instance
+    T_QSTAT_LAT m_mntscan;              // duration of mount table scans
+#ifdef FANOTIFY_TRACKING
+    T_QTRACK * m_tracker;               // usage tracking started via track_usage(), or NULL
 #endif
 } Quota_ObjectType;
 
-// forward declaration
+// forward declarations
 static int Quota_setqcarg(Quota_ObjectType *self);
+static PyObject * QuotaIter_Create(Quota_ObjectType * quota, int is_grpquota, int is_prjquota,
+                                   const T_QFILTER * flt, size_t chunk_size, unsigned queue_depth);
+
+//
+// Helper function returning the default error description for the given
+// quotactl() error code.
+//
+static const char *
+FsQuota_QuotaCtlErrStr(T_QUOTA_DEV_FS_TYPE dev_fs_type, int errnum)
+{
+    const char * str;
+
+    if ((errnum == ENOENT) && (dev_fs_type == QUOTA_DEV_XFS))
+        str = "No quota for this user";
+    else if ((errnum == ENOENT) && (dev_fs_type == QUOTA_DEV_BTRFS))
+        str = "Quotas not enabled, no qgroup for this subvolume";
+    else if ((errnum == EINVAL) || (errnum == ENOTTY) ||
+             (errnum == ENOENT) || (errnum == ENOSYS))
+        str = "No quotas on this system";
+    else if (errnum == ENODEV)
+        str = "Not a standard file system";
+    else if (errnum == EPERM)
+        str = "Not privileged";
+    else if (errnum == EACCES)
+        str = "Access denied";
+    else if (errnum == ESRCH)
+#ifdef Q_CTL_V3  /* Linux */
+        str = "Quotas not enabled, no quota for this user";
+#else
+        str = "No quota for this user";
+#endif
+    else if (errnum == EUSERS)
+        str = "Quota table overflow";
+    else
+        str = strerror(errnum);
+
+    return str;
+}
 
 //
 // Helper function for raising an exception upon quotactl() error
@@ -435,27 +586,7 @@ FsQuota_QuotaCtlException(Quota_ObjectType * self, int errnum, const char * str)
 {
     if (str == NULL)
     {
-        if ((errnum == ENOENT) && (self->m_dev_fs_type == QUOTA_DEV_XFS))
-            str = "No quota for this user";
-        else if ((errnum == EINVAL) || (errnum == ENOTTY) ||
-                 (errnum == ENOENT) || (errnum == ENOSYS))
-            str = "No quotas on this system";
-        else if (errnum == ENODEV)
-            str = "Not a standard file system";
-        else if (errnum == EPERM)
-            str = "Not privileged";
-        else if (errnum == EACCES)
-            str = "Access denied";
-        else if (errnum == ESRCH)
-#ifdef Q_CTL_V3  /* Linux */
-            str = "Quotas not enabled, no quota for this user";
-#else
-            str = "No quota for this user";
-#endif
-        else if (errnum == EUSERS)
-            str = "Quota table overflow";
-        else
-            str = strerror(errnum);
+        str = FsQuota_QuotaCtlErrStr(self->m_dev_fs_type, errnum);
     }
 
     PyObject * tuple = PyTuple_New(2);
@@ -463,6 +594,7 @@ FsQuota_QuotaCtlException(Quota_ObjectType * self, int errnum, const char * str)
     PyTuple_SetItem(tuple, 1, PyUnicode_DecodeFSDefault(str));
 
     PyErr_SetObject(FsQuotaError, tuple);
+    Py_DECREF(tuple);
 
     // for convenience: to be assiged to caller's RETVAL
     return NULL;
@@ -485,12 +617,114 @@ FsQuota_OsException(int errnum, const char * desc, const char * path)
         PyTuple_SetItem(tuple, 2, PyUnicode_DecodeFSDefault(path));
 
     PyErr_SetObject(FsQuotaError, tuple);
+    Py_DECREF(tuple);
     Py_DECREF(strerr);
 
     // for convenience: to be assiged to caller's RETVAL
     return NULL;
 }
 
+//
+// This data structure describes the error of a quota operation, for reporting
+// either via exception, or via an error object returned in place of the
+// result (see below).
+//
+typedef struct
+{
+    int          errnum;    // errno value; zero upon success
+    const char * str;       // error description, or NULL for the default of errnum
+    int          is_os;     // if TRUE, the description is formatted as for C library errors
+} T_QUOTA_ERROR;
+
+//
+// Helper function for raising an exception for the given error
+//
+static void *
+FsQuota_RaiseError(Quota_ObjectType * self, const T_QUOTA_ERROR * err)
+{
+    if (err->is_os)
+    {
+        return FsQuota_OsException(err->errnum, err->str, NULL);
+    }
+    return FsQuota_QuotaCtlException(self, err->errnum, err->str);
+}
+
+//
+// Cache of error objects returned instead of raising exceptions in "noraise"
+// mode: objects for errors with default description are shared, so that
+// failed queries for large numbers of IDs cost no allocations. Objects for
+// common errors are created during module initialization; further ones are
+// added upon first use while space is left. Descriptions are compared by
+// address, which is sufficient as defaults are string constants.
+//
+#define FSQUOTA_ERROBJ_CACHE_SIZE  24
+
+static struct
+{
+    int          errnum;
+    const char * str;
+    PyObject *   obj;
+} FsQuota_ErrObjCache[FSQUOTA_ERROBJ_CACHE_SIZE];
+static unsigned FsQuota_ErrObjCount;
+
+static PyObject *
+FsQuota_NewErrorObject(int errnum, PyObject * str)
+{
+    PyObject * RETVAL = NULL;
+
+    if (str != NULL)
+    {
+        RETVAL = PyObject_CallFunction(FsQuotaError, "iO", errnum, str);
+        Py_DECREF(str);
+    }
+    return RETVAL;
+}
+
+static PyObject *
+FsQuota_ErrorObject(T_QUOTA_DEV_FS_TYPE dev_fs_type, const T_QUOTA_ERROR * err)
+{
+    PyObject * RETVAL;
+
+    if (err->is_os)
+    {
+        PyObject * strerr = PyUnicode_DecodeFSDefault(strerror(err->errnum));
+        RETVAL = FsQuota_NewErrorObject(err->errnum,
+                                        ((strerr != NULL)
+                                           ? PyUnicode_FromFormat("%s: %U", err->str, strerr)
+                                           : NULL));
+        Py_XDECREF(strerr);
+    }
+    else if (err->str != NULL)
+    {
+        RETVAL = FsQuota_NewErrorObject(err->errnum, PyUnicode_DecodeFSDefault(err->str));
+    }
+    else
+    {
+        const char * str = FsQuota_QuotaCtlErrStr(dev_fs_type, err->errnum);
+
+        for (unsigned idx = 0; idx < FsQuota_ErrObjCount; idx++)
+        {
+            if ((FsQuota_ErrObjCache[idx].errnum == err->errnum) &&
+                (FsQuota_ErrObjCache[idx].str == str))
+            {
+                RETVAL = FsQuota_ErrObjCache[idx].obj;
+                Py_INCREF(RETVAL);
+                return RETVAL;
+            }
+        }
+        RETVAL = FsQuota_NewErrorObject(err->errnum, PyUnicode_DecodeFSDefault(str));
+        if ((RETVAL != NULL) && (FsQuota_ErrObjCount < FSQUOTA_ERROBJ_CACHE_SIZE))
+        {
+            FsQuota_ErrObjCache[FsQuota_ErrObjCount].errnum = err->errnum;
+            FsQuota_ErrObjCache[FsQuota_ErrObjCount].str = str;
+            FsQuota_ErrObjCache[FsQuota_ErrObjCount].obj = RETVAL;
+            FsQuota_ErrObjCount += 1;
+            Py_INCREF(RETVAL);  // reference owned by the cache
+        }
+    }
+    return RETVAL;
+}
+
 //
 // Helper function for allocating and filling a query result tuple with given
 // values.
@@ -517,1584 +751,8037 @@ FsQuota_BuildQuotaResult(uint64_t bc, uint64_t bs, uint64_t bh, uint32_t bt,
 }
 
 //
-// Implementation of the Quota.query() method
+// Names of the values in FsQuota.QueryResult, as used for selecting values
+// in filter specifications
 //
-PyDoc_STRVAR(Quota_query__doc__,
-    "query(uid, *, grpquota=False, projquota=False) -> FsQuota.QueryResult\n\n"
-    "Query quota usage and limits for the given user.\n\n"
-    "When either grpquota or projquota is set to True, the query returns "
-    "group or project quotas instead of user quotas. Only one of these "
-    "options should be True. Project quotas are supported only by XFS "
-    "file systems.");
-
-static PyObject *
-Quota_query(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+static const char * const FsQuota_ValueNames[QFILTER_VAL_COUNT] =
 {
-    int     uid = getuid();
-    int     is_grpquota = FALSE;
-    int     is_prjquota = FALSE;
+    "bcount", "bsoft", "bhard", "btime", "icount", "isoft", "ihard", "itime"
+};
 
-    static char * kwlist[] = {"uid", "grpquota", "prjquota", NULL};
+static int
+FsQuota_ValueIndex(PyObject * obj, const char * key, int limits_only, unsigned * p_idx)
+{
+    const char * name = (PyUnicode_Check(obj) ? PyUnicode_AsUTF8(obj) : NULL);
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|$pp", kwlist,
-                                     &uid, &is_grpquota, &is_prjquota))
+    if (name != NULL)
     {
-        return NULL;
+        for (unsigned idx = 0; idx < QFILTER_VAL_COUNT; idx++)
+        {
+            if ((strcmp(name, FsQuota_ValueNames[idx]) == 0) &&
+                (!limits_only || (idx == 1) || (idx == 2) || (idx == 5) || (idx == 6)))
+            {
+                *p_idx = idx;
+                return TRUE;
+            }
+        }
+    }
+    if (!PyErr_Occurred())
+    {
+        PyErr_Format(PyExc_ValueError, "Invalid value for filter key \"%s\": %R", key, obj);
     }
+    return FALSE;
+}
 
-    PyObject * RETVAL = NULL;
-    int err;
+//
+// Helper function for parsing a filter specification given as dict into the
+// form used by qfilter.c. Returns TRUE upon success, else raises an exception.
+//
+static int
+FsQuota_ParseFilter(PyObject * p_filter, T_QFILTER * flt)
+{
+    PyObject * key;
+    PyObject * value;
+    Py_ssize_t pos = 0;
 
-    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    memset(flt, 0, sizeof(*flt));
+    flt->ratio_usage = 0;
+    flt->ratio_limit = 1;
+    flt->top_col = 0;
+    flt->now = time(NULL);
+
+    if ((p_filter == NULL) || (p_filter == Py_None))
     {
-        RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+        return TRUE;
     }
-    else if (is_prjquota && (self->m_dev_fs_type != QUOTA_DEV_XFS))
+    if (!PyDict_Check(p_filter))
     {
-        RETVAL = FsQuota_QuotaCtlException(self, ENOTSUP, "Project quotas are only supported by XFS");
+        PyErr_SetString(PyExc_TypeError, "filter must be a dict");
+        return FALSE;
     }
-    else
-#ifdef SGI_XFS
-    if (self->m_dev_fs_type == QUOTA_DEV_XFS)
+
+    while (PyDict_Next(p_filter, &pos, &key, &value))
     {
-        fs_disk_quota_t xfs_dqblk;
-#ifndef linux
-        err = quotactl(Q_XGETQUOTA, self->m_qcarg, uid, CADR &xfs_dqblk);
-#else
-        err = quotactl(QCMD(Q_XGETQUOTA, (is_prjquota ? XQM_PRJQUOTA :
-                                          is_grpquota ? XQM_GRPQUOTA : XQM_USRQUOTA)),
-                       self->m_qcarg, uid, CADR &xfs_dqblk);
-#endif
-        if (!err)
-        {
-            RETVAL = FsQuota_BuildQuotaResult(QX_DIV(xfs_dqblk.d_bcount),
-                                              QX_DIV(xfs_dqblk.d_blk_softlimit),
-                                              QX_DIV(xfs_dqblk.d_blk_hardlimit),
-                                              xfs_dqblk.d_btimer,
-                                              xfs_dqblk.d_icount,
-                                              xfs_dqblk.d_ino_softlimit,
-                                              xfs_dqblk.d_ino_hardlimit,
-                                              xfs_dqblk.d_itimer);
-        }
-        else
+        const char * name = (PyUnicode_Check(key) ? PyUnicode_AsUTF8(key) : NULL);
+
+        if (name == NULL)
         {
-            FsQuota_QuotaCtlException(self, errno, NULL);
+            if (!PyErr_Occurred())
+            {
+                PyErr_SetString(PyExc_TypeError, "filter keys must be strings");
+            }
+            return FALSE;
         }
-    }
-    else
-#endif  /* SGI_XFS */
-#ifdef SOLARIS_VXFS
-    if (self->m_dev_fs_type == QUOTA_DEV_VXFS)
-    {
-        struct vx_dqblk vxfs_dqb;
-        err = vx_quotactl(VX_GETQUOTA, self->m_qcarg, uid, CADR &vxfs_dqb);
-        if (!err)
+        else if (strcmp(name, "min_ratio") == 0)
         {
-            RETVAL = FsQuota_BuildQuotaResult(Q_DIV(vxfs_dqb.dqb_curblocks),
-                                              Q_DIV(vxfs_dqb.dqb_bsoftlimit),
-                                              Q_DIV(vxfs_dqb.dqb_bhardlimit),
-                                              vxfs_dqb.dqb_btimelimit,
-                                              vxfs_dqb.dqb_curfiles,
-                                              vxfs_dqb.dqb_fsoftlimit,
-                                              vxfs_dqb.dqb_fhardlimit,
-                                              vxfs_dqb.dqb_ftimelimit);
+            double ratio = PyFloat_AsDouble(value);
+            if ((ratio == -1.0) && PyErr_Occurred())
+            {
+                return FALSE;
+            }
+            if (!(ratio >= 0.0))
+            {
+                PyErr_SetString(PyExc_ValueError, "filter min_ratio must not be negative");
+                return FALSE;
+            }
+            flt->use_ratio = TRUE;
+            flt->ratio = ratio;
         }
-        else
+        else if (strcmp(name, "ratio_of") == 0)
         {
-            FsQuota_QuotaCtlException(self, errno, NULL);
+            if (!FsQuota_ValueIndex(value, name, TRUE, &flt->ratio_limit))
+            {
+                return FALSE;
+            }
+            flt->ratio_usage = ((flt->ratio_limit < 4) ? 0 : 4);
         }
-    }
-    else
-#endif  /* SOLARIS_VXFS */
-#ifdef AFSQUOTA
-    if (self->m_dev_fs_type == QUOTA_DEV_AFS)
-    {
-        if (!afs_check())  // check is *required* as setup!
+        else if (strcmp(name, "grace_expired") == 0)
         {
-            FsQuota_OsException(EINVAL, "AFS setup failed", NULL);
+            int is_set = PyObject_IsTrue(value);
+            if (is_set < 0)
+            {
+                return FALSE;
+            }
+            flt->grace_expired = is_set;
         }
-        else
+        else if (strcmp(name, "top") == 0)
         {
-            int maxQuota, blocksUsed;
-
-            err = afs_getquota(self->m_qcarg, &maxQuota, &blocksUsed);
-            if (!err)
+            unsigned long long top = PyLong_AsUnsignedLongLong(value);
+            if ((top == (unsigned long long) -1) && PyErr_Occurred())
             {
-                RETVAL = FsQuota_BuildQuotaResult(blocksUsed,
-                                                  maxQuota,
-                                                  maxQuota,
-                                                  0,
-                                                  0,
-                                                  0,
-                                                  0,
-                                                  0);
+                return FALSE;
             }
-            else
+            if (top == 0)
             {
-                FsQuota_QuotaCtlException(self, errno, NULL);
+                PyErr_SetString(PyExc_ValueError, "filter top must be positive");
+                return FALSE;
             }
+            flt->top_k = top;
         }
-    }
-    else
-#endif  /* AFSQUOTA */
-#if defined(HAVE_JFS2)
-    if (self->m_dev_fs_type == QUOTA_DEV_JFS2)
-    {
-        // AIX quotactl doesn't fail if path does not exist!?
-        struct stat st;
-        if (stat(self->m_qcarg, &st) == 0)
+        else if (strcmp(name, "top_by") == 0)
         {
-            quota64_t user_quota;
-
-            err = quotactl(self->m_qcarg, QCMD(Q_J2GETQUOTA, (is_grpquota ? GRPQUOTA : USRQUOTA)),
-                           uid, CADR &user_quota);
-            if (!err)
+            if (!FsQuota_ValueIndex(value, name, FALSE, &flt->top_col))
             {
-                RETVAL = FsQuota_BuildQuotaResult(user_quota.bused,
-                                                  user_quota.bsoft,
-                                                  user_quota.bhard,
-                                                  user_quota.btime,
-                                                  user_quota.ihard,
-                                                  user_quota.isoft,
-                                                  user_quota.iused,
-                                                  user_quota.itime);
+                return FALSE;
             }
         }
-        else
-            err = 1;
-    }
-    else
-#endif  /* HAVE_JFS2 */
-#ifndef NO_RPC
-    if (self->m_dev_fs_type == QUOTA_DEV_NFS)
-    {
-        T_QUOTA_RPC_RESULT rslt;
-        char * rpc_err_str = NULL;
-        err = getnfsquota(self->m_rpc_host, self->m_qcarg, uid, is_grpquota, &self->m_rpc_opt, &rpc_err_str, &rslt);
-        if (!err)
-        {
-            RETVAL = FsQuota_BuildQuotaResult(Q_DIV(rslt.bcur),
-                                              Q_DIV(rslt.bsoft),
-                                              Q_DIV(rslt.bhard),
-                                              rslt.btime,
-                                              rslt.fcur,
-                                              rslt.fsoft,
-                                              rslt.fhard,
-                                              rslt.ftime);
-        }
-        else if (rpc_err_str != NULL)
-        {
-            FsQuota_QuotaCtlException(self, EIO, rpc_err_str);
-        }
         else
         {
-            FsQuota_QuotaCtlException(self, errno, NULL);
+            PyErr_Format(PyExc_ValueError, "Unknown filter key: %s", name);
+            return FALSE;
         }
     }
-    else
-#endif  /* NO_RPC */
-    {
-#ifdef NETBSD_LIBQUOTA
-        struct quotahandle *qh = quota_open(self->m_qcarg);
-        if (qh != NULL)
-        {
-            struct quotakey qk_blocks, qk_files;
-            struct quotaval qv_blocks, qv_files;
+    return TRUE;
+}
 
-            qk_blocks.qk_idtype = /*fall-through*/
-            qk_files.qk_idtype = is_grpquota ? QUOTA_IDTYPE_GROUP : QUOTA_IDTYPE_USER;
-            qk_blocks.qk_id = qk_files.qk_id = uid;
-            qk_blocks.qk_objtype = QUOTA_OBJTYPE_BLOCKS;
-            qk_files.qk_objtype = QUOTA_OBJTYPE_FILES;
+// value for the name_kind parameter when no name column is requested
+#define FSQUOTA_NO_NAMES  (-1)
 
-            if ((quota_get(qh, &qk_blocks, &qv_blocks) >= 0) &&
-                (quota_get(qh, &qk_files, &qv_files) >= 0) )
-            {
-                // adapt to common "unlimited" semantics
-                if ((qv_blocks.qv_softlimit == QUOTA_NOLIMIT) &&
-                    (qv_blocks.qv_hardlimit == QUOTA_NOLIMIT))
-                {
-                  qv_blocks.qv_hardlimit = qv_blocks.qv_softlimit = 0;
-                }
-                if ((qv_files.qv_softlimit == QUOTA_NOLIMIT) &&
-                    (qv_files.qv_hardlimit == QUOTA_NOLIMIT))
-                {
-                  qv_files.qv_hardlimit = qv_files.qv_softlimit = 0;
-                }
-                RETVAL = FsQuota_BuildQuotaResult(Q_DIV(qv_blocks.qv_usage),
-                                                  Q_DIV(qv_blocks.qv_softlimit),
-                                                  Q_DIV(qv_blocks.qv_hardlimit),
-                                                  qv_blocks.qv_expiretime,
-                                                  qv_files.qv_usage,
-                                                  qv_files.qv_softlimit,
-                                                  qv_files.qv_hardlimit,
-                                                  qv_files.qv_expiretime);
-            }
-            else
-            {
-                FsQuota_QuotaCtlException(self, errno, NULL);
-            }
-            quota_close(qh);
+// number of threads resolving names in parallel to quota queries
+#define FSQUOTA_NAME_THREADS  4
+
+//
+// Helper function returning the kind of names for quota type options
+//
+static int
+FsQuota_NameKind(int is_grpquota, int is_prjquota)
+{
+    return (is_prjquota ? QNAMES_PROJECT : (is_grpquota ? QNAMES_GROUP : QNAMES_USER));
+}
+
+//
+// Helper function returning the name of a user, group or project ID as
+// str, or None if the ID has no name. The name is taken from the cache,
+// which is expected to be filled already via a resolver; only remaining
+// IDs are resolved while holding the GIL.
+//
+static PyObject *
+FsQuota_BuildName(int name_kind, uint32_t id)
+{
+    char name[QNAMES_NAME_MAX];
+
+    if (qnames_lookup(name_kind, id, name, sizeof(name)))
+    {
+        return PyUnicode_DecodeFSDefault(name);
+    }
+    Py_RETURN_NONE;
+}
+
+//
+// Helper function for converting the result of filtering into a list of
+// tuples of ID and FsQuota.QueryResult; if a name kind is given, the name
+// of the ID is appended to each tuple.
+//
+static PyObject *
+FsQuota_BuildFilterResult(const T_QFILTER_RESULT * res, int name_kind)
+{
+    PyObject * RETVAL = PyList_New(res->count);
+
+    for (size_t idx = 0; (RETVAL != NULL) && (idx < res->count); idx++)
+    {
+        const T_QFILTER_ROW * row = &res->rows[idx];
+        PyObject * qres = FsQuota_BuildQuotaResult(row->val[0], row->val[1],
+                                                   row->val[2], row->val[3],
+                                                   row->val[4], row->val[5],
+                                                   row->val[6], row->val[7]);
+        PyObject * item;
+
+        if (name_kind == FSQUOTA_NO_NAMES)
+        {
+            item = Py_BuildValue("(kN)", (unsigned long) row->id, qres);
         }
         else
         {
-            FsQuota_QuotaCtlException(self, errno, NULL);
+            item = Py_BuildValue("(kNN)", (unsigned long) row->id, qres,
+                                 FsQuota_BuildName(name_kind, row->id));
         }
-#else /* not NETBSD_LIBQUOTA */
-        struct dqblk dqblk;
-#ifdef USE_IOCTL
-        struct quotactl qp;
-        int fd = -1;
 
-        qp.op = Q_GETQUOTA;
-        qp.uid = uid;
-        qp.addr = (char *)&dqblk;
-        if ((fd = open(self->m_qcarg, O_RDONLY)) != -1)
+        if (item != NULL)
         {
-            err = (ioctl(fd, Q_QUOTACTL, &qp) == -1);
-            close(fd);
+            PyList_SET_ITEM(RETVAL, idx, item);
         }
         else
         {
-            err = 1;
-        }
-#else /* not USE_IOCTL */
-#ifdef Q_CTL_V3  /* Linux */
-        err = linuxquota_query(self->m_qcarg, uid, is_grpquota, &dqblk);
-#else /* not Q_CTL_V3 */
-#ifdef Q_CTL_V2
-#ifdef AIX
-        // AIX quotactl doesn't fail if path does not exist!?
-        struct stat st;
-        if (stat(self->m_qcarg, &st) != 0)
-        {
-            err = 1;
+            Py_CLEAR(RETVAL);
         }
-        else
-#endif /* AIX */
-        err = quotactl(self->m_qcarg, QCMD(Q_GETQUOTA, (is_grpquota ? GRPQUOTA : USRQUOTA)), uid, CADR &dqblk);
-#else /* not Q_CTL_V2 */
-        err = quotactl(Q_GETQUOTA, self->m_qcarg, uid, CADR &dqblk);
-#endif /* not Q_CTL_V2 */
-#endif /* Q_CTL_V3 */
-#endif /* not USE_IOCTL */
-        if (!err && (RETVAL == NULL))
+    }
+    return RETVAL;
+}
+
+//
+// Helper function for parsing a sequence of floats within the given range,
+// in strictly ascending order if requested. Returns the number of elements,
+// or -1 with an exception raised, using the given message for invalid values.
+//
+static int
+FsQuota_ParseFloatSeq(PyObject * obj, const char * name, double * arr, unsigned max_cnt,
+                      double min_val, double max_val, int ascending, const char * errmsg)
+{
+    PyObject * seq = PySequence_Fast(obj, "expected a sequence of floats");
+    if (seq == NULL)
+    {
+        return -1;
+    }
+
+    Py_ssize_t cnt = PySequence_Fast_GET_SIZE(seq);
+    int RETVAL = cnt;
+
+    if (cnt > max_cnt)
+    {
+        PyErr_Format(PyExc_ValueError, "%s: at most %u values are supported", name, max_cnt);
+        RETVAL = -1;
+    }
+    for (Py_ssize_t idx = 0; (RETVAL >= 0) && (idx < cnt); idx++)
+    {
+        arr[idx] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, idx));
+        if ((arr[idx] == -1.0) && PyErr_Occurred())
         {
-            RETVAL = FsQuota_BuildQuotaResult(Q_DIV(dqblk.QS_BCUR),
-                                              Q_DIV(dqblk.QS_BSOFT),
-                                              Q_DIV(dqblk.QS_BHARD),
-                                              dqblk.QS_BTIME,
-                                              dqblk.QS_FCUR,
-                                              dqblk.QS_FSOFT,
-                                              dqblk.QS_FHARD,
-                                              dqblk.QS_FTIME);
+            RETVAL = -1;
         }
-        else if (err)
+        else if (!((arr[idx] >= min_val) && (arr[idx] <= max_val)) ||
+                 (ascending && (idx > 0) && !(arr[idx] > arr[idx - 1])))
         {
-            FsQuota_QuotaCtlException(self, errno, NULL);
+            PyErr_Format(PyExc_ValueError, "%s: %s", name, errmsg);
+            RETVAL = -1;
         }
-#endif /* not NETBSD_LIBQUOTA */
     }
+    Py_DECREF(seq);
     return RETVAL;
 }
 
 //
-// Implementation of the Quota.seqlim() method
+// Options for summarizing distributions of usage, common to methods
+// Quota.summary() and Snapshot.summary()
 //
-PyDoc_STRVAR(Quota_setqlim__doc__,
-    "setqlim(uid, bsoft, bhard, isoft, ihard, *, grpquota=False, projquota=False)\n\n"
-    "Set the given block and inode quota limits for the given user\n\n"
-    "When either grpquota or projquota is set to True, the query returns "
-    "group or project quotas instead of user quotas. Only one of these "
-    "options should be True. Project quotas are supported only by XFS "
-    "file systems.\n\n"
-    "Limit parameters may also be specified in form of keyword parameters "
-    "using the names given in the signature above. Omitted values default "
-    "to zero.");
+#define FSQUOTA_MAX_QUANTILES  16
 
-static PyObject *
-Quota_setqlim(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+typedef struct
 {
-    int     uid = -1;
-    unsigned long long  bs = 0;
-    unsigned long long  bh = 0;
-    unsigned long long  fs = 0;
-    unsigned long long  fh = 0;
-    int     timelimflag = 0;
-    int     is_grpquota = FALSE;
-    int     is_prjquota = FALSE;
+    unsigned    quant_cnt;
+    double      quantiles[FSQUOTA_MAX_QUANTILES];
+    unsigned    bound_cnt;
+    double      bounds[QSKETCH_MAX_BOUNDS];
+} T_FSQUOTA_SKETCH_OPT;
 
-    static char * kwlist[] = {"uid", "bsoft", "bhard", "isoft", "ihard",
-                              "timereset", "grpquota", "prjquota", NULL};
+static int
+FsQuota_ParseSketchOpt(PyObject * p_quantiles, PyObject * p_bounds, T_FSQUOTA_SKETCH_OPT * opt)
+{
+    static const double default_quantiles[] = { 0.5, 0.9, 0.99 };
+    static const double default_bounds[] = { 0.5, 0.9, 1.0 };
+    int cnt;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|KKKK$ppp", kwlist,
-                                     &uid, &bs, &bh, &fs, &fh,
-                                     &timelimflag, &is_grpquota, &is_prjquota))
+    if (p_quantiles == NULL)
     {
-        return NULL;
+        opt->quant_cnt = sizeof(default_quantiles) / sizeof(default_quantiles[0]);
+        memcpy(opt->quantiles, default_quantiles, sizeof(default_quantiles));
     }
-
-    PyObject * RETVAL = Py_None;
-
-    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    else if ((cnt = FsQuota_ParseFloatSeq(p_quantiles, "quantiles", opt->quantiles,
+                                          FSQUOTA_MAX_QUANTILES, 0.0, 1.0, FALSE,
+                                          "values must be in range 0.0 to 1.0")) >= 0)
     {
-        RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+        opt->quant_cnt = cnt;
     }
-    else if (self->m_dev_fs_type == QUOTA_DEV_NFS)
+    else
     {
-        RETVAL = FsQuota_QuotaCtlException(self, ENOTSUP, "Setting quota on NFS-mount is not supported");
+        return FALSE;
     }
-    else if (is_prjquota && (self->m_dev_fs_type != QUOTA_DEV_XFS))
+
+    if (p_bounds == NULL)
     {
-        RETVAL = FsQuota_QuotaCtlException(self, ENOTSUP, "Project quotas are only supported by XFS");
+        opt->bound_cnt = sizeof(default_bounds) / sizeof(default_bounds[0]);
+        memcpy(opt->bounds, default_bounds, sizeof(default_bounds));
     }
-    else
-#ifdef SGI_XFS
-    if (self->m_dev_fs_type == QUOTA_DEV_XFS)
+    else if ((cnt = FsQuota_ParseFloatSeq(p_bounds, "ratio_bounds", opt->bounds,
+                                          QSKETCH_MAX_BOUNDS, 0.0, HUGE_VAL, TRUE,
+                                          "values must be non-negative in ascending order")) >= 0)
     {
-        fs_disk_quota_t xfs_dqblk;
-
-        xfs_dqblk.d_blk_softlimit = QX_MUL(bs);
-        xfs_dqblk.d_blk_hardlimit = QX_MUL(bh);
-        xfs_dqblk.d_btimer        = timelimflag;
-        xfs_dqblk.d_ino_softlimit = fs;
-        xfs_dqblk.d_ino_hardlimit = fh;
-        xfs_dqblk.d_itimer        = timelimflag;
-        xfs_dqblk.d_fieldmask     = FS_DQ_LIMIT_MASK;
-        xfs_dqblk.d_flags         = XFS_USER_QUOTA;
-#ifndef linux
-        int err = quotactl(Q_XSETQLIM, self->m_qcarg, uid, CADR &xfs_dqblk);
-#else
-        int err = quotactl(QCMD(Q_XSETQLIM, (is_prjquota ? XQM_PRJQUOTA : (is_grpquota ? XQM_GRPQUOTA : XQM_USRQUOTA))), self->m_qcarg, uid, CADR &xfs_dqblk);
-#endif
-        if (err)
-        {
-            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
-        }
+        opt->bound_cnt = cnt;
     }
     else
-    // if not xfs, than it's a classic IRIX efs file system
-#endif
-#ifdef SOLARIS_VXFS
-    if (self->m_dev_fs_type == QUOTA_DEV_VXFS)
     {
-        struct vx_dqblk vxfs_dqb;
+        return FALSE;
+    }
+    return TRUE;
+}
 
-        vxfs_dqb.dqb_bsoftlimit = Q_MUL(bs);
-        vxfs_dqb.dqb_bhardlimit = Q_MUL(bh);
-        vxfs_dqb.dqb_btimelimit = timelimflag;
-        vxfs_dqb.dqb_fsoftlimit = fs;
-        vxfs_dqb.dqb_fhardlimit = fh;
-        vxfs_dqb.dqb_ftimelimit = timelimflag;
-        int err = vx_quotactl(VX_SETQUOTA, self->m_qcarg, uid, CADR &vxfs_dqb);
-        if (err)
+static PyObject *
+FsQuota_BuildSketchDist(const T_QSKETCH_DIST * dist, const T_FSQUOTA_SKETCH_OPT * opt)
+{
+    PyObject * quant = PyDict_New();
+
+    for (unsigned idx = 0; (quant != NULL) && (idx < opt->quant_cnt); idx++)
+    {
+        PyObject * key = PyFloat_FromDouble(opt->quantiles[idx]);
+        PyObject * val = PyLong_FromUnsignedLongLong(qsketch_quantile(dist, opt->quantiles[idx]));
+
+        if ((key == NULL) || (val == NULL) || (PyDict_SetItem(quant, key, val) != 0))
         {
-            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            Py_CLEAR(quant);
         }
+        Py_XDECREF(key);
+        Py_XDECREF(val);
     }
-    else
-#endif
-#ifdef AFSQUOTA
-    if (self->m_dev_fs_type == QUOTA_DEV_AFS)
+    if (quant == NULL)
     {
-        if (!afs_check())  // check is *required* as setup!
+        return NULL;
+    }
+    return Py_BuildValue("{s:K,s:K,s:K,s:N}",
+                         "sum", (unsigned long long) dist->sum,
+                         "min", (unsigned long long) dist->min,
+                         "max", (unsigned long long) dist->max,
+                         "quantiles", quant);
+}
+
+static PyObject *
+FsQuota_BuildSketchRatio(const T_QSKETCH_RATIO * ratio, const T_QSKETCH * sk)
+{
+    PyObject * counts = PyList_New(sk->bound_cnt + 1);
+
+    for (unsigned idx = 0; (counts != NULL) && (idx <= sk->bound_cnt); idx++)
+    {
+        PyObject * val = PyLong_FromUnsignedLongLong(ratio->counts[idx]);
+        if (val != NULL)
         {
-            RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "AFS setup via afc_check failed");
+            PyList_SET_ITEM(counts, idx, val);
         }
         else
         {
-            int err = afs_setqlim(self->m_qcarg, bh);
-            if (err)
-            {
-                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
-            }
+            Py_CLEAR(counts);
         }
     }
-    else
-#endif
-#if defined(HAVE_JFS2)
-    if (self->m_dev_fs_type == QUOTA_DEV_JFS2)
+    if (counts == NULL)
     {
-        quota64_t user_quota;
+        return NULL;
+    }
+    return Py_BuildValue("{s:N,s:K}", "counts", counts,
+                         "no_limit", (unsigned long long) ratio->no_limit);
+}
 
-        int err = quotactl(self->m_qcarg, QCMD(Q_J2GETQUOTA, (is_grpquota ? GRPQUOTA : USRQUOTA)),
-                           uid, CADR &user_quota);
-        if (err == 0)
+//
+// Helper function for converting the summary into a dict as returned by
+// methods Quota.summary() and Snapshot.summary()
+//
+static PyObject *
+FsQuota_BuildSketch(const T_QSKETCH * sk, const T_FSQUOTA_SKETCH_OPT * opt)
+{
+    PyObject * bounds = PyTuple_New(sk->bound_cnt);
+
+    for (unsigned idx = 0; (bounds != NULL) && (idx < sk->bound_cnt); idx++)
+    {
+        PyObject * val = PyFloat_FromDouble(sk->bounds[idx]);
+        if (val != NULL)
         {
-            user_quota.bsoft = bs;
-            user_quota.bhard = bh;
-            user_quota.btime = timelimflag;
-            user_quota.isoft = fs;
-            user_quota.ihard = fh;
-            user_quota.itime = timelimflag;
-            err = quotactl(self->m_qcarg, QCMD(Q_J2PUTQUOTA, (is_grpquota ? GRPQUOTA : USRQUOTA)),
-                           uid, CADR &user_quota);
+            PyTuple_SET_ITEM(bounds, idx, val);
         }
-        if (err)
+        else
         {
-            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            Py_CLEAR(bounds);
         }
     }
-    else
-#endif /* HAVE_JFS2 */
+    if (bounds == NULL)
     {
-#ifdef NETBSD_LIBQUOTA
-        struct quotahandle *qh;
-        struct quotakey qk;
-        struct quotaval qv;
+        return NULL;
+    }
+    return Py_BuildValue("{s:K,s:N,s:N,s:N,s:N,s:N}",
+                         "entries", (unsigned long long) sk->usage[0].count,
+                         "bcount", FsQuota_BuildSketchDist(&sk->usage[0], opt),
+                         "icount", FsQuota_BuildSketchDist(&sk->usage[1], opt),
+                         "ratio_bounds", bounds,
+                         "bratio", FsQuota_BuildSketchRatio(&sk->ratio[0], sk),
+                         "iratio", FsQuota_BuildSketchRatio(&sk->ratio[1], sk));
+}
 
-        qh = quota_open(self->m_qcarg);
-        if (qh != NULL)
+//
+// Helper function for retrieving the error code from a pending exception,
+// without clearing the exception.
+//
+static int
+FsQuota_GetPendingErrno(void)
+{
+    PyObject * type, * value, * traceback;
+    int errnum = 0;
+
+    PyErr_Fetch(&type, &value, &traceback);
+    if (value != NULL)
+    {
+        PyObject * obj = NULL;
+
+        // exceptions raised via the helpers above are not yet normalized
+        if (PyTuple_Check(value) && (PyTuple_Size(value) > 0))
         {
-            qk.qk_idtype = is_grpquota ? QUOTA_IDTYPE_GROUP : QUOTA_IDTYPE_USER;
-            qk.qk_id = uid;
+            obj = PyTuple_GetItem(value, 0);
+            Py_INCREF(obj);
+        }
+        else if (PyExceptionInstance_Check(value))
+        {
+            obj = PyObject_GetAttrString(value, "errno");
+        }
+        if ((obj != NULL) && PyLong_Check(obj))
+        {
+            errnum = PyLong_AsLong(obj);
+        }
+        Py_XDECREF(obj);
+        PyErr_Clear();
+    }
+    PyErr_Restore(type, value, traceback);
 
-            qk.qk_objtype = QUOTA_OBJTYPE_BLOCKS;
+    // errors are counted only for non-zero values
+    return ((errnum != 0) ? errnum : EIO);
+}
 
-            // set the grace period for blocks
-            if (timelimflag)  // seven days
-            {
-                qv.qv_grace = 7*24*60*60;
-            }
-            else if (quota_get(qh, &qk, &qv) >= 0)  // use user's current setting
-            {
-                // OK
-            }
-            else if (qk.qk_id = QUOTA_DEFAULTID, quota_get(qh, &qk, &qv) >= 0)  // use default setting
-            {
-                // OK, reset qk_id
-                qk.qk_id = uid;
-            }
-            else
-            {
-                qv.qv_grace = 0;
-            }
+//
+// Map the file system type to the set of process-wide performance counters
+//
+static T_QSTAT_BACKEND
+FsQuota_StatsBackend(T_QUOTA_DEV_FS_TYPE dev_fs_type)
+{
+    switch (dev_fs_type)
+    {
+        case QUOTA_DEV_NFS:  return QSTAT_BE_RPC;
+        case QUOTA_DEV_XFS:  return QSTAT_BE_XFS;
+        case QUOTA_DEV_BTRFS: return QSTAT_BE_BTRFS;
+        default:             return QSTAT_BE_VFS;
+    }
+}
 
-            qv.qv_usage = 0;
-            qv.qv_hardlimit = Q_MUL(bh);
-            qv.qv_softlimit = Q_MUL(bs);
-            qv.qv_expiretime = 0;
-            if (quota_put(qh, &qk, &qv) >= 0)
-            {
-                qk.qk_objtype = QUOTA_OBJTYPE_FILES;
+//
+// Account a call of a Quota method in the performance counters of the
+// object and in the process-wide counters. Parameter result is the return
+// value of the method; if NULL, the errno is taken from the exception.
+// The errno value (or zero) is returned for use in trace probes.
+// The first variant takes the errno value directly.
+//
+static int
+Quota_RecordStatsErrno(Quota_ObjectType * self, T_QSTAT_OP op, uint64_t t_start, int errnum)
+{
+    uint64_t t_end = qstat_now();
 
-                // set the grace period for files, see comments above
-                if (timelimflag)
-                {
-                    qv.qv_grace = 7*24*60*60;
-                }
-                else if (quota_get(qh, &qk, &qv) >= 0)
-                {
-                    // OK
-                }
-                else if (qk.qk_id = QUOTA_DEFAULTID, quota_get(qh, &qk, &qv) >= 0)
-                {
-                    // OK, reset qk_id
-                    qk.qk_id = uid;
-                }
-                else
-                {
-                    qv.qv_grace = 0;
-                }
+    qstat_record(&self->m_stats.op[op], t_start, t_end, errnum);
+    qstat_record(&qstat_backend[FsQuota_StatsBackend(self->m_dev_fs_type)].op[op],
+                 t_start, t_end, errnum);
+    return errnum;
+}
 
-                qv.qv_usage = 0;
-                qv.qv_hardlimit = fh;
-                qv.qv_softlimit = fs;
-                qv.qv_expiretime = 0;
+static int
+Quota_RecordStats(Quota_ObjectType * self, T_QSTAT_OP op, uint64_t t_start, PyObject * result)
+{
+    return Quota_RecordStatsErrno(self, op, t_start,
+                                  ((result == NULL) ? FsQuota_GetPendingErrno() : 0));
+}
 
-                if (quota_put(qh, &qk, &qv) < 0)
-                {
-                    RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
-                }
-            }
-            else
-            {
-                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
-            }
-            quota_close(qh);
-        }
-        else
+//
+// Helper function returning the key under which operations of the object
+// are recorded in traces: this is the device argument, prefixed with the
+// host name for NFS, as the remote path alone is ambiguous.
+//
+static const char *
+Quota_TraceDev(Quota_ObjectType * self, char * buf, size_t buf_size)
+{
+#ifndef NO_RPC
+    if (self->m_dev_fs_type == QUOTA_DEV_NFS)
+    {
+        snprintf(buf, buf_size, "%s:%s", self->m_rpc_host, self->m_qcarg);
+        return buf;
+    }
+#endif
+    return self->m_qcarg;
+}
+
+//
+// Append a record for a call of a Quota method to the trace, when recording
+// is enabled. Parameter val holds operation specific values (result of
+// query, or parameters of setqlim) or is NULL.
+//
+static void
+Quota_TraceCall(Quota_ObjectType * self, T_QTRACE_REC_TYPE type, int id, int qtype,
+                uint64_t t_start, int errnum, const uint64_t * val)
+{
+    if ((qtrace_mode == QTRACE_RECORD) && (self->m_dev_fs_type != QUOTA_DEV_INVALID))
+    {
+        T_QTRACE_REC rec;
+        char dev_buf[1024];
+
+        memset(&rec, 0, sizeof(rec));
+        rec.type = type;
+        rec.backend = FsQuota_StatsBackend(self->m_dev_fs_type);
+        rec.qtype = qtype;
+        rec.id = id;
+        rec.errnum = errnum;
+        rec.t_start = t_start;
+        rec.duration = qstat_now() - t_start;
+        rec.str = Quota_TraceDev(self, dev_buf, sizeof(dev_buf));
+        if (val != NULL)
         {
-            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            memcpy(rec.val, val, sizeof(rec.val));
         }
-#else /* not NETBSD_LIBQUOTA */
-        struct dqblk dqblk;
-        memset(&dqblk, 0, sizeof(dqblk));
-        dqblk.QS_BSOFT = Q_MUL(bs);
-        dqblk.QS_BHARD = Q_MUL(bh);
-        dqblk.QS_BTIME = timelimflag;
-        dqblk.QS_FSOFT = fs;
-        dqblk.QS_FHARD = fh;
-        dqblk.QS_FTIME = timelimflag;
+        qtrace_put(&rec);
+    }
+}
 
-        // check for truncation during assignment
-        if ((sizeof(dqblk.QS_BSOFT) < sizeof(uint64_t)) &&
-            ((bs|bh|fs|fh) & 0xFFFFFFFF00000000ULL))
+//
+// Serve a call of a Quota method from the replay trace, instead of the
+// backend. The recorded values are copied to the given array and the
+// recorded latency is simulated. Returns the recorded errno value, or
+// QTRACE_ERR_NO_RECORD with a description if the trace has no matching
+// record.
+//
+static int
+Quota_ReplayCall(Quota_ObjectType * self, T_QTRACE_REC_TYPE type, int id, int qtype,
+                 uint64_t * val, const char ** p_errstr)
+{
+    char dev_buf[1024];
+    const T_QTRACE_REC * rec = qtrace_lookup(type, Quota_TraceDev(self, dev_buf, sizeof(dev_buf)),
+                                             qtype, id);
+    *p_errstr = NULL;
+    if (rec == NULL)
+    {
+        *p_errstr = "No matching record in replay trace";
+        return QTRACE_ERR_NO_RECORD;
+    }
+
+    // copy all data, as the record is invalidated if replay is stopped while the GIL is released
+    int errnum = rec->errnum;
+    uint64_t delay_ns = qtrace_delay_ns(rec);
+    memcpy(val, rec->val, sizeof(rec->val));
+
+    Py_BEGIN_ALLOW_THREADS
+    qtrace_sleep(delay_ns);
+    Py_END_ALLOW_THREADS
+
+    return errnum;
+}
+
+//
+// Helper function for adding an entry to a dict, taking over the reference
+// of the value. Returns -1 if the value is NULL or insertion failed.
+//
+static int
+FsQuota_DictSetNew(PyObject * dict, const char * key, PyObject * val)
+{
+    int err = ((val == NULL) || (PyDict_SetItemString(dict, key, val) != 0));
+    Py_XDECREF(val);
+    return (err ? -1 : 0);
+}
+
+//
+// Helper functions for converting performance counters into dicts
+//
+static PyObject *
+FsQuota_BuildStatsLat(const T_QSTAT_LAT * lat)
+{
+    PyObject * RETVAL = PyDict_New();
+    PyObject * errs = PyDict_New();
+    PyObject * hist = PyTuple_New(QSTAT_HIST_BUCKETS);
+
+    if ((RETVAL != NULL) && (errs != NULL) && (hist != NULL))
+    {
+        for (unsigned idx = 0; idx < QSTAT_HIST_BUCKETS; idx++)
         {
-            RETVAL = FsQuota_OsException(EINVAL, "Device supports only 32-bit quota", NULL);
+            PyTuple_SET_ITEM(hist, idx, PyLong_FromUnsignedLong(lat->hist[idx]));
         }
-        else
+        // key 0 is used for errno values not fitting into the table
+        for (unsigned idx = 0; idx <= QSTAT_ERRNO_SLOTS; idx++)
         {
-#ifdef USE_IOCTL
-            int fd;
-            if ((fd = open(self->m_qcarg, O_RDONLY)) != -1)
+            if (lat->err_cnt[idx] != 0)
             {
-                struct quotactl qp;
-                qp.op = Q_SETQLIM;
-                qp.uid = uid;
-                qp.addr = (char *)&dqblk;
-
-                if (ioctl(fd, Q_QUOTACTL, &qp) != 0)
+                PyObject * key = PyLong_FromLong((idx < QSTAT_ERRNO_SLOTS) ? lat->err_no[idx] : 0);
+                PyObject * val = PyLong_FromUnsignedLong(lat->err_cnt[idx]);
+                if ((key != NULL) && (val != NULL))
                 {
-                    RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+                    PyDict_SetItem(errs, key, val);
                 }
-                close(fd);
-            }
-            else
-            {
-                RETVAL = FsQuota_OsException(errno, "opening device", self->m_qcarg);
-            }
-#else  /* not USE_IOCTL */
-#ifdef Q_CTL_V3  /* Linux */
-            int err = linuxquota_setqlim (self->m_qcarg, uid, is_grpquota, &dqblk);
-#else
-#ifdef Q_CTL_V2
-            int err = quotactl (self->m_qcarg, QCMD(Q_SETQUOTA,(is_grpquota ? GRPQUOTA : USRQUOTA)), uid, CADR &dqblk);
-#else
-            int err = quotactl (Q_SETQLIM, self->m_qcarg, uid, CADR &dqblk);
-#endif /* Q_CTL_V2 */
-#endif /* Q_CTL_V3 */
-            if (err)
-            {
-                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+                Py_XDECREF(key);
+                Py_XDECREF(val);
             }
-#endif /* not USE_IOCTL */
         }
-#endif /* not NETBSD_LIBQUOTA */
+        if ((FsQuota_DictSetNew(RETVAL, "calls", PyLong_FromUnsignedLong(lat->calls)) != 0) ||
+            (FsQuota_DictSetNew(RETVAL, "errors", PyLong_FromUnsignedLong(lat->errors)) != 0) ||
+            (FsQuota_DictSetNew(RETVAL, "time_ns", PyLong_FromUnsignedLongLong(lat->time_ns)) != 0) ||
+            (PyDict_SetItemString(RETVAL, "errno", errs) != 0) ||
+            (PyDict_SetItemString(RETVAL, "histogram", hist) != 0))
+        {
+            Py_CLEAR(RETVAL);
+        }
+    }
+    else
+    {
+        Py_CLEAR(RETVAL);
     }
+    Py_XDECREF(errs);
+    Py_XDECREF(hist);
+    return RETVAL;
+}
+
+static PyObject *
+FsQuota_BuildStatsSet(const T_QSTAT_SET * set, int with_rpc)
+{
+    PyObject * RETVAL = PyDict_New();
 
+    if (RETVAL != NULL)
+    {
+        if ((FsQuota_DictSetNew(RETVAL, "query", FsQuota_BuildStatsLat(&set->op[QSTAT_OP_QUERY])) != 0) ||
+            (FsQuota_DictSetNew(RETVAL, "setqlim", FsQuota_BuildStatsLat(&set->op[QSTAT_OP_SETQLIM])) != 0) ||
+            (FsQuota_DictSetNew(RETVAL, "sync", FsQuota_BuildStatsLat(&set->op[QSTAT_OP_SYNC])) != 0) ||
+            (with_rpc &&
+             (FsQuota_DictSetNew(RETVAL, "rpc",
+                                 Py_BuildValue("{s:k,s:k,s:k,s:k,s:k}",
+                                               "connects", set->rpc.connects,
+                                               "connect_errors", set->rpc.connect_errors,
+                                               "calls", set->rpc.calls,
+                                               "timeouts", set->rpc.timeouts,
+                                               "fallbacks", set->rpc.fallbacks)) != 0)))
+        {
+            Py_CLEAR(RETVAL);
+        }
+    }
     return RETVAL;
 }
 
+#ifdef BTRFS_QGROUPS
 //
-// Implementation of the Quota.sync() method
+// Helper function converting usage and limits of a Btrfs qgroup to a query
+// result: the referenced size is reported as block usage and its limit as
+// hard block limit; there are no soft, inode or grace time limits.
 //
-PyDoc_STRVAR(Quota_sync__doc__,
-    "quota()\n\n"
-    "Sync quota changes to disk.");
+static void
+Quota_BtrfsResult(const T_QBTRFS_QGROUP * ent, T_QUOTA_QUERY_RESULT * rslt)
+{
+    memset(rslt, 0, sizeof(*rslt));
+    rslt->bcur  = ent->rfer / DEV_QBSIZE;
+    rslt->bhard = ent->max_rfer / DEV_QBSIZE;
+}
+#endif
 
-static PyObject *
-Quota_sync(Quota_ObjectType *self, PyObject *args)
+//
+// Query quota usage and limits for the given user on a local file system.
+// This function is independent of the Python interpreter state, so that it
+// can also be used by background threads. Block counts are returned in units
+// of 1 kB. Upon error, -1 is returned and errno is set; in some cases an
+// error description is returned additionally via p_errstr.
+//
+static int
+Quota_query_local(T_QUOTA_DEV_FS_TYPE dev_fs_type, const char * qcarg,
+                  int uid, int is_grpquota, int is_prjquota,
+                  T_QUOTA_QUERY_RESULT * rslt, const char ** p_errstr)
 {
-    if (!PyArg_ParseTuple(args, ""))
+    int err;
+
+    *p_errstr = NULL;
+
+#ifdef BTRFS_QGROUPS
+    if (dev_fs_type == QUOTA_DEV_BTRFS)
     {
-        return NULL;
-    }
-    PyObject * RETVAL = Py_None;
+        T_QBTRFS_QGROUP ent;
 
-    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+        if (!is_prjquota)
+        {
+            *p_errstr = "Btrfs only supports qgroups, which are queried via option prjquota";
+            errno = ENOTSUP;
+            err = -1;
+        }
+        else if ((err = qbtrfs_get(qcarg, (uint32_t) uid, &ent)) == 0)
+        {
+            Quota_BtrfsResult(&ent, rslt);
+        }
+    }
+    else
+#endif  /* BTRFS_QGROUPS */
+#ifdef SGI_XFS
+    if (dev_fs_type == QUOTA_DEV_XFS)
     {
-        RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+        fs_disk_quota_t xfs_dqblk;
+#ifndef linux
+        err = quotactl(Q_XGETQUOTA, (char*)qcarg, uid, CADR &xfs_dqblk);
+#else
+        err = quotactl(QCMD(Q_XGETQUOTA, (is_prjquota ? XQM_PRJQUOTA :
+                                          is_grpquota ? XQM_GRPQUOTA : XQM_USRQUOTA)),
+                       qcarg, uid, CADR &xfs_dqblk);
+#endif
+        if (!err)
+        {
+            rslt->bcur  = QX_DIV(xfs_dqblk.d_bcount);
+            rslt->bsoft = QX_DIV(xfs_dqblk.d_blk_softlimit);
+            rslt->bhard = QX_DIV(xfs_dqblk.d_blk_hardlimit);
+            rslt->btime = xfs_dqblk.d_btimer;
+            rslt->fcur  = xfs_dqblk.d_icount;
+            rslt->fsoft = xfs_dqblk.d_ino_softlimit;
+            rslt->fhard = xfs_dqblk.d_ino_hardlimit;
+            rslt->ftime = xfs_dqblk.d_itimer;
+        }
     }
     else
+#endif  /* SGI_XFS */
 #ifdef SOLARIS_VXFS
-    if (self->m_dev_fs_type == QUOTA_DEV_VXFS)
+    if (dev_fs_type == QUOTA_DEV_VXFS)
     {
-        if (vx_quotactl(VX_QSYNCALL, self->m_qcarg, 0, NULL) != 0)
+        struct vx_dqblk vxfs_dqb;
+        err = vx_quotactl(VX_GETQUOTA, (char*)qcarg, uid, CADR &vxfs_dqb);
+        if (!err)
         {
-            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            rslt->bcur  = Q_DIV(vxfs_dqb.dqb_curblocks);
+            rslt->bsoft = Q_DIV(vxfs_dqb.dqb_bsoftlimit);
+            rslt->bhard = Q_DIV(vxfs_dqb.dqb_bhardlimit);
+            rslt->btime = vxfs_dqb.dqb_btimelimit;
+            rslt->fcur  = vxfs_dqb.dqb_curfiles;
+            rslt->fsoft = vxfs_dqb.dqb_fsoftlimit;
+            rslt->fhard = vxfs_dqb.dqb_fhardlimit;
+            rslt->ftime = vxfs_dqb.dqb_ftimelimit;
+        }
+    }
+    else
+#endif  /* SOLARIS_VXFS */
+#ifdef AFSQUOTA
+    if (dev_fs_type == QUOTA_DEV_AFS)
+    {
+        if (!afs_check())  // check is *required* as setup!
+        {
+            *p_errstr = "AFS setup failed";
+            errno = EINVAL;
+            err = -1;
+        }
+        else
+        {
+            int maxQuota, blocksUsed;
+
+            err = afs_getquota((char*)qcarg, &maxQuota, &blocksUsed);
+            if (!err)
+            {
+                memset(rslt, 0, sizeof(*rslt));
+                rslt->bcur  = blocksUsed;
+                rslt->bsoft = maxQuota;
+                rslt->bhard = maxQuota;
+            }
+        }
+    }
+    else
+#endif  /* AFSQUOTA */
+#if defined(HAVE_JFS2)
+    if (dev_fs_type == QUOTA_DEV_JFS2)
+    {
+        // AIX quotactl doesn't fail if path does not exist!?
+        struct stat st;
+        if (stat(qcarg, &st) == 0)
+        {
+            quota64_t user_quota;
+
+            err = quotactl((char*)qcarg, QCMD(Q_J2GETQUOTA, (is_grpquota ? GRPQUOTA : USRQUOTA)),
+                           uid, CADR &user_quota);
+            if (!err)
+            {
+                rslt->bcur  = user_quota.bused;
+                rslt->bsoft = user_quota.bsoft;
+                rslt->bhard = user_quota.bhard;
+                rslt->btime = user_quota.btime;
+                rslt->fcur  = user_quota.ihard;
+                rslt->fsoft = user_quota.isoft;
+                rslt->fhard = user_quota.iused;
+                rslt->ftime = user_quota.itime;
+            }
         }
+        else
+            err = -1;
+    }
+    else
+#endif  /* HAVE_JFS2 */
+    {
+#ifdef NETBSD_LIBQUOTA
+        struct quotahandle *qh = quota_open((char*)qcarg);
+        if (qh != NULL)
+        {
+            struct quotakey qk_blocks, qk_files;
+            struct quotaval qv_blocks, qv_files;
+
+            qk_blocks.qk_idtype = /*fall-through*/
+            qk_files.qk_idtype = is_grpquota ? QUOTA_IDTYPE_GROUP : QUOTA_IDTYPE_USER;
+            qk_blocks.qk_id = qk_files.qk_id = uid;
+            qk_blocks.qk_objtype = QUOTA_OBJTYPE_BLOCKS;
+            qk_files.qk_objtype = QUOTA_OBJTYPE_FILES;
+
+            if ((quota_get(qh, &qk_blocks, &qv_blocks) >= 0) &&
+                (quota_get(qh, &qk_files, &qv_files) >= 0) )
+            {
+                // adapt to common "unlimited" semantics
+                if ((qv_blocks.qv_softlimit == QUOTA_NOLIMIT) &&
+                    (qv_blocks.qv_hardlimit == QUOTA_NOLIMIT))
+                {
+                  qv_blocks.qv_hardlimit = qv_blocks.qv_softlimit = 0;
+                }
+                if ((qv_files.qv_softlimit == QUOTA_NOLIMIT) &&
+                    (qv_files.qv_hardlimit == QUOTA_NOLIMIT))
+                {
+                  qv_files.qv_hardlimit = qv_files.qv_softlimit = 0;
+                }
+                rslt->bcur  = Q_DIV(qv_blocks.qv_usage);
+                rslt->bsoft = Q_DIV(qv_blocks.qv_softlimit);
+                rslt->bhard = Q_DIV(qv_blocks.qv_hardlimit);
+                rslt->btime = qv_blocks.qv_expiretime;
+                rslt->fcur  = qv_files.qv_usage;
+                rslt->fsoft = qv_files.qv_softlimit;
+                rslt->fhard = qv_files.qv_hardlimit;
+                rslt->ftime = qv_files.qv_expiretime;
+                err = 0;
+            }
+            else
+            {
+                err = -1;
+            }
+            int errno_bak = errno;
+            quota_close(qh);
+            errno = errno_bak;
+        }
+        else
+        {
+            err = -1;
+        }
+#else /* not NETBSD_LIBQUOTA */
+        struct dqblk dqblk;
+#ifdef USE_IOCTL
+        struct quotactl qp;
+        int fd = -1;
+
+        qp.op = Q_GETQUOTA;
+        qp.uid = uid;
+        qp.addr = (char *)&dqblk;
+        if ((fd = open(qcarg, O_RDONLY)) != -1)
+        {
+            err = (ioctl(fd, Q_QUOTACTL, &qp) == -1);
+            close(fd);
+        }
+        else
+        {
+            err = 1;
+        }
+#else /* not USE_IOCTL */
+#ifdef Q_CTL_V3  /* Linux */
+        err = linuxquota_query(qcarg, uid, (is_prjquota ? PRJQUOTA : (is_grpquota ? GRPQUOTA : USRQUOTA)), &dqblk);
+#else /* not Q_CTL_V3 */
+#ifdef Q_CTL_V2
+#ifdef AIX
+        // AIX quotactl doesn't fail if path does not exist!?
+        struct stat st;
+        if (stat(qcarg, &st) != 0)
+        {
+            err = 1;
+        }
+        else
+#endif /* AIX */
+        err = quotactl((char*)qcarg, QCMD(Q_GETQUOTA, (is_grpquota ? GRPQUOTA : USRQUOTA)), uid, CADR &dqblk);
+#else /* not Q_CTL_V2 */
+        err = quotactl(Q_GETQUOTA, (char*)qcarg, uid, CADR &dqblk);
+#endif /* not Q_CTL_V2 */
+#endif /* Q_CTL_V3 */
+#endif /* not USE_IOCTL */
+        if (!err)
+        {
+            rslt->bcur  = Q_DIV(dqblk.QS_BCUR);
+            rslt->bsoft = Q_DIV(dqblk.QS_BSOFT);
+            rslt->bhard = Q_DIV(dqblk.QS_BHARD);
+            rslt->btime = dqblk.QS_BTIME;
+            rslt->fcur  = dqblk.QS_FCUR;
+            rslt->fsoft = dqblk.QS_FSOFT;
+            rslt->fhard = dqblk.QS_FHARD;
+            rslt->ftime = dqblk.QS_FTIME;
+        }
+#endif /* not NETBSD_LIBQUOTA */
+    }
+    return (err ? -1 : 0);
+}
+
+//
+// Query quota usage and limits of the first ID equal or larger than the given
+// one that has a quota entry on a local file system, i.e. for enumerating all
+// entries. The ID of the entry is returned via p_next_id. The end of the
+// table is indicated by failure with errno ENOENT. Only supported for Linux
+// kernels providing Q_GETNEXTQUOTA and Q_XGETNEXTQUOTA (4.6 and later). The
+// function can be called while the GIL is released, as Quota_query_local().
+//
+static int
+Quota_query_next_local(T_QUOTA_DEV_FS_TYPE dev_fs_type, const char * qcarg,
+                       int id, int is_grpquota, int is_prjquota, int * p_next_id,
+                       T_QUOTA_QUERY_RESULT * rslt, const char ** p_errstr)
+{
+    int err;
+
+    *p_errstr = NULL;
+
+#if defined(SGI_XFS) && defined(linux) && defined(Q_XGETNEXTQUOTA)
+    if (dev_fs_type == QUOTA_DEV_XFS)
+    {
+        fs_disk_quota_t xfs_dqblk;
+        err = quotactl(QCMD(Q_XGETNEXTQUOTA, (is_prjquota ? XQM_PRJQUOTA :
+                                              is_grpquota ? XQM_GRPQUOTA : XQM_USRQUOTA)),
+                       qcarg, id, CADR &xfs_dqblk);
+        if (!err)
+        {
+            *p_next_id  = xfs_dqblk.d_id;
+            rslt->bcur  = QX_DIV(xfs_dqblk.d_bcount);
+            rslt->bsoft = QX_DIV(xfs_dqblk.d_blk_softlimit);
+            rslt->bhard = QX_DIV(xfs_dqblk.d_blk_hardlimit);
+            rslt->btime = xfs_dqblk.d_btimer;
+            rslt->fcur  = xfs_dqblk.d_icount;
+            rslt->fsoft = xfs_dqblk.d_ino_softlimit;
+            rslt->fhard = xfs_dqblk.d_ino_hardlimit;
+            rslt->ftime = xfs_dqblk.d_itimer;
+        }
+    }
+    else
+#endif
+#ifdef Q_CTL_V3  /* Linux */
+    if (dev_fs_type == QUOTA_DEV_REGULAR)
+    {
+        struct dqblk dqblk;
+        err = linuxquota_query_next(qcarg, id, (is_prjquota ? PRJQUOTA : (is_grpquota ? GRPQUOTA : USRQUOTA)),
+                                    p_next_id, &dqblk);
+        if (!err)
+        {
+            rslt->bcur  = Q_DIV(dqblk.QS_BCUR);
+            rslt->bsoft = Q_DIV(dqblk.QS_BSOFT);
+            rslt->bhard = Q_DIV(dqblk.QS_BHARD);
+            rslt->btime = dqblk.QS_BTIME;
+            rslt->fcur  = dqblk.QS_FCUR;
+            rslt->fsoft = dqblk.QS_FSOFT;
+            rslt->fhard = dqblk.QS_FHARD;
+            rslt->ftime = dqblk.QS_FTIME;
+        }
+    }
+    else
+#endif
+    {
+        *p_errstr = "Enumeration of quota entries is not supported for this file system";
+        errno = ENOTSUP;
+        err = -1;
+    }
+    return (err ? -1 : 0);
+}
+
+//
+// Callback for Quota_enum_local(), invoked for each entry in ascending order
+// of IDs. Returns zero for continuing, or -1 with errno set for aborting.
+//
+typedef int (*T_QUOTA_ENUM_CB)(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt);
+
+#ifdef BTRFS_QGROUPS
+//
+// Enumerate the qgroups of subvolumes of a Btrfs file system: all qgroups
+// are read at once via a single tree search, instead of one call per ID.
+// Higher-level qgroups and IDs exceeding 32 bits are skipped.
+//
+static int
+Quota_enum_btrfs(const char * qcarg, int is_prjquota,
+                 T_QUOTA_ENUM_CB cb, void * ctx, T_QUOTA_ERROR * err)
+{
+    T_QBTRFS_QGROUP * tab;
+    size_t count;
+
+    if (!is_prjquota)
+    {
+        err->str = "Btrfs only supports qgroups, which are queried via option prjquota";
+        err->errnum = ENOTSUP;
+    }
+    else if (qbtrfs_get_all(qcarg, &tab, &count) != 0)
+    {
+        err->errnum = ((errno != 0) ? errno : EIO);
+    }
+    else
+    {
+        for (size_t idx = 0; idx < count; idx++)
+        {
+            if ((QBTRFS_LEVEL(tab[idx].qgroupid) == 0) && (tab[idx].qgroupid <= UINT32_MAX))
+            {
+                T_QUOTA_QUERY_RESULT rslt;
+                Quota_BtrfsResult(&tab[idx], &rslt);
+
+                if (cb(ctx, (uint32_t) tab[idx].qgroupid, &rslt) != 0)
+                {
+                    err->errnum = ((errno != 0) ? errno : EIO);
+                    err->str = "collecting quota entries";
+                    err->is_os = TRUE;
+                    break;
+                }
+            }
+        }
+        free(tab);
+    }
+    return err->errnum;
+}
+#endif
+
+//
+// Enumerate all quota entries of a local file system via
+// Quota_query_next_local(), i.e. without holding the GIL. Returns zero upon
+// success, else the errno value; the error is described in the given struct.
+//
+static int
+Quota_enum_local(T_QUOTA_DEV_FS_TYPE dev_fs_type, const char * qcarg,
+                 int is_grpquota, int is_prjquota,
+                 T_QUOTA_ENUM_CB cb, void * ctx, T_QUOTA_ERROR * err)
+{
+    uint32_t id = 0;
+
+    err->errnum = 0;
+    err->str = NULL;
+    err->is_os = FALSE;
+
+#ifdef BTRFS_QGROUPS
+    if (dev_fs_type == QUOTA_DEV_BTRFS)
+    {
+        return Quota_enum_btrfs(qcarg, is_prjquota, cb, ctx, err);
+    }
+#endif
+
+    for (;;)
+    {
+        T_QUOTA_QUERY_RESULT rslt;
+        int next_id;
+
+        if (Quota_query_next_local(dev_fs_type, qcarg, id, is_grpquota, is_prjquota,
+                                   &next_id, &rslt, &err->str) != 0)
+        {
+            // ENOENT indicates the end of the table
+            if (errno != ENOENT)
+            {
+                err->errnum = ((errno != 0) ? errno : EIO);
+            }
+            break;
+        }
+        if ((uint32_t) next_id < id)
+        {
+            // protection against endless loop
+            err->errnum = EIO;
+            break;
+        }
+        if (cb(ctx, next_id, &rslt) != 0)
+        {
+            err->errnum = ((errno != 0) ? errno : EIO);
+            err->str = "collecting quota entries";
+            err->is_os = TRUE;
+            break;
+        }
+        if ((uint32_t) next_id == UINT32_MAX)
+        {
+            break;
+        }
+        id = (uint32_t) next_id + 1;
+    }
+    return err->errnum;
+}
+
+//
+// Helper function for processing work items with the given indices in
+// parallel, by up to the given number of threads. Each thread takes the next
+// index not yet taken by another. The calling thread works as well, so that
+// progress does not depend on thread creation. This function does not
+// access the Python interpreter state, i.e. it can be called while the GIL
+// is released.
+//
+typedef struct
+{
+    void     (*work)(void * ctx, unsigned idx);
+    void *     ctx;
+    unsigned   count;
+    unsigned   next_idx;                // accessed atomically
+} T_FSQUOTA_PARALLEL;
+
+static void *
+FsQuota_ParallelWorker(void * arg)
+{
+    T_FSQUOTA_PARALLEL * par = (T_FSQUOTA_PARALLEL *) arg;
+    unsigned idx;
+
+    while ((idx = __atomic_fetch_add(&par->next_idx, 1, __ATOMIC_RELAXED)) < par->count)
+    {
+        par->work(par->ctx, idx);
+    }
+    return NULL;
+}
+
+static void
+FsQuota_RunParallel(unsigned count, unsigned max_threads,
+                    void (*work)(void * ctx, unsigned idx), void * ctx)
+{
+    T_FSQUOTA_PARALLEL par = { work, ctx, count, 0 };
+    pthread_t threads[max_threads];
+    unsigned thread_cnt = 0;
+
+    while ((thread_cnt + 1 < max_threads) && (thread_cnt + 1 < count) &&
+           (pthread_create(&threads[thread_cnt], NULL, FsQuota_ParallelWorker, &par) == 0))
+    {
+        thread_cnt += 1;
+    }
+    FsQuota_ParallelWorker(&par);
+
+    for (unsigned idx = 0; idx < thread_cnt; idx++)
+    {
+        pthread_join(threads[idx], NULL);
+    }
+}
+
+//
+// Query quota usage and limits via the access method of the given object.
+// This is the common part of methods query() and query_bulk(), which does
+// not raise exceptions. Returns zero upon success, else the errno value;
+// the error is described in the given struct.
+//
+static int
+Quota_QueryDispatch(Quota_ObjectType *self, int uid, int is_grpquota, int is_prjquota,
+                    T_QUOTA_QUERY_RESULT * rslt, T_QUOTA_ERROR * err)
+{
+    err->errnum = 0;
+    err->str = NULL;
+    err->is_os = FALSE;
+
+    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        err->errnum = EINVAL;
+        err->str = "FsQuota.Quota instance is uninitialized";
+    }
+#ifdef FANOTIFY_TRACKING
+    else if (self->m_tracker != NULL)
+    {
+        unsigned kind = (is_prjquota ? QUSAGE_PROJECT : (is_grpquota ? QUSAGE_GROUP : QUSAGE_USER));
+        uint64_t blocks;
+        uint64_t inodes;
+
+        // usage is maintained by the tracker; there are no limits
+        if (qtrack_get(self->m_tracker, kind, uid, &blocks, &inodes) == 0)
+        {
+            memset(rslt, 0, sizeof(*rslt));
+            rslt->bcur = QX_DIV(blocks);
+            rslt->fcur = inodes;
+        }
+        else
+        {
+            err->errnum = errno;
+            if (errno == EOVERFLOW)
+                err->str = "Usage tracking lost events, tracking has to be restarted";
+            else if (errno == ENOTSUP)
+                err->str = "Usage tracking was started without project IDs";
+            else
+            {
+                err->str = "tracking usage";
+                err->is_os = TRUE;
+            }
+        }
+    }
+#endif
+    else if (is_prjquota && !QUOTA_DEV_HAS_PRJQUOTA(self->m_dev_fs_type))
+    {
+        err->errnum = ENOTSUP;
+        err->str = "Project quotas are not supported by this file system";
+    }
+    else if (qtrace_mode == QTRACE_REPLAY)
+    {
+        uint64_t val[QTRACE_VAL_COUNT];
+
+        err->errnum = Quota_ReplayCall(self, QTRACE_REC_QUERY, uid,
+                                       QPROBE_QTYPE(is_grpquota, is_prjquota), val, &err->str);
+        if (err->errnum == 0)
+        {
+            rslt->bcur  = val[0];
+            rslt->bsoft = val[1];
+            rslt->bhard = val[2];
+            rslt->btime = val[3];
+            rslt->fcur  = val[4];
+            rslt->fsoft = val[5];
+            rslt->fhard = val[6];
+            rslt->ftime = val[7];
+        }
+    }
+    else
+#ifndef NO_RPC
+    if (self->m_dev_fs_type == QUOTA_DEV_NFS)
+    {
+        struct sockaddr_in remaddr;
+        char * rpc_err_str = NULL;
+        int rpc_err = rpc_resolve_host(self->m_rpc_host, &self->m_rpc_opt, &remaddr, &rpc_err_str);
+        if (!rpc_err)
+        {
+            // copy, as the Quota object may be re-initialized or its options
+            // changed via rpc_opt() while the GIL is released
+            T_QUOTA_RPC_OPT rpc_opt = self->m_rpc_opt;
+            char * qcarg = strdup(self->m_qcarg);
+
+            if (qcarg == NULL)
+            {
+                rpc_err = -1;
+                errno = ENOMEM;
+            }
+            else
+            {
+                // release the GIL, as the call may block up to the RPC timeout
+                Py_BEGIN_ALLOW_THREADS
+                rpc_err = getnfsquota(&remaddr, qcarg, uid, is_grpquota, &rpc_opt,
+                                      &self->m_stats.rpc, &rpc_err_str, rslt);
+                Py_END_ALLOW_THREADS
+
+                int saved_errno = errno;
+                free(qcarg);
+                errno = saved_errno;
+            }
+        }
+        if (!rpc_err)
+        {
+            rslt->bcur  = Q_DIV(rslt->bcur);
+            rslt->bsoft = Q_DIV(rslt->bsoft);
+            rslt->bhard = Q_DIV(rslt->bhard);
+        }
+        else if (rpc_err_str != NULL)
+        {
+            err->errnum = EIO;
+            err->str = rpc_err_str;
+        }
+        else
+        {
+            err->errnum = ((errno != 0) ? errno : EIO);
+        }
+    }
+    else
+#endif  /* NO_RPC */
+    {
+        const char * err_str;
+
+        if (Quota_query_local(self->m_dev_fs_type, self->m_qcarg, uid,
+                              is_grpquota, is_prjquota, rslt, &err_str) != 0)
+        {
+            err->errnum = ((errno != 0) ? errno : EIO);
+            err->str = err_str;
+            err->is_os = (err_str != NULL);
+        }
+    }
+    return err->errnum;
+}
+
+//
+// Perform a query including accounting in performance counters, probes and
+// trace recording. Returns zero upon success, else the errno value; the
+// error is described in the given struct.
+//
+static int
+Quota_QueryAccounted(Quota_ObjectType *self, int uid, int is_grpquota, int is_prjquota,
+                     T_QUOTA_QUERY_RESULT * rslt, T_QUOTA_ERROR * err)
+{
+    int qtype = QPROBE_QTYPE(is_grpquota, is_prjquota);
+    uint64_t t_start = qstat_now();
+    QPROBE3(query__entry, uid, qtype, self->m_qcarg);
+
+    Quota_QueryDispatch(self, uid, is_grpquota, is_prjquota, rslt, err);
+
+    Quota_RecordStatsErrno(self, QSTAT_OP_QUERY, t_start, err->errnum);
+    QPROBE4(query__return, uid, qtype, self->m_qcarg, err->errnum);
+
+    if (qtrace_mode == QTRACE_RECORD)
+    {
+        uint64_t val[QTRACE_VAL_COUNT] = {0};
+
+        if (err->errnum == 0)
+        {
+            val[0] = rslt->bcur;
+            val[1] = rslt->bsoft;
+            val[2] = rslt->bhard;
+            val[3] = rslt->btime;
+            val[4] = rslt->fcur;
+            val[5] = rslt->fsoft;
+            val[6] = rslt->fhard;
+            val[7] = rslt->ftime;
+        }
+        Quota_TraceCall(self, QTRACE_REC_QUERY, uid, qtype, t_start, err->errnum, val);
+    }
+    return err->errnum;
+}
+
+//
+// Perform a query via Quota_QueryAccounted(). Upon error, either an
+// exception is raised, or in "noraise" mode an error object is returned.
+//
+static PyObject *
+Quota_QueryOne(Quota_ObjectType *self, int uid, int is_grpquota, int is_prjquota, int noraise)
+{
+    PyObject * RETVAL = NULL;
+    T_QUOTA_QUERY_RESULT rslt;
+    T_QUOTA_ERROR err;
+
+    if (Quota_QueryAccounted(self, uid, is_grpquota, is_prjquota, &rslt, &err) == 0)
+    {
+        RETVAL = FsQuota_BuildQuotaResult(rslt.bcur,
+                                          rslt.bsoft,
+                                          rslt.bhard,
+                                          rslt.btime,
+                                          rslt.fcur,
+                                          rslt.fsoft,
+                                          rslt.fhard,
+                                          rslt.ftime);
+    }
+    else if (noraise)
+    {
+        RETVAL = FsQuota_ErrorObject(self->m_dev_fs_type, &err);
+    }
+    else
+    {
+        FsQuota_RaiseError(self, &err);
+    }
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.query() method
+//
+PyDoc_STRVAR(Quota_query__doc__,
+    "query(uid, *, grpquota=False, projquota=False, noraise=False) -> FsQuota.QueryResult\n\n"
+    "Query quota usage and limits for the given user.\n\n"
+    "When either grpquota or projquota is set to True, the query returns "
+    "group or project quotas instead of user quotas. Only one of these "
+    "options should be True. Project quotas are supported by XFS, and on "
+    "Linux also by other file systems such as ext4; for Btrfs, qgroups of "
+    "subvolumes are queried, using the subvolume ID.\n\n"
+    "When noraise is True, errors are reported by returning an instance of "
+    "FsQuota.error instead of raising it.");
+
+static PyObject *
+Quota_query(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    int     uid = getuid();
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    int     noraise = FALSE;
+
+    static char * kwlist[] = {"uid", "grpquota", "prjquota", "noraise", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|$ppp", kwlist,
+                                     &uid, &is_grpquota, &is_prjquota, &noraise))
+    {
+        return NULL;
+    }
+
+    return Quota_QueryOne(self, uid, is_grpquota, is_prjquota, noraise);
+}
+
+//
+// Implementation of the Quota.query_bulk() method
+//
+PyDoc_STRVAR(Quota_query_bulk__doc__,
+    "query_bulk(uids, *, grpquota=False, projquota=False, noraise=False, filter=None, "
+    "names=False) -> list\n\n"
+    "Query quota usage and limits for each user in the given sequence.\n\n"
+    "Returns a list with one FsQuota.QueryResult per ID. When noraise is "
+    "True, the list contains an instance of FsQuota.error for each failed "
+    "query; else the first error is raised. Options are the same as for "
+    "method query().\n\n"
+    "When a filter is given, the list contains tuples of ID and "
+    "FsQuota.QueryResult only for IDs matching the filter, and failed "
+    "queries are skipped in noraise mode. See method query_all() for the "
+    "filter specification.\n\n"
+    "When names is True, each element is a tuple with the name of the "
+    "user, group or project appended (or None if the ID has no name). "
+    "Names are resolved by background threads while quotas are queried.");
+
+//
+// Helper function for query_bulk(): convert an element of the ID sequence.
+// Returns FALSE with an exception raised if the value is invalid.
+//
+static int
+Quota_BulkGetId(PyObject * seq, Py_ssize_t idx, int * p_uid)
+{
+    int overflow;
+    long uid = PyLong_AsLongAndOverflow(PySequence_Fast_GET_ITEM(seq, idx), &overflow);
+
+    if (overflow || (uid > INT_MAX) || (uid < INT_MIN))
+    {
+        PyErr_SetString(PyExc_OverflowError, "ID is out of range");
+        return FALSE;
+    }
+    if ((uid == -1) && PyErr_Occurred())
+    {
+        return FALSE;
+    }
+    *p_uid = uid;
+    return TRUE;
+}
+
+static PyObject *
+Quota_query_bulk(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_uids = NULL;
+    PyObject * p_filter = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    int     noraise = FALSE;
+    int     with_names = FALSE;
+    T_QFILTER flt;
+
+    static char * kwlist[] = {"uids", "grpquota", "prjquota", "noraise", "filter", "names", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$pppOp", kwlist,
+                                     &p_uids, &is_grpquota, &is_prjquota, &noraise, &p_filter,
+                                     &with_names))
+    {
+        return NULL;
+    }
+    if (!FsQuota_ParseFilter(p_filter, &flt))
+    {
+        return NULL;
+    }
+
+    PyObject * seq = PySequence_Fast(p_uids, "uids must be an iterable of integers");
+    if (seq == NULL)
+    {
+        return NULL;
+    }
+
+    Py_ssize_t cnt = PySequence_Fast_GET_SIZE(seq);
+    PyObject * RETVAL = NULL;
+    int name_kind = (with_names ? FsQuota_NameKind(is_grpquota, is_prjquota) : FSQUOTA_NO_NAMES);
+    T_QNAMES_RESOLVER resolver;
+
+    // names are resolved in the background while quotas are queried below
+    if (with_names && (qnames_resolver_start(&resolver, name_kind, FSQUOTA_NAME_THREADS) != 0))
+    {
+        FsQuota_OsException(errno, "starting name resolver threads", NULL);
+        qnames_resolver_finish(&resolver);
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    if ((p_filter == NULL) || (p_filter == Py_None))
+    {
+        RETVAL = PyList_New(cnt);
+
+        for (Py_ssize_t idx = 0; (RETVAL != NULL) && (idx < cnt); idx++)
+        {
+            PyObject * item = NULL;
+            int uid;
+
+            if (Quota_BulkGetId(seq, idx, &uid))
+            {
+                if (with_names)
+                {
+                    qnames_resolver_add(&resolver, uid);
+                }
+                item = Quota_QueryOne(self, uid, is_grpquota, is_prjquota, noraise);
+            }
+
+            if (item != NULL)
+            {
+                PyList_SET_ITEM(RETVAL, idx, item);
+            }
+            else
+            {
+                Py_CLEAR(RETVAL);
+            }
+        }
+    }
+    else
+    {
+        // results are filtered before conversion into Python objects
+        T_QFILTER_RESULT res;
+        int ok = TRUE;
+
+        qfilter_result_init(&res);
+        for (Py_ssize_t idx = 0; ok && (idx < cnt); idx++)
+        {
+            T_QUOTA_QUERY_RESULT rslt;
+            T_QUOTA_ERROR err;
+            int uid;
+
+            if (!Quota_BulkGetId(seq, idx, &uid))
+            {
+                ok = FALSE;
+                break;
+            }
+            if (with_names)
+            {
+                qnames_resolver_add(&resolver, uid);
+            }
+            if (Quota_QueryAccounted(self, uid, is_grpquota, is_prjquota, &rslt, &err) == 0)
+            {
+                uint64_t val[QFILTER_VAL_COUNT] = { rslt.bcur, rslt.bsoft, rslt.bhard, rslt.btime,
+                                                    rslt.fcur, rslt.fsoft, rslt.fhard, rslt.ftime };
+
+                if (qfilter_add_row(&flt, &res, uid, val) != 0)
+                {
+                    PyErr_NoMemory();
+                    ok = FALSE;
+                }
+            }
+            else if (!noraise)
+            {
+                FsQuota_RaiseError(self, &err);
+                ok = FALSE;
+            }
+        }
+        if (with_names)
+        {
+            Py_BEGIN_ALLOW_THREADS
+            qnames_resolver_finish(&resolver);
+            Py_END_ALLOW_THREADS
+        }
+        if (ok)
+        {
+            qfilter_result_finish(&flt, &res);
+            RETVAL = FsQuota_BuildFilterResult(&res, name_kind);
+        }
+        qfilter_result_free(&res);
+    }
+
+    if (with_names && ((p_filter == NULL) || (p_filter == Py_None)))
+    {
+        Py_BEGIN_ALLOW_THREADS
+        qnames_resolver_finish(&resolver);
+        Py_END_ALLOW_THREADS
+
+        if (RETVAL != NULL)
+        {
+            // append the name to each result
+            for (Py_ssize_t idx = 0; (RETVAL != NULL) && (idx < cnt); idx++)
+            {
+                int uid = 0;
+                Quota_BulkGetId(seq, idx, &uid);  // validated above
+
+                PyObject * item = Py_BuildValue("(ON)", PyList_GET_ITEM(RETVAL, idx),
+                                                FsQuota_BuildName(name_kind, uid));
+                if (item != NULL)
+                {
+                    PyList_SetItem(RETVAL, idx, item);
+                }
+                else
+                {
+                    Py_CLEAR(RETVAL);
+                }
+            }
+        }
+    }
+    Py_DECREF(seq);
+    return RETVAL;
+}
+
+//
+// Helper function for query_path() and query_paths(): determine the user,
+// group or project ID of the given path and query its quota. The path has
+// to be located on the given device, unless NULL. Returns zero upon success,
+// else the errno value; the error is described in the given struct. Upon
+// error, p_has_id indicates if the ID was determined.
+//
+static int
+Quota_QueryPath(Quota_ObjectType *self, const char * path, const dev_t * p_dev,
+                int is_grpquota, int is_prjquota, uint32_t * p_id, int * p_has_id,
+                T_QUOTA_QUERY_RESULT * rslt, T_QUOTA_ERROR * err)
+{
+    unsigned kind = (is_prjquota ? QPATHID_PROJECT : (is_grpquota ? QPATHID_GROUP : QPATHID_USER));
+    int errnum = 0;
+#ifdef BTRFS_QGROUPS
+    // copy, as the Quota object may be re-initialized while the GIL is released
+    int is_subvol = ((self->m_dev_fs_type == QUOTA_DEV_BTRFS) && is_prjquota);
+    char * qcarg = (is_subvol ? strdup(self->m_qcarg) : NULL);
+#endif
+
+    // release the GIL, as stat() may block, e.g. on NFS
+    Py_BEGIN_ALLOW_THREADS
+#ifdef BTRFS_QGROUPS
+    if (is_subvol)
+    {
+        // the qgroup of a path is that of the subvolume containing it
+        uint64_t subvol_id;
+        if (qcarg == NULL)
+            errnum = ENOMEM;
+        else if (qbtrfs_subvol_id(qcarg, path, &subvol_id) != 0)
+            errnum = errno;
+        else if (subvol_id > UINT32_MAX)
+            errnum = EOVERFLOW;
+        else
+            *p_id = subvol_id;
+    }
+    else
+#endif
+    if (qpathid_get(path, kind, p_dev, p_id) != 0)
+    {
+        errnum = errno;
+    }
+    Py_END_ALLOW_THREADS
+#ifdef BTRFS_QGROUPS
+    free(qcarg);
+#endif
+
+    if (errnum != 0)
+    {
+        err->errnum = errnum;
+        err->str = ((errnum == EXDEV) ? "path is not located on the file system of the Quota object"
+                                      : "determining quota ID of path");
+        err->is_os = TRUE;
+        *p_has_id = FALSE;
+        return errnum;
+    }
+    *p_has_id = TRUE;
+    return Quota_QueryAccounted(self, *p_id, is_grpquota, is_prjquota, rslt, err);
+}
+
+//
+// Helper function for query_path() and query_paths(): determine the device
+// of the file system, for checking that paths are located on it. Returns
+// NULL if unknown, in which case the check is skipped.
+//
+static const dev_t *
+Quota_GetPathDevice(Quota_ObjectType *self, dev_t * p_dev)
+{
+    struct stat st;
+
+    if ((self->m_path != NULL) && (stat(self->m_path, &st) == 0))
+    {
+        *p_dev = st.st_dev;
+        return p_dev;
+    }
+    return NULL;
+}
+
+//
+// Helper function for verify_usage() and track_usage(): determine the root
+// directory of the file system containing the given path, by ascending from
+// the canonical path while the device ID stays the same. Returns a malloc'ed
+// path, or NULL with errno set upon error.
+//
+static char *
+FsQuota_GetFsRoot(const char * path)
+{
+    struct stat st;
+    struct stat st_parent;
+    char * root = realpath(path, NULL);
+
+    if ((root != NULL) && (stat(root, &st) != 0))
+    {
+        free(root);
+        root = NULL;
+    }
+    while ((root != NULL) && (root[0] == '/') && (root[1] != 0))
+    {
+        char * sep = strrchr(root, '/');
+        size_t len = ((sep == root) ? 1 : (size_t)(sep - root));
+        char saved = root[len];
+
+        root[len] = 0;
+        if ((stat(root, &st_parent) != 0) || (st_parent.st_dev != st.st_dev))
+        {
+            root[len] = saved;
+            break;
+        }
+    }
+    return root;
+}
+
+//
+// Helper function for verify_usage() and track_usage(): return the path of
+// the tree to walk, which is the root directory of the file system of the
+// Quota object, as usage reported by quota or file system events covers the
+// complete file system. A path given by the caller has to be that root.
+// Returns a malloc'ed path, or NULL after raising an exception.
+//
+static char *
+Quota_GetRootPath(Quota_ObjectType *self, const char * path)
+{
+    const char * base = ((path != NULL) ? path : self->m_path);
+    dev_t dev;
+    const dev_t * p_dev = Quota_GetPathDevice(self, &dev);
+    struct stat st;
+    struct stat st_root;
+    char * root = NULL;
+
+    if (stat(base, &st) != 0)
+    {
+        FsQuota_OsException(errno, "accessing directory", base);
+    }
+    else if ((p_dev != NULL) && (st.st_dev != *p_dev))
+    {
+        FsQuota_OsException(EXDEV, "path is not located on the file system of the Quota object", base);
+    }
+    else if ((root = FsQuota_GetFsRoot(base)) == NULL)
+    {
+        FsQuota_OsException(errno, "determining root of the file system", base);
+    }
+    else if ((path != NULL) &&
+             ((stat(root, &st_root) != 0) || (st_root.st_dev != st.st_dev) || (st_root.st_ino != st.st_ino)))
+    {
+        FsQuota_OsException(EINVAL, "path is not the root of the file system", path);
+        free(root);
+        root = NULL;
+    }
+    return root;
+}
+
+//
+// Helper function for query_path() and query_paths(): build the tuple of ID
+// and result, or ID and error object in "noraise" mode. In the latter case,
+// the ID is None if it could not be determined.
+//
+static PyObject *
+Quota_BuildPathResult(Quota_ObjectType *self, uint32_t id, int has_id,
+                      const T_QUOTA_QUERY_RESULT * rslt, const T_QUOTA_ERROR * err,
+                      const char * path, int noraise)
+{
+    if (err->errnum == 0)
+    {
+        return Py_BuildValue("(kN)", (unsigned long) id,
+                             FsQuota_BuildQuotaResult(rslt->bcur, rslt->bsoft, rslt->bhard, rslt->btime,
+                                                      rslt->fcur, rslt->fsoft, rslt->fhard, rslt->ftime));
+    }
+    if (noraise)
+    {
+        PyObject * p_id;
+
+        if (has_id)
+        {
+            p_id = PyLong_FromUnsignedLong(id);
+        }
+        else
+        {
+            p_id = Py_None;
+            Py_INCREF(p_id);
+        }
+        return Py_BuildValue("(NN)", p_id, FsQuota_ErrorObject(self->m_dev_fs_type, err));
+    }
+    if (!has_id)
+    {
+        return FsQuota_OsException(err->errnum, err->str, path);
+    }
+    return FsQuota_RaiseError(self, err);
+}
+
+//
+// Implementation of the Quota.query_path() method
+//
+PyDoc_STRVAR(Quota_query_path__doc__,
+    "query_path(path, *, grpquota=False, prjquota=False, noraise=False) -> tuple\n\n"
+    "Query quota usage and limits for the owner of the given file or "
+    "directory, or for its group or project respectively. Returns a tuple "
+    "of the ID and FsQuota.QueryResult.\n\n"
+    "For project quotas, the project ID is read via ioctl "
+    "FS_IOC_FSGETXATTR and cached per inode. The path has to be located on "
+    "the file system of the Quota object. Options are the same as for "
+    "method query(); in noraise mode, the error object is returned in "
+    "place of the result, and in place of the ID None if the ID could not "
+    "be determined.");
+
+static PyObject *
+Quota_query_path(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_path = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    int     noraise = FALSE;
+
+    static char * kwlist[] = {"path", "grpquota", "prjquota", "noraise", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|$ppp", kwlist,
+                                     PyUnicode_FSConverter, &p_path,
+                                     &is_grpquota, &is_prjquota, &noraise))
+    {
+        return NULL;
+    }
+
+    const char * path = PyBytes_AS_STRING(p_path);
+    T_QUOTA_QUERY_RESULT rslt;
+    T_QUOTA_ERROR err;
+    uint32_t id = 0;
+    int has_id = FALSE;
+    dev_t dev;
+
+    Quota_QueryPath(self, path, Quota_GetPathDevice(self, &dev), is_grpquota, is_prjquota,
+                    &id, &has_id, &rslt, &err);
+
+    PyObject * RETVAL = Quota_BuildPathResult(self, id, has_id, &rslt, &err, path, noraise);
+    Py_DECREF(p_path);
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.query_paths() method
+//
+PyDoc_STRVAR(Quota_query_paths__doc__,
+    "query_paths(paths, *, grpquota=False, prjquota=False, noraise=False) -> list\n\n"
+    "Query quota usage and limits for each path in the given sequence, as "
+    "done by method query_path(). Returns a list of tuples of ID and "
+    "FsQuota.QueryResult, in the order of the given paths.");
+
+static PyObject *
+Quota_query_paths(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_paths = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    int     noraise = FALSE;
+
+    static char * kwlist[] = {"paths", "grpquota", "prjquota", "noraise", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$ppp", kwlist,
+                                     &p_paths, &is_grpquota, &is_prjquota, &noraise))
+    {
+        return NULL;
+    }
+
+    PyObject * seq = PySequence_Fast(p_paths, "paths must be an iterable of path names");
+    if (seq == NULL)
+    {
+        return NULL;
+    }
+
+    Py_ssize_t cnt = PySequence_Fast_GET_SIZE(seq);
+    PyObject * RETVAL = PyList_New(cnt);
+    dev_t dev;
+    const dev_t * p_dev = Quota_GetPathDevice(self, &dev);
+
+    for (Py_ssize_t idx = 0; (RETVAL != NULL) && (idx < cnt); idx++)
+    {
+        PyObject * p_path = NULL;
+        PyObject * item = NULL;
+
+        if (PyUnicode_FSConverter(PySequence_Fast_GET_ITEM(seq, idx), &p_path))
+        {
+            const char * path = PyBytes_AS_STRING(p_path);
+            T_QUOTA_QUERY_RESULT rslt;
+            T_QUOTA_ERROR err;
+            uint32_t id = 0;
+            int has_id = FALSE;
+
+            Quota_QueryPath(self, path, p_dev, is_grpquota, is_prjquota, &id, &has_id, &rslt, &err);
+            item = Quota_BuildPathResult(self, id, has_id, &rslt, &err, path, noraise);
+            Py_DECREF(p_path);
+        }
+
+        if (item != NULL)
+        {
+            PyList_SET_ITEM(RETVAL, idx, item);
+        }
+        else
+        {
+            Py_CLEAR(RETVAL);
+        }
+    }
+    Py_DECREF(seq);
+    return RETVAL;
+}
+
+// default number of threads for Quota.assign_project()
+#define QUOTA_ASSIGN_DEFAULT_THREADS  8
+
+//
+// Callbacks for the tree walk in Quota.assign_project(), invoked by worker
+// threads without holding the GIL. Entries other than directories and
+// regular files (e.g. symbolic links and devices) are skipped, as their
+// attributes cannot be set via a file descriptor.
+//
+static int
+Quota_AssignDirCb(void * ctx, unsigned worker, int fd, const char * relpath)
+{
+    uint32_t prjid = *(const uint32_t *) ctx;
+
+    return ((qpathid_set_project(fd, prjid, TRUE) == 0) ? 0 : errno);
+}
+
+static int
+Quota_AssignEntryCb(void * ctx, unsigned worker, int dirfd, const char * name, unsigned char d_type)
+{
+    uint32_t prjid = *(const uint32_t *) ctx;
+
+    if (d_type != DT_REG)
+    {
+        return 0;
+    }
+    return ((qpathid_set_project_at(dirfd, name, prjid) == 0) ? 0 : errno);
+}
+
+//
+// Helper function for building the dict of counters of a tree walk
+//
+static PyObject *
+FsQuota_BuildTreeProgress(const T_QTREE_PROGRESS * prog)
+{
+    return Py_BuildValue("{s:K,s:K,s:K,s:K}",
+                         "dirs", (unsigned long long) prog->dirs,
+                         "files", (unsigned long long) prog->entries,
+                         "errors", (unsigned long long) prog->errors,
+                         "skipped", (unsigned long long) prog->skipped);
+}
+
+//
+// Helper function for building the dict of final counters of a tree walk,
+// including the first error as tuple of errno and path, or None
+//
+static PyObject *
+FsQuota_BuildTreeResult(T_QTREE_WALK * walk)
+{
+    T_QTREE_PROGRESS prog;
+    char err_path[PATH_MAX];
+    int err_no = qtree_first_error(walk, err_path, sizeof(err_path));
+
+    qtree_progress(walk, &prog);
+
+    PyObject * RETVAL = FsQuota_BuildTreeProgress(&prog);
+    if (RETVAL != NULL)
+    {
+        PyObject * first_err;
+        if (err_no != 0)
+        {
+            first_err = Py_BuildValue("(iN)", err_no, PyUnicode_DecodeFSDefault(err_path));
+        }
+        else
+        {
+            first_err = Py_None;
+            Py_INCREF(first_err);
+        }
+        if ((first_err == NULL) || (PyDict_SetItemString(RETVAL, "first_error", first_err) != 0))
+        {
+            Py_CLEAR(RETVAL);
+        }
+        Py_XDECREF(first_err);
+    }
+    return RETVAL;
+}
+
+//
+// Helper function for waiting for completion of a tree walk, while invoking
+// the given progress callback once per interval. Upon exceptions raised by
+// the callback or signal handlers, the walk is cancelled. Returns FALSE with
+// an exception raised in this case; in any case the walk is completed.
+//
+static int
+FsQuota_WaitTreeWalk(T_QTREE_WALK * walk, PyObject * progress, double interval)
+{
+    unsigned timeout_ms = ((interval * 1000.0 < 1.0) ? 1 : (unsigned) (interval * 1000.0));
+    int done = FALSE;
+    int ok = TRUE;
+
+    while (!done)
+    {
+        // wait in short steps, so that signals (e.g. Ctrl-C) are handled
+        unsigned waited = 0;
+        while (!done && (waited < timeout_ms) && ok)
+        {
+            unsigned step = ((timeout_ms - waited < 100) ? (timeout_ms - waited) : 100);
+
+            Py_BEGIN_ALLOW_THREADS
+            done = qtree_wait(walk, step);
+            Py_END_ALLOW_THREADS
+
+            waited += step;
+            if (ok && (PyErr_CheckSignals() != 0))
+            {
+                ok = FALSE;
+            }
+        }
+        if (!done && ok && (progress != NULL) && (progress != Py_None))
+        {
+            T_QTREE_PROGRESS prog;
+            qtree_progress(walk, &prog);
+
+            PyObject * arg = FsQuota_BuildTreeProgress(&prog);
+            PyObject * rslt = ((arg != NULL) ? PyObject_CallFunctionObjArgs(progress, arg, NULL) : NULL);
+            Py_XDECREF(arg);
+            if (rslt != NULL)
+            {
+                Py_DECREF(rslt);
+            }
+            else
+            {
+                ok = FALSE;
+            }
+        }
+        if (!ok && !done)
+        {
+            qtree_cancel(walk);
+
+            Py_BEGIN_ALLOW_THREADS
+            while (!qtree_wait(walk, 1000))
+                ;
+            Py_END_ALLOW_THREADS
+            done = TRUE;
+        }
+    }
+    return ok;
+}
+
+//
+// Implementation of the Quota.assign_project() method
+//
+PyDoc_STRVAR(Quota_assign_project__doc__,
+    "assign_project(path, prjid, *, threads=8, progress=None, interval=1.0) -> dict\n\n"
+    "Assign the given project ID to the directory and all files and "
+    "directories below, and set the project inherit flag on directories. "
+    "The tree is walked by the given number of threads. If given, progress "
+    "is called once per interval with a dict of counters. Returns a dict "
+    "with the final counters, the first error (if any) as tuple of errno "
+    "and path, and the result of querying the project quota afterward.");
+
+static PyObject *
+Quota_assign_project(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_path = NULL;
+    unsigned long prjid_arg = 0;
+    unsigned int threads = QUOTA_ASSIGN_DEFAULT_THREADS;
+    PyObject * progress = NULL;
+    double  interval = 1.0;
+
+    static char * kwlist[] = {"path", "prjid", "threads", "progress", "interval", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&k|$IOd", kwlist,
+                                     PyUnicode_FSConverter, &p_path, &prjid_arg,
+                                     &threads, &progress, &interval))
+    {
+        return NULL;
+    }
+
+    PyObject * RETVAL = NULL;
+    const char * path = PyBytes_AS_STRING(p_path);
+    uint32_t prjid = prjid_arg;
+    dev_t dev;
+    const dev_t * p_dev = Quota_GetPathDevice(self, &dev);
+    struct stat st;
+
+    if ((prjid_arg > UINT32_MAX) || (threads < 1) || (threads > QTREE_MAX_THREADS) ||
+        !(interval > 0.0))
+    {
+        PyErr_SetString(PyExc_ValueError, "prjid, threads or interval is out of range");
+    }
+    else if (progress && (progress != Py_None) && !PyCallable_Check(progress))
+    {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+    }
+    else if (self->m_dev_fs_type == QUOTA_DEV_BTRFS)
+    {
+        FsQuota_QuotaCtlException(self, ENOTSUP, "Btrfs qgroups are defined by subvolumes, not by project IDs");
+    }
+    else if (stat(path, &st) != 0)
+    {
+        FsQuota_OsException(errno, "accessing directory", path);
+    }
+    else if ((p_dev != NULL) && (st.st_dev != *p_dev))
+    {
+        FsQuota_OsException(EXDEV, "path is not located on the file system of the Quota object", path);
+    }
+    else
+    {
+        T_QTREE_OPS ops = { Quota_AssignDirCb, Quota_AssignEntryCb, &prjid };
+        T_QTREE_WALK * walk = NULL;
+        int result;
+
+        Py_BEGIN_ALLOW_THREADS
+        result = qtree_start(&walk, path, &ops, threads);
+        Py_END_ALLOW_THREADS
+
+        if (result != 0)
+        {
+            FsQuota_OsException(errno, "accessing directory", path);
+        }
+        else
+        {
+            int ok = FsQuota_WaitTreeWalk(walk, progress, interval);
+            if (ok)
+            {
+                T_QUOTA_QUERY_RESULT rslt;
+                T_QUOTA_ERROR err;
+
+                RETVAL = FsQuota_BuildTreeResult(walk);
+                if (RETVAL != NULL)
+                {
+                    PyObject * qres;
+                    if (Quota_QueryAccounted(self, prjid, FALSE, TRUE, &rslt, &err) == 0)
+                    {
+                        qres = FsQuota_BuildQuotaResult(rslt.bcur, rslt.bsoft, rslt.bhard, rslt.btime,
+                                                        rslt.fcur, rslt.fsoft, rslt.fhard, rslt.ftime);
+                    }
+                    else
+                    {
+                        qres = FsQuota_ErrorObject(self->m_dev_fs_type, &err);
+                    }
+
+                    if (FsQuota_DictSetNew(RETVAL, "result", qres) != 0)
+                    {
+                        Py_CLEAR(RETVAL);
+                    }
+                }
+            }
+
+            Py_BEGIN_ALLOW_THREADS
+            qtree_finish(walk);
+            Py_END_ALLOW_THREADS
+        }
+    }
+    Py_DECREF(p_path);
+    return RETVAL;
+}
+
+// default number of threads for Quota.scan_usage() and FsQuota.scan_tree()
+#define QUOTA_SCAN_DEFAULT_THREADS  8
+
+//
+// Helper function for Quota.scan_usage() and FsQuota.scan_tree(): build
+// the list of tuples of ID and FsQuota.QueryResult for a table of usage
+// per ID, without limits
+//
+static PyObject *
+FsQuota_BuildUsageList(const T_QUSAGE_ENTRY * tab, size_t count)
+{
+    PyObject * RETVAL = PyList_New(count);
+
+    for (size_t idx = 0; (RETVAL != NULL) && (idx < count); idx++)
+    {
+        PyObject * item = Py_BuildValue("(kN)", (unsigned long) tab[idx].id,
+                                        FsQuota_BuildQuotaResult(QX_DIV(tab[idx].blocks), 0, 0, 0,
+                                                                 tab[idx].inodes, 0, 0, 0));
+        if (item != NULL)
+        {
+            PyList_SET_ITEM(RETVAL, idx, item);
+        }
+        else
+        {
+            Py_CLEAR(RETVAL);
+        }
+    }
+    return RETVAL;
+}
+
+//
+// Helper function for adding the lists of usage per user, group and
+// (optionally) project to the given dict
+//
+static int
+FsQuota_DictSetUsage(PyObject * dict, const T_QUSAGE_RESULT * res, int with_projects)
+{
+    if ((FsQuota_DictSetNew(dict, "user", FsQuota_BuildUsageList(res->tab[QUSAGE_USER], res->count[QUSAGE_USER])) != 0) ||
+        (FsQuota_DictSetNew(dict, "group", FsQuota_BuildUsageList(res->tab[QUSAGE_GROUP], res->count[QUSAGE_GROUP])) != 0) ||
+        (with_projects &&
+         (FsQuota_DictSetNew(dict, "project", FsQuota_BuildUsageList(res->tab[QUSAGE_PROJECT], res->count[QUSAGE_PROJECT])) != 0)))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Helper function for FsQuota.scan_tree() and Quota.verify_usage(): walk
+// the tree below the given path for determining usage per ID. Returns a
+// dict with the counters of the walk, and the usage in the given struct,
+// which has to be freed via qusage_free(); or NULL with an exception
+// raised, including exceptions raised by the progress callback.
+//
+static PyObject *
+FsQuota_WalkUsage(const char * path, unsigned threads, int with_projects,
+                  PyObject * progress, double interval, T_QUSAGE_RESULT * res)
+{
+    PyObject * RETVAL = NULL;
+    T_QDU_SCAN * scan = qdu_create(threads, with_projects);
+
+    if (scan == NULL)
+    {
+        return PyErr_NoMemory();
+    }
+
+    T_QTREE_OPS ops;
+    T_QTREE_WALK * walk = NULL;
+    int result;
+
+    qdu_ops(scan, &ops);
+
+    Py_BEGIN_ALLOW_THREADS
+    result = qtree_start(&walk, path, &ops, threads);
+    Py_END_ALLOW_THREADS
+
+    if (result != 0)
+    {
+        FsQuota_OsException(errno, "accessing directory", path);
+    }
+    else
+    {
+        if (FsQuota_WaitTreeWalk(walk, progress, interval))
+        {
+            uint64_t hardlinks;
+
+            if (qdu_result(scan, res, &hardlinks) != 0)
+            {
+                PyErr_NoMemory();
+            }
+            else
+            {
+                RETVAL = FsQuota_BuildTreeResult(walk);
+                if ((RETVAL != NULL) &&
+                    (FsQuota_DictSetNew(RETVAL, "hardlinks", PyLong_FromUnsignedLongLong(hardlinks)) != 0))
+                {
+                    Py_CLEAR(RETVAL);
+                }
+                if (RETVAL == NULL)
+                {
+                    qusage_free(res);
+                }
+            }
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        qtree_finish(walk);
+        Py_END_ALLOW_THREADS
+    }
+    qdu_destroy(scan);
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.scan_usage() method
+//
+PyDoc_STRVAR(Quota_scan_usage__doc__,
+    "scan_usage(*, threads=8) -> dict\n\n"
+    "Determine usage per user, group and project by reading all inodes of "
+    "the file system, independent of quota accounting. Returns a dict with "
+    "keys \"user\", \"group\" and \"project\", each a list of tuples of "
+    "ID and FsQuota.QueryResult in ascending order of IDs, with all limits "
+    "and times zero. Supported for XFS on Linux 5.2 and later, where inodes "
+    "are read via bulkstat by the given number of threads in parallel per "
+    "allocation group. Requires admin privileges.");
+
+static PyObject *
+Quota_scan_usage(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    unsigned int threads = QUOTA_SCAN_DEFAULT_THREADS;
+
+    static char * kwlist[] = {"threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$I", kwlist, &threads))
+    {
+        return NULL;
+    }
+
+    PyObject * RETVAL = NULL;
+
+#ifdef XFS_BULKSTAT
+    if ((threads < 1) || (threads > QBULKSTAT_MAX_THREADS))
+    {
+        PyErr_SetString(PyExc_ValueError, "threads is out of range");
+    }
+    else if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    else if (self->m_dev_fs_type != QUOTA_DEV_XFS)
+    {
+        FsQuota_QuotaCtlException(self, ENOTSUP, "Usage scan is only supported for XFS");
+    }
+    else
+    {
+        // copy, as the Quota object may be re-initialized while the GIL is released
+        char * path = strdup(self->m_path);
+        T_QUSAGE_RESULT res;
+        int errnum = 0;
+
+        Py_BEGIN_ALLOW_THREADS
+        if (path == NULL)
+        {
+            errnum = ENOMEM;
+        }
+        else if (qbulkstat_scan(path, threads, &res) != 0)
+        {
+            errnum = errno;
+        }
+        Py_END_ALLOW_THREADS
+
+        if (errnum != 0)
+        {
+            FsQuota_OsException(errnum, "reading inodes via bulkstat", path);
+        }
+        else
+        {
+            RETVAL = PyDict_New();
+            if ((RETVAL != NULL) && (FsQuota_DictSetUsage(RETVAL, &res, TRUE) != 0))
+            {
+                Py_CLEAR(RETVAL);
+            }
+            qusage_free(&res);
+        }
+        free(path);
+    }
+#else
+    FsQuota_QuotaCtlException(self, ENOTSUP, "Usage scan is not supported on this platform");
+#endif
+    return RETVAL;
+}
+
+// default number of threads for Quota.verify_usage()
+#define QUOTA_VERIFY_DEFAULT_THREADS  8
+
+//
+// Callback for Quota_enum_local() in Quota.verify_usage(): collect all
+// entries, which are enumerated in ascending order of IDs
+//
+typedef struct
+{
+    uint32_t                id;
+    T_QUOTA_QUERY_RESULT    rslt;
+} T_QUOTA_VERIFY_ENTRY;
+
+typedef struct
+{
+    T_QUOTA_VERIFY_ENTRY *  tab;
+    size_t                  count;
+    size_t                  max_count;
+} T_QUOTA_VERIFY_CTX;
+
+static int
+Quota_VerifyAddCb(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt)
+{
+    T_QUOTA_VERIFY_CTX * vctx = (T_QUOTA_VERIFY_CTX *) ctx;
+
+    if (vctx->count >= vctx->max_count)
+    {
+        size_t new_max = ((vctx->max_count != 0) ? (vctx->max_count * 2) : 1024);
+        T_QUOTA_VERIFY_ENTRY * new_tab = realloc(vctx->tab, new_max * sizeof(T_QUOTA_VERIFY_ENTRY));
+        if (new_tab == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        vctx->tab = new_tab;
+        vctx->max_count = new_max;
+    }
+    vctx->tab[vctx->count].id = id;
+    vctx->tab[vctx->count].rslt = *rslt;
+    vctx->count += 1;
+    return 0;
+}
+
+//
+// Helper function for Quota.verify_usage(): compare accounted usage with
+// the scanned usage (both sorted by ID) and build the list of tuples of ID,
+// accounted and scanned result for IDs where the difference exceeds the
+// thresholds. IDs missing on either side count as zero usage.
+//
+static PyObject *
+Quota_BuildDriftList(const T_QUOTA_VERIFY_CTX * acc, const T_QUSAGE_ENTRY * tab, size_t count,
+                     uint64_t bthreshold, uint64_t ithreshold, size_t * p_compared)
+{
+    static const T_QUOTA_QUERY_RESULT zero_rslt;
+    PyObject * RETVAL = PyList_New(0);
+    size_t acc_idx = 0;
+    size_t scan_idx = 0;
+
+    *p_compared = 0;
+    while ((RETVAL != NULL) && ((acc_idx < acc->count) || (scan_idx < count)))
+    {
+        const T_QUOTA_QUERY_RESULT * rslt = &zero_rslt;
+        uint64_t bscan = 0;
+        uint64_t iscan = 0;
+        uint32_t id;
+
+        if ((scan_idx >= count) ||
+            ((acc_idx < acc->count) && (acc->tab[acc_idx].id <= tab[scan_idx].id)))
+        {
+            id = acc->tab[acc_idx].id;
+            rslt = &acc->tab[acc_idx++].rslt;
+        }
+        else
+        {
+            id = tab[scan_idx].id;
+        }
+        if ((scan_idx < count) && (tab[scan_idx].id == id))
+        {
+            bscan = QX_DIV(tab[scan_idx].blocks);
+            iscan = tab[scan_idx++].inodes;
+        }
+        *p_compared += 1;
+
+        uint64_t bdiff = ((rslt->bcur > bscan) ? (rslt->bcur - bscan) : (bscan - rslt->bcur));
+        uint64_t idiff = ((rslt->fcur > iscan) ? (rslt->fcur - iscan) : (iscan - rslt->fcur));
+
+        if ((bdiff > bthreshold) || (idiff > ithreshold))
+        {
+            PyObject * item = Py_BuildValue("(kNN)", (unsigned long) id,
+                                            FsQuota_BuildQuotaResult(rslt->bcur, rslt->bsoft, rslt->bhard, rslt->btime,
+                                                                     rslt->fcur, rslt->fsoft, rslt->fhard, rslt->ftime),
+                                            FsQuota_BuildQuotaResult(bscan, 0, 0, 0, iscan, 0, 0, 0));
+            if ((item == NULL) || (PyList_Append(RETVAL, item) != 0))
+            {
+                Py_CLEAR(RETVAL);
+            }
+            Py_XDECREF(item);
+        }
+    }
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.verify_usage() method
+//
+PyDoc_STRVAR(Quota_verify_usage__doc__,
+    "verify_usage(path=None, *, grpquota=False, prjquota=False, threads=8, "
+    "bthreshold=0, ithreshold=0, progress=None, interval=1.0) -> dict\n\n"
+    "Verify quota accounting while the file system is in use: determine "
+    "actual usage per ID by walking the complete file system from its root "
+    "directory (path, if given, has to be that root) as done by "
+    "FsQuota.scan_tree(), and compare it with usage reported by "
+    "enumerating all quota entries. Returns a dict with the counters of the "
+    "walk, the number of IDs compared, and under key \"drift\" a list of "
+    "tuples of ID, accounted and scanned FsQuota.QueryResult for IDs where "
+    "the difference of block or inode usage exceeds the given threshold.");
+
+static PyObject *
+Quota_verify_usage(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_path = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    unsigned int threads = QUOTA_VERIFY_DEFAULT_THREADS;
+    unsigned long long bthreshold = 0;
+    unsigned long long ithreshold = 0;
+    PyObject * progress = NULL;
+    double  interval = 1.0;
+
+    static char * kwlist[] = {"path", "grpquota", "prjquota", "threads", "bthreshold", "ithreshold",
+                              "progress", "interval", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O&$ppIKKOd", kwlist,
+                                     PyUnicode_FSConverter, &p_path, &is_grpquota, &is_prjquota,
+                                     &threads, &bthreshold, &ithreshold, &progress, &interval))
+    {
+        return NULL;
+    }
+
+    PyObject * RETVAL = NULL;
+    char * path = NULL;
+
+    if ((threads < 1) || (threads > QTREE_MAX_THREADS) || !(interval > 0.0))
+    {
+        PyErr_SetString(PyExc_ValueError, "threads or interval is out of range");
+    }
+    else if (progress && (progress != Py_None) && !PyCallable_Check(progress))
+    {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+    }
+    else if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    else if (qtrace_mode == QTRACE_REPLAY)
+    {
+        FsQuota_QuotaCtlException(self, ENOTSUP, "Enumeration is not supported during trace replay");
+    }
+    else if (self->m_dev_fs_type == QUOTA_DEV_BTRFS)
+    {
+        FsQuota_QuotaCtlException(self, ENOTSUP, "Btrfs qgroups are defined by subvolumes, not by owners");
+    }
+    else if ((path = Quota_GetRootPath(self, ((p_path != NULL) ? PyBytes_AS_STRING(p_path) : NULL))) == NULL)
+    {
+        // exception was raised by the helper
+    }
+    else
+    {
+        // copy, as the Quota object may be re-initialized while the GIL is
+        // released, or by the progress callback
+        T_QUOTA_DEV_FS_TYPE dev_fs_type = self->m_dev_fs_type;
+        char * qcarg = strdup(self->m_qcarg);
+        T_QUSAGE_RESULT res;
+
+        RETVAL = ((qcarg != NULL) ? FsQuota_WalkUsage(path, threads, is_prjquota, progress, interval, &res)
+                                  : PyErr_NoMemory());
+        if (RETVAL != NULL)
+        {
+            T_QUOTA_VERIFY_CTX acc = { NULL, 0, 0 };
+            T_QUOTA_ERROR err;
+            unsigned kind = (is_prjquota ? QUSAGE_PROJECT : (is_grpquota ? QUSAGE_GROUP : QUSAGE_USER));
+
+            // enumerate after the walk, so that the difference only covers
+            // changes during the walk, same as for quotacheck
+            Py_BEGIN_ALLOW_THREADS
+            Quota_enum_local(dev_fs_type, qcarg, is_grpquota, is_prjquota,
+                             Quota_VerifyAddCb, &acc, &err);
+            Py_END_ALLOW_THREADS
+
+            if (err.errnum != 0)
+            {
+                FsQuota_RaiseError(self, &err);
+                Py_CLEAR(RETVAL);
+            }
+            else
+            {
+                size_t compared;
+                PyObject * drift = Quota_BuildDriftList(&acc, res.tab[kind], res.count[kind],
+                                                        bthreshold, ithreshold, &compared);
+                if ((FsQuota_DictSetNew(RETVAL, "drift", drift) != 0) ||
+                    (FsQuota_DictSetNew(RETVAL, "ids", PyLong_FromSize_t(compared)) != 0))
+                {
+                    Py_CLEAR(RETVAL);
+                }
+            }
+            free(acc.tab);
+            qusage_free(&res);
+        }
+        free(qcarg);
+    }
+    free(path);
+    Py_XDECREF(p_path);
+    return RETVAL;
+}
+
+// default number of threads for Quota.top_consumers()
+#define QUOTA_TOP_DEFAULT_THREADS  8
+
+//
+// Helper function for Quota.top_consumers(): build a list of tuples of path,
+// usage in 1 kB units and (optionally) number of inodes
+//
+static PyObject *
+FsQuota_BuildTopList(const T_QTOP_ENTRY * tab, size_t count, int with_inodes)
+{
+    PyObject * RETVAL = PyList_New(count);
+
+    for (size_t idx = 0; (RETVAL != NULL) && (idx < count); idx++)
+    {
+        PyObject * item;
+        if (with_inodes)
+        {
+            item = Py_BuildValue("(NKK)", PyUnicode_DecodeFSDefault(tab[idx].path),
+                                 (unsigned long long) QX_DIV(tab[idx].blocks),
+                                 (unsigned long long) tab[idx].inodes);
+        }
+        else
+        {
+            item = Py_BuildValue("(NK)", PyUnicode_DecodeFSDefault(tab[idx].path),
+                                 (unsigned long long) QX_DIV(tab[idx].blocks));
+        }
+        if (item != NULL)
+        {
+            PyList_SET_ITEM(RETVAL, idx, item);
+        }
+        else
+        {
+            Py_CLEAR(RETVAL);
+        }
+    }
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.top_consumers() method
+//
+PyDoc_STRVAR(Quota_top_consumers__doc__,
+    "top_consumers(id, n=10, *, root=None, grpquota=False, prjquota=False, threads=8, "
+    "progress=None, interval=1.0) -> dict\n\n"
+    "Determine the n largest files and directory sub-trees owned by the "
+    "given user (or group or project ID) below the given root directory "
+    "(default: the path passed to the constructor), by walking the tree "
+    "with the given number of threads. Returns a dict with the counters of "
+    "the walk, \"top_files\" with a list of tuples of path and usage in kB, "
+    "\"top_dirs\" with a list of tuples of path, usage and number of inodes of "
+    "the ID in the sub-tree, both in descending order, the total usage of "
+    "the ID, and the result of querying its quota.");
+
+static PyObject *
+Quota_top_consumers(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    unsigned long id_arg = 0;
+    Py_ssize_t top_n = 10;
+    PyObject * p_root = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    unsigned int threads = QUOTA_TOP_DEFAULT_THREADS;
+    PyObject * progress = NULL;
+    double  interval = 1.0;
+
+    static char * kwlist[] = {"id", "n", "root", "grpquota", "prjquota", "threads",
+                              "progress", "interval", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "k|n$O&ppIOd", kwlist,
+                                     &id_arg, &top_n, PyUnicode_FSConverter, &p_root,
+                                     &is_grpquota, &is_prjquota, &threads, &progress, &interval))
+    {
+        return NULL;
+    }
+
+    PyObject * RETVAL = NULL;
+    const char * root = ((p_root != NULL) ? PyBytes_AS_STRING(p_root) : self->m_path);
+    unsigned kind = (is_prjquota ? QUSAGE_PROJECT : (is_grpquota ? QUSAGE_GROUP : QUSAGE_USER));
+    T_QTOP_SCAN * scan = NULL;
+    dev_t dev;
+    const dev_t * p_dev = Quota_GetPathDevice(self, &dev);
+    struct stat st;
+
+    if ((id_arg > UINT32_MAX) || (top_n < 1) || (top_n > QTOP_MAX_COUNT) ||
+        (threads < 1) || (threads > QTREE_MAX_THREADS) || !(interval > 0.0))
+    {
+        PyErr_SetString(PyExc_ValueError, "id, n, threads or interval is out of range");
+    }
+    else if (progress && (progress != Py_None) && !PyCallable_Check(progress))
+    {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+    }
+    else if ((self->m_dev_fs_type == QUOTA_DEV_BTRFS) && is_prjquota)
+    {
+        FsQuota_QuotaCtlException(self, ENOTSUP, "Btrfs qgroups are defined by subvolumes, not by project IDs");
+    }
+    else if (stat(root, &st) != 0)
+    {
+        FsQuota_OsException(errno, "accessing directory", root);
+    }
+    else if ((p_dev != NULL) && (st.st_dev != *p_dev))
+    {
+        FsQuota_OsException(EXDEV, "path is not located on the file system of the Quota object", root);
+    }
+    else if ((scan = qtop_create(threads, kind, id_arg, top_n)) == NULL)
+    {
+        PyErr_NoMemory();
+    }
+    else
+    {
+        T_QTREE_OPS ops;
+        T_QTREE_WALK * walk = NULL;
+        int result;
+
+        qtop_ops(scan, &ops);
+
+        Py_BEGIN_ALLOW_THREADS
+        result = qtree_start(&walk, root, &ops, threads);
+        Py_END_ALLOW_THREADS
+
+        if (result != 0)
+        {
+            FsQuota_OsException(errno, "accessing directory", root);
+        }
+        else
+        {
+            if (FsQuota_WaitTreeWalk(walk, progress, interval))
+            {
+                T_QTOP_RESULT res;
+
+                if (qtop_result(scan, &res) != 0)
+                {
+                    PyErr_NoMemory();
+                }
+                else
+                {
+                    RETVAL = FsQuota_BuildTreeResult(walk);
+                    if (RETVAL != NULL)
+                    {
+                        T_QUOTA_QUERY_RESULT rslt;
+                        T_QUOTA_ERROR err;
+                        PyObject * qres;
+
+                        if (Quota_QueryAccounted(self, id_arg, is_grpquota, is_prjquota, &rslt, &err) == 0)
+                        {
+                            qres = FsQuota_BuildQuotaResult(rslt.bcur, rslt.bsoft, rslt.bhard, rslt.btime,
+                                                            rslt.fcur, rslt.fsoft, rslt.fhard, rslt.ftime);
+                        }
+                        else
+                        {
+                            qres = FsQuota_ErrorObject(self->m_dev_fs_type, &err);
+                        }
+
+                        if ((FsQuota_DictSetNew(RETVAL, "top_files", FsQuota_BuildTopList(res.files, res.file_count, FALSE)) != 0) ||
+                            (FsQuota_DictSetNew(RETVAL, "top_dirs", FsQuota_BuildTopList(res.dirs, res.dir_count, TRUE)) != 0) ||
+                            (FsQuota_DictSetNew(RETVAL, "bcount", PyLong_FromUnsignedLongLong(QX_DIV(res.blocks))) != 0) ||
+                            (FsQuota_DictSetNew(RETVAL, "icount", PyLong_FromUnsignedLongLong(res.inodes)) != 0) ||
+                            (FsQuota_DictSetNew(RETVAL, "result", qres) != 0))
+                        {
+                            Py_CLEAR(RETVAL);
+                        }
+                    }
+                    qtop_free(&res);
+                }
+            }
+
+            Py_BEGIN_ALLOW_THREADS
+            qtree_finish(walk);
+            Py_END_ALLOW_THREADS
+        }
+        qtop_destroy(scan);
+    }
+    Py_XDECREF(p_root);
+    return RETVAL;
+}
+
+// default number of threads for seeding in Quota.track_usage()
+#define QUOTA_TRACK_DEFAULT_THREADS  8
+
+#ifdef FANOTIFY_TRACKING
+//
+// Helper function for stopping usage tracking of a Quota object, if active
+//
+static void
+Quota_StopTracker(Quota_ObjectType *self)
+{
+    if (self->m_tracker != NULL)
+    {
+        T_QTRACK * trk = self->m_tracker;
+        self->m_tracker = NULL;
+
+        Py_BEGIN_ALLOW_THREADS
+        qtrack_destroy(trk);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+//
+// Helper function for Quota.track_usage(): check if quota accounting of any
+// type is enabled, as enumeration and limits would then still be reported
+// by the kernel, inconsistent with tracked usage
+//
+static int
+Quota_IsAccountingActive(Quota_ObjectType *self)
+{
+    T_QUOTA_QUERY_RESULT rslt;
+    T_QUOTA_ERROR err;
+
+    return ((Quota_QueryDispatch(self, 0, FALSE, FALSE, &rslt, &err) == 0) ||
+            (Quota_QueryDispatch(self, 0, TRUE, FALSE, &rslt, &err) == 0) ||
+            (Quota_QueryDispatch(self, 0, FALSE, TRUE, &rslt, &err) == 0));
+}
+
+//
+// Helper function for Quota.track_stats() and Quota.track_stop(): build a
+// dict with the counters of the tracker
+//
+static PyObject *
+Quota_BuildTrackStats(T_QTRACK * trk)
+{
+    T_QTRACK_STATS stats;
+    PyObject * RETVAL = PyDict_New();
+
+    qtrack_stats(trk, &stats);
+
+    if ((RETVAL != NULL) &&
+        ((FsQuota_DictSetNew(RETVAL, "events", PyLong_FromUnsignedLongLong(stats.events)) != 0) ||
+         (FsQuota_DictSetNew(RETVAL, "updates", PyLong_FromUnsignedLongLong(stats.updates)) != 0) ||
+         (FsQuota_DictSetNew(RETVAL, "errors", PyLong_FromUnsignedLongLong(stats.errors)) != 0) ||
+         (FsQuota_DictSetNew(RETVAL, "inodes", PyLong_FromUnsignedLongLong(stats.inodes)) != 0) ||
+         (FsQuota_DictSetNew(RETVAL, "overflow", PyBool_FromLong(stats.overflow)) != 0)))
+    {
+        Py_CLEAR(RETVAL);
+    }
+    return RETVAL;
+}
+#endif  /* FANOTIFY_TRACKING */
+
+//
+// Implementation of the Quota.track_usage() method
+//
+PyDoc_STRVAR(Quota_track_usage__doc__,
+    "track_usage(path=None, *, prjquota=False, threads=8, progress=None, "
+    "interval=1.0) -> dict\n\n"
+    "Start tracking usage per user, group and (optionally) project ID of the "
+    "file system, for file systems without quota accounting. Usage is "
+    "determined once by walking the complete file system from its root "
+    "directory (path, if given, has to be that root) as done by "
+    "FsQuota.scan_tree(), and then kept up to date by processing fanotify "
+    "events of the file system in a background thread. While tracking is "
+    "active, query(), query_bulk() and query_path() of this object return "
+    "the tracked usage in constant time, with all limits and times zero. "
+    "Fails with EBUSY when quota accounting is enabled. "
+    "Returns a dict with the counters of the walk. Requires Linux 5.9 or "
+    "later and admin privileges.");
+
+static PyObject *
+Quota_track_usage(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_path = NULL;
+    int     is_prjquota = FALSE;
+    unsigned int threads = QUOTA_TRACK_DEFAULT_THREADS;
+    PyObject * progress = NULL;
+    double  interval = 1.0;
+
+    static char * kwlist[] = {"path", "prjquota", "threads", "progress", "interval", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O&$pIOd", kwlist,
+                                     PyUnicode_FSConverter, &p_path, &is_prjquota,
+                                     &threads, &progress, &interval))
+    {
+        return NULL;
+    }
+
+    PyObject * RETVAL = NULL;
+
+#ifdef FANOTIFY_TRACKING
+    char * path = NULL;
+
+    if ((threads < 1) || (threads > QTREE_MAX_THREADS) || !(interval > 0.0))
+    {
+        PyErr_SetString(PyExc_ValueError, "threads or interval is out of range");
+    }
+    else if (progress && (progress != Py_None) && !PyCallable_Check(progress))
+    {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+    }
+    else if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    else if ((self->m_dev_fs_type == QUOTA_DEV_NFS) || (qtrace_mode == QTRACE_REPLAY))
+    {
+        FsQuota_QuotaCtlException(self, ENOTSUP, "Usage tracking is only supported for local file systems");
+    }
+    else if ((self->m_dev_fs_type == QUOTA_DEV_BTRFS) && is_prjquota)
+    {
+        FsQuota_QuotaCtlException(self, ENOTSUP, "Btrfs qgroups are defined by subvolumes, not by project IDs");
+    }
+    else if (self->m_tracker != NULL)
+    {
+        FsQuota_QuotaCtlException(self, EBUSY, "Usage tracking is already active");
+    }
+    else if (Quota_IsAccountingActive(self))
+    {
+        FsQuota_QuotaCtlException(self, EBUSY, "Quota accounting is enabled for this file system");
+    }
+    else if ((path = Quota_GetRootPath(self, ((p_path != NULL) ? PyBytes_AS_STRING(p_path) : NULL))) == NULL)
+    {
+        // exception was raised by the helper
+    }
+    else
+    {
+        T_QTRACK * trk;
+        int errnum = 0;
+
+        // subscribe before the walk, so that no change is missed
+        Py_BEGIN_ALLOW_THREADS
+        trk = qtrack_create(path, threads, is_prjquota);
+        if (trk == NULL)
+        {
+            errnum = errno;
+        }
+        Py_END_ALLOW_THREADS
+
+        if (trk == NULL)
+        {
+            FsQuota_OsException(errnum, "subscribing to file system events", path);
+        }
+        else
+        {
+            T_QTREE_OPS ops;
+            T_QTREE_WALK * walk = NULL;
+            int result;
+
+            qtrack_ops(trk, &ops);
+
+            Py_BEGIN_ALLOW_THREADS
+            result = qtree_start(&walk, path, &ops, threads);
+            Py_END_ALLOW_THREADS
+
+            if (result != 0)
+            {
+                FsQuota_OsException(errno, "accessing directory", path);
+            }
+            else
+            {
+                if (FsQuota_WaitTreeWalk(walk, progress, interval))
+                {
+                    if (qtrack_start(trk) != 0)
+                    {
+                        FsQuota_OsException(errno, "starting event processing", path);
+                    }
+                    else if ((RETVAL = FsQuota_BuildTreeResult(walk)) != NULL)
+                    {
+                        self->m_tracker = trk;
+                        trk = NULL;
+                    }
+                }
+
+                Py_BEGIN_ALLOW_THREADS
+                qtree_finish(walk);
+                Py_END_ALLOW_THREADS
+            }
+
+            if (trk != NULL)
+            {
+                Py_BEGIN_ALLOW_THREADS
+                qtrack_destroy(trk);
+                Py_END_ALLOW_THREADS
+            }
+        }
+    }
+    free(path);
+#else
+    FsQuota_QuotaCtlException(self, ENOTSUP, "Usage tracking is not supported on this platform");
+#endif
+    Py_XDECREF(p_path);
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.track_stats() method
+//
+PyDoc_STRVAR(Quota_track_stats__doc__,
+    "track_stats() -> dict or None\n\n"
+    "Return the counters of usage tracking started via track_usage(): "
+    "number of events read, inodes re-read or removed upon events, events "
+    "that could not be processed, inodes currently tracked, and whether "
+    "events were lost due to overflow of the event queue, in which case "
+    "queries fail until tracking is restarted. Returns None when tracking "
+    "is not active.");
+
+static PyObject *
+Quota_track_stats(Quota_ObjectType *self, PyObject *args)
+{
+#ifdef FANOTIFY_TRACKING
+    if (self->m_tracker != NULL)
+    {
+        return Quota_BuildTrackStats(self->m_tracker);
+    }
+#endif
+    Py_RETURN_NONE;
+}
+
+//
+// Implementation of the Quota.track_stop() method
+//
+PyDoc_STRVAR(Quota_track_stop__doc__,
+    "track_stop() -> dict or None\n\n"
+    "Stop usage tracking started via track_usage(), so that queries again "
+    "use the regular quota interface. Returns the final counters as for "
+    "track_stats(), or None when tracking was not active.");
+
+static PyObject *
+Quota_track_stop(Quota_ObjectType *self, PyObject *args)
+{
+#ifdef FANOTIFY_TRACKING
+    if (self->m_tracker != NULL)
+    {
+        PyObject * RETVAL = Quota_BuildTrackStats(self->m_tracker);
+        Quota_StopTracker(self);
+        return RETVAL;
+    }
+#endif
+    Py_RETURN_NONE;
+}
+
+//
+// Callback for Quota_enum_local() in Quota.query_all()
+//
+typedef struct
+{
+    const T_QFILTER *  flt;
+    T_QFILTER_RESULT * res;
+    T_QNAMES_RESOLVER * resolver;       // NULL if no names are requested
+} T_QUOTA_FILTER_CTX;
+
+static int
+Quota_FilterAddCb(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt)
+{
+    T_QUOTA_FILTER_CTX * fctx = (T_QUOTA_FILTER_CTX *) ctx;
+    uint64_t val[QFILTER_VAL_COUNT] = { rslt->bcur, rslt->bsoft, rslt->bhard, rslt->btime,
+                                        rslt->fcur, rslt->fsoft, rslt->fhard, rslt->ftime };
+
+    size_t prev_count = fctx->res->count;
+
+    if (qfilter_add_row(fctx->flt, fctx->res, id, val) != 0)
+    {
+        return -1;
+    }
+    // names of matching entries are resolved in parallel to the enumeration;
+    // for top-N selection only the final result is resolved
+    if ((fctx->resolver != NULL) && (fctx->flt->top_k == 0) && (fctx->res->count > prev_count))
+    {
+        qnames_resolver_add(fctx->resolver, id);
+    }
+    return 0;
+}
+
+//
+// Implementation of the Quota.query_all() method
+//
+PyDoc_STRVAR(Quota_query_all__doc__,
+    "query_all(*, grpquota=False, prjquota=False, filter=None, names=False) -> list\n\n"
+    "Enumerate all IDs that have a quota entry and return a list of tuples "
+    "of ID and FsQuota.QueryResult, in ascending order of IDs.\n\n"
+    "When a filter is given as dict, only matching entries are returned; "
+    "filtering is done before entries are converted into Python objects. "
+    "Supported keys are: \"min_ratio\" (match if usage is at least the given "
+    "fraction of a limit that is set), \"ratio_of\" (name of the limit used "
+    "by min_ratio: one of \"bsoft\" (default), \"bhard\", \"isoft\", "
+    "\"ihard\"), \"grace_expired\" (match if a grace time has expired), "
+    "\"top\" (return only the given number of entries with largest value, "
+    "in descending order) and \"top_by\" (name of the value used by top; "
+    "default \"bcount\"). All given conditions have to match.\n\n"
+    "Options select group or project quotas as for method query(). "
+    "When names is True, the name of the user, group or project is "
+    "appended to each tuple (or None if the ID has no name). Enumeration "
+    "of quota entries is supported only for local file systems on Linux.");
+
+static PyObject *
+Quota_query_all(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_filter = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    int     with_names = FALSE;
+    T_QFILTER flt;
+
+    static char * kwlist[] = {"grpquota", "prjquota", "filter", "names", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$ppOp", kwlist,
+                                     &is_grpquota, &is_prjquota, &p_filter, &with_names))
+    {
+        return NULL;
+    }
+    if (!FsQuota_ParseFilter(p_filter, &flt))
+    {
+        return NULL;
+    }
+    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        return FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    if (qtrace_mode == QTRACE_REPLAY)
+    {
+        return FsQuota_QuotaCtlException(self, ENOTSUP, "Enumeration is not supported during trace replay");
+    }
+
+    // copy, as the Quota object may be re-initialized while the GIL is released
+    T_QUOTA_DEV_FS_TYPE dev_fs_type = self->m_dev_fs_type;
+    char * qcarg = strdup(self->m_qcarg);
+    if (qcarg == NULL)
+    {
+        return PyErr_NoMemory();
+    }
+
+    PyObject * RETVAL = NULL;
+    T_QFILTER_RESULT res;
+    T_QNAMES_RESOLVER resolver;
+    T_QUOTA_FILTER_CTX fctx = { &flt, &res, (with_names ? &resolver : NULL) };
+    int name_kind = (with_names ? FsQuota_NameKind(is_grpquota, is_prjquota) : FSQUOTA_NO_NAMES);
+    T_QUOTA_ERROR err;
+
+    if (with_names && (qnames_resolver_start(&resolver, name_kind, FSQUOTA_NAME_THREADS) != 0))
+    {
+        FsQuota_OsException(errno, "starting name resolver threads", NULL);
+        qnames_resolver_finish(&resolver);
+        free(qcarg);
+        return NULL;
+    }
+    qfilter_result_init(&res);
+
+    // release the GIL, as enumerating may take a while for large tables
+    Py_BEGIN_ALLOW_THREADS
+    if (Quota_enum_local(dev_fs_type, qcarg, is_grpquota, is_prjquota,
+                         Quota_FilterAddCb, &fctx, &err) == 0)
+    {
+        qfilter_result_finish(&flt, &res);
+    }
+    if (with_names)
+    {
+        if ((err.errnum == 0) && (flt.top_k != 0))
+        {
+            for (size_t idx = 0; idx < res.count; idx++)
+            {
+                qnames_resolver_add(&resolver, res.rows[idx].id);
+            }
+        }
+        qnames_resolver_finish(&resolver);
+    }
+    Py_END_ALLOW_THREADS
+
+    free(qcarg);
+
+    if (err.errnum != 0)
+    {
+        RETVAL = FsQuota_RaiseError(self, &err);
+    }
+    else
+    {
+        RETVAL = FsQuota_BuildFilterResult(&res, name_kind);
+    }
+    qfilter_result_free(&res);
+    return RETVAL;
+}
+
+// limits for options of Quota.iter_all()
+#define QUOTA_ITER_DEFAULT_CHUNK   1024
+#define QUOTA_ITER_DEFAULT_DEPTH   2
+#define QUOTA_ITER_MAX_CHUNK       (1024 * 1024)
+#define QUOTA_ITER_MAX_DEPTH       64
+
+//
+// Implementation of the Quota.iter_all() method
+//
+PyDoc_STRVAR(Quota_iter_all__doc__,
+    "iter_all(*, grpquota=False, prjquota=False, filter=None, chunk_size=1024, "
+    "queue_depth=2) -> FsQuota.QuotaIterator\n\n"
+    "Return an iterator over tuples of ID and FsQuota.QueryResult for all "
+    "IDs that have a quota entry, as returned by method query_all(). "
+    "Entries are fetched by a background thread in chunks of the given "
+    "number of entries, up to the given number of chunks ahead of "
+    "consumption.");
+
+static PyObject *
+Quota_iter_all(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_filter = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    unsigned long chunk_size = QUOTA_ITER_DEFAULT_CHUNK;
+    unsigned int queue_depth = QUOTA_ITER_DEFAULT_DEPTH;
+    T_QFILTER flt;
+
+    static char * kwlist[] = {"grpquota", "prjquota", "filter", "chunk_size", "queue_depth", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$ppOkI", kwlist,
+                                     &is_grpquota, &is_prjquota, &p_filter,
+                                     &chunk_size, &queue_depth))
+    {
+        return NULL;
+    }
+    if ((chunk_size == 0) || (chunk_size > QUOTA_ITER_MAX_CHUNK) ||
+        (queue_depth == 0) || (queue_depth > QUOTA_ITER_MAX_DEPTH))
+    {
+        PyErr_SetString(PyExc_ValueError, "chunk_size or queue_depth is out of range");
+        return NULL;
+    }
+    if (!FsQuota_ParseFilter(p_filter, &flt))
+    {
+        return NULL;
+    }
+    if (flt.top_k != 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "filter key \"top\" is not supported by iter_all()");
+        return NULL;
+    }
+    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        return FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    if (qtrace_mode == QTRACE_REPLAY)
+    {
+        return FsQuota_QuotaCtlException(self, ENOTSUP, "Enumeration is not supported during trace replay");
+    }
+
+    return QuotaIter_Create(self, is_grpquota, is_prjquota, &flt, chunk_size, queue_depth);
+}
+
+//
+// Callback for Quota_enum_local() in Quota.snapshot()
+//
+static int
+Quota_SnapshotAddCb(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt)
+{
+    uint64_t val[QSNAP_VAL_COUNT] = { rslt->bcur, rslt->bsoft, rslt->bhard, rslt->btime,
+                                      rslt->fcur, rslt->fsoft, rslt->fhard, rslt->ftime };
+
+    return qsnap_builder_add((T_QSNAP_BUILDER *) ctx, id, val);
+}
+
+//
+// Implementation of the Quota.snapshot() method
+//
+PyDoc_STRVAR(Quota_snapshot__doc__,
+    "snapshot(path, *, grpquota=False, prjquota=False) -> int\n\n"
+    "Write usage and limits of all IDs that have a quota entry into the "
+    "given file, which then can be opened via FsQuota.Snapshot.open(). "
+    "Returns the number of entries.\n\n"
+    "Options select group or project quotas as for method query(). "
+    "Enumeration of quota entries is supported only for local file "
+    "systems on Linux.");
+
+static PyObject *
+Quota_snapshot(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    char *  p_path = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+
+    static char * kwlist[] = {"path", "grpquota", "prjquota", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|$pp", kwlist,
+                                     &p_path, &is_grpquota, &is_prjquota))
+    {
+        return NULL;
+    }
+
+    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        return FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    if (qtrace_mode == QTRACE_REPLAY)
+    {
+        return FsQuota_QuotaCtlException(self, ENOTSUP, "Snapshots are not supported during trace replay");
+    }
+
+    // copy, as the Quota object may be re-initialized while the GIL is released
+    T_QUOTA_DEV_FS_TYPE dev_fs_type = self->m_dev_fs_type;
+    char * qcarg = strdup(self->m_qcarg);
+    T_QSNAP_BUILDER * bld = ((qcarg != NULL) ? qsnap_builder_create() : NULL);
+    if (bld == NULL)
+    {
+        free(qcarg);
+        return PyErr_NoMemory();
+    }
+
+    PyObject * RETVAL = NULL;
+    T_QUOTA_ERROR err;
+    int write_errnum = 0;
+    const char * write_errstr = NULL;
+    int qtype = QPROBE_QTYPE(is_grpquota, is_prjquota);
+    T_QSNAP_INFO info;
+
+    info.dev = qcarg;
+    info.fstype = ((dev_fs_type == QUOTA_DEV_XFS) ? "xfs" : "vfs");
+    info.qtype = qtype;
+    info.timestamp = time(NULL);
+
+    QPROBE2(snapshot__entry, qtype, qcarg);
+
+    // release the GIL, as enumerating may take a while for large tables
+    Py_BEGIN_ALLOW_THREADS
+    if ((Quota_enum_local(dev_fs_type, qcarg, is_grpquota, is_prjquota,
+                          Quota_SnapshotAddCb, bld, &err) == 0) &&
+        (qsnap_builder_write(bld, p_path, &info, &write_errstr) != 0))
+    {
+        write_errnum = ((errno != 0) ? errno : EIO);
+    }
+    Py_END_ALLOW_THREADS
+
+    unsigned long long count = qsnap_builder_count(bld);
+    qsnap_builder_free(bld);
+
+    if (err.errnum != 0)
+    {
+        RETVAL = FsQuota_RaiseError(self, &err);
+    }
+    else if (write_errnum != 0)
+    {
+        RETVAL = FsQuota_OsException(write_errnum, ((write_errstr != NULL) ? write_errstr
+                                                                           : "writing snapshot"),
+                                     p_path);
+    }
+    else
+    {
+        RETVAL = PyLong_FromUnsignedLongLong(count);
+    }
+
+    QPROBE4(snapshot__return, qtype, qcarg, count,
+            ((err.errnum != 0) ? err.errnum : write_errnum));
+    free(qcarg);
+    return RETVAL;
+}
+
+//
+// Callback for Quota_enum_local() in Quota.summary()
+//
+static int
+Quota_SketchAddCb(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt)
+{
+    uint64_t val[QSKETCH_VAL_COUNT] = { rslt->bcur, rslt->bsoft, rslt->bhard, rslt->btime,
+                                        rslt->fcur, rslt->fsoft, rslt->fhard, rslt->ftime };
+
+    qsketch_add((T_QSKETCH *) ctx, val);
+    return 0;
+}
+
+//
+// Implementation of the Quota.summary() method
+//
+PyDoc_STRVAR(Quota_summary__doc__,
+    "summary(*, grpquota=False, prjquota=False, quantiles=(0.5, 0.9, 0.99), "
+    "ratio_bounds=(0.5, 0.9, 1.0)) -> dict\n\n"
+    "Enumerate all quota entries and return a summary of the distribution "
+    "of block and inode usage: sums, extremes, estimated quantiles and "
+    "histograms of usage relative to limits. Memory use is independent of "
+    "the number of entries.\n\n"
+    "Please refer to the documentation for a description of the content. "
+    "Enumeration has the same requirements as for method snapshot().");
+
+static PyObject *
+Quota_summary(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_quantiles = NULL;
+    PyObject * p_bounds = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+    T_FSQUOTA_SKETCH_OPT opt;
+
+    static char * kwlist[] = {"grpquota", "prjquota", "quantiles", "ratio_bounds", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$ppOO", kwlist,
+                                     &is_grpquota, &is_prjquota, &p_quantiles, &p_bounds))
+    {
+        return NULL;
+    }
+    if (!FsQuota_ParseSketchOpt(p_quantiles, p_bounds, &opt))
+    {
+        return NULL;
+    }
+    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        return FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    if (qtrace_mode == QTRACE_REPLAY)
+    {
+        return FsQuota_QuotaCtlException(self, ENOTSUP, "Enumeration is not supported during trace replay");
+    }
+
+    // copy, as the Quota object may be re-initialized while the GIL is released
+    T_QUOTA_DEV_FS_TYPE dev_fs_type = self->m_dev_fs_type;
+    char * qcarg = strdup(self->m_qcarg);
+    T_QSKETCH * sk = ((qcarg != NULL) ? PyMem_Malloc(sizeof(T_QSKETCH)) : NULL);
+    if (sk == NULL)
+    {
+        free(qcarg);
+        return PyErr_NoMemory();
+    }
+
+    PyObject * RETVAL = NULL;
+    T_QUOTA_ERROR err;
+
+    qsketch_init(sk, opt.bounds, opt.bound_cnt);
+
+    // release the GIL, as enumerating may take a while for large tables
+    Py_BEGIN_ALLOW_THREADS
+    Quota_enum_local(dev_fs_type, qcarg, is_grpquota, is_prjquota,
+                     Quota_SketchAddCb, sk, &err);
+    Py_END_ALLOW_THREADS
+
+    free(qcarg);
+
+    if (err.errnum != 0)
+    {
+        RETVAL = FsQuota_RaiseError(self, &err);
+    }
+    else
+    {
+        RETVAL = FsQuota_BuildSketch(sk, &opt);
+    }
+    PyMem_Free(sk);
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.seqlim() method
+//
+PyDoc_STRVAR(Quota_setqlim__doc__,
+    "setqlim(uid, bsoft, bhard, isoft, ihard, *, grpquota=False, projquota=False)\n\n"
+    "Set the given block and inode quota limits for the given user\n\n"
+    "When either grpquota or projquota is set to True, the query returns "
+    "group or project quotas instead of user quotas. Only one of these "
+    "options should be True. Project quotas are supported by XFS, and on "
+    "Linux also by other file systems such as ext4.\n\n"
+    "Limit parameters may also be specified in form of keyword parameters "
+    "using the names given in the signature above. Omitted values default "
+    "to zero.");
+
+static PyObject *
+Quota_setqlim(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    int     uid = -1;
+    unsigned long long  bs = 0;
+    unsigned long long  bh = 0;
+    unsigned long long  fs = 0;
+    unsigned long long  fh = 0;
+    int     timelimflag = 0;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+
+    static char * kwlist[] = {"uid", "bsoft", "bhard", "isoft", "ihard",
+                              "timereset", "grpquota", "prjquota", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|KKKK$ppp", kwlist,
+                                     &uid, &bs, &bh, &fs, &fh,
+                                     &timelimflag, &is_grpquota, &is_prjquota))
+    {
+        return NULL;
+    }
+
+    PyObject * RETVAL = Py_None;
+    uint64_t t_start = qstat_now();
+    QPROBE3(setqlim__entry, uid, QPROBE_QTYPE(is_grpquota, is_prjquota), self->m_qcarg);
+
+    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    else if (self->m_dev_fs_type == QUOTA_DEV_NFS)
+    {
+        RETVAL = FsQuota_QuotaCtlException(self, ENOTSUP, "Setting quota on NFS-mount is not supported");
+    }
+    else if (is_prjquota && !QUOTA_DEV_HAS_PRJQUOTA(self->m_dev_fs_type))
+    {
+        RETVAL = FsQuota_QuotaCtlException(self, ENOTSUP, "Project quotas are not supported by this file system");
+    }
+    else if (qtrace_mode == QTRACE_REPLAY)
+    {
+        uint64_t val[QTRACE_VAL_COUNT];
+        const char * err_str;
+
+        int errnum = Quota_ReplayCall(self, QTRACE_REC_SETQLIM, uid,
+                                      QPROBE_QTYPE(is_grpquota, is_prjquota), val, &err_str);
+        if (errnum != 0)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errnum, err_str);
+        }
+    }
+    else
+#ifdef BTRFS_QGROUPS
+    if (self->m_dev_fs_type == QUOTA_DEV_BTRFS)
+    {
+        if (!is_prjquota)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, ENOTSUP, "Btrfs only supports qgroups, which are set via option prjquota");
+        }
+        else if ((bs != 0) || (fs != 0) || (fh != 0))
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, ENOTSUP, "Btrfs qgroups only support a hard block limit");
+        }
+        else if (qbtrfs_set_limit(self->m_qcarg, (uint32_t) uid, bh * DEV_QBSIZE) != 0)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+    }
+    else
+#endif  /* BTRFS_QGROUPS */
+#ifdef SGI_XFS
+    if (self->m_dev_fs_type == QUOTA_DEV_XFS)
+    {
+        fs_disk_quota_t xfs_dqblk;
+
+        xfs_dqblk.d_blk_softlimit = QX_MUL(bs);
+        xfs_dqblk.d_blk_hardlimit = QX_MUL(bh);
+        xfs_dqblk.d_btimer        = timelimflag;
+        xfs_dqblk.d_ino_softlimit = fs;
+        xfs_dqblk.d_ino_hardlimit = fh;
+        xfs_dqblk.d_itimer        = timelimflag;
+        xfs_dqblk.d_fieldmask     = FS_DQ_LIMIT_MASK;
+        xfs_dqblk.d_flags         = XFS_USER_QUOTA;
+#ifndef linux
+        int err = quotactl(Q_XSETQLIM, self->m_qcarg, uid, CADR &xfs_dqblk);
+#else
+        int err = quotactl(QCMD(Q_XSETQLIM, (is_prjquota ? XQM_PRJQUOTA : (is_grpquota ? XQM_GRPQUOTA : XQM_USRQUOTA))), self->m_qcarg, uid, CADR &xfs_dqblk);
+#endif
+        if (err)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+    }
+    else
+    // if not xfs, than it's a classic IRIX efs file system
+#endif
+#ifdef SOLARIS_VXFS
+    if (self->m_dev_fs_type == QUOTA_DEV_VXFS)
+    {
+        struct vx_dqblk vxfs_dqb;
+
+        vxfs_dqb.dqb_bsoftlimit = Q_MUL(bs);
+        vxfs_dqb.dqb_bhardlimit = Q_MUL(bh);
+        vxfs_dqb.dqb_btimelimit = timelimflag;
+        vxfs_dqb.dqb_fsoftlimit = fs;
+        vxfs_dqb.dqb_fhardlimit = fh;
+        vxfs_dqb.dqb_ftimelimit = timelimflag;
+        int err = vx_quotactl(VX_SETQUOTA, self->m_qcarg, uid, CADR &vxfs_dqb);
+        if (err)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+    }
+    else
+#endif
+#ifdef AFSQUOTA
+    if (self->m_dev_fs_type == QUOTA_DEV_AFS)
+    {
+        if (!afs_check())  // check is *required* as setup!
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "AFS setup via afc_check failed");
+        }
+        else
+        {
+            int err = afs_setqlim(self->m_qcarg, bh);
+            if (err)
+            {
+                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            }
+        }
+    }
+    else
+#endif
+#if defined(HAVE_JFS2)
+    if (self->m_dev_fs_type == QUOTA_DEV_JFS2)
+    {
+        quota64_t user_quota;
+
+        int err = quotactl(self->m_qcarg, QCMD(Q_J2GETQUOTA, (is_grpquota ? GRPQUOTA : USRQUOTA)),
+                           uid, CADR &user_quota);
+        if (err == 0)
+        {
+            user_quota.bsoft = bs;
+            user_quota.bhard = bh;
+            user_quota.btime = timelimflag;
+            user_quota.isoft = fs;
+            user_quota.ihard = fh;
+            user_quota.itime = timelimflag;
+            err = quotactl(self->m_qcarg, QCMD(Q_J2PUTQUOTA, (is_grpquota ? GRPQUOTA : USRQUOTA)),
+                           uid, CADR &user_quota);
+        }
+        if (err)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+    }
+    else
+#endif /* HAVE_JFS2 */
+    {
+#ifdef NETBSD_LIBQUOTA
+        struct quotahandle *qh;
+        struct quotakey qk;
+        struct quotaval qv;
+
+        qh = quota_open(self->m_qcarg);
+        if (qh != NULL)
+        {
+            qk.qk_idtype = is_grpquota ? QUOTA_IDTYPE_GROUP : QUOTA_IDTYPE_USER;
+            qk.qk_id = uid;
+
+            qk.qk_objtype = QUOTA_OBJTYPE_BLOCKS;
+
+            // set the grace period for blocks
+            if (timelimflag)  // seven days
+            {
+                qv.qv_grace = 7*24*60*60;
+            }
+            else if (quota_get(qh, &qk, &qv) >= 0)  // use user's current setting
+            {
+                // OK
+            }
+            else if (qk.qk_id = QUOTA_DEFAULTID, quota_get(qh, &qk, &qv) >= 0)  // use default setting
+            {
+                // OK, reset qk_id
+                qk.qk_id = uid;
+            }
+            else
+            {
+                qv.qv_grace = 0;
+            }
+
+            qv.qv_usage = 0;
+            qv.qv_hardlimit = Q_MUL(bh);
+            qv.qv_softlimit = Q_MUL(bs);
+            qv.qv_expiretime = 0;
+            if (quota_put(qh, &qk, &qv) >= 0)
+            {
+                qk.qk_objtype = QUOTA_OBJTYPE_FILES;
+
+                // set the grace period for files, see comments above
+                if (timelimflag)
+                {
+                    qv.qv_grace = 7*24*60*60;
+                }
+                else if (quota_get(qh, &qk, &qv) >= 0)
+                {
+                    // OK
+                }
+                else if (qk.qk_id = QUOTA_DEFAULTID, quota_get(qh, &qk, &qv) >= 0)
+                {
+                    // OK, reset qk_id
+                    qk.qk_id = uid;
+                }
+                else
+                {
+                    qv.qv_grace = 0;
+                }
+
+                qv.qv_usage = 0;
+                qv.qv_hardlimit = fh;
+                qv.qv_softlimit = fs;
+                qv.qv_expiretime = 0;
+
+                if (quota_put(qh, &qk, &qv) < 0)
+                {
+                    RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+                }
+            }
+            else
+            {
+                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            }
+            quota_close(qh);
+        }
+        else
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+#else /* not NETBSD_LIBQUOTA */
+        struct dqblk dqblk;
+        memset(&dqblk, 0, sizeof(dqblk));
+        dqblk.QS_BSOFT = Q_MUL(bs);
+        dqblk.QS_BHARD = Q_MUL(bh);
+        dqblk.QS_BTIME = timelimflag;
+        dqblk.QS_FSOFT = fs;
+        dqblk.QS_FHARD = fh;
+        dqblk.QS_FTIME = timelimflag;
+
+        // check for truncation during assignment
+        if ((sizeof(dqblk.QS_BSOFT) < sizeof(uint64_t)) &&
+            ((bs|bh|fs|fh) & 0xFFFFFFFF00000000ULL))
+        {
+            RETVAL = FsQuota_OsException(EINVAL, "Device supports only 32-bit quota", NULL);
+        }
+        else
+        {
+#ifdef USE_IOCTL
+            int fd;
+            if ((fd = open(self->m_qcarg, O_RDONLY)) != -1)
+            {
+                struct quotactl qp;
+                qp.op = Q_SETQLIM;
+                qp.uid = uid;
+                qp.addr = (char *)&dqblk;
+
+                if (ioctl(fd, Q_QUOTACTL, &qp) != 0)
+                {
+                    RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+                }
+                close(fd);
+            }
+            else
+            {
+                RETVAL = FsQuota_OsException(errno, "opening device", self->m_qcarg);
+            }
+#else  /* not USE_IOCTL */
+#ifdef Q_CTL_V3  /* Linux */
+            int err = linuxquota_setqlim (self->m_qcarg, uid, (is_prjquota ? PRJQUOTA : (is_grpquota ? GRPQUOTA : USRQUOTA)), &dqblk);
+#else
+#ifdef Q_CTL_V2
+            int err = quotactl (self->m_qcarg, QCMD(Q_SETQUOTA,(is_grpquota ? GRPQUOTA : USRQUOTA)), uid, CADR &dqblk);
+#else
+            int err = quotactl (Q_SETQLIM, self->m_qcarg, uid, CADR &dqblk);
+#endif /* Q_CTL_V2 */
+#endif /* Q_CTL_V3 */
+            if (err)
+            {
+                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            }
+#endif /* not USE_IOCTL */
+        }
+#endif /* not NETBSD_LIBQUOTA */
+    }
+
+    int errnum = Quota_RecordStats(self, QSTAT_OP_SETQLIM, t_start, RETVAL);
+    QPROBE4(setqlim__return, uid, QPROBE_QTYPE(is_grpquota, is_prjquota), self->m_qcarg, errnum);
+
+    if (qtrace_mode == QTRACE_RECORD)
+    {
+        uint64_t val[QTRACE_VAL_COUNT] = {bs, bh, fs, fh, timelimflag};
+
+        Quota_TraceCall(self, QTRACE_REC_SETQLIM, uid, QPROBE_QTYPE(is_grpquota, is_prjquota),
+                        t_start, errnum, val);
+    }
+    Py_XINCREF(RETVAL);  // reference for Py_None
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.sync() method
+//
+PyDoc_STRVAR(Quota_sync__doc__,
+    "quota()\n\n"
+    "Sync quota changes to disk.");
+
+static PyObject *
+Quota_sync(Quota_ObjectType *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ""))
+    {
+        return NULL;
+    }
+    PyObject * RETVAL = Py_None;
+    uint64_t t_start = qstat_now();
+    QPROBE1(sync__entry, self->m_qcarg);
+
+    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    else if (qtrace_mode == QTRACE_REPLAY)
+    {
+        uint64_t val[QTRACE_VAL_COUNT];
+        const char * err_str;
+
+        int errnum = Quota_ReplayCall(self, QTRACE_REC_SYNC, 0, 0, val, &err_str);
+        if (errnum != 0)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errnum, err_str);
+        }
+    }
+    else
+#ifdef SOLARIS_VXFS
+    if (self->m_dev_fs_type == QUOTA_DEV_VXFS)
+    {
+        if (vx_quotactl(VX_QSYNCALL, self->m_qcarg, 0, NULL) != 0)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+    }
+    else
+#endif
+#ifdef AFSQUOTA
+    if (self->m_dev_fs_type == QUOTA_DEV_AFS)
+    {
+        if (!afs_check())
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "AFS setup via afc_check failed");
+        }
+        else
+        {
+            int foo1, foo2;
+            if (afs_getquota(self->m_qcarg, &foo1, &foo2) != 0)
+            {
+                RETVAL = FsQuota_QuotaCtlException(self, EINVAL, NULL);
+            }
+        }
+    }
+    else
+#endif
+#ifdef NETBSD_LIBQUOTA
+    // NOP / not supported
+#else /* !NETBSD_LIBQUOTA */
+#ifdef USE_IOCTL
+    {
+        struct quotactl qp;
+        int fd;
+
+        qp.op = Q_SYNC;
+
+        if ((fd = open(self->m_qcarg, O_RDONLY)) != -1)
+        {
+            if (ioctl(fd, Q_QUOTACTL, &qp) != 0)
+            {
+                if (errno == ESRCH)
+                {
+                    RETVAL = FsQuota_QuotaCtlException(self, EINVAL, NULL);
+                }
+                else
+                {
+                    RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+                }
+            }
+            close(fd);
+        }
+        else
+        {
+            RETVAL = FsQuota_OsException(errno, "opening device", self->m_qcarg);
+        }
+    }
+#else /* !USE_IOCTL */
+    {
+#ifdef Q_CTL_V3  /* Linux */
+#ifdef BTRFS_QGROUPS
+        if (self->m_dev_fs_type == QUOTA_DEV_BTRFS)
+        {
+            if (qbtrfs_sync(self->m_qcarg) != 0)
+            {
+                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            }
+        }
+        else
+#endif /* BTRFS_QGROUPS */
+#ifdef SGI_XFS
+        if (self->m_dev_fs_type == QUOTA_DEV_XFS)
+        {
+            if (quotactl(QCMD(Q_XQUOTASYNC, XQM_USRQUOTA), self->m_qcarg, 0, NULL) != 0)
+            {
+                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            }
+        }
+        else
+#endif /* SGI_XFS */
+        if (linuxquota_sync(self->m_qcarg, USRQUOTA) != 0)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+#else /* !Q_CTL_V3 */
+#ifdef Q_CTL_V2
+#ifdef AIX
+        struct stat st;
+#endif
+#ifdef AIX
+        if (stat(self->m_qcarg, &st))
+        {
+            RETVAL = FsQuota_OsException(errno, "accessing device", self->m_qcarg);
+        }
+        else
+#endif /* AIX */
+        if (quotactl(self->m_qcarg, QCMD(Q_SYNC, USRQUOTA), 0, NULL) != 0)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+#else /* !Q_CTL_V2 */
+#ifdef SGI_XFS
+#define XFS_UQUOTA (XFS_QUOTA_UDQ_ACCT|XFS_QUOTA_UDQ_ENFD)
+        // Q_SYNC is not supported on XFS filesystems, so emulate it
+        if (self->m_dev_fs_type == QUOTA_DEV_XFS)
+        {
+            fs_quota_stat_t fsq_stat;
+
+            sync();
+
+            if (quotactl(Q_GETQSTAT, self->m_qcarg, 0, CADR &fsq_stat) != 0)
+            {
+                if ((fsq_stat.qs_flags & XFS_UQUOTA) != XFS_UQUOTA)
+                {
+                    RETVAL = FsQuota_QuotaCtlException(self, ENOENT, NULL);
+                }
+                else
+                {
+                    RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+                }
+            }
+        }
+        else
+#endif /* SGI_XFS */
+        if (quotactl(Q_SYNC, self->m_qcarg, 0, NULL) != 0)
+        {
+            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+        }
+#endif /* !Q_CTL_V2 */
+#endif /* !Q_CTL_V3 */
+    }
+#endif /* !USE_IOCTL */
+#endif /* NETBSD_LIBQUOTA */
+
+    int errnum = Quota_RecordStats(self, QSTAT_OP_SYNC, t_start, RETVAL);
+    QPROBE2(sync__return, self->m_qcarg, errnum);
+
+    Quota_TraceCall(self, QTRACE_REC_SYNC, 0, 0, t_start, errnum, NULL);
+    Py_XINCREF(RETVAL);  // reference for Py_None
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.rpc_opt() method
+//
+PyDoc_STRVAR(Quota_rpc_opt__doc__,
+    "rpc_opt(*)\n\n"
+    "Set networking and authentication parameters for RPC\n"
+    "Please refer to the documentation for a list of options.");
+
+static PyObject *
+Quota_rpc_opt(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * RETVAL = Py_None;
+#ifndef NO_RPC
+    static char * kwlist[] = {"rpc_port", "rpc_use_tcp", "rpc_timeout",
+                              "auth_uid", "auth_gid", "auth_hostname", NULL};
+    char * p_hostname = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$IpIiis", kwlist,
+                                     &self->m_rpc_opt.port,
+                                     &self->m_rpc_opt.use_tcp,
+                                     &self->m_rpc_opt.timeout,
+                                     &self->m_rpc_opt.auth_uid,
+                                     &self->m_rpc_opt.auth_gid,
+                                     &p_hostname
+                                    ))
+    {
+        return NULL;
+    }
+
+    if ((self->m_rpc_opt.auth_uid < 0) && (self->m_rpc_opt.auth_gid >= 0))
+    {
+        self->m_rpc_opt.auth_uid = getuid();
+    }
+
+    if ((self->m_rpc_opt.auth_gid < 0) && (self->m_rpc_opt.auth_uid >= 0))
+    {
+        self->m_rpc_opt.auth_gid = getgid();
+    }
+
+    if ((p_hostname != NULL) && (*p_hostname != 0))
+    {
+        if (strlen(p_hostname) < MAX_MACHINE_NAME)
+        {
+            strcpy(self->m_rpc_opt.auth_hostname, p_hostname);
+        }
+        else
+        {
+            RETVAL = FsQuota_OsException(ENAMETOOLONG, "hostname is too long", p_hostname);
+        }
+    }
+    else if (self->m_rpc_opt.auth_uid >= 0)
+    {
+        if (gethostname(self->m_rpc_opt.auth_hostname, MAX_MACHINE_NAME) != 0)
+        {
+            RETVAL = FsQuota_OsException(errno, "gethostname", NULL);
+        }
+    }
+#endif
+
+    Py_XINCREF(RETVAL);  // reference for Py_None
+    return RETVAL;
+}
+
+//
+// Implementation of the Quota.stats() method
+//
+PyDoc_STRVAR(Quota_stats__doc__,
+    "stats(*, reset=False) -> dict\n\n"
+    "Return performance counters of this instance.\n"
+    "Please refer to the documentation for a description of the content. "
+    "When reset is True, counters are set to zero after reading.");
+
+static PyObject *
+Quota_stats(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    int     do_reset = FALSE;
+
+    static char * kwlist[] = {"reset", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$p", kwlist, &do_reset))
+    {
+        return NULL;
+    }
+
+    PyObject * RETVAL = FsQuota_BuildStatsSet(&self->m_stats, (self->m_dev_fs_type == QUOTA_DEV_NFS));
+    if ((RETVAL != NULL) &&
+        (FsQuota_DictSetNew(RETVAL, "mntscan", FsQuota_BuildStatsLat(&self->m_mntscan)) != 0))
+    {
+        Py_CLEAR(RETVAL);
+    }
+    if ((RETVAL != NULL) && do_reset)
+    {
+        qstat_reset_set(&self->m_stats);
+        qstat_reset_lat(&self->m_mntscan);
+    }
+    return RETVAL;
+}
+
+//
+// Allocate a new "Quota" object and initialize the C state struct
+//
+static PyObject *
+Quota_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    Quota_ObjectType *self;
+    self = (Quota_ObjectType *) type->tp_alloc(type, 0);
+
+#ifndef NO_RPC
+    self->m_rpc_opt.timeout = RPC_DEFAULT_TIMEOUT;
+    self->m_rpc_opt.auth_uid = RPC_AUTH_UGID_NON_INIT;
+    self->m_rpc_opt.auth_gid = RPC_AUTH_UGID_NON_INIT;
+#endif
+
+    return (PyObject *) self;
+}
+
+//
+// De-allocate a "Quota" object and internal resources
+//
+static void
+Quota_dealloc(Quota_ObjectType *self)
+{
+#ifdef FANOTIFY_TRACKING
+    Quota_StopTracker(self);
+#endif
+    if (self->m_path != NULL)
+    {
+        free(self->m_path);
+    }
+    if (self->m_qcarg != NULL)
+    {
+        free(self->m_qcarg);
+    }
+    if (self->m_rpc_host != NULL)
+    {
+        free(self->m_rpc_host);
+    }
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+//
+// Implementation of the standard "__init__" function: Usually called after
+// "new"; may be called again to re-initialize the object.
+//
+static int
+Quota_init(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    static char * kwlist[] = {"path", "rpc_host", NULL};
+    char * p_path = NULL;
+    char * p_rpc_host = NULL;
+
+    // reset state in case the module is already initialized
+#ifdef FANOTIFY_TRACKING
+    Quota_StopTracker(self);
+#endif
+    if (self->m_path != NULL)
+    {
+        free(self->m_path);
+        self->m_path = NULL;
+    }
+    if (self->m_qcarg != NULL)
+    {
+        free(self->m_qcarg);
+        self->m_qcarg = NULL;
+    }
+    if (self->m_rpc_host != NULL)
+    {
+        free(self->m_rpc_host);
+        self->m_rpc_host = NULL;
+    }
+    self->m_dev_fs_type = QUOTA_DEV_INVALID;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|s", kwlist,
+                                     &p_path, &p_rpc_host))
+    {
+        return -1;
+    }
+
+    if (p_rpc_host != NULL)
+    {
+#ifndef NO_RPC
+        self->m_rpc_host = strdup(p_rpc_host);
+        self->m_qcarg = strdup(p_path);
+        self->m_path = strdup("n/a");
+        self->m_dev_fs_type = QUOTA_DEV_NFS;
+#else
+        FsQuota_QuotaCtlException(self, ENOTSUP, "RPC not supported for this platform");
+        return -1;
+#endif
+    }
+    else
+    {
+        // dup is needed as the string buffer lives only as long as object passed as parameter
+        self->m_path = strdup(p_path);
+
+        if (Quota_setqcarg(self) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+//
+// Implementation of the standard "repr" function: Returns a "string
+// representation" of the object. Should include all parameters.
+//
+static PyObject *
+Quota_Repr(Quota_ObjectType *self)
+{
+    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        return PyUnicode_FromString("<FsQuota.Quota()>");
+    }
+#ifndef NO_RPC
+    else if (self->m_dev_fs_type == QUOTA_DEV_NFS)
+    {
+        return PyUnicode_FromFormat("<FsQuota.Quota(%s), qcarg=%s:%s, special:NFS, "
+                                    "use_tcp:%d, port:%d, timeout:%d, "
+                                    "auth_uid:%d, auth_gid:%d, auth_hostname:%s>",
+                                    self->m_path, self->m_rpc_host, self->m_qcarg,
+                                    self->m_rpc_opt.port,
+                                    self->m_rpc_opt.use_tcp,
+                                    self->m_rpc_opt.timeout,
+                                    self->m_rpc_opt.auth_uid,
+                                    self->m_rpc_opt.auth_gid,
+                                    self->m_rpc_opt.auth_hostname
+                                    );
+    }
+#endif
+    else
+    {
+        const char * typn;
+        switch (self->m_dev_fs_type)
+        {
+            case QUOTA_DEV_NFS:  typn = "NFS"; break;  // never reached, handled above
+            case QUOTA_DEV_XFS:  typn = "XFS"; break;
+            case QUOTA_DEV_VXFS: typn = "VXFS"; break;
+            case QUOTA_DEV_AFS:  typn = "AFS"; break;
+            case QUOTA_DEV_JFS2: typn = "JFS2"; break;
+            case QUOTA_DEV_BTRFS: typn = "BTRFS"; break;
+            default:             typn = "no"; break;
+        }
+        return PyUnicode_FromFormat("<FsQuota.Quota(%s), qcarg=%s, special:%s>",
+                                    self->m_path, self->m_qcarg, typn);
+    }
+}
+
+//
+// Implementation of the standard "__getattr__" function: This function adds
+// "virtual" attributes "dev" and "is_nfs" on top of the regular attributes
+// returned by the generic handler of this interface.
+//
+static PyObject *
+Quota_GetAttr(Quota_ObjectType *self, PyObject * attr)
+{
+    PyObject * RETVAL = PyObject_GenericGetAttr((PyObject*)self, attr);
+    if (RETVAL == NULL)
+    {
+        if (PyUnicode_Check(attr) == 1)
+        {
+            if (strcmp("dev", PyUnicode_AsUTF8(attr)) == 0)
+            {
+                PyErr_Clear();
+                if (self->m_rpc_host != NULL)
+                    RETVAL = PyUnicode_FromFormat("%s:%s", self->m_rpc_host, self->m_qcarg);
+                else if (self->m_qcarg != NULL)
+                    RETVAL = PyUnicode_FromString(self->m_qcarg);
+            }
+            else if (strcmp("is_nfs", PyUnicode_AsUTF8(attr)) == 0)
+            {
+                PyErr_Clear();
+                RETVAL = PyLong_FromLong(self->m_dev_fs_type == QUOTA_DEV_NFS);
+            }
+        }
+    }
+    return RETVAL;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static PyMethodDef Quota_MethodsDef[] =
+{
+    {"query",     (PyCFunction) Quota_query,     METH_VARARGS | METH_KEYWORDS, Quota_query__doc__ },
+    {"query_bulk", (PyCFunction) Quota_query_bulk, METH_VARARGS | METH_KEYWORDS, Quota_query_bulk__doc__ },
+    {"query_path", (PyCFunction) Quota_query_path, METH_VARARGS | METH_KEYWORDS, Quota_query_path__doc__ },
+    {"query_paths", (PyCFunction) Quota_query_paths, METH_VARARGS | METH_KEYWORDS, Quota_query_paths__doc__ },
+    {"assign_project", (PyCFunction) Quota_assign_project, METH_VARARGS | METH_KEYWORDS, Quota_assign_project__doc__ },
+    {"scan_usage", (PyCFunction) Quota_scan_usage, METH_VARARGS | METH_KEYWORDS, Quota_scan_usage__doc__ },
+    {"verify_usage", (PyCFunction) Quota_verify_usage, METH_VARARGS | METH_KEYWORDS, Quota_verify_usage__doc__ },
+    {"top_consumers", (PyCFunction) Quota_top_consumers, METH_VARARGS | METH_KEYWORDS, Quota_top_consumers__doc__ },
+    {"track_usage", (PyCFunction) Quota_track_usage, METH_VARARGS | METH_KEYWORDS, Quota_track_usage__doc__ },
+    {"track_stats", (PyCFunction) Quota_track_stats, METH_NOARGS,                 Quota_track_stats__doc__ },
+    {"track_stop", (PyCFunction) Quota_track_stop, METH_NOARGS,                  Quota_track_stop__doc__ },
+    {"query_all", (PyCFunction) Quota_query_all, METH_VARARGS | METH_KEYWORDS, Quota_query_all__doc__ },
+    {"iter_all",  (PyCFunction) Quota_iter_all,  METH_VARARGS | METH_KEYWORDS, Quota_iter_all__doc__ },
+    {"snapshot",  (PyCFunction) Quota_snapshot,  METH_VARARGS | METH_KEYWORDS, Quota_snapshot__doc__ },
+    {"summary",   (PyCFunction) Quota_summary,   METH_VARARGS | METH_KEYWORDS, Quota_summary__doc__ },
+    {"setqlim",   (PyCFunction) Quota_setqlim,   METH_VARARGS | METH_KEYWORDS, Quota_setqlim__doc__ },
+    {"sync",      (PyCFunction) Quota_sync,      METH_VARARGS,                 Quota_sync__doc__ },
+    {"rpc_opt",   (PyCFunction) Quota_rpc_opt,   METH_VARARGS | METH_KEYWORDS, Quota_rpc_opt__doc__ },
+    {"stats",     (PyCFunction) Quota_stats,     METH_VARARGS | METH_KEYWORDS, Quota_stats__doc__ },
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject QuotaTypeDef =
+{
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "FsQuota.Quota",
+    .tp_doc = PyDoc_STR("Class providing access to file-system quota"),
+    .tp_basicsize = sizeof(Quota_ObjectType),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_new = Quota_new,
+    .tp_init = (initproc) Quota_init,
+    .tp_dealloc = (destructor) Quota_dealloc,
+    .tp_repr = (PyObject * (*)(PyObject*)) Quota_Repr,
+    .tp_getattro = (PyObject * (*)(PyObject*, PyObject*))Quota_GetAttr,
+    .tp_methods = Quota_MethodsDef,
+    //.tp_members = Quota_Members,
+};
+
+static PyStructSequence_Field QuotaQueryType_Members[] =
+{
+    { "bcount", PyDoc_STR("Number of blocks currently used") },
+    { "bsoft",  PyDoc_STR("Soft limit for block count (or 0 if none)") },
+    { "bhard",  PyDoc_STR("Hard limit for block count (or 0 if none)") },
+    { "btime",  PyDoc_STR("Time when an exceeded soft block limit turns into "
+                          "a hard limit (or n/a when not exceeded)") },
+    { "icount", PyDoc_STR("Number of inodes (i.e. files) currently used") },
+    { "isoft",  PyDoc_STR("Soft limit for inode count (or 0 if none)") },
+    { "ihard",  PyDoc_STR("Hard limit for inode count (or 0 if none)") },
+    { "itime",  PyDoc_STR("Time when an exceeded soft inode limit turns into "
+                          "a hard limit (or n/a when not exceeded)") },
+    { NULL, NULL }
+};
+
+static PyStructSequence_Desc QuotaQuery_Desc =
+{
+    "FsQuota.QueryResult",
+    PyDoc_STR("Named tuple type returned by Quota.query(), containing quota usage and limits"),
+    QuotaQueryType_Members,
+    8
+};
+
+
+// ----------------------------------------------------------------------------
+// Sub-functions for iterating across the mount table
+
+typedef struct
+{
+    const char * fsname;
+    const char * path;
+    const char * fstyp;
+    const char * fsopt;
+} T_MY_MNTENT_BUF;
+
+//
+// Portable setmntent(): This function must be called once at the start of
+// iteration.
+//
+int
+my_setmntent(T_MY_MNTENT_STATE * state)
+{
+    int RETVAL = 0;
+
+#ifndef AIX
+#ifndef NO_MNTENT
+#ifndef NO_OPEN_MNTTAB
+    if (state->mtab != NULL) endmntent(state->mtab);
+    if ((state->mtab = setmntent(MOUNTED, "r")) == NULL)
+#else
+    if (state->mtab != NULL) fclose(state->mtab);
+    if ((state->mtab = fopen (MOUNTED,"r")) == NULL)
+#endif
+        RETVAL = -1;
+    else
+        RETVAL = 0;
+#else /* NO_MNTENT */
+
+    // if (state->mtab != NULL) free(state->mtab);
+    state->mtab_size = getmntinfo(&state->mtab, MNT_NOWAIT);
+    RETVAL = ((state->mtab_size <= 0) ? -1 : 0);
+    state->mntp = state->mtab;
+#endif
+#else /* AIX */
+    int count, space;
+
+    if (state->mtab != NULL)
+    {
+        free(state->mtab);
+    }
+
+    count = mntctl(MCTL_QUERY, sizeof(space), (char *) &space);
+    if (count == 0)
+    {
+        state->mtab = (struct vmount *) malloc(space);
+        if (state->mtab != NULL)
+        {
+            count = mntctl(MCTL_QUERY, space, (char *) state->mtab);
+            if (count > 0)
+            {
+                state->aix_mtab_count = count;
+                state->aix_mtab_idx   = 0;
+                RETVAL = 0;
+            }
+            else  // error, or size changed between calls
+            {
+                if (count == 0) errno = EINTR;
+                RETVAL = -1;
+            }
+        }
+        else
+        {
+            RETVAL = -1;
+        }
+    }
+    else if (count < 0)
+    {
+        RETVAL = -1;
+    }
+    else  // should never happen
+    {
+        errno = ENOENT;
+        RETVAL = -1;
+    }
+#endif
+    return RETVAL;
+}
+
+//
+// Portable getmntent(): This function fills the given buffers with string
+// pointers describing the next mount table entry. Note the strings are
+// located in static memory owned by the function and must not be freed by
+// the caller; they are invalidated upon the next call.
+//
+int
+my_getmntent(T_MY_MNTENT_STATE * state, T_MY_MNTENT_BUF * str_buf)
+{
+    int RETVAL = -1;
+#ifndef AIX
+#ifndef NO_MNTENT
+#ifndef NO_OPEN_MNTTAB
+    struct mntent *mntp;
+    if (state->mtab != NULL)
+    {
+        mntp = getmntent(state->mtab);
+        if (mntp != NULL)
+        {
+            str_buf->fsname = mntp->mnt_fsname;
+            str_buf->path = mntp->mnt_dir;
+            str_buf->fstyp = mntp->mnt_type;
+            str_buf->fsopt = mntp->mnt_opts;
+            RETVAL = 0;
+        }
+    }
+    else
+    {
+        errno = EBADF;
+    }
+
+#else /* NO_OPEN_MNTTAB */
+    struct mnttab mntp;
+    if (state->mtab != NULL)
+    {
+        if (getmntent(state->mtab, &mntp) == 0)
+        {
+            str_buf->fsname = mntp->mnt_special;
+            str_buf->path = mntp->mnt_mountp;
+            str_buf->fstyp = mntp->mnt_ftype;
+            str_buf->fsopt = mntp->mnt_mntopts;
+            RETVAL = 0;
+        }
+    }
+
+#endif /* NO_OPEN_MNTTAB */
+#else /* NO_MNTENT */
+    if ((state->mtab != NULL) && state->mtab_size)
+    {
+        str_buf->fsname = state->mntp->f_mntfromname;
+        str_buf->path = state->mntp->f_mntonname;
+#ifdef OSF_QUOTA
+        char *fstype = getvfsbynumber((int)state->mntp->f_type);
+        if (fstype != (char *) -1)
+        {
+            str_buf->fstyp = fstype;
+        }
+        else
+#endif
+        {
+            str_buf->fstyp = state->mntp->f_fstypename;
+        }
+        snprintf(state->str_mnt_flag, sizeof(state->str_mnt_flag),
+                        "%s%s%s%s%s%s%s",
+                        ((state->mntp->MNTINFO_FLAG_EL & MNT_LOCAL) ? "local" : "non-local"),
+                        ((state->mntp->MNTINFO_FLAG_EL & MNT_RDONLY) ? ",read-only" : ""),
+                        ((state->mntp->MNTINFO_FLAG_EL & MNT_SYNCHRONOUS) ? ",sync" : ""),
+                        ((state->mntp->MNTINFO_FLAG_EL & MNT_NOEXEC) ? ",noexec" : ""),
+                        ((state->mntp->MNTINFO_FLAG_EL & MNT_NOSUID) ? ",nosuid" : ""),
+                        ((state->mntp->MNTINFO_FLAG_EL & MNT_ASYNC) ? ",async" : ""),
+                        ((state->mntp->MNTINFO_FLAG_EL & MNT_QUOTA) ? ",quotas" : ""));
+        state->str_mnt_flag[sizeof(state->str_mnt_flag) - 1] = 0;
+        str_buf->fsopt = state->str_mnt_flag;
+        RETVAL = 0;
+
+        state->mtab_size--;
+        state->mntp++;
+    }
+#endif
+#else /* AIX */
+    struct vmount *vmp;
+    char *cp;
+    int i;
+
+    if ((state->mtab != NULL) && (state->aix_mtab_idx < state->aix_mtab_count))
+    {
+        cp = (char *) state->mtab;
+        for (i=0; i<state->aix_mtab_idx; i++)
+        {
+            vmp = (struct vmount *) cp;
+            cp += vmp->vmt_length;
+        }
+        vmp = (struct vmount *) cp;
+        state->aix_mtab_idx += 1;
+
+        if ((vmp->vmt_gfstype != MNT_NFS) && (vmp->vmt_gfstype != MNT_NFS3))
+        {
+            cp = vmt2dataptr(vmp, VMT_OBJECT);
+            str_buf->fsname = cp;
+        }
+        else
+        {
+            uchar *mp, *cp2;
+            cp = vmt2dataptr(vmp, VMT_HOST);
+            cp2 = vmt2dataptr(vmp, VMT_OBJECT);
+            mp = malloc(strlen(cp) + strlen(cp2) + 2);
+            if (mp != NULL)
+            {
+                strcpy(mp, cp);
+                strcat(mp, ":");
+                strcat(mp, cp2);
+                str_buf->fsname = mp;
+                free(mp);
+            }
+            else
+            {
+                cp = "?";
+                str_buf->fsname = cp;
+            }
+        }
+        cp = vmt2dataptr(vmp, VMT_STUB);
+        str_buf->path = cp;
+
+        switch(vmp->vmt_gfstype)
+        {
+            case MNT_NFS:   cp = "nfs"; break;
+            case MNT_NFS3:  cp = "nfs"; break;
+            case MNT_JFS:   cp = "jfs"; break;
+#if defined(MNT_AIX) && defined(MNT_J2) && (MNT_AIX==MNT_J2)
+            case MNT_J2:    cp = "jfs2"; break;
+#else
+#if defined(MNT_J2)
+            case MNT_J2:    cp = "jfs2"; break;
+#endif
+            case MNT_AIX:   cp = "aix"; break;
+#endif
+            case 4:         cp = "afs"; break;
+            case MNT_CDROM: cp = "cdrom,ignore"; break;
+            default:        cp = "unknown,ignore"; break;
+        }
+        str_buf->fstyp = cp;
+
+        cp = vmt2dataptr(vmp, VMT_ARGS);
+        str_buf->fsopt = cp;
+        RETVAL = 0;
+    }
+#endif  /* AIX */
+    return RETVAL;
+}
+
+//
+// Portable endmntent(): This function end the iteration and frees resources
+// (if needed). This function should be called once for each call to
+// setmntent(). getmntent must not be called afterward.
+//
+void
+my_endmntent(T_MY_MNTENT_STATE * state)
+{
+    if (state->mtab != NULL)
+    {
+#ifndef AIX
+#ifndef NO_MNTENT
+#ifndef NO_OPEN_MNTTAB
+        endmntent(state->mtab);   // returns always 1 in SunOS
+#else
+        fclose (state->mtab);
+#endif
+        // else: if (state->mtab != NULL) free(state->mtab);
+#endif
+#else /* AIX */
+        free(state->mtab);
+#endif
+        state->mtab = NULL;
+    }
+}
+
+// ----------------------------------------------------------------------------
+//   Class "MntTab"
+// ----------------------------------------------------------------------------
+
+//
+// Container for instance state variables
+//
+typedef struct
+{
+    PyObject_HEAD
+    T_MY_MNTENT_STATE mntent;   // transparent state used by my_getmntent()
+    int iterIndex;              // index tracking calls of __next__()
+    T_QTRACE_REPLAY * replayRef;        // reference on the replay trace, or NULL
+    const T_QTRACE_REC * replayRec;     // mount table snapshot in replay mode, or NULL
+} MntTab_ObjectType;
+
+//
+// Write a snapshot of the complete mount table to the trace; afterward
+// iteration is restarted.
+//
+static int
+MntTab_TraceSnapshot(MntTab_ObjectType *self)
+{
+    T_MY_MNTENT_BUF str_buf;
+    T_QTRACE_REC rec;
+    char ** mnt = NULL;
+    size_t mnt_max = 0;
+    size_t cnt = 0;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = QTRACE_REC_MNTTAB;
+    rec.t_start = qstat_now();
+
+    // strings are copied, as they are invalidated by the next call of getmntent
+    while (my_getmntent(&self->mntent, &str_buf) == 0)
+    {
+        if (cnt >= mnt_max)
+        {
+            mnt_max = (mnt_max != 0) ? (mnt_max * 2) : 32;
+            char ** p = (char **) realloc(mnt, sizeof(char *) * 4 * mnt_max);
+            if (p == NULL)
+            {
+                break;
+            }
+            mnt = p;
+        }
+        mnt[cnt * 4 + 0] = (str_buf.fsname != NULL) ? strdup(str_buf.fsname) : NULL;
+        mnt[cnt * 4 + 1] = (str_buf.path != NULL) ? strdup(str_buf.path) : NULL;
+        mnt[cnt * 4 + 2] = (str_buf.fstyp != NULL) ? strdup(str_buf.fstyp) : NULL;
+        mnt[cnt * 4 + 3] = (str_buf.fsopt != NULL) ? strdup(str_buf.fsopt) : NULL;
+        cnt += 1;
+    }
+    rec.duration = qstat_now() - rec.t_start;
+    rec.val[0] = cnt;
+    rec.mnt = (const char * const *) mnt;
+    qtrace_put(&rec);
+
+    for (size_t idx = 0; idx < cnt * 4; idx++)
+    {
+        if (mnt[idx] != NULL)
+            free(mnt[idx]);
+    }
+    if (mnt != NULL)
+    {
+        free(mnt);
+    }
+
+    my_endmntent(&self->mntent);
+    return my_setmntent(&self->mntent);
+}
+
+//
+// Start iteration: in replay mode, the next mount table snapshot is taken
+// from the trace; in recording mode, a snapshot is written to the trace.
+// Returns -1 and sets errno upon error.
+//
+static int
+MntTab_Start(MntTab_ObjectType *self)
+{
+    qtrace_replay_release(self->replayRef);
+    self->replayRef = NULL;
+    self->replayRec = NULL;
+
+    if (qtrace_mode == QTRACE_REPLAY)
+    {
+        const T_QTRACE_REC * rec = qtrace_lookup(QTRACE_REC_MNTTAB, NULL, 0, 0);
+        if (rec == NULL)
+        {
+            errno = QTRACE_ERR_NO_RECORD;
+            return -1;
+        }
+        uint64_t delay_ns = qtrace_delay_ns(rec);
+
+        // the reference keeps the record valid when replay is stopped during iteration
+        self->replayRef = qtrace_replay_hold();
+        self->replayRec = rec;
+
+        Py_BEGIN_ALLOW_THREADS
+        qtrace_sleep(delay_ns);
+        Py_END_ALLOW_THREADS
+        return 0;
+    }
+
+    if (my_setmntent(&self->mntent) != 0)
+    {
+        return -1;
+    }
+    if (qtrace_mode == QTRACE_RECORD)
+    {
+        return MntTab_TraceSnapshot(self);
+    }
+    return 0;
+}
+
+//
+// Allocate a new object and initialize the iteration state.
+// Raise an exception if setmntent reports an error.
+//
+static PyObject *
+MntTab_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    MntTab_ObjectType *self;
+    self = (MntTab_ObjectType *) type->tp_alloc(type, 0);
+
+    if (MntTab_Start(self) != 0)
+    {
+        Py_DECREF(self);
+        return FsQuota_OsException(errno, "setmntent", NULL);
+    }
+    self->iterIndex = 0;
+    return (PyObject *) self;
+}
+
+//
+// De-allocate an object and internal resources
+//
+static void
+MntTab_dealloc(MntTab_ObjectType *self)
+{
+    my_endmntent(&self->mntent);
+    qtrace_replay_release(self->replayRef);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+//
+// Implementation of the standard "__init__" function: Usually called after
+// "new": in this case the function does nothing as initialization is already
+// done within "new"; may be called again to re-initialize the object: if
+// __next__() was called at least once, iteration is re-initialized.
+//
+static int
+MntTab_init(MntTab_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    char *kwlist[] = {NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "", kwlist))
+    {
+        return -1;
+    }
+
+    if (self->iterIndex != 0)
+    {
+        // re-initialize iterator
+        if (MntTab_Start(self) != 0)
+        {
+            FsQuota_OsException(errno, "setmntent", NULL);
+            return -1;
+        }
+        self->iterIndex = 0;
+    }
+
+    return 0;
+}
+
+//
+// Implementation of the standard "repr" function: Returns a "string
+// representation" of the object. Should include all parameters; in this
+// case we can only show the iteration index.
+//
+static PyObject *
+MntTab_Repr(MntTab_ObjectType *self)
+{
+    if (self->iterIndex >= 0)
+    {
+        return PyUnicode_FromFormat("<FsQuota.MntTab iterator at index %d>", self->iterIndex);
+    }
+    else
+    {
+        return PyUnicode_FromFormat("<FsQuota.MntTab iterator at EOL>");
+    }
+}
+
+//
+// Implementation of the standard "__iter__" function: Simply returns a
+// reference to itself, as the object is already set up for iteration.
+//
+static PyObject *
+MntTab_Iter(MntTab_ObjectType *self)
+{
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+//
+// Implementation of the standard "__next__" function: Call C getmntent() and
+// return the resulting strings in form of a tuple, or raise an exception upon
+// end of iteration.
+//
+static PyObject *
+MntTab_IterNext(MntTab_ObjectType *self)
+{
+    T_MY_MNTENT_BUF str_buf;
+    PyObject * RETVAL = NULL;
+    int have_ent = FALSE;
+
+    if (self->iterIndex < 0)
+    {
+        // iteration already done
+    }
+    else if (self->replayRec != NULL)
+    {
+        if ((uint64_t) self->iterIndex < self->replayRec->val[0])
+        {
+            const char * const * mnt = self->replayRec->mnt + self->iterIndex * 4;
+            str_buf.fsname = mnt[0];
+            str_buf.path = mnt[1];
+            str_buf.fstyp = mnt[2];
+            str_buf.fsopt = mnt[3];
+            have_ent = TRUE;
+        }
+    }
+    else
+    {
+        have_ent = (my_getmntent(&self->mntent, &str_buf) == 0);
+    }
+
+    if (have_ent)
+    {
+        RETVAL = PyStructSequence_New(FsQuota_MntTabType);
+        if (str_buf.fsname != NULL)
+            PyStructSequence_SetItem(RETVAL, 0, PyUnicode_DecodeFSDefault(str_buf.fsname));
+        if (str_buf.path != NULL)
+            PyStructSequence_SetItem(RETVAL, 1, PyUnicode_DecodeFSDefault(str_buf.path));
+        if (str_buf.fstyp != NULL)
+            PyStructSequence_SetItem(RETVAL, 2, PyUnicode_DecodeFSDefault(str_buf.fstyp));
+        if (str_buf.fsopt != NULL)
+            PyStructSequence_SetItem(RETVAL, 3, PyUnicode_DecodeFSDefault(str_buf.fsopt));
+
+        self->iterIndex += 1;
+    }
+    else
+    {
+        PyErr_SetNone(PyExc_StopIteration);
+        self->iterIndex = -1;
+    }
+    return RETVAL;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static PyTypeObject MntTabTypeDef =
+{
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "FsQuota.MntTab",
+    .tp_doc = PyDoc_STR("Class providing iterator for the file-system mount table"),
+    .tp_basicsize = sizeof(MntTab_ObjectType),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_new = MntTab_new,
+    .tp_init = (initproc) MntTab_init,
+    .tp_dealloc = (destructor) MntTab_dealloc,
+    .tp_repr = (PyObject * (*)(PyObject*)) MntTab_Repr,
+    .tp_iter = (PyObject * (*)(PyObject*)) MntTab_Iter,
+    .tp_iternext = (PyObject * (*)(PyObject*)) MntTab_IterNext,
+    //.tp_members = MntTab_Members,
+    //.tp_methods = MntTab_MethodsDef,
+};
+
+static PyStructSequence_Field MntEntType_Members[] =
+{
+    { "mnt_fsname", PyDoc_STR("Name of the filesystem (e.g. device name)") },
+    { "mnt_dir",    PyDoc_STR("Filesystem path prefix (aka mount point)") },
+    { "mnt_type",   PyDoc_STR("Mount type (aka file system type)") },
+    { "mnt_opts",   PyDoc_STR("Mount options, separated by colon.") },
+    { NULL, NULL }
+};
+
+static PyStructSequence_Desc MntEntType_Desc =
+{
+    "FsQuota.MntEnt",
+    PyDoc_STR("Mount table entry type, as returned by iterator of class FsQuota.MntTab"),
+    MntEntType_Members,
+    4
+};
+
+// ----------------------------------------------------------------------------
+//
+//  Determine "device" argument for the "Quota" class methods
+//
+//  The mount table is searched for the file system containing the given
+//  path. The device argument and (in case of NFS) the remote host name are
+//  returned in newly allocated strings. Upon error, -1 is returned, errno is
+//  set and a description is returned in p_errstr. Note the function is not
+//  reentrant, as getmntent() uses static buffers on most platforms.
+//
+
+static int
+FsQuota_GetQcArg(const char * path, char ** p_qcarg, char ** p_rpc_host,
+                 T_QUOTA_DEV_FS_TYPE * p_dev_fs_type, const char ** p_errstr)
+{
+    struct stat statbuf_target;  // keep complete struct for comparison b/c type of st_dev varies b/w platforms
+    struct stat statbuf_ent;
+
+    *p_qcarg = NULL;
+    *p_rpc_host = NULL;
+    *p_dev_fs_type = QUOTA_DEV_INVALID;
+
+    // determine device ID at the given path for later comparison with mount points
+    if (stat(path, &statbuf_target) != 0)
+    {
+        *p_errstr = "Failed to access path";
+        return -1;
+    }
+
+    T_MY_MNTENT_STATE l_mntab;
+    memset(&l_mntab, 0, sizeof(l_mntab));
+    if (my_setmntent(&l_mntab) != 0)
+    {
+        *p_errstr = "setmntent";
+        return -1;
+    }
+
+    // loop to search the given path's entry in the mount table
+    T_MY_MNTENT_BUF mntent;
+    while (my_getmntent(&l_mntab, &mntent) == 0)
+    {
+        if ((strcmp(mntent.fstyp, "lofs") == 0) ||
+            (strcmp(mntent.fstyp, "ignore") == 0) ||
+            (strcmp(mntent.fstyp, "proc") == 0) ||
+            (strcmp(mntent.fstyp, "rootfs") == 0) ||
+            (strncmp(mntent.fstyp, "auto", 4) == 0) )
+        {
+            continue;
+        }
+
+        // compare device ID of mount point with that of target path
+        if ((stat(mntent.path, &statbuf_ent) == 0) &&
+            (statbuf_target.st_dev == statbuf_ent.st_dev))
+        {
+            const char * p = NULL;
+
+            // NFS host:/path
+            if ((mntent.fsname[0] != '/') &&
+                ((p = strchr(mntent.fsname, ':')) != NULL) && (p[1] == '/'))
+            {
+#ifndef NO_RPC
+                *p_rpc_host = strdup(mntent.fsname);
+                (*p_rpc_host)[p - mntent.fsname] = 0;
+                *p_qcarg = strdup(p + 1);
+                *p_dev_fs_type = QUOTA_DEV_NFS;
+#endif
+            }
+            // NFS /path@host -> swap to "host:/path"
+            else if ((strncmp(mntent.fstyp, "nfs", 3) == 0) &&
+                     (mntent.fsname[0] == '/') &&
+                     ((p = strchr(mntent.fsname, '@')) != NULL) &&
+                     (strchr(p + 1, '/') == NULL) )
+            {
+#ifndef NO_RPC
+                *p_qcarg = (char*) malloc(strlen(mntent.fsname) + 1 + 1);
+                sprintf(*p_qcarg, "%s:%.*s", p + 1, (int)(p - mntent.fsname), mntent.fsname);
+
+                *p_qcarg = strdup(mntent.fsname);
+                (*p_qcarg)[p - mntent.fsname] = 0;
+                *p_rpc_host = strdup(p + 1);
+                *p_dev_fs_type = QUOTA_DEV_NFS;
+#endif
+            }
+            else  // local device
+            {
+                *p_dev_fs_type = QUOTA_DEV_REGULAR;
+
+                // XFS, VxFS and AFS quotas require separate access methods
+#if defined (SGI_XFS)
+                // (optional for VxFS: later versions use 'normal' quota interface)
+                if (strcmp(mntent.fstyp, "xfs") == 0)
+                    *p_dev_fs_type = QUOTA_DEV_XFS;
+#endif
+#if defined (SOLARIS_VXFS)
+                if (strcmp(mntent.fstyp, "vxfs") == 0)
+                    *p_dev_fs_type = QUOTA_DEV_VXFS;
+#endif
+#ifdef AFSQUOTA
+                if ((strcmp(mntent.fstyp, "afs") == 0) && (strcmp(mntent.fsname, "AFS") == 0))
+                    *p_dev_fs_type = QUOTA_DEV_AFS;
+#endif
+#if defined(HAVE_JFS2)
+                if (strcmp(mntent.fstyp, "jfs2") == 0)
+                    *p_dev_fs_type = QUOTA_DEV_JFS2;
+#endif
+#if defined(BTRFS_QGROUPS)
+                if (strcmp(mntent.fstyp, "btrfs") == 0)
+                    *p_dev_fs_type = QUOTA_DEV_BTRFS;
+#endif
+
+#if defined(USE_IOCTL) || defined(QCARG_MNTPT)
+                // use mount point
+                *p_qcarg = strdup(mntent.path);
+#elif defined(HAVE_JFS2) || defined(AIX) || defined(OSF_QUOTA)
+                // use path of any file in the file system
+                *p_qcarg = strdup(path);
+#elif defined (Q_CTL_V2)
+                // use path of "quotas" file directly under fs root path
+                *p_qcarg = (char *) malloc(strlen(mntent.path) + 7 + 1);
+                strcpy(*p_qcarg, mntent.path);
+                strcat(*p_qcarg, "/quotas");
+#else
+                // use device path
+                // check for special case: Linux mount -o loop
+                if (((p = strstr(mntent.fsopt, "loop=/dev/")) != NULL) &&
+                    ((p == mntent.fsopt) || (*(p - 1) == ',')))
+                {
+                    const char * pe = strchr(p, ',');
+                    if (pe != NULL)
+                    {
+                        *p_qcarg = strdup(p);
+                        (*p_qcarg)[pe - p] = 0;
+                    }
+                    else
+                    {
+                        *p_qcarg = strdup(p);
+                    }
+                }
+                else
+                {
+                    *p_qcarg = strdup(mntent.fsname);
+                }
+#endif
+#if defined(BTRFS_QGROUPS)
+                // Btrfs ioctls are applied to the mount point instead of the device
+                if (*p_dev_fs_type == QUOTA_DEV_BTRFS)
+                {
+                    free(*p_qcarg);
+                    *p_qcarg = strdup(mntent.path);
+                }
+#endif
+            }
+            // getmntent loop done
+            break;
+        }
+    }
+    my_endmntent(&l_mntab);
+
+    if (*p_qcarg == NULL)
+    {
+        *p_errstr = "Mount path not found or device unsupported";
+        *p_dev_fs_type = QUOTA_DEV_INVALID;
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Replacement for the above function in replay mode: the result is taken
+// from the trace. Upon error, the description is copied to the given buffer.
+//
+static int
+Quota_ReplayQcArg(Quota_ObjectType *self, char * err_buf, size_t err_buf_size)
+{
+    const T_QTRACE_REC * rec = qtrace_lookup(QTRACE_REC_RESOLVE, self->m_path, 0, 0);
+    if (rec == NULL)
+    {
+        snprintf(err_buf, err_buf_size, "No matching record in replay trace");
+        errno = QTRACE_ERR_NO_RECORD;
+        return -1;
+    }
+
+    // copy all data, as the record is invalidated if replay is stopped while the GIL is released
+    int errnum = rec->errnum;
+    uint64_t delay_ns = qtrace_delay_ns(rec);
+    if (errnum == 0)
+    {
+        self->m_qcarg = strdup(rec->str2);
+        if (rec->str3 != NULL)
+        {
+            self->m_rpc_host = strdup(rec->str3);
+        }
+        self->m_dev_fs_type = (T_QUOTA_DEV_FS_TYPE) rec->val[0];
+    }
+    else
+    {
+        snprintf(err_buf, err_buf_size, "%s", ((rec->str2 != NULL) ? rec->str2 : "Error"));
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    qtrace_sleep(delay_ns);
+    Py_END_ALLOW_THREADS
+
+    errno = errnum;
+    return ((errnum != 0) ? -1 : 0);
+}
+
+//
+// Wrapper for the above functions, which stores the result in the object
+// state, or raises an exception.
+//
+static int
+Quota_setqcarg(Quota_ObjectType *self)
+{
+    const char * err_str = NULL;
+    char err_buf[128];
+    int err;
+    uint64_t t_start = qstat_now();
+    QPROBE1(setqcarg__entry, self->m_path);
+
+    if (qtrace_mode == QTRACE_REPLAY)
+    {
+        err = Quota_ReplayQcArg(self, err_buf, sizeof(err_buf));
+        err_str = err_buf;
+    }
+    else
+    {
+        err = FsQuota_GetQcArg(self->m_path, &self->m_qcarg, &self->m_rpc_host,
+                               &self->m_dev_fs_type, &err_str);
+    }
+    int errnum = (err ? errno : 0);
+    uint64_t t_end = qstat_now();
+    QPROBE3(setqcarg__return, self->m_path, self->m_qcarg, errnum);
+
+    qstat_record(&self->m_mntscan, t_start, t_end, errnum);
+    qstat_record(&qstat_mntscan, t_start, t_end, errnum);
+
+    if (qtrace_mode == QTRACE_RECORD)
+    {
+        T_QTRACE_REC rec;
+
+        memset(&rec, 0, sizeof(rec));
+        rec.type = QTRACE_REC_RESOLVE;
+        rec.errnum = errnum;
+        rec.t_start = t_start;
+        rec.duration = t_end - t_start;
+        rec.str = self->m_path;
+        rec.str2 = (err ? err_str : self->m_qcarg);
+        rec.str3 = self->m_rpc_host;
+        rec.val[0] = self->m_dev_fs_type;
+        qtrace_put(&rec);
+    }
+
+    if (err)
+    {
+        FsQuota_OsException(errnum, err_str, self->m_path);
+        return -1;
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+//   Class "QuotaIterator"
+// ----------------------------------------------------------------------------
+
+//
+// Container for instance state variables
+//
+typedef struct
+{
+    PyObject_HEAD
+    Quota_ObjectType * m_quota;         // file system being enumerated
+    T_QUOTA_DEV_FS_TYPE m_dev_fs_type;  // copied from the Quota object, as it
+    char * m_qcarg;                     // may be re-initialized meanwhile
+    int m_is_grpquota;
+    int m_is_prjquota;
+    T_QFILTER m_filter;
+    size_t m_chunk_size;
+    T_QPREFETCH_QUEUE m_queue;
+    T_QPREFETCH_CHUNK * m_fill;         // chunk being filled by the producer
+    T_QUOTA_ERROR m_err;                // result of enumeration by the producer
+    pthread_t m_thread;
+    int m_thread_valid;                 // TRUE until the producer thread is joined
+    T_QPREFETCH_CHUNK * m_chunk;        // chunk being consumed
+    size_t m_pos;                       // index of the next row in m_chunk
+    int m_busy;                         // TRUE while __next__ waits without holding the GIL
+} QuotaIter_ObjectType;
+
+//
+// Callback for Quota_enum_local() in the producer thread
+//
+static int
+QuotaIter_AddCb(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt)
+{
+    QuotaIter_ObjectType * self = (QuotaIter_ObjectType *) ctx;
+    uint64_t val[QPREFETCH_VAL_COUNT] = { rslt->bcur, rslt->bsoft, rslt->bhard, rslt->btime,
+                                          rslt->fcur, rslt->fsoft, rslt->fhard, rslt->ftime };
+
+    // checked here, as a selective filter may skip all remaining entries
+    if (qprefetch_cancelled(&self->m_queue))
+    {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (!qfilter_match(&self->m_filter, val))
+    {
+        return 0;
+    }
+    if ((self->m_fill == NULL) &&
+        ((self->m_fill = qprefetch_chunk_alloc(self->m_chunk_size)) == NULL))
+    {
+        return -1;
+    }
+
+    T_QPREFETCH_ROW * row = &self->m_fill->rows[self->m_fill->count++];
+    row->id = id;
+    memcpy(row->val, val, sizeof(row->val));
+
+    if (self->m_fill->count >= self->m_chunk_size)
+    {
+        if (qprefetch_push(&self->m_queue, self->m_fill) != 0)
+        {
+            return -1;
+        }
+        self->m_fill = NULL;
+    }
+    return 0;
+}
+
+//
+// Main function of the producer thread, which does not access the Python
+// interpreter state
+//
+static void *
+QuotaIter_Thread(void * arg)
+{
+    QuotaIter_ObjectType * self = (QuotaIter_ObjectType *) arg;
+
+    self->m_filter.now = time(NULL);
+    Quota_enum_local(self->m_dev_fs_type, self->m_qcarg, self->m_is_grpquota, self->m_is_prjquota,
+                     QuotaIter_AddCb, self, &self->m_err);
+
+    // rows collected before an error are still passed on
+    if ((self->m_fill != NULL) && (qprefetch_push(&self->m_queue, self->m_fill) == 0))
+    {
+        self->m_fill = NULL;
+    }
+    qprefetch_finish(&self->m_queue);
+    return NULL;
+}
+
+//
+// Terminate the producer thread, if still running, and release buffers
+//
+static void
+QuotaIter_Stop(QuotaIter_ObjectType * self)
+{
+    if (self->m_thread_valid)
+    {
+        qprefetch_cancel(&self->m_queue);
+
+        Py_BEGIN_ALLOW_THREADS
+        pthread_join(self->m_thread, NULL);
+        Py_END_ALLOW_THREADS
+
+        self->m_thread_valid = FALSE;
+    }
+    qprefetch_destroy(&self->m_queue);
+    free(self->m_fill);
+    self->m_fill = NULL;
+    free(self->m_chunk);
+    self->m_chunk = NULL;
+    self->m_pos = 0;
+}
+
+//
+// Implementation of iteration: return the next row of the current chunk,
+// else wait for the next chunk from the producer without holding the GIL
+//
+static PyObject *
+QuotaIter_Next(QuotaIter_ObjectType * self)
+{
+    // other threads may use the object while the GIL is released below,
+    // which is refused the same way as for generators
+    if (self->m_busy)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "FsQuota.QuotaIterator is already executing");
+        return NULL;
+    }
+    if ((self->m_chunk == NULL) || (self->m_pos >= self->m_chunk->count))
+    {
+        T_QPREFETCH_CHUNK * chunk = NULL;
+
+        free(self->m_chunk);
+        self->m_chunk = NULL;
+
+        if (!self->m_thread_valid)
+        {
+            return NULL;  // StopIteration
+        }
+
+        self->m_busy = TRUE;
+        Py_BEGIN_ALLOW_THREADS
+        chunk = qprefetch_pop(&self->m_queue);
+        if (chunk == NULL)
+        {
+            // producer finished: join the thread before reporting its result
+            pthread_join(self->m_thread, NULL);
+        }
+        Py_END_ALLOW_THREADS
+        self->m_busy = FALSE;
+
+        if (chunk == NULL)
+        {
+            self->m_thread_valid = FALSE;
+
+            if (self->m_err.errnum != 0)
+            {
+                return FsQuota_RaiseError(self->m_quota, &self->m_err);
+            }
+            return NULL;  // StopIteration
+        }
+        self->m_chunk = chunk;
+        self->m_pos = 0;
+    }
+
+    const T_QPREFETCH_ROW * row = &self->m_chunk->rows[self->m_pos++];
+    return Py_BuildValue("(kN)", (unsigned long) row->id,
+                         FsQuota_BuildQuotaResult(row->val[0], row->val[1], row->val[2], row->val[3],
+                                                  row->val[4], row->val[5], row->val[6], row->val[7]));
+}
+
+//
+// Implementation of the QuotaIterator.close() method
+//
+PyDoc_STRVAR(QuotaIter_close__doc__,
+    "close()\n\n"
+    "Stop enumeration and release buffers. This is done implicitly upon "
+    "deletion of the object.");
+
+static PyObject *
+QuotaIter_close(QuotaIter_ObjectType *self, PyObject *args)
+{
+    if (self->m_busy)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "FsQuota.QuotaIterator cannot be closed while executing");
+        return NULL;
+    }
+    QuotaIter_Stop(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+QuotaIter_enter(QuotaIter_ObjectType *self, PyObject *args)
+{
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject *
+QuotaIter_exit(QuotaIter_ObjectType *self, PyObject *args)
+{
+    return QuotaIter_close(self, NULL);
+}
+
+//
+// De-allocate an object and all members
+//
+static void
+QuotaIter_dealloc(QuotaIter_ObjectType *self)
+{
+    QuotaIter_Stop(self);
+    free(self->m_qcarg);
+    Py_XDECREF(self->m_quota);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static PyMethodDef QuotaIter_MethodsDef[] =
+{
+    {"close",     (PyCFunction) QuotaIter_close, METH_NOARGS,               QuotaIter_close__doc__ },
+    {"__enter__", (PyCFunction) QuotaIter_enter, METH_NOARGS,               NULL },
+    {"__exit__",  (PyCFunction) QuotaIter_exit,  METH_VARARGS,              NULL },
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject QuotaIterTypeDef =
+{
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "FsQuota.QuotaIterator",
+    .tp_doc = PyDoc_STR("Iterator over quota entries returned by Quota.iter_all(), "
+                        "prefetching entries in a background thread"),
+    .tp_basicsize = sizeof(QuotaIter_ObjectType),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) QuotaIter_dealloc,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) QuotaIter_Next,
+    .tp_methods = QuotaIter_MethodsDef,
+};
+
+//
+// Create an iterator for Quota.iter_all() and start its producer thread
+//
+static PyObject *
+QuotaIter_Create(Quota_ObjectType * quota, int is_grpquota, int is_prjquota,
+                 const T_QFILTER * flt, size_t chunk_size, unsigned queue_depth)
+{
+    QuotaIter_ObjectType * iter = PyObject_New(QuotaIter_ObjectType, &QuotaIterTypeDef);
+    if (iter == NULL)
+    {
+        return NULL;
+    }
+    memset((char *) iter + sizeof(PyObject), 0, sizeof(QuotaIter_ObjectType) - sizeof(PyObject));
+
+    Py_INCREF(quota);
+    iter->m_quota = quota;
+    iter->m_dev_fs_type = quota->m_dev_fs_type;
+    iter->m_is_grpquota = is_grpquota;
+    iter->m_is_prjquota = is_prjquota;
+    iter->m_filter = *flt;
+    iter->m_chunk_size = chunk_size;
+    iter->m_qcarg = strdup(quota->m_qcarg);
+
+    if ((iter->m_qcarg == NULL) || (qprefetch_init(&iter->m_queue, queue_depth) != 0))
+    {
+        Py_DECREF(iter);
+        return PyErr_NoMemory();
+    }
+
+    int err = pthread_create(&iter->m_thread, NULL, QuotaIter_Thread, iter);
+    if (err != 0)
+    {
+        Py_DECREF(iter);
+        return FsQuota_OsException(err, "starting enumeration thread", NULL);
+    }
+    iter->m_thread_valid = TRUE;
+
+    return (PyObject *) iter;
+}
+
+// ----------------------------------------------------------------------------
+//   Class "Snapshot"
+// ----------------------------------------------------------------------------
+
+//
+// Container for instance state variables
+//
+typedef struct
+{
+    PyObject_HEAD
+    char * m_path;                      // path of the snapshot file
+    T_QSNAP_MAP m_map;                  // file mapping; member base is NULL when closed
+    Py_ssize_t m_exports;               // number of buffers exported via buffer protocol
+} Snapshot_ObjectType;
+
+//
+// Names of the columns as used by method column(), and their element type in
+// the notation of the struct module
+//
+static const struct
+{
+    const char * name;
+    const char * format;
+} Snapshot_Columns[QSNAP_COL_COUNT] =
+{
+    { "id",     "I" },
+    { "bcount", "Q" },
+    { "bsoft",  "Q" },
+    { "bhard",  "Q" },
+    { "btime",  "q" },
+    { "icount", "Q" },
+    { "isoft",  "Q" },
+    { "ihard",  "Q" },
+    { "itime",  "q" },
+};
+
+//
+// Helper function for raising an exception when accessing a closed snapshot.
+// Returns TRUE if the snapshot is open.
+//
+static int
+Snapshot_CheckOpen(Snapshot_ObjectType *self)
+{
+    if (self->m_map.base == NULL)
+    {
+        PyErr_SetString(PyExc_ValueError, "Operation on closed FsQuota.Snapshot");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//
+// Implementation of the Snapshot.open() class method
+//
+PyDoc_STRVAR(Snapshot_open__doc__,
+    "open(path) -> FsQuota.Snapshot\n\n"
+    "Map the given snapshot file, as written via method Quota.snapshot(), "
+    "read-only into memory.");
+
+static PyObject *
+Snapshot_open(PyObject *cls, PyObject *args)
+{
+    PyObject * p_path = NULL;
+
+    if (!PyArg_ParseTuple(args, "O", &p_path))
+    {
+        return NULL;
+    }
+    return PyObject_CallFunctionObjArgs(cls, p_path, NULL);
+}
+
+//
+// Implementation of the Snapshot.lookup() method
+//
+PyDoc_STRVAR(Snapshot_lookup__doc__,
+    "lookup(id) -> FsQuota.QueryResult or None\n\n"
+    "Return quota usage and limits of the given ID in the same format as "
+    "Quota.query(), or None if the snapshot contains no entry for the ID.");
+
+static PyObject *
+Snapshot_lookup(Snapshot_ObjectType *self, PyObject *args)
+{
+    unsigned int id;
+
+    if (!PyArg_ParseTuple(args, "I", &id))
+    {
+        return NULL;
+    }
+    if (!Snapshot_CheckOpen(self))
+    {
+        return NULL;
+    }
+
+    PyObject * RETVAL = Py_None;
+    int64_t row = qsnap_lookup(&self->m_map, id);
+    if (row >= 0)
+    {
+        uint64_t val[QSNAP_VAL_COUNT];
+
+        qsnap_get_row(&self->m_map, row, val);
+        RETVAL = FsQuota_BuildQuotaResult(val[0], val[1], val[2], val[3],
+                                          val[4], val[5], val[6], val[7]);
+    }
+    else
+    {
+        Py_INCREF(RETVAL);  // reference for Py_None
+    }
+    return RETVAL;
+}
+
+//
+// Implementation of the Snapshot.column() method: the result is a slice of
+// a memoryview on the complete mapping, cast to the element type, so that
+// the data is not copied and the snapshot stays referenced by the view.
+//
+PyDoc_STRVAR(Snapshot_column__doc__,
+    "column(name) -> memoryview\n\n"
+    "Return a read-only view on the given column, which is one of "
+    "\"id\" or the names of the elements of FsQuota.QueryResult. "
+    "Rows are in ascending order of IDs. The data is not copied.");
+
+static PyObject *
+Snapshot_column(Snapshot_ObjectType *self, PyObject *args)
+{
+    char * p_name = NULL;
+
+    if (!PyArg_ParseTuple(args, "s", &p_name))
+    {
+        return NULL;
+    }
+    if (!Snapshot_CheckOpen(self))
+    {
+        return NULL;
+    }
+
+    unsigned col;
+    for (col = 0; col < QSNAP_COL_COUNT; col++)
+    {
+        if (strcmp(Snapshot_Columns[col].name, p_name) == 0)
+            break;
+    }
+    if (col >= QSNAP_COL_COUNT)
+    {
+        PyErr_Format(PyExc_KeyError, "Unknown snapshot column: %s", p_name);
+        return NULL;
+    }
+
+    Py_ssize_t start = (const char *) qsnap_column(&self->m_map, col) - self->m_map.base;
+    Py_ssize_t len = self->m_map.hdr->count * ((col == QSNAP_COL_ID) ? sizeof(uint32_t)
+                                                                      : sizeof(uint64_t));
+    PyObject * RETVAL = NULL;
+    PyObject * view = PyMemoryView_FromObject((PyObject *) self);
+    if (view != NULL)
+    {
+        PyObject * start_obj = PyLong_FromSsize_t(start);
+        PyObject * stop_obj = PyLong_FromSsize_t(start + len);
+        PyObject * slice = NULL;
+
+        if ((start_obj != NULL) && (stop_obj != NULL))
+        {
+            slice = PySlice_New(start_obj, stop_obj, NULL);
+        }
+        if (slice != NULL)
+        {
+            PyObject * sub = PyObject_GetItem(view, slice);
+            if (sub != NULL)
+            {
+                RETVAL = PyObject_CallMethod(sub, "cast", "s", Snapshot_Columns[col].format);
+                Py_DECREF(sub);
+            }
+            Py_DECREF(slice);
+        }
+        Py_XDECREF(start_obj);
+        Py_XDECREF(stop_obj);
+        Py_DECREF(view);
+    }
+    return RETVAL;
+}
+
+//
+// Implementation of the Snapshot.select() method: predicates are evaluated
+// over the mapped columns without holding the GIL; the mapping is protected
+// against close() meanwhile in the same way as by exported buffers.
+//
+PyDoc_STRVAR(Snapshot_select__doc__,
+    "select(filter) -> list\n\n"
+    "Return a list of tuples of ID and FsQuota.QueryResult for entries "
+    "matching the given filter, which is specified as for method "
+    "Quota.query_all().");
+
+static PyObject *
+Snapshot_select(Snapshot_ObjectType *self, PyObject *args)
+{
+    PyObject * p_filter = NULL;
+    T_QFILTER flt;
+
+    if (!PyArg_ParseTuple(args, "O", &p_filter))
+    {
+        return NULL;
+    }
+    if (!Snapshot_CheckOpen(self) || !FsQuota_ParseFilter(p_filter, &flt))
+    {
+        return NULL;
+    }
+
+    const uint32_t * ids = qsnap_column(&self->m_map, QSNAP_COL_ID);
+    const uint64_t * cols[QFILTER_VAL_COUNT];
+    uint64_t count = self->m_map.hdr->count;
+    T_QFILTER_RESULT res;
+    int result;
+
+    for (unsigned idx = 0; idx < QFILTER_VAL_COUNT; idx++)
+    {
+        cols[idx] = qsnap_column(&self->m_map, QSNAP_COL_BCOUNT + idx);
+    }
+    qfilter_result_init(&res);
+
+    self->m_exports += 1;
+    Py_BEGIN_ALLOW_THREADS
+    result = qfilter_add_columns(&flt, &res, ids, cols, count);
+    if (result == 0)
+    {
+        qfilter_result_finish(&flt, &res);
+    }
+    Py_END_ALLOW_THREADS
+    self->m_exports -= 1;
+
+    PyObject * RETVAL = ((result == 0) ? FsQuota_BuildFilterResult(&res, FSQUOTA_NO_NAMES) : PyErr_NoMemory());
+    qfilter_result_free(&res);
+    return RETVAL;
+}
+
+//
+// Implementation of the Snapshot.summary() method
+//
+PyDoc_STRVAR(Snapshot_summary__doc__,
+    "summary(*, quantiles=(0.5, 0.9, 0.99), ratio_bounds=(0.5, 0.9, 1.0)) -> dict\n\n"
+    "Return a summary of the distribution of usage of all entries, in the "
+    "same format as method Quota.summary().");
+
+static PyObject *
+Snapshot_summary(Snapshot_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_quantiles = NULL;
+    PyObject * p_bounds = NULL;
+    T_FSQUOTA_SKETCH_OPT opt;
+
+    static char * kwlist[] = {"quantiles", "ratio_bounds", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$OO", kwlist, &p_quantiles, &p_bounds))
+    {
+        return NULL;
+    }
+    if (!Snapshot_CheckOpen(self) || !FsQuota_ParseSketchOpt(p_quantiles, p_bounds, &opt))
+    {
+        return NULL;
+    }
+
+    T_QSKETCH * sk = PyMem_Malloc(sizeof(T_QSKETCH));
+    if (sk == NULL)
+    {
+        return PyErr_NoMemory();
+    }
+    qsketch_init(sk, opt.bounds, opt.bound_cnt);
+
+    // the mapping is protected against close() as in method select()
+    self->m_exports += 1;
+    Py_BEGIN_ALLOW_THREADS
+    for (uint64_t row = 0; row < self->m_map.hdr->count; row++)
+    {
+        uint64_t val[QSNAP_VAL_COUNT];
+
+        qsnap_get_row(&self->m_map, row, val);
+        qsketch_add(sk, val);
+    }
+    Py_END_ALLOW_THREADS
+    self->m_exports -= 1;
+
+    PyObject * RETVAL = FsQuota_BuildSketch(sk, &opt);
+    PyMem_Free(sk);
+    return RETVAL;
+}
+
+//
+// Implementation of the Snapshot.close() method
+//
+PyDoc_STRVAR(Snapshot_close__doc__,
+    "close()\n\n"
+    "Unmap the snapshot file. This fails while views returned by column() "
+    "are still in use. Closing is done implicitly upon deletion of the object.");
+
+static PyObject *
+Snapshot_close(Snapshot_ObjectType *self, PyObject *args)
+{
+    if (self->m_exports > 0)
+    {
+        PyErr_SetString(PyExc_BufferError, "Cannot close FsQuota.Snapshot: column views exist");
+        return NULL;
+    }
+    qsnap_close(&self->m_map);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+//
+// Implementation of methods __enter__ and __exit__ for use as context manager
+//
+static PyObject *
+Snapshot_enter(Snapshot_ObjectType *self, PyObject *args)
+{
+    if (!Snapshot_CheckOpen(self))
+    {
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject *
+Snapshot_exit(Snapshot_ObjectType *self, PyObject *args)
+{
+    return Snapshot_close(self, NULL);
+}
+
+//
+// Implementation of the buffer protocol: exports the complete file content
+//
+static int
+Snapshot_GetBuffer(Snapshot_ObjectType *self, Py_buffer *view, int flags)
+{
+    if (!Snapshot_CheckOpen(self))
+    {
+        view->obj = NULL;
+        return -1;
+    }
+    if (PyBuffer_FillInfo(view, (PyObject *) self, (void *) self->m_map.base,
+                          self->m_map.size, 1, flags) != 0)
+    {
+        return -1;
+    }
+    self->m_exports += 1;
+    return 0;
+}
+
+static void
+Snapshot_ReleaseBuffer(Snapshot_ObjectType *self, Py_buffer *view)
+{
+    self->m_exports -= 1;
+}
+
+//
+// Implementation of len() and operator "in"
+//
+static Py_ssize_t
+Snapshot_Length(Snapshot_ObjectType *self)
+{
+    if (!Snapshot_CheckOpen(self))
+    {
+        return -1;
+    }
+    return self->m_map.hdr->count;
+}
+
+static int
+Snapshot_Contains(Snapshot_ObjectType *self, PyObject * key)
+{
+    if (!Snapshot_CheckOpen(self))
+    {
+        return -1;
+    }
+    int overflow;
+    long long id = PyLong_AsLongLongAndOverflow(key, &overflow);
+    if ((id == -1) && PyErr_Occurred())
+    {
+        return -1;
+    }
+    if (overflow || (id < 0) || (id > UINT32_MAX))
+    {
+        return FALSE;
+    }
+    return (qsnap_lookup(&self->m_map, id) >= 0);
+}
+
+//
+// Implementation of attributes
+//
+static PyObject *
+Snapshot_GetAttrHdr(Snapshot_ObjectType *self, void * closure)
+{
+    if (!Snapshot_CheckOpen(self))
+    {
+        return NULL;
+    }
+    const T_QSNAP_HEADER * hdr = self->m_map.hdr;
+    switch ((intptr_t) closure)
+    {
+        case 0:  return PyUnicode_DecodeFSDefault(hdr->dev);
+        case 1:  return PyUnicode_FromString(hdr->fstype);
+        case 2:  return PyLong_FromUnsignedLong(hdr->qtype);
+        default: return PyLong_FromLongLong(hdr->timestamp);
+    }
+}
+
+static PyObject *
+Snapshot_GetAttrPath(Snapshot_ObjectType *self, void * closure)
+{
+    return PyUnicode_DecodeFSDefault(self->m_path);
+}
+
+//
+// Allocate a new "Snapshot" object
+//
+static PyObject *
+Snapshot_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    Snapshot_ObjectType *self;
+    self = (Snapshot_ObjectType *) type->tp_alloc(type, 0);
+
+    return (PyObject *) self;
+}
+
+//
+// De-allocate a "Snapshot" object and unmap the file; there can be no
+// exported buffers at this point, as these hold a reference.
+//
+static void
+Snapshot_dealloc(Snapshot_ObjectType *self)
+{
+    qsnap_close(&self->m_map);
+    if (self->m_path != NULL)
+    {
+        free(self->m_path);
+    }
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+//
+// Implementation of the standard "__init__" function: map the given file
+//
+static int
+Snapshot_init(Snapshot_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    static char * kwlist[] = {"path", NULL};
+    char * p_path = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &p_path))
+    {
+        return -1;
+    }
+    if (self->m_exports > 0)
+    {
+        PyErr_SetString(PyExc_BufferError, "Cannot re-initialize FsQuota.Snapshot: column views exist");
+        return -1;
+    }
+
+    // reset state in case the object is already initialized
+    qsnap_close(&self->m_map);
+    if (self->m_path != NULL)
+    {
+        free(self->m_path);
+    }
+    self->m_path = strdup(p_path);
+
+    const char * err_str = NULL;
+    if (qsnap_open(p_path, &self->m_map, &err_str) != 0)
+    {
+        FsQuota_OsException(errno, ((err_str != NULL) ? err_str : "opening snapshot"), p_path);
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Implementation of the standard "repr" function
+//
+static PyObject *
+Snapshot_Repr(Snapshot_ObjectType *self)
+{
+    if (self->m_map.base == NULL)
+    {
+        return PyUnicode_FromString("<FsQuota.Snapshot(), closed>");
+    }
+    return PyUnicode_FromFormat("<FsQuota.Snapshot(%s), dev=%s, fstype=%s, qtype=%u, entries=%llu>",
+                                self->m_path, self->m_map.hdr->dev, self->m_map.hdr->fstype,
+                                (unsigned) self->m_map.hdr->qtype,
+                                (unsigned long long) self->m_map.hdr->count);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static PyMethodDef Snapshot_MethodsDef[] =
+{
+    {"open",      (PyCFunction) Snapshot_open,   METH_VARARGS | METH_CLASS, Snapshot_open__doc__ },
+    {"lookup",    (PyCFunction) Snapshot_lookup, METH_VARARGS,              Snapshot_lookup__doc__ },
+    {"column",    (PyCFunction) Snapshot_column, METH_VARARGS,              Snapshot_column__doc__ },
+    {"select",    (PyCFunction) Snapshot_select, METH_VARARGS,              Snapshot_select__doc__ },
+    {"summary",   (PyCFunction) Snapshot_summary, METH_VARARGS | METH_KEYWORDS, Snapshot_summary__doc__ },
+    {"close",     (PyCFunction) Snapshot_close,  METH_NOARGS,               Snapshot_close__doc__ },
+    {"__enter__", (PyCFunction) Snapshot_enter,  METH_NOARGS,               NULL },
+    {"__exit__",  (PyCFunction) Snapshot_exit,   METH_VARARGS,              NULL },
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef Snapshot_GetSetDef[] =
+{
+    {"path",      (getter) Snapshot_GetAttrPath, NULL, PyDoc_STR("Path of the snapshot file"), NULL },
+    {"dev",       (getter) Snapshot_GetAttrHdr,  NULL, PyDoc_STR("Device argument of the file system, as in Quota.dev"), (void *) 0 },
+    {"fstype",    (getter) Snapshot_GetAttrHdr,  NULL, PyDoc_STR("Access method: \"vfs\" or \"xfs\""), (void *) 1 },
+    {"qtype",     (getter) Snapshot_GetAttrHdr,  NULL, PyDoc_STR("Quota type: 0 for user, 1 for group, 2 for project"), (void *) 2 },
+    {"timestamp", (getter) Snapshot_GetAttrHdr,  NULL, PyDoc_STR("Creation time in seconds since epoch"), (void *) 3 },
+    {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods Snapshot_SequenceDef =
+{
+    .sq_length = (lenfunc) Snapshot_Length,
+    .sq_contains = (objobjproc) Snapshot_Contains,
+};
+
+static PyBufferProcs Snapshot_BufferDef =
+{
+    .bf_getbuffer = (getbufferproc) Snapshot_GetBuffer,
+    .bf_releasebuffer = (releasebufferproc) Snapshot_ReleaseBuffer,
+};
+
+static PyTypeObject SnapshotTypeDef =
+{
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "FsQuota.Snapshot",
+    .tp_doc = PyDoc_STR("Class providing read-only access to a memory-mapped quota snapshot file"),
+    .tp_basicsize = sizeof(Snapshot_ObjectType),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = Snapshot_new,
+    .tp_init = (initproc) Snapshot_init,
+    .tp_dealloc = (destructor) Snapshot_dealloc,
+    .tp_repr = (PyObject * (*)(PyObject*)) Snapshot_Repr,
+    .tp_methods = Snapshot_MethodsDef,
+    .tp_getset = Snapshot_GetSetDef,
+    .tp_as_sequence = &Snapshot_SequenceDef,
+    .tp_as_buffer = &Snapshot_BufferDef,
+};
+
+
+// ----------------------------------------------------------------------------
+//   Class "DeltaScanner"
+// ----------------------------------------------------------------------------
+
+//
+// Container for instance state variables
+//
+typedef struct
+{
+    PyObject_HEAD
+    Quota_ObjectType * m_quota;         // file system to be scanned
+    int m_is_grpquota;                  // quota type selected via constructor options
+    int m_is_prjquota;
+    T_QDELTA_STATE m_state;             // entries found by the previous scan
+    int m_scanning;                     // TRUE while within scan()
+} DeltaScanner_ObjectType;
+
+//
+// Callback for Quota_enum_local() in DeltaScanner.scan()
+//
+static int
+DeltaScanner_AddCb(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt)
+{
+    uint64_t val[QDELTA_VAL_COUNT] = { rslt->bcur, rslt->bsoft, rslt->bhard, rslt->btime,
+                                       rslt->fcur, rslt->fsoft, rslt->fhard, rslt->ftime };
+
+    return qdelta_scan_add((T_QDELTA_SCAN *) ctx, id, val);
+}
+
+//
+// Helper function building the list of changes returned by scan()
+//
+static PyObject *
+DeltaScanner_BuildChanges(const T_QDELTA_SCAN * scan)
+{
+    PyObject * RETVAL = PyList_New(scan->change_cnt);
+
+    for (size_t idx = 0; (RETVAL != NULL) && (idx < scan->change_cnt); idx++)
+    {
+        const T_QDELTA_CHANGE * chg = &scan->changes[idx];
+        const uint64_t * v;
+        PyObject * old_obj = Py_None;
+        PyObject * new_obj = Py_None;
+        PyObject * item = NULL;
+
+        if (chg->has_old)
+        {
+            v = chg->old_val;
+            old_obj = FsQuota_BuildQuotaResult(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+        }
+        else
+        {
+            Py_INCREF(old_obj);
+        }
+        if (chg->has_new)
+        {
+            v = chg->new_val;
+            new_obj = FsQuota_BuildQuotaResult(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+        }
+        else
+        {
+            Py_INCREF(new_obj);
+        }
+        if ((old_obj != NULL) && (new_obj != NULL))
+        {
+            item = Py_BuildValue("(kOO)", (unsigned long) chg->id, old_obj, new_obj);
+        }
+        Py_XDECREF(old_obj);
+        Py_XDECREF(new_obj);
+
+        if (item != NULL)
+        {
+            PyList_SET_ITEM(RETVAL, idx, item);
+        }
+        else
+        {
+            Py_CLEAR(RETVAL);
+        }
+    }
+    return RETVAL;
+}
+
+//
+// Implementation of the DeltaScanner.scan() method
+//
+PyDoc_STRVAR(DeltaScanner_scan__doc__,
+    "scan() -> (list, dict)\n\n"
+    "Enumerate all quota entries and compare them with the result of the "
+    "previous scan. Returns a list of tuples (id, old, new) for each "
+    "inserted, removed or changed entry in ascending order of IDs, where "
+    "old or new is None for inserted and removed entries respectively, and "
+    "a dict with totals of the new scan and the number of changes.");
+
+static PyObject *
+DeltaScanner_scan(DeltaScanner_ObjectType *self, PyObject *args)
+{
+    Quota_ObjectType * quota = self->m_quota;
+
+    if (self->m_scanning)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "FsQuota.DeltaScanner.scan() is already in progress");
+        return NULL;
+    }
+    if (quota->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        return FsQuota_QuotaCtlException(quota, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    if (qtrace_mode == QTRACE_REPLAY)
+    {
+        return FsQuota_QuotaCtlException(quota, ENOTSUP, "Scans are not supported during trace replay");
+    }
+
+    // copy, as the Quota object may be re-initialized while the GIL is released
+    T_QUOTA_DEV_FS_TYPE dev_fs_type = quota->m_dev_fs_type;
+    char * qcarg = strdup(quota->m_qcarg);
+    if (qcarg == NULL)
+    {
+        return PyErr_NoMemory();
+    }
+
+    PyObject * RETVAL = NULL;
+    T_QDELTA_SCAN scan;
+    T_QUOTA_ERROR err;
+
+    qdelta_scan_init(&scan, &self->m_state);
+    self->m_scanning = TRUE;
+
+    // release the GIL, as enumerating may take a while for large tables
+    Py_BEGIN_ALLOW_THREADS
+    if ((Quota_enum_local(dev_fs_type, qcarg, self->m_is_grpquota, self->m_is_prjquota,
+                          DeltaScanner_AddCb, &scan, &err) == 0) &&
+        (qdelta_scan_finish(&scan) != 0))
+    {
+        err.errnum = ((errno != 0) ? errno : EIO);
+        err.str = "collecting quota entries";
+        err.is_os = TRUE;
+    }
+    Py_END_ALLOW_THREADS
+
+    self->m_scanning = FALSE;
+    free(qcarg);
+
+    if (err.errnum != 0)
+    {
+        RETVAL = FsQuota_RaiseError(quota, &err);
+    }
+    else
+    {
+        PyObject * changes = DeltaScanner_BuildChanges(&scan);
+        if (changes != NULL)
+        {
+            RETVAL = Py_BuildValue("(N{s:K,s:K,s:K,s:K,s:K,s:K})", changes,
+                                   "entries", (unsigned long long) scan.totals.entries,
+                                   "bcount", (unsigned long long) scan.totals.bcount,
+                                   "icount", (unsigned long long) scan.totals.icount,
+                                   "inserted", (unsigned long long) scan.totals.inserted,
+                                   "changed", (unsigned long long) scan.totals.changed,
+                                   "removed", (unsigned long long) scan.totals.removed);
+        }
+        // the new state replaces the previous one only upon success
+        if (RETVAL != NULL)
+        {
+            qdelta_state_move(&self->m_state, &scan.next);
+        }
+    }
+    qdelta_scan_free(&scan);
+    return RETVAL;
+}
+
+//
+// Implementation of the DeltaScanner.reset() method
+//
+PyDoc_STRVAR(DeltaScanner_reset__doc__,
+    "reset()\n\n"
+    "Discard the result of the previous scan, so that the next scan "
+    "reports all entries as inserted.");
+
+static PyObject *
+DeltaScanner_reset(DeltaScanner_ObjectType *self, PyObject *args)
+{
+    if (self->m_scanning)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "FsQuota.DeltaScanner.scan() is in progress");
+        return NULL;
+    }
+    qdelta_state_free(&self->m_state);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+//
+// Implementation of attributes
+//
+static PyObject *
+DeltaScanner_GetAttrState(DeltaScanner_ObjectType *self, void * closure)
+{
+    unsigned char * buf;
+    size_t len;
+
+    if (qdelta_state_export(&self->m_state,
+                            QPROBE_QTYPE(self->m_is_grpquota, self->m_is_prjquota),
+                            &buf, &len) != 0)
+    {
+        return PyErr_NoMemory();
+    }
+    PyObject * RETVAL = PyBytes_FromStringAndSize((const char *) buf, len);
+    free(buf);
+    return RETVAL;
+}
+
+static PyObject *
+DeltaScanner_GetAttrEntries(DeltaScanner_ObjectType *self, void * closure)
+{
+    return PyLong_FromUnsignedLongLong(self->m_state.count);
+}
+
+//
+// Allocate a new "DeltaScanner" object
+//
+static PyObject *
+DeltaScanner_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    DeltaScanner_ObjectType *self;
+    self = (DeltaScanner_ObjectType *) type->tp_alloc(type, 0);
+
+    return (PyObject *) self;
+}
+
+//
+// De-allocate a "DeltaScanner" object and internal resources
+//
+static void
+DeltaScanner_dealloc(DeltaScanner_ObjectType *self)
+{
+    qdelta_state_free(&self->m_state);
+    Py_XDECREF(self->m_quota);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+//
+// Implementation of the standard "__init__" function
+//
+static int
+DeltaScanner_init(DeltaScanner_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    static char * kwlist[] = {"quota", "grpquota", "prjquota", "state", NULL};
+    PyObject * p_quota = NULL;
+    PyObject * p_state = Py_None;
+    int is_grpquota = FALSE;
+    int is_prjquota = FALSE;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|$ppO", kwlist,
+                                     &QuotaTypeDef, &p_quota,
+                                     &is_grpquota, &is_prjquota, &p_state))
+    {
+        return -1;
+    }
+    if (self->m_scanning)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "FsQuota.DeltaScanner.scan() is in progress");
+        return -1;
+    }
+
+    // reset state in case the object is already initialized
+    qdelta_state_free(&self->m_state);
+    Py_XDECREF(self->m_quota);
+    Py_INCREF(p_quota);
+    self->m_quota = (Quota_ObjectType *) p_quota;
+    self->m_is_grpquota = is_grpquota;
+    self->m_is_prjquota = is_prjquota;
+
+    if (p_state != Py_None)
+    {
+        Py_buffer buf;
+        int ret;
+
+        if (PyObject_GetBuffer(p_state, &buf, PyBUF_SIMPLE) != 0)
+        {
+            return -1;
+        }
+        ret = qdelta_state_import(&self->m_state, QPROBE_QTYPE(is_grpquota, is_prjquota),
+                                  buf.buf, buf.len);
+        PyBuffer_Release(&buf);
+
+        if (ret != 0)
+        {
+            if (errno == ENOMEM)
+                PyErr_NoMemory();
+            else
+                PyErr_SetString(PyExc_ValueError, "Invalid or incompatible DeltaScanner state");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static PyMethodDef DeltaScanner_MethodsDef[] =
+{
+    {"scan",      (PyCFunction) DeltaScanner_scan,  METH_NOARGS, DeltaScanner_scan__doc__ },
+    {"reset",     (PyCFunction) DeltaScanner_reset, METH_NOARGS, DeltaScanner_reset__doc__ },
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef DeltaScanner_GetSetDef[] =
+{
+    {"state",     (getter) DeltaScanner_GetAttrState,   NULL,
+     PyDoc_STR("Result of the previous scan in serialized form, for passing to the constructor"), NULL },
+    {"entries",   (getter) DeltaScanner_GetAttrEntries, NULL,
+     PyDoc_STR("Number of entries found by the previous scan"), NULL },
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject DeltaScannerTypeDef =
+{
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "FsQuota.DeltaScanner",
+    .tp_doc = PyDoc_STR("Class for scanning quota entries, reporting only changes since the previous scan"),
+    .tp_basicsize = sizeof(DeltaScanner_ObjectType),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = DeltaScanner_new,
+    .tp_init = (initproc) DeltaScanner_init,
+    .tp_dealloc = (destructor) DeltaScanner_dealloc,
+    .tp_methods = DeltaScanner_MethodsDef,
+    .tp_getset = DeltaScanner_GetSetDef,
+};
+
+
+// ----------------------------------------------------------------------------
+//   Class "Watcher"
+// ----------------------------------------------------------------------------
+
+#define WATCHER_DEFAULT_INTERVAL  60.0
+#define WATCHER_MAX_CONCURRENCY   64
+
+//
+// Registered file system, with the state of the previous and current scan
+//
+typedef struct
+{
+    PyObject *          quota;          // Quota object, passed to callbacks
+    T_QUOTA_DEV_FS_TYPE dev_fs_type;    // copied from the Quota object, as it
+    char *              qcarg;          // may be re-initialized meanwhile
+    int                 is_grpquota;
+    int                 is_prjquota;
+    uint32_t *          ids;            // sorted IDs to be queried; NULL for enumeration
+    size_t              id_cnt;
+    T_QWATCH_SET        state;          // IDs matching the condition in the previous scan
+    T_QWATCH_SCAN       scan;           // result of the current scan
+    T_QUOTA_ERROR       err;
+} T_WATCHER_FS;
+
+//
+// Container for instance state variables
+//
+typedef struct watcher_object
+{
+    PyObject_HEAD
+    PyObject * m_callback;              // invoked for each transition
+    PyObject * m_on_error;              // invoked for failed scans; may be NULL
+    double m_interval;                  // seconds between the end and start of rounds
+    unsigned m_concurrency;             // max. number of file systems scanned in parallel
+    T_QFILTER m_filter;                 // threshold condition
+    T_WATCHER_FS * m_fs;                // registered file systems
+    unsigned m_fs_cnt;
+    unsigned long long m_rounds;        // number of completed scan rounds
+    int m_busy;                         // TRUE while poll() is in progress
+    int m_running;                      // TRUE while the background thread exists
+    int m_stop;                         // termination request; protected by m_mutex
+    pthread_t m_thread;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    struct watcher_object * m_next_running;  // link in Watcher_Running
+} Watcher_ObjectType;
+
+// Watchers with running background thread, for stopping them at exit, as the
+// threads must not acquire the GIL during finalization of the interpreter.
+// The list is protected by the GIL.
+static Watcher_ObjectType * Watcher_Running = NULL;
+
+//
+// Callback for Quota_enum_local() in Watcher_ScanFs()
+//
+static int
+Watcher_EnumCb(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt)
+{
+    void ** args = (void **) ctx;
+    const T_QFILTER * flt = (const T_QFILTER *) args[0];
+    T_QWATCH_SCAN * scan = (T_QWATCH_SCAN *) args[1];
+    uint64_t val[QWATCH_VAL_COUNT] = { rslt->bcur, rslt->bsoft, rslt->bhard, rslt->btime,
+                                       rslt->fcur, rslt->fsoft, rslt->fhard, rslt->ftime };
+
+    return qwatch_scan_add(scan, id, qfilter_match(flt, val), val);
+}
+
+//
+// Scan one registered file system, either by querying the registered IDs,
+// or by enumeration. This is called without holding the GIL, possibly by
+// multiple threads in parallel for different file systems.
+//
+static void
+Watcher_ScanFs(Watcher_ObjectType * self, T_WATCHER_FS * fs)
+{
+    T_QFILTER flt = self->m_filter;
+
+    flt.now = time(NULL);
+    qwatch_scan_init(&fs->scan, &fs->state);
+
+    if (fs->ids == NULL)
+    {
+        void * args[2] = { &flt, &fs->scan };
+
+        Quota_enum_local(fs->dev_fs_type, fs->qcarg, fs->is_grpquota, fs->is_prjquota,
+                         Watcher_EnumCb, args, &fs->err);
+    }
+    else
+    {
+        fs->err.errnum = 0;
+        fs->err.str = NULL;
+        fs->err.is_os = FALSE;
+
+        for (size_t idx = 0; idx < fs->id_cnt; idx++)
+        {
+            T_QUOTA_QUERY_RESULT rslt;
+            const char * err_str;
+            uint64_t t_start = qstat_now();
+            int err = Quota_query_local(fs->dev_fs_type, fs->qcarg, fs->ids[idx],
+                                        fs->is_grpquota, fs->is_prjquota, &rslt, &err_str);
+            int errno_bak = errno;
+            qstat_record(&qstat_backend[FsQuota_StatsBackend(fs->dev_fs_type)].op[QSTAT_OP_QUERY],
+                         t_start, qstat_now(), (err ? errno_bak : 0));
+            if (err && ((errno_bak == ENOENT) || (errno_bak == ESRCH)))
+            {
+                // no entry for this ID: skipping it reports it as removed, same as enumeration
+                continue;
+            }
+            else if (err)
+            {
+                fs->err.errnum = ((errno_bak != 0) ? errno_bak : EIO);
+                fs->err.str = err_str;
+                fs->err.is_os = (err_str != NULL);
+                break;
+            }
+
+            uint64_t val[QWATCH_VAL_COUNT] = { rslt.bcur, rslt.bsoft, rslt.bhard, rslt.btime,
+                                               rslt.fcur, rslt.fsoft, rslt.fhard, rslt.ftime };
+            if (qwatch_scan_add(&fs->scan, fs->ids[idx], qfilter_match(&flt, val), val) != 0)
+            {
+                fs->err.errnum = ENOMEM;
+                fs->err.str = "collecting quota entries";
+                fs->err.is_os = TRUE;
+                break;
+            }
+        }
+    }
+
+    if ((fs->err.errnum == 0) && (qwatch_scan_finish(&fs->scan) != 0))
+    {
+        fs->err.errnum = ENOMEM;
+        fs->err.str = "collecting quota entries";
+        fs->err.is_os = TRUE;
+    }
+}
+
+static void
+Watcher_ScanWork(void * ctx, unsigned idx)
+{
+    Watcher_ObjectType * self = (Watcher_ObjectType *) ctx;
+
+    Watcher_ScanFs(self, &self->m_fs[idx]);
+}
+
+//
+// Invoke callbacks for the results of a scan round; must be called while
+// holding the GIL. States of all file systems are updated before invoking
+// callbacks, so that transitions are reported only once. When a callback
+// raises an exception, remaining events are dropped and FALSE is returned
+// with the exception pending.
+//
+static int
+Watcher_Deliver(Watcher_ObjectType * self)
+{
+    int ok = TRUE;
+
+    for (unsigned fs_idx = 0; fs_idx < self->m_fs_cnt; fs_idx++)
+    {
+        T_WATCHER_FS * fs = &self->m_fs[fs_idx];
+
+        if (fs->err.errnum == 0)
+        {
+            qwatch_set_move(&fs->state, &fs->scan.next);
+        }
+    }
+    self->m_rounds += 1;
+
+    for (unsigned fs_idx = 0; fs_idx < self->m_fs_cnt; fs_idx++)
+    {
+        T_WATCHER_FS * fs = &self->m_fs[fs_idx];
+
+        if (ok && (fs->err.errnum != 0))
+        {
+            if (self->m_on_error != NULL)
+            {
+                PyObject * err_obj = FsQuota_ErrorObject(fs->dev_fs_type, &fs->err);
+                PyObject * ret = NULL;
+                if (err_obj != NULL)
+                {
+                    ret = PyObject_CallFunctionObjArgs(self->m_on_error, fs->quota, err_obj, NULL);
+                    Py_DECREF(err_obj);
+                }
+                ok = (ret != NULL);
+                Py_XDECREF(ret);
+            }
+        }
+        else
+        {
+            for (size_t idx = 0; ok && (idx < fs->scan.event_cnt); idx++)
+            {
+                const T_QWATCH_EVENT * ev = &fs->scan.events[idx];
+                PyObject * rslt = Py_None;
+                PyObject * ret = NULL;
+
+                if (ev->has_val)
+                {
+                    rslt = FsQuota_BuildQuotaResult(ev->val[0], ev->val[1], ev->val[2], ev->val[3],
+                                                    ev->val[4], ev->val[5], ev->val[6], ev->val[7]);
+                }
+                else
+                {
+                    Py_INCREF(rslt);  // reference for Py_None
+                }
+                if (rslt != NULL)
+                {
+                    ret = PyObject_CallFunction(self->m_callback, "OkOO", fs->quota,
+                                                (unsigned long) ev->id,
+                                                (ev->matched ? Py_True : Py_False), rslt);
+                    Py_DECREF(rslt);
+                }
+                ok = (ret != NULL);
+                Py_XDECREF(ret);
+            }
+        }
+        qwatch_scan_free(&fs->scan);
+    }
+    return ok;
+}
+
+//
+// Main loop of the background thread: scan rounds are separated by the
+// configured interval, or terminated by stop()
+//
+static void *
+Watcher_Thread(void * arg)
+{
+    Watcher_ObjectType * self = (Watcher_ObjectType *) arg;
+
+    pthread_mutex_lock(&self->m_mutex);
+    while (!self->m_stop)
+    {
+        pthread_mutex_unlock(&self->m_mutex);
+
+        FsQuota_RunParallel(self->m_fs_cnt, self->m_concurrency, Watcher_ScanWork, self);
+
+        PyGILState_STATE gstate = PyGILState_Ensure();
+        if (!Watcher_Deliver(self))
+        {
+            PyErr_WriteUnraisable(self->m_callback);
+        }
+        PyGILState_Release(gstate);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t) self->m_interval;
+        deadline.tv_nsec += (long) ((self->m_interval - (time_t) self->m_interval) * 1e9);
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&self->m_mutex);
+        while (!self->m_stop &&
+               (pthread_cond_timedwait(&self->m_cond, &self->m_mutex, &deadline) != ETIMEDOUT))
+        {
+        }
+    }
+    pthread_mutex_unlock(&self->m_mutex);
+    return NULL;
+}
+
+//
+// Helper function for raising an exception when the operation is not
+// possible while the background thread is running. Returns TRUE if idle.
+//
+static int
+Watcher_CheckIdle(Watcher_ObjectType *self, const char * op)
+{
+    if (self->m_running || self->m_busy)
+    {
+        PyErr_Format(PyExc_RuntimeError, "FsQuota.Watcher.%s() is not possible while running", op);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//
+// Implementation of the Watcher.add() method
+//
+PyDoc_STRVAR(Watcher_add__doc__,
+    "add(quota, ids=None, *, grpquota=False, prjquota=False)\n\n"
+    "Register a file system given as FsQuota.Quota instance for watching. "
+    "When a sequence of IDs is given, only these are queried in each "
+    "round; else all entries are enumerated. Options select group or "
+    "project quotas as for method Quota.query(). Only local file systems "
+    "are supported.");
+
+static PyObject *
+Watcher_add(Watcher_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    PyObject * p_quota = NULL;
+    PyObject * p_ids = Py_None;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+
+    static char * kwlist[] = {"quota", "ids", "grpquota", "prjquota", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|O$pp", kwlist, &QuotaTypeDef, &p_quota,
+                                     &p_ids, &is_grpquota, &is_prjquota))
+    {
+        return NULL;
+    }
+    if (!Watcher_CheckIdle(self, "add"))
+    {
+        return NULL;
+    }
+
+    Quota_ObjectType * quota = (Quota_ObjectType *) p_quota;
+    if (quota->m_dev_fs_type == QUOTA_DEV_INVALID)
+    {
+        return FsQuota_QuotaCtlException(quota, EINVAL, "FsQuota.Quota instance is uninitialized");
+    }
+    if (quota->m_dev_fs_type == QUOTA_DEV_NFS)
+    {
+        return FsQuota_QuotaCtlException(quota, ENOTSUP, "Watching is supported only for local file systems");
+    }
+    if (is_prjquota && !QUOTA_DEV_HAS_PRJQUOTA(quota->m_dev_fs_type))
+    {
+        return FsQuota_QuotaCtlException(quota, ENOTSUP, "Project quotas are not supported by this file system");
+    }
+
+    T_WATCHER_FS fs;
+    memset(&fs, 0, sizeof(fs));
+    fs.dev_fs_type = quota->m_dev_fs_type;
+    fs.is_grpquota = is_grpquota;
+    fs.is_prjquota = is_prjquota;
+
+    if (p_ids != Py_None)
+    {
+        PyObject * seq = PySequence_Fast(p_ids, "ids must be an iterable of integers");
+        if (seq == NULL)
+        {
+            return NULL;
+        }
+        Py_ssize_t cnt = PySequence_Fast_GET_SIZE(seq);
+        fs.ids = PyMem_Malloc(((cnt > 0) ? cnt : 1) * sizeof(uint32_t));
+        if (fs.ids == NULL)
+        {
+            Py_DECREF(seq);
+            return PyErr_NoMemory();
+        }
+        for (Py_ssize_t idx = 0; idx < cnt; idx++)
+        {
+            unsigned long id = PyLong_AsUnsignedLong(PySequence_Fast_GET_ITEM(seq, idx));
+            if (((id == (unsigned long) -1) && PyErr_Occurred()) || (id > UINT32_MAX))
+            {
+                if (!PyErr_Occurred())
+                {
+                    PyErr_SetString(PyExc_OverflowError, "ID is out of range");
+                }
+                PyMem_Free(fs.ids);
+                Py_DECREF(seq);
+                return NULL;
+            }
+            // insertion into the sorted array, dropping duplicates
+            size_t pos = fs.id_cnt;
+            while ((pos > 0) && (fs.ids[pos - 1] > id))
+            {
+                pos--;
+            }
+            if ((pos == 0) || (fs.ids[pos - 1] != id))
+            {
+                memmove(&fs.ids[pos + 1], &fs.ids[pos], (fs.id_cnt - pos) * sizeof(uint32_t));
+                fs.ids[pos] = id;
+                fs.id_cnt += 1;
+            }
+        }
+        Py_DECREF(seq);
+    }
+
+    T_WATCHER_FS * new_fs = PyMem_Realloc(self->m_fs, (self->m_fs_cnt + 1) * sizeof(T_WATCHER_FS));
+    fs.qcarg = strdup(quota->m_qcarg);
+    if ((new_fs == NULL) || (fs.qcarg == NULL))
+    {
+        if (new_fs != NULL)
+        {
+            self->m_fs = new_fs;
+        }
+        free(fs.qcarg);
+        PyMem_Free(fs.ids);
+        return PyErr_NoMemory();
+    }
+    Py_INCREF(p_quota);
+    fs.quota = p_quota;
+    self->m_fs = new_fs;
+    self->m_fs[self->m_fs_cnt++] = fs;
+
+    Py_RETURN_NONE;
+}
+
+//
+// Implementation of the Watcher.poll() method
+//
+PyDoc_STRVAR(Watcher_poll__doc__,
+    "poll()\n\n"
+    "Perform one scan round in the calling thread and invoke callbacks for "
+    "transitions. This is an alternative to start() for applications "
+    "running their own loop; exceptions raised by callbacks are passed on.");
+
+static PyObject *
+Watcher_poll(Watcher_ObjectType *self, PyObject *args)
+{
+    if (!Watcher_CheckIdle(self, "poll"))
+    {
+        return NULL;
+    }
+
+    self->m_busy = TRUE;
+    Py_BEGIN_ALLOW_THREADS
+    FsQuota_RunParallel(self->m_fs_cnt, self->m_concurrency, Watcher_ScanWork, self);
+    Py_END_ALLOW_THREADS
+
+    int ok = Watcher_Deliver(self);
+    self->m_busy = FALSE;
+
+    if (!ok)
+    {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+//
+// Implementation of the Watcher.start() method
+//
+PyDoc_STRVAR(Watcher_start__doc__,
+    "start()\n\n"
+    "Start the background thread, which performs a scan round immediately "
+    "and then once per interval, until stop() is called. Exceptions raised "
+    "by callbacks are reported via sys.unraisablehook.");
+
+static PyObject *
+Watcher_start(Watcher_ObjectType *self, PyObject *args)
+{
+    if (!Watcher_CheckIdle(self, "start"))
+    {
+        return NULL;
+    }
+
+    self->m_stop = FALSE;
+    // the thread keeps a reference, so that the object stays valid until stop()
+    Py_INCREF(self);
+    int err = pthread_create(&self->m_thread, NULL, Watcher_Thread, self);
+    if (err != 0)
+    {
+        Py_DECREF(self);
+        return FsQuota_OsException(err, "starting watcher thread", NULL);
+    }
+    self->m_running = TRUE;
+    self->m_next_running = Watcher_Running;
+    Watcher_Running = self;
+
+    Py_RETURN_NONE;
+}
+
+//
+// Implementation of the Watcher.stop() method
+//
+PyDoc_STRVAR(Watcher_stop__doc__,
+    "stop()\n\n"
+    "Stop the background thread, waiting for completion of a scan round "
+    "in progress. This must not be called from within a callback.");
+
+static PyObject *
+Watcher_stop(Watcher_ObjectType *self, PyObject *args)
+{
+    if (self->m_running)
+    {
+        if (pthread_equal(pthread_self(), self->m_thread))
+        {
+            PyErr_SetString(PyExc_RuntimeError, "FsQuota.Watcher.stop() cannot be called by callbacks");
+            return NULL;
+        }
+        pthread_mutex_lock(&self->m_mutex);
+        self->m_stop = TRUE;
+        pthread_cond_signal(&self->m_cond);
+        pthread_mutex_unlock(&self->m_mutex);
+
+        // release the GIL, as the thread may need it for completing callbacks
+        Py_BEGIN_ALLOW_THREADS
+        pthread_join(self->m_thread, NULL);
+        Py_END_ALLOW_THREADS
+
+        self->m_running = FALSE;
+        for (Watcher_ObjectType ** pp = &Watcher_Running; *pp != NULL; pp = &(*pp)->m_next_running)
+        {
+            if (*pp == self)
+            {
+                *pp = self->m_next_running;
+                break;
+            }
+        }
+        Py_DECREF(self);  // reference held by the thread
+    }
+    Py_RETURN_NONE;
+}
+
+//
+// Stop the background threads of all watchers; registered via module atexit
+// during module initialization, so that this is called before finalization
+//
+static PyObject *
+Watcher_StopAll(PyObject *module, PyObject *args)
+{
+    while (Watcher_Running != NULL)
+    {
+        PyObject * ret = Watcher_stop(Watcher_Running, NULL);
+        if (ret == NULL)
+        {
+            return NULL;
+        }
+        Py_DECREF(ret);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef Watcher_StopAllDef =
+{
+    "_stop_watchers", (PyCFunction) Watcher_StopAll, METH_NOARGS, NULL
+};
+
+//
+// Implementation of methods __enter__ and __exit__ for use as context
+// manager, which starts and stops the background thread
+//
+static PyObject *
+Watcher_enter(Watcher_ObjectType *self, PyObject *args)
+{
+    PyObject * ret = Watcher_start(self, NULL);
+    if (ret == NULL)
+    {
+        return NULL;
+    }
+    Py_DECREF(ret);
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject *
+Watcher_exit(Watcher_ObjectType *self, PyObject *args)
+{
+    return Watcher_stop(self, NULL);
+}
+
+//
+// Implementation of attributes
+//
+static PyObject *
+Watcher_get_running(Watcher_ObjectType *self, void *closure)
+{
+    return PyBool_FromLong(self->m_running);
+}
+
+static PyObject *
+Watcher_get_rounds(Watcher_ObjectType *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->m_rounds);
+}
+
+//
+// Implementation of the Watcher.matched() method
+//
+PyDoc_STRVAR(Watcher_matched__doc__,
+    "matched() -> list\n\n"
+    "Return a list of tuples of FsQuota.Quota instance and list of IDs "
+    "matching the condition as of the last completed scan round, in the "
+    "order of registration.");
+
+static PyObject *
+Watcher_matched(Watcher_ObjectType *self, PyObject *args)
+{
+    PyObject * RETVAL = PyList_New(self->m_fs_cnt);
+
+    for (unsigned fs_idx = 0; (RETVAL != NULL) && (fs_idx < self->m_fs_cnt); fs_idx++)
+    {
+        const T_WATCHER_FS * fs = &self->m_fs[fs_idx];
+        PyObject * ids = PyList_New(fs->state.count);
+
+        for (size_t idx = 0; (ids != NULL) && (idx < fs->state.count); idx++)
+        {
+            PyObject * id = PyLong_FromUnsignedLong(fs->state.ids[idx]);
+            if (id != NULL)
+            {
+                PyList_SET_ITEM(ids, idx, id);
+            }
+            else
+            {
+                Py_CLEAR(ids);
+            }
+        }
+        PyObject * item = ((ids != NULL) ? Py_BuildValue("(ON)", fs->quota, ids) : NULL);
+        if (item != NULL)
+        {
+            PyList_SET_ITEM(RETVAL, fs_idx, item);
+        }
+        else
+        {
+            Py_CLEAR(RETVAL);
+        }
+    }
+    return RETVAL;
+}
+
+//
+// Allocate a new object and initialize all members
+//
+static PyObject *
+Watcher_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    Watcher_ObjectType * self = (Watcher_ObjectType *) type->tp_alloc(type, 0);
+    if (self != NULL)
+    {
+        self->m_interval = WATCHER_DEFAULT_INTERVAL;
+        self->m_concurrency = 1;
+        pthread_mutex_init(&self->m_mutex, NULL);
+        pthread_cond_init(&self->m_cond, NULL);
+    }
+    return (PyObject *) self;
+}
+
+static void
+Watcher_Clear(Watcher_ObjectType *self)
+{
+    // detach first, as releasing references may invoke the garbage collector
+    T_WATCHER_FS * fs_list = self->m_fs;
+    unsigned fs_cnt = self->m_fs_cnt;
+
+    self->m_fs = NULL;
+    self->m_fs_cnt = 0;
+
+    for (unsigned idx = 0; idx < fs_cnt; idx++)
+    {
+        T_WATCHER_FS * fs = &fs_list[idx];
+
+        Py_XDECREF(fs->quota);
+        free(fs->qcarg);
+        PyMem_Free(fs->ids);
+        qwatch_set_free(&fs->state);
+    }
+    PyMem_Free(fs_list);
+    Py_CLEAR(self->m_callback);
+    Py_CLEAR(self->m_on_error);
+}
+
+//
+// Support for the cyclic garbage collector, as callbacks often reference
+// the watcher; a running watcher is not collected, as the background thread
+// holds a reference
+//
+static int
+Watcher_traverse(Watcher_ObjectType *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->m_callback);
+    Py_VISIT(self->m_on_error);
+    for (unsigned idx = 0; idx < self->m_fs_cnt; idx++)
+    {
+        Py_VISIT(self->m_fs[idx].quota);
+    }
+    return 0;
+}
+
+static int
+Watcher_clear(Watcher_ObjectType *self)
+{
+    Watcher_Clear(self);
+    return 0;
+}
+
+//
+// De-allocate an object and all members; the background thread is not
+// running, as it holds a reference
+//
+static void
+Watcher_dealloc(Watcher_ObjectType *self)
+{
+    PyObject_GC_UnTrack(self);
+    Watcher_Clear(self);
+    pthread_mutex_destroy(&self->m_mutex);
+    pthread_cond_destroy(&self->m_cond);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+//
+// Implementation of the Watcher() constructor
+//
+static int
+Watcher_init(Watcher_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    static char * kwlist[] = {"callback", "interval", "concurrency", "filter", "on_error", NULL};
+    PyObject * p_callback = NULL;
+    PyObject * p_filter = NULL;
+    PyObject * p_on_error = Py_None;
+    double interval = WATCHER_DEFAULT_INTERVAL;
+    unsigned concurrency = 1;
+    T_QFILTER flt;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$dIOO", kwlist,
+                                     &p_callback, &interval, &concurrency, &p_filter, &p_on_error))
+    {
+        return -1;
+    }
+    if (!PyCallable_Check(p_callback) || ((p_on_error != Py_None) && !PyCallable_Check(p_on_error)))
+    {
+        PyErr_SetString(PyExc_TypeError, "callback and on_error must be callable");
+        return -1;
+    }
+    if (!(interval > 0.0) || (interval > 1e9))
+    {
+        PyErr_SetString(PyExc_ValueError, "interval is out of range");
+        return -1;
+    }
+    if ((concurrency == 0) || (concurrency > WATCHER_MAX_CONCURRENCY))
+    {
+        PyErr_SetString(PyExc_ValueError, "concurrency is out of range");
+        return -1;
+    }
+    if (p_filter == NULL)
+    {
+        // default: usage reached the soft block limit
+        FsQuota_ParseFilter(NULL, &flt);
+        flt.use_ratio = TRUE;
+        flt.ratio = 1.0;
+    }
+    else if (!FsQuota_ParseFilter(p_filter, &flt))
+    {
+        return -1;
+    }
+    else if (flt.top_k != 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "filter key \"top\" is not supported by FsQuota.Watcher");
+        return -1;
+    }
+    if (!Watcher_CheckIdle(self, "__init__"))
+    {
+        return -1;
+    }
+
+    // reset state in case the object is already initialized
+    Watcher_Clear(self);
+    Py_INCREF(p_callback);
+    self->m_callback = p_callback;
+    if (p_on_error != Py_None)
+    {
+        Py_INCREF(p_on_error);
+        self->m_on_error = p_on_error;
+    }
+    self->m_interval = interval;
+    self->m_concurrency = concurrency;
+    self->m_filter = flt;
+    self->m_rounds = 0;
+    return 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static PyMethodDef Watcher_MethodsDef[] =
+{
+    {"add",       (PyCFunction) Watcher_add,     METH_VARARGS | METH_KEYWORDS, Watcher_add__doc__ },
+    {"poll",      (PyCFunction) Watcher_poll,    METH_NOARGS,                  Watcher_poll__doc__ },
+    {"start",     (PyCFunction) Watcher_start,   METH_NOARGS,                  Watcher_start__doc__ },
+    {"stop",      (PyCFunction) Watcher_stop,    METH_NOARGS,                  Watcher_stop__doc__ },
+    {"matched",   (PyCFunction) Watcher_matched, METH_NOARGS,                  Watcher_matched__doc__ },
+    {"__enter__", (PyCFunction) Watcher_enter,   METH_NOARGS,                  NULL },
+    {"__exit__",  (PyCFunction) Watcher_exit,    METH_VARARGS,                 NULL },
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef Watcher_GetSetDef[] =
+{
+    {"running", (getter) Watcher_get_running, NULL,
+                PyDoc_STR("True while the background thread is running"), NULL },
+    {"rounds",  (getter) Watcher_get_rounds, NULL,
+                PyDoc_STR("Number of completed scan rounds"), NULL },
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject WatcherTypeDef =
+{
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "FsQuota.Watcher",
+    .tp_doc = PyDoc_STR("Class for watching quota entries in a background thread, "
+                        "invoking callbacks when thresholds are crossed"),
+    .tp_basicsize = sizeof(Watcher_ObjectType),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .tp_new = Watcher_new,
+    .tp_init = (initproc) Watcher_init,
+    .tp_dealloc = (destructor) Watcher_dealloc,
+    .tp_traverse = (traverseproc) Watcher_traverse,
+    .tp_clear = (inquiry) Watcher_clear,
+    .tp_methods = Watcher_MethodsDef,
+    .tp_getset = Watcher_GetSetDef,
+};
+
+// ----------------------------------------------------------------------------
+//   Class "RquotaServer"
+// ----------------------------------------------------------------------------
+
+#ifdef RQUOTA_SERVER
+
+#define RQUOTA_SERVER_DEFAULT_THREADS    4
+#define RQUOTA_SERVER_DEFAULT_CACHE_TTL  1000
+
+//
+// Local file system served, as determined via the mount table upon
+// construction. Paths given in requests are mapped via their device ID, so
+// that any path within the file system matches.
+//
+typedef struct rquota_export
+{
+    struct rquota_export * next;
+    char * path;
+    dev_t dev;
+    char * qcarg;
+    T_QUOTA_DEV_FS_TYPE dev_fs_type;
+} T_RQUOTA_EXPORT;
+
+//
+// Container for instance state variables
+//
+typedef struct
+{
+    PyObject_HEAD
+    T_RQSRV * m_srv;                    // server state; NULL if not initialized
+    unsigned m_port;                    // UDP port used by the server
+    char * m_upstream;                  // host name of upstream server in proxy mode, or NULL
+    struct sockaddr_in m_upstream_addr; // resolved address of the upstream server
+    T_QUOTA_RPC_OPT m_rpc_opt;          // options for RPC to the upstream server
+    int m_serving;                      // TRUE while within serve()
+    PyThreadState * m_thread_state;     // saved while the GIL is released in serve()
+    T_RQUOTA_EXPORT * m_exports;        // local file systems; not modified while serving
+} RquotaServer_ObjectType;
+
+//
+// Determine the local file systems to be served. This is done once upon
+// construction, so that requests for arbitrary paths neither allocate
+// memory nor need the GIL for scanning the mount table. The mount points
+// are collected first, as the mount table cannot be scanned recursively.
+//
+static int
+RquotaServer_ScanExports(RquotaServer_ObjectType * self)
+{
+    T_MY_MNTENT_STATE l_mntab;
+    T_MY_MNTENT_BUF mntent;
+    T_RQUOTA_EXPORT ** p_next = &self->m_exports;
+    T_RQUOTA_EXPORT * exp;
+    struct stat st;
+    uint64_t t_start = qstat_now();
+
+    memset(&l_mntab, 0, sizeof(l_mntab));
+    if (my_setmntent(&l_mntab) != 0)
+    {
+        qstat_record(&qstat_mntscan, t_start, qstat_now(), errno);
+        return -1;
     }
-    else
-#endif
-#ifdef AFSQUOTA
-    if (self->m_dev_fs_type == QUOTA_DEV_AFS)
+    while (my_getmntent(&l_mntab, &mntent) == 0)
     {
-        if (!afs_check())
+        if (stat(mntent.path, &st) != 0)
         {
-            RETVAL = FsQuota_QuotaCtlException(self, EINVAL, "AFS setup via afc_check failed");
+            continue;
         }
-        else
+        for (exp = self->m_exports; exp != NULL; exp = exp->next)
         {
-            int foo1, foo2;
-            if (afs_getquota(self->m_qcarg, &foo1, &foo2) != 0)
-            {
-                RETVAL = FsQuota_QuotaCtlException(self, EINVAL, NULL);
-            }
+            if (exp->dev == st.st_dev)
+                break;
         }
-    }
-    else
-#endif
-#ifdef NETBSD_LIBQUOTA
-    // NOP / not supported
-#else /* !NETBSD_LIBQUOTA */
-#ifdef USE_IOCTL
-    {
-        struct quotactl qp;
-        int fd;
-
-        qp.op = Q_SYNC;
-
-        if ((fd = open(self->m_qcarg, O_RDONLY)) != -1)
+        if (exp == NULL)
         {
-            if (ioctl(fd, Q_QUOTACTL, &qp) != 0)
+            exp = (T_RQUOTA_EXPORT *) calloc(1, sizeof(T_RQUOTA_EXPORT));
+            if ((exp == NULL) || ((exp->path = strdup(mntent.path)) == NULL))
             {
-                if (errno == ESRCH)
-                {
-                    RETVAL = FsQuota_QuotaCtlException(self, EINVAL, NULL);
-                }
-                else
-                {
-                    RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
-                }
+                free(exp);
+                my_endmntent(&l_mntab);
+                errno = ENOMEM;
+                return -1;
             }
-            close(fd);
-        }
-        else
-        {
-            RETVAL = FsQuota_OsException(errno, "opening device", self->m_qcarg);
+            exp->dev = st.st_dev;
+            exp->dev_fs_type = QUOTA_DEV_INVALID;
+            *p_next = exp;
+            p_next = &exp->next;
         }
     }
-#else /* !USE_IOCTL */
+    my_endmntent(&l_mntab);
+
+    for (exp = self->m_exports; exp != NULL; exp = exp->next)
     {
-#ifdef Q_CTL_V3  /* Linux */
-#ifdef SGI_XFS
-        if (self->m_dev_fs_type == QUOTA_DEV_XFS)
-        {
-            if (quotactl(QCMD(Q_XQUOTASYNC, XQM_USRQUOTA), self->m_qcarg, 0, NULL) != 0)
-            {
-                RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
-            }
-        }
-        else
-#endif /* SGI_XFS */
-        if (linuxquota_sync(self->m_qcarg, FALSE) != 0)
-        {
-            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
-        }
-#else /* !Q_CTL_V3 */
-#ifdef Q_CTL_V2
-#ifdef AIX
-        struct stat st;
-#endif
-#ifdef AIX
-        if (stat(self->m_qcarg, &st))
+        const char * err_str;
+        char * rpc_host = NULL;
+
+        if (FsQuota_GetQcArg(exp->path, &exp->qcarg, &rpc_host, &exp->dev_fs_type, &err_str) != 0)
         {
-            RETVAL = FsQuota_OsException(errno, "accessing device", self->m_qcarg);
+            exp->dev_fs_type = QUOTA_DEV_INVALID;
         }
-        else
-#endif /* AIX */
-        if (quotactl(self->m_qcarg, QCMD(Q_SYNC, USRQUOTA), 0, NULL) != 0)
+        if (rpc_host != NULL)
         {
-            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            free(rpc_host);
         }
-#else /* !Q_CTL_V2 */
-#ifdef SGI_XFS
-#define XFS_UQUOTA (XFS_QUOTA_UDQ_ACCT|XFS_QUOTA_UDQ_ENFD)
-        // Q_SYNC is not supported on XFS filesystems, so emulate it
-        if (self->m_dev_fs_type == QUOTA_DEV_XFS)
-        {
-            fs_quota_stat_t fsq_stat;
+    }
+    qstat_record(&qstat_mntscan, t_start, qstat_now(), 0);
+    return 0;
+}
 
-            sync();
+//
+// Look up the file system for a path given in a request. Paths not within
+// a served local file system yield NULL.
+//
+static const T_RQUOTA_EXPORT *
+RquotaServer_GetExport(RquotaServer_ObjectType * self, const char * path)
+{
+    T_RQUOTA_EXPORT * exp;
+    struct stat st;
 
-            if (quotactl(Q_GETQSTAT, self->m_qcarg, 0, CADR &fsq_stat) != 0)
-            {
-                if ((fsq_stat.qs_flags & XFS_UQUOTA) != XFS_UQUOTA)
-                {
-                    RETVAL = FsQuota_QuotaCtlException(self, ENOENT, NULL);
-                }
-                else
-                {
-                    RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
-                }
-            }
-        }
-        else
-#endif /* SGI_XFS */
-        if (quotactl(Q_SYNC, self->m_qcarg, 0, NULL) != 0)
+    if (stat(path, &st) != 0)
+    {
+        return NULL;
+    }
+    for (exp = self->m_exports; exp != NULL; exp = exp->next)
+    {
+        if ((exp->dev == st.st_dev) &&
+            (exp->dev_fs_type != QUOTA_DEV_INVALID) &&
+            (exp->dev_fs_type != QUOTA_DEV_NFS))
         {
-            RETVAL = FsQuota_QuotaCtlException(self, errno, NULL);
+            return exp;
         }
-#endif /* !Q_CTL_V2 */
-#endif /* !Q_CTL_V3 */
     }
-#endif /* !USE_IOCTL */
-#endif /* NETBSD_LIBQUOTA */
-
-    return RETVAL;
+    return NULL;
 }
 
 //
-// Implementation of the Quota.rpc_opt() method
+// Query a local file system on behalf of a server thread. The query is
+// accounted in the process-wide performance counters.
 //
-PyDoc_STRVAR(Quota_rpc_opt__doc__,
-    "rpc_opt(*)\n\n"
-    "Set networking and authentication parameters for RPC\n"
-    "Please refer to the documentation for a list of options.");
+static int
+RquotaServer_QueryLocal(const T_RQUOTA_EXPORT * exp, int id, int is_grpquota,
+                        T_QUOTA_QUERY_RESULT * qres)
+{
+    const char * err_str;
+    uint64_t t_start = qstat_now();
 
-static PyObject *
-Quota_rpc_opt(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
+    int err = Quota_query_local(exp->dev_fs_type, exp->qcarg, id, is_grpquota, FALSE,
+                                qres, &err_str);
+    int errno_bak = errno;
+
+    qstat_record(&qstat_backend[FsQuota_StatsBackend(exp->dev_fs_type)].op[QSTAT_OP_QUERY],
+                 t_start, qstat_now(), (err ? errno_bak : 0));
+    errno = errno_bak;
+    return err;
+}
+
+//
+// Callback invoked by server threads for answering a quota query
+// (possibly concurrently). Only local file systems are served.
+//
+static int
+RquotaServer_QueryCb(void * ctx, const char * path, int qtype, int id, getquota_rslt * rslt)
 {
-    PyObject * RETVAL = Py_None;
-#ifndef NO_RPC
-    static char * kwlist[] = {"rpc_port", "rpc_use_tcp", "rpc_timeout",
-                              "auth_uid", "auth_gid", "auth_hostname", NULL};
-    char * p_hostname = NULL;
+    RquotaServer_ObjectType * self = (RquotaServer_ObjectType *) ctx;
+    const T_RQUOTA_EXPORT * exp = RquotaServer_GetExport(self, path);
+    T_QUOTA_QUERY_RESULT qres;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$IpIiis", kwlist,
-                                     &self->m_rpc_opt.port,
-                                     &self->m_rpc_opt.use_tcp,
-                                     &self->m_rpc_opt.timeout,
-                                     &self->m_rpc_opt.auth_uid,
-                                     &self->m_rpc_opt.auth_gid,
-                                     &p_hostname
-                                    ))
-    {
-        return NULL;
-    }
+    memset(rslt, 0, sizeof(*rslt));
 
-    if ((self->m_rpc_opt.auth_uid < 0) && (self->m_rpc_opt.auth_gid >= 0))
+    if ((exp == NULL) ||
+        ((qtype != GQA_TYPE_USR) && (qtype != GQA_TYPE_GRP)))
     {
-        self->m_rpc_opt.auth_uid = getuid();
+        rslt->GQR_STATUS = Q_NOQUOTA;
     }
-
-    if ((self->m_rpc_opt.auth_gid < 0) && (self->m_rpc_opt.auth_uid >= 0))
+    else if (RquotaServer_QueryLocal(exp, id, (qtype == GQA_TYPE_GRP), &qres) != 0)
     {
-        self->m_rpc_opt.auth_gid = getgid();
+        rslt->GQR_STATUS = ((errno == EPERM) || (errno == EACCES)) ? Q_EPERM : Q_NOQUOTA;
     }
-
-    if ((p_hostname != NULL) && (*p_hostname != 0))
+    else
     {
-        if (strlen(p_hostname) < MAX_MACHINE_NAME)
-        {
-            strcpy(self->m_rpc_opt.auth_hostname, p_hostname);
-        }
-        else
+        struct rquota * rq = &rslt->GQR_RQUOTA;
+        time_t now = time(NULL);
+        int bsize = DEV_QBSIZE;
+
+        // scale block size so that block counts fit into 32-bit XDR fields
+        while ((qres.bhard > UINT32_MAX) || (qres.bsoft > UINT32_MAX) || (qres.bcur > UINT32_MAX))
         {
-            RETVAL = FsQuota_OsException(ENAMETOOLONG, "hostname is too long", p_hostname);
+            qres.bhard >>= 1;
+            qres.bsoft >>= 1;
+            qres.bcur >>= 1;
+            bsize <<= 1;
         }
+        rslt->GQR_STATUS = Q_OK;
+        rq->rq_bsize = bsize;
+        rq->rq_active = TRUE;
+        rq->rq_bhardlimit = qres.bhard;
+        rq->rq_bsoftlimit = qres.bsoft;
+        rq->rq_curblocks = qres.bcur;
+        rq->rq_fhardlimit = (qres.fhard > UINT32_MAX) ? UINT32_MAX : qres.fhard;
+        rq->rq_fsoftlimit = (qres.fsoft > UINT32_MAX) ? UINT32_MAX : qres.fsoft;
+        rq->rq_curfiles = (qres.fcur > UINT32_MAX) ? UINT32_MAX : qres.fcur;
+        // the protocol defines times relative to the current time; as the
+        // fields are unsigned, expired grace times are reported as zero
+        rq->rq_btimeleft = (qres.btime > now) ? (u_int)(qres.btime - now) : 0;
+        rq->rq_ftimeleft = (qres.ftime > now) ? (u_int)(qres.ftime - now) : 0;
     }
-    else if (self->m_rpc_opt.auth_uid >= 0)
+    return 0;
+}
+
+//
+// Callback invoked by server threads in proxy mode: the request is forwarded
+// to the upstream server and the reply passed back unmodified. When the
+// upstream server does not respond, the request is dropped, so that the
+// client sees the same behavior as if it had addressed the server directly.
+//
+static int
+RquotaServer_ProxyCb(void * ctx, const char * path, int qtype, int id, getquota_rslt * rslt)
+{
+    RquotaServer_ObjectType * self = (RquotaServer_ObjectType *) ctx;
+    char * rpc_err_str = NULL;
+
+    if ((qtype != GQA_TYPE_USR) && (qtype != GQA_TYPE_GRP))
     {
-        if (gethostname(self->m_rpc_opt.auth_hostname, MAX_MACHINE_NAME) != 0)
-        {
-            RETVAL = FsQuota_OsException(errno, "gethostname", NULL);
-        }
+        memset(rslt, 0, sizeof(*rslt));
+        rslt->GQR_STATUS = Q_NOQUOTA;
+        return 0;
     }
-#endif
-
-    return RETVAL;
+    return getnfsquota_rpc(&self->m_upstream_addr, (char*)path, id, (qtype == GQA_TYPE_GRP),
+                           &self->m_rpc_opt, NULL, &rpc_err_str, rslt);
 }
 
 //
-// Allocate a new "Quota" object and initialize the C state struct
+// Callback invoked periodically by the thread blocked in serve(), for
+// allowing Python signal handlers to run (e.g. KeyboardInterrupt)
 //
-static PyObject *
-Quota_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+static int
+RquotaServer_IdleCb(void * ctx)
 {
-    Quota_ObjectType *self;
-    self = (Quota_ObjectType *) type->tp_alloc(type, 0);
+    RquotaServer_ObjectType * self = (RquotaServer_ObjectType *) ctx;
+    int stop;
 
-#ifndef NO_RPC
-    self->m_rpc_opt.timeout = RPC_DEFAULT_TIMEOUT;
-    self->m_rpc_opt.auth_uid = RPC_AUTH_UGID_NON_INIT;
-    self->m_rpc_opt.auth_gid = RPC_AUTH_UGID_NON_INIT;
-#endif
+    PyEval_RestoreThread(self->m_thread_state);
+    stop = (PyErr_CheckSignals() != 0);
+    self->m_thread_state = PyEval_SaveThread();
 
-    return (PyObject *) self;
+    return stop;
 }
 
 //
-// De-allocate a "Quota" object and internal resources
+// Implementation of the RquotaServer.serve() method
 //
-static void
-Quota_dealloc(Quota_ObjectType *self)
+PyDoc_STRVAR(RquotaServer_serve__doc__,
+    "serve()\n\n"
+    "Serve requests until stop() is called or a signal handler raises an "
+    "exception.");
+
+static PyObject *
+RquotaServer_serve(RquotaServer_ObjectType *self, PyObject *args)
 {
-    if (self->m_path != NULL)
+    if (!PyArg_ParseTuple(args, ""))
     {
-        free(self->m_path);
+        return NULL;
     }
-    if (self->m_qcarg != NULL)
+    if (self->m_srv == NULL)
     {
-        free(self->m_qcarg);
+        return FsQuota_OsException(EINVAL, "FsQuota.RquotaServer instance is uninitialized", NULL);
     }
-    if (self->m_rpc_host != NULL)
+    if (self->m_serving)
     {
-        free(self->m_rpc_host);
+        return FsQuota_OsException(EBUSY, "serve() already running", NULL);
     }
 
-    Py_TYPE(self)->tp_free((PyObject *) self);
+    self->m_serving = TRUE;
+    self->m_thread_state = PyEval_SaveThread();
+    int err = rqsrv_run(self->m_srv, RquotaServer_IdleCb, self);
+    int errno_bak = errno;
+    PyEval_RestoreThread(self->m_thread_state);
+    self->m_thread_state = NULL;
+    self->m_serving = FALSE;
+
+    if (PyErr_Occurred())
+    {
+        return NULL;
+    }
+    if (err != 0)
+    {
+        return FsQuota_OsException(errno_bak, "rquota server", NULL);
+    }
+    Py_RETURN_NONE;
 }
 
 //
-// Implementation of the standard "__init__" function: Usually called after
-// "new"; may be called again to re-initialize the object.
+// Implementation of the RquotaServer.stop() method
 //
-static int
-Quota_init(Quota_ObjectType *self, PyObject *args, PyObject *kwds)
-{
-    static char * kwlist[] = {"path", "rpc_host", NULL};
-    char * p_path = NULL;
-    char * p_rpc_host = NULL;
+PyDoc_STRVAR(RquotaServer_stop__doc__,
+    "stop()\n\n"
+    "Request termination of serve(), which returns within a fraction of "
+    "a second. When serve() is not running yet, the next call returns "
+    "immediately.");
 
-    // reset state in case the module is already initialized
-    if (self->m_path != NULL)
+static PyObject *
+RquotaServer_stop(RquotaServer_ObjectType *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ""))
     {
-        free(self->m_path);
-        self->m_path = NULL;
+        return NULL;
     }
-    if (self->m_qcarg != NULL)
+    if (self->m_srv != NULL)
     {
-        free(self->m_qcarg);
-        self->m_qcarg = NULL;
+        rqsrv_stop(self->m_srv);
     }
-    if (self->m_rpc_host != NULL)
+    Py_RETURN_NONE;
+}
+
+//
+// Implementation of the RquotaServer.cache_stats() method
+//
+PyDoc_STRVAR(RquotaServer_cache_stats__doc__,
+    "cache_stats() -> (hits, misses, coalesced)\n\n"
+    "Return the number of requests answered from the cache, the number of "
+    "requests passed to the backend, and the number of requests that "
+    "waited for an identical request already in progress.");
+
+static PyObject *
+RquotaServer_cache_stats(RquotaServer_ObjectType *self, PyObject *args)
+{
+    T_RQSRV_STATS stats;
+
+    if (!PyArg_ParseTuple(args, ""))
     {
-        free(self->m_rpc_host);
-        self->m_rpc_host = NULL;
+        return NULL;
     }
-    self->m_dev_fs_type = QUOTA_DEV_INVALID;
+    if (self->m_srv == NULL)
+    {
+        return FsQuota_OsException(EINVAL, "FsQuota.RquotaServer instance is uninitialized", NULL);
+    }
+    rqsrv_get_stats(self->m_srv, &stats);
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|s", kwlist,
-                                     &p_path, &p_rpc_host))
+    return Py_BuildValue("(kkk)", stats.hits, stats.misses, stats.coalesced);
+}
+
+//
+// Implementation of the RquotaServer.exports() method
+//
+PyDoc_STRVAR(RquotaServer_exports__doc__,
+    "exports() -> list\n\n"
+    "Return the mount points of the local file systems served, as "
+    "determined upon construction.");
+
+static PyObject *
+RquotaServer_exports(RquotaServer_ObjectType *self, PyObject *args)
+{
+    const T_RQUOTA_EXPORT * exp;
+
+    if (!PyArg_ParseTuple(args, ""))
     {
-        return -1;
+        return NULL;
     }
-
-    if (p_rpc_host != NULL)
+    PyObject * RETVAL = PyList_New(0);
+    if (RETVAL == NULL)
     {
-#ifndef NO_RPC
-        self->m_rpc_host = strdup(p_rpc_host);
-        self->m_qcarg = strdup(p_path);
-        self->m_path = strdup("n/a");
-        self->m_dev_fs_type = QUOTA_DEV_NFS;
-#else
-        FsQuota_QuotaCtlException(self, ENOTSUP, "RPC not supported for this platform");
-        return -1;
-#endif
+        return NULL;
     }
-    else
+    for (exp = self->m_exports; exp != NULL; exp = exp->next)
     {
-        // dup is needed as the string buffer lives only as long as object passed as parameter
-        self->m_path = strdup(p_path);
-
-        if (Quota_setqcarg(self) != 0)
+        if ((exp->dev_fs_type != QUOTA_DEV_INVALID) && (exp->dev_fs_type != QUOTA_DEV_NFS))
         {
-            return -1;
+            PyObject * path = PyUnicode_DecodeFSDefault(exp->path);
+            if ((path == NULL) || (PyList_Append(RETVAL, path) != 0))
+            {
+                Py_XDECREF(path);
+                Py_DECREF(RETVAL);
+                return NULL;
+            }
+            Py_DECREF(path);
         }
     }
-
-    return 0;
+    return RETVAL;
 }
 
 //
-// Implementation of the standard "repr" function: Returns a "string
-// representation" of the object. Should include all parameters.
+// Free the server state and the path mapping cache
 //
-static PyObject *
-Quota_Repr(Quota_ObjectType *self)
+static void
+RquotaServer_Free(RquotaServer_ObjectType *self)
 {
-    if (self->m_dev_fs_type == QUOTA_DEV_INVALID)
+    if (self->m_srv != NULL)
     {
-        return PyUnicode_FromString("<FsQuota.Quota()>");
+        rqsrv_destroy(self->m_srv);
+        self->m_srv = NULL;
     }
-#ifndef NO_RPC
-    else if (self->m_dev_fs_type == QUOTA_DEV_NFS)
+    if (self->m_upstream != NULL)
     {
-        return PyUnicode_FromFormat("<FsQuota.Quota(%s), qcarg=%s:%s, special:NFS, "
-                                    "use_tcp:%d, port:%d, timeout:%d, "
-                                    "auth_uid:%d, auth_gid:%d, auth_hostname:%s>",
-                                    self->m_path, self->m_rpc_host, self->m_qcarg,
-                                    self->m_rpc_opt.port,
-                                    self->m_rpc_opt.use_tcp,
-                                    self->m_rpc_opt.timeout,
-                                    self->m_rpc_opt.auth_uid,
-                                    self->m_rpc_opt.auth_gid,
-                                    self->m_rpc_opt.auth_hostname
-                                    );
+        free(self->m_upstream);
+        self->m_upstream = NULL;
     }
-#endif
-    else
+    while (self->m_exports != NULL)
     {
-        const char * typn;
-        switch (self->m_dev_fs_type)
+        T_RQUOTA_EXPORT * exp = self->m_exports;
+        self->m_exports = exp->next;
+        free(exp->path);
+        if (exp->qcarg != NULL)
         {
-            case QUOTA_DEV_NFS:  typn = "NFS"; break;  // never reached, handled above
-            case QUOTA_DEV_XFS:  typn = "XFS"; break;
-            case QUOTA_DEV_VXFS: typn = "VXFS"; break;
-            case QUOTA_DEV_AFS:  typn = "AFS"; break;
-            case QUOTA_DEV_JFS2: typn = "JFS2"; break;
-            default:             typn = "no"; break;
+            free(exp->qcarg);
         }
-        return PyUnicode_FromFormat("<FsQuota.Quota(%s), qcarg=%s, special:%s>",
-                                    self->m_path, self->m_qcarg, typn);
+        free(exp);
     }
 }
 
 //
-// Implementation of the standard "__getattr__" function: This function adds
-// "virtual" attributes "dev" and "is_nfs" on top of the regular attributes
-// returned by the generic handler of this interface.
+// Allocate a new "RquotaServer" object
 //
 static PyObject *
-Quota_GetAttr(Quota_ObjectType *self, PyObject * attr)
+RquotaServer_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
-    PyObject * RETVAL = PyObject_GenericGetAttr((PyObject*)self, attr);
-    if (RETVAL == NULL)
+    RquotaServer_ObjectType *self;
+    self = (RquotaServer_ObjectType *) type->tp_alloc(type, 0);
+
+    return (PyObject *) self;
+}
+
+//
+// De-allocate a "RquotaServer" object and internal resources
+//
+static void
+RquotaServer_dealloc(RquotaServer_ObjectType *self)
+{
+    RquotaServer_Free(self);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+//
+// Implementation of the standard "__init__" function: create the socket and
+// optionally register at the portmapper.
+//
+static int
+RquotaServer_init(RquotaServer_ObjectType *self, PyObject *args, PyObject *kwds)
+{
+    static char * kwlist[] = {"port", "threads", "cache_ttl", "register",
+                              "upstream", "upstream_port", "upstream_use_tcp",
+                              "upstream_timeout", NULL};
+    unsigned port = 0;
+    unsigned thread_cnt = RQUOTA_SERVER_DEFAULT_THREADS;
+    unsigned cache_ttl = RQUOTA_SERVER_DEFAULT_CACHE_TTL;
+    int do_register = TRUE;
+    char * p_upstream = NULL;
+    T_QUOTA_RPC_OPT rpc_opt;
+
+    memset(&rpc_opt, 0, sizeof(rpc_opt));
+    rpc_opt.timeout = RPC_DEFAULT_TIMEOUT;
+    rpc_opt.auth_uid = RPC_AUTH_UGID_NON_INIT;
+    rpc_opt.auth_gid = RPC_AUTH_UGID_NON_INIT;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$IIIpzIpI", kwlist,
+                                     &port, &thread_cnt, &cache_ttl, &do_register,
+                                     &p_upstream, &rpc_opt.port, &rpc_opt.use_tcp,
+                                     &rpc_opt.timeout))
     {
-        if (PyUnicode_Check(attr) == 1)
+        return -1;
+    }
+    if (self->m_serving)
+    {
+        FsQuota_OsException(EBUSY, "cannot re-initialize while serving", NULL);
+        return -1;
+    }
+    RquotaServer_Free(self);
+
+    self->m_rpc_opt = rpc_opt;
+    if (p_upstream != NULL)
+    {
+        char * rpc_err_str = NULL;
+
+        // resolve once here, as the lookup is not reentrant
+        if (rpc_resolve_host(p_upstream, &self->m_rpc_opt, &self->m_upstream_addr, &rpc_err_str) != 0)
         {
-            if (strcmp("dev", PyUnicode_AsUTF8(attr)) == 0)
-            {
-                PyErr_Clear();
-                if (self->m_rpc_host != NULL)
-                    RETVAL = PyUnicode_FromFormat("%s:%s", self->m_rpc_host, self->m_qcarg);
-                else if (self->m_qcarg != NULL)
-                    RETVAL = PyUnicode_FromString(self->m_qcarg);
-            }
-            else if (strcmp("is_nfs", PyUnicode_AsUTF8(attr)) == 0)
-            {
-                PyErr_Clear();
-                RETVAL = PyLong_FromLong(self->m_dev_fs_type == QUOTA_DEV_NFS);
-            }
+            FsQuota_OsException(EHOSTUNREACH, rpc_err_str, p_upstream);
+            return -1;
         }
+        self->m_upstream = strdup(p_upstream);
     }
-    return RETVAL;
+    else if (RquotaServer_ScanExports(self) != 0)
+    {
+        FsQuota_OsException(errno, "failed to scan the mount table", NULL);
+        RquotaServer_Free(self);
+        return -1;
+    }
+
+    self->m_srv = rqsrv_create(port, thread_cnt, cache_ttl,
+                               ((self->m_upstream != NULL) ? RquotaServer_ProxyCb
+                                                           : RquotaServer_QueryCb),
+                               self);
+    if (self->m_srv == NULL)
+    {
+        FsQuota_OsException(errno, "failed to create server socket", NULL);
+        return -1;
+    }
+    self->m_port = rqsrv_get_port(self->m_srv);
+
+    if (do_register && (rqsrv_register(self->m_srv) != 0))
+    {
+        RquotaServer_Free(self);
+        FsQuota_OsException(EIO, "failed to register at portmapper", NULL);
+        return -1;
+    }
+    return 0;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-static PyMethodDef Quota_MethodsDef[] =
+static PyMethodDef RquotaServer_MethodsDef[] =
 {
-    {"query",     (PyCFunction) Quota_query,     METH_VARARGS | METH_KEYWORDS, Quota_query__doc__ },
-    {"setqlim",   (PyCFunction) Quota_setqlim,   METH_VARARGS | METH_KEYWORDS, Quota_setqlim__doc__ },
-    {"sync",      (PyCFunction) Quota_sync,      METH_VARARGS,                 Quota_sync__doc__ },
-    {"rpc_opt",   (PyCFunction) Quota_rpc_opt,   METH_VARARGS | METH_KEYWORDS, Quota_rpc_opt__doc__ },
+    {"serve",     (PyCFunction) RquotaServer_serve,  METH_VARARGS, RquotaServer_serve__doc__ },
+    {"stop",      (PyCFunction) RquotaServer_stop,   METH_VARARGS, RquotaServer_stop__doc__ },
+    {"cache_stats", (PyCFunction) RquotaServer_cache_stats, METH_VARARGS, RquotaServer_cache_stats__doc__ },
+    {"exports",   (PyCFunction) RquotaServer_exports, METH_VARARGS, RquotaServer_exports__doc__ },
     {NULL}  /* Sentinel */
 };
 
-static PyTypeObject QuotaTypeDef =
-{
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "FsQuota.Quota",
-    .tp_doc = PyDoc_STR("Class providing access to file-system quota"),
-    .tp_basicsize = sizeof(Quota_ObjectType),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = Quota_new,
-    .tp_init = (initproc) Quota_init,
-    .tp_dealloc = (destructor) Quota_dealloc,
-    .tp_repr = (PyObject * (*)(PyObject*)) Quota_Repr,
-    .tp_getattro = (PyObject * (*)(PyObject*, PyObject*))Quota_GetAttr,
-    .tp_methods = Quota_MethodsDef,
-    //.tp_members = Quota_Members,
-};
-
-static PyStructSequence_Field QuotaQueryType_Members[] =
+static PyMemberDef RquotaServer_Members[] =
 {
-    { "bcount", PyDoc_STR("Number of blocks currently used") },
-    { "bsoft",  PyDoc_STR("Soft limit for block count (or 0 if none)") },
-    { "bhard",  PyDoc_STR("Hard limit for block count (or 0 if none)") },
-    { "btime",  PyDoc_STR("Time when an exceeded soft block limit turns into "
-                          "a hard limit (or n/a when not exceeded)") },
-    { "icount", PyDoc_STR("Number of inodes (i.e. files) currently used") },
-    { "isoft",  PyDoc_STR("Soft limit for inode count (or 0 if none)") },
-    { "ihard",  PyDoc_STR("Hard limit for inode count (or 0 if none)") },
-    { "itime",  PyDoc_STR("Time when an exceeded soft inode limit turns into "
-                          "a hard limit (or n/a when not exceeded)") },
-    { NULL, NULL }
+    {"port", T_UINT, offsetof(RquotaServer_ObjectType, m_port), READONLY,
+     PyDoc_STR("UDP port used by the server")},
+    {NULL}  /* Sentinel */
 };
 
-static PyStructSequence_Desc QuotaQuery_Desc =
+static PyTypeObject RquotaServerTypeDef =
 {
-    "FsQuota.QueryResult",
-    PyDoc_STR("Named tuple type returned by Quota.query(), containing quota usage and limits"),
-    QuotaQueryType_Members,
-    8
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "FsQuota.RquotaServer",
+    .tp_doc = PyDoc_STR("Class implementing an rquotad server for local file systems, or a caching proxy"),
+    .tp_basicsize = sizeof(RquotaServer_ObjectType),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = RquotaServer_new,
+    .tp_init = (initproc) RquotaServer_init,
+    .tp_dealloc = (destructor) RquotaServer_dealloc,
+    .tp_methods = RquotaServer_MethodsDef,
+    .tp_members = RquotaServer_Members,
 };
 
+#endif /* RQUOTA_SERVER */
 
 // ----------------------------------------------------------------------------
-// Sub-functions for iterating across the mount table
-
-typedef struct
-{
-    const char * fsname;
-    const char * path;
-    const char * fstyp;
-    const char * fsopt;
-} T_MY_MNTENT_BUF;
+//   Module functions
+// ----------------------------------------------------------------------------
 
 //
-// Portable setmntent(): This function must be called once at the start of
-// iteration.
+// Implementation of the FsQuota.stats() function
 //
-int
-my_setmntent(T_MY_MNTENT_STATE * state)
-{
-    int RETVAL = 0;
+PyDoc_STRVAR(FsQuota_stats__doc__,
+    "stats(*, reset=False) -> dict\n\n"
+    "Return process-wide performance counters, per access method.\n"
+    "Please refer to the documentation for a description of the content. "
+    "When reset is True, counters are set to zero after reading.");
 
-#ifndef AIX
-#ifndef NO_MNTENT
-#ifndef NO_OPEN_MNTTAB
-    if (state->mtab != NULL) endmntent(state->mtab);
-    if ((state->mtab = setmntent(MOUNTED, "r")) == NULL)
-#else
-    if (state->mtab != NULL) fclose(state->mtab);
-    if ((state->mtab = fopen (MOUNTED,"r")) == NULL)
-#endif
-        RETVAL = -1;
-    else
-        RETVAL = 0;
-#else /* NO_MNTENT */
+static PyObject *
+FsQuota_stats(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    int     do_reset = FALSE;
 
-    // if (state->mtab != NULL) free(state->mtab);
-    state->mtab_size = getmntinfo(&state->mtab, MNT_NOWAIT);
-    RETVAL = ((state->mtab_size <= 0) ? -1 : 0);
-    state->mntp = state->mtab;
-#endif
-#else /* AIX */
-    int count, space;
+    static char * kwlist[] = {"reset", NULL};
 
-    if (state->mtab != NULL)
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$p", kwlist, &do_reset))
     {
-        free(state->mtab);
+        return NULL;
     }
 
-    count = mntctl(MCTL_QUERY, sizeof(space), (char *) &space);
-    if (count == 0)
+    PyObject * RETVAL = PyDict_New();
+    if ((RETVAL != NULL) &&
+        ((FsQuota_DictSetNew(RETVAL, "vfs", FsQuota_BuildStatsSet(&qstat_backend[QSTAT_BE_VFS], FALSE)) != 0) ||
+         (FsQuota_DictSetNew(RETVAL, "xfs", FsQuota_BuildStatsSet(&qstat_backend[QSTAT_BE_XFS], FALSE)) != 0) ||
+         (FsQuota_DictSetNew(RETVAL, "btrfs", FsQuota_BuildStatsSet(&qstat_backend[QSTAT_BE_BTRFS], FALSE)) != 0) ||
+         (FsQuota_DictSetNew(RETVAL, "rpc", FsQuota_BuildStatsSet(&qstat_backend[QSTAT_BE_RPC], TRUE)) != 0) ||
+         (FsQuota_DictSetNew(RETVAL, "mntscan", FsQuota_BuildStatsLat(&qstat_mntscan)) != 0)))
     {
-        state->mtab = (struct vmount *) malloc(space);
-        if (state->mtab != NULL)
-        {
-            count = mntctl(MCTL_QUERY, space, (char *) state->mtab);
-            if (count > 0)
-            {
-                state->aix_mtab_count = count;
-                state->aix_mtab_idx   = 0;
-                RETVAL = 0;
-            }
-            else  // error, or size changed between calls
-            {
-                if (count == 0) errno = EINTR;
-                RETVAL = -1;
-            }
-        }
-        else
-        {
-            RETVAL = -1;
-        }
+        Py_CLEAR(RETVAL);
     }
-    else if (count < 0)
+    if ((RETVAL != NULL) && do_reset)
     {
-        RETVAL = -1;
+        for (unsigned idx = 0; idx < QSTAT_BE_COUNT; idx++)
+        {
+            qstat_reset_set(&qstat_backend[idx]);
+        }
+        qstat_reset_lat(&qstat_mntscan);
     }
-    else  // should never happen
+    return RETVAL;
+}
+
+//
+// Per file system state of FsQuota.aggregate()
+//
+typedef struct
+{
+    T_QUOTA_DEV_FS_TYPE dev_fs_type;    // copied from the Quota objects, as these
+    char *              qcarg;          // may be re-initialized meanwhile
+    T_QAGG_SOURCE       src;
+    T_QUOTA_ERROR       err;
+} T_QUOTA_AGG_FS;
+
+typedef struct
+{
+    T_QUOTA_AGG_FS *    fs;
+    int                 is_grpquota;
+    int                 is_prjquota;
+} T_QUOTA_AGG_JOB;
+
+// maximum number of file systems enumerated in parallel
+#define FSQUOTA_AGG_MAX_THREADS  8
+
+static int
+FsQuota_AggAddCb(void * ctx, uint32_t id, const T_QUOTA_QUERY_RESULT * rslt)
+{
+    return qagg_source_add((T_QAGG_SOURCE *) ctx, id, rslt->bcur, rslt->fcur);
+}
+
+static void
+FsQuota_AggWork(void * ctx, unsigned idx)
+{
+    T_QUOTA_AGG_JOB * job = (T_QUOTA_AGG_JOB *) ctx;
+    T_QUOTA_AGG_FS * fs = &job->fs[idx];
+
+    Quota_enum_local(fs->dev_fs_type, fs->qcarg, job->is_grpquota, job->is_prjquota,
+                     FsQuota_AggAddCb, &fs->src, &fs->err);
+}
+
+//
+// Helper function for FsQuota.aggregate(): return a read-only view on the
+// given bytes object, cast to the given element type. The reference to the
+// bytes object is stolen.
+//
+static PyObject *
+FsQuota_AggColumn(PyObject * bytes, const char * format)
+{
+    PyObject * RETVAL = NULL;
+
+    if (bytes != NULL)
     {
-        errno = ENOENT;
-        RETVAL = -1;
+        PyObject * view = PyMemoryView_FromObject(bytes);
+        if (view != NULL)
+        {
+            RETVAL = PyObject_CallMethod(view, "cast", "s", format);
+            Py_DECREF(view);
+        }
+        Py_DECREF(bytes);
     }
-#endif
     return RETVAL;
 }
 
 //
-// Portable getmntent(): This function fills the given buffers with string
-// pointers describing the next mount table entry. Note the strings are
-// located in static memory owned by the function and must not be freed by
-// the caller; they are invalidated upon the next call.
+// Implementation of the FsQuota.aggregate() function
 //
-int
-my_getmntent(T_MY_MNTENT_STATE * state, T_MY_MNTENT_BUF * str_buf)
+PyDoc_STRVAR(FsQuota_aggregate__doc__,
+    "aggregate(quotas, *, grpquota=False, prjquota=False) -> dict\n\n"
+    "Enumerate quota entries of all given FsQuota.Quota instances in "
+    "parallel, and return usage per ID summed across the file systems, plus "
+    "the breakdown per file system, in form of columns.\n\n"
+    "Please refer to the documentation for a description of the content. "
+    "Options select group or project quotas as for method Quota.query().");
+
+static PyObject *
+FsQuota_aggregate(PyObject *self, PyObject *args, PyObject *kwds)
 {
-    int RETVAL = -1;
-#ifndef AIX
-#ifndef NO_MNTENT
-#ifndef NO_OPEN_MNTTAB
-    struct mntent *mntp;
-    if (state->mtab != NULL)
+    PyObject * p_quotas = NULL;
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+
+    static char * kwlist[] = {"quotas", "grpquota", "prjquota", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$pp", kwlist,
+                                     &p_quotas, &is_grpquota, &is_prjquota))
     {
-        mntp = getmntent(state->mtab);
-        if (mntp != NULL)
-        {
-            str_buf->fsname = mntp->mnt_fsname;
-            str_buf->path = mntp->mnt_dir;
-            str_buf->fstyp = mntp->mnt_type;
-            str_buf->fsopt = mntp->mnt_opts;
-            RETVAL = 0;
-        }
+        return NULL;
     }
-    else
+
+    PyObject * seq = PySequence_Fast(p_quotas, "quotas must be an iterable of FsQuota.Quota");
+    if (seq == NULL)
     {
-        errno = EBADF;
+        return NULL;
     }
 
-#else /* NO_OPEN_MNTTAB */
-    struct mnttab mntp;
-    if (state->mtab != NULL)
+    Py_ssize_t fs_count = PySequence_Fast_GET_SIZE(seq);
+    T_QUOTA_AGG_FS * fs = PyMem_Calloc((fs_count > 0) ? fs_count : 1, sizeof(T_QUOTA_AGG_FS));
+    PyObject * RETVAL = NULL;
+    int ok = (fs != NULL);
+
+    if (!ok)
     {
-        if (getmntent(state->mtab, &mntp) == 0)
-        {
-            str_buf->fsname = mntp->mnt_special;
-            str_buf->path = mntp->mnt_mountp;
-            str_buf->fstyp = mntp->mnt_ftype;
-            str_buf->fsopt = mntp->mnt_mntopts;
-            RETVAL = 0;
-        }
+        PyErr_NoMemory();
     }
-
-#endif /* NO_OPEN_MNTTAB */
-#else /* NO_MNTENT */
-    if ((state->mtab != NULL) && state->mtab_size)
+    for (Py_ssize_t idx = 0; ok && (idx < fs_count); idx++)
     {
-        str_buf->fsname = state->mntp->f_mntfromname;
-        str_buf->path = state->mntp->f_mntonname;
-#ifdef OSF_QUOTA
-        char *fstype = getvfsbynumber((int)state->mntp->f_type);
-        if (fstype != (char *) -1)
+        PyObject * item = PySequence_Fast_GET_ITEM(seq, idx);
+        Quota_ObjectType * quota = (Quota_ObjectType *) item;
+
+        if (!PyObject_TypeCheck(item, &QuotaTypeDef))
         {
-            str_buf->fstyp = fstype;
+            PyErr_SetString(PyExc_TypeError, "quotas must be an iterable of FsQuota.Quota");
+            ok = FALSE;
+        }
+        else if (quota->m_dev_fs_type == QUOTA_DEV_INVALID)
+        {
+            FsQuota_QuotaCtlException(quota, EINVAL, "FsQuota.Quota instance is uninitialized");
+            ok = FALSE;
+        }
+        else if (qtrace_mode == QTRACE_REPLAY)
+        {
+            FsQuota_QuotaCtlException(quota, ENOTSUP, "Enumeration is not supported during trace replay");
+            ok = FALSE;
+        }
+        else if ((fs[idx].qcarg = strdup(quota->m_qcarg)) == NULL)
+        {
+            PyErr_NoMemory();
+            ok = FALSE;
         }
         else
-#endif
         {
-            str_buf->fstyp = state->mntp->f_fstypename;
+            fs[idx].dev_fs_type = quota->m_dev_fs_type;
+            qagg_source_init(&fs[idx].src);
         }
-        snprintf(state->str_mnt_flag, sizeof(state->str_mnt_flag),
-                        "%s%s%s%s%s%s%s",
-                        ((state->mntp->MNTINFO_FLAG_EL & MNT_LOCAL) ? "local" : "non-local"),
-                        ((state->mntp->MNTINFO_FLAG_EL & MNT_RDONLY) ? ",read-only" : ""),
-                        ((state->mntp->MNTINFO_FLAG_EL & MNT_SYNCHRONOUS) ? ",sync" : ""),
-                        ((state->mntp->MNTINFO_FLAG_EL & MNT_NOEXEC) ? ",noexec" : ""),
-                        ((state->mntp->MNTINFO_FLAG_EL & MNT_NOSUID) ? ",nosuid" : ""),
-                        ((state->mntp->MNTINFO_FLAG_EL & MNT_ASYNC) ? ",async" : ""),
-                        ((state->mntp->MNTINFO_FLAG_EL & MNT_QUOTA) ? ",quotas" : ""));
-        state->str_mnt_flag[sizeof(state->str_mnt_flag) - 1] = 0;
-        str_buf->fsopt = state->str_mnt_flag;
-        RETVAL = 0;
-
-        state->mtab_size--;
-        state->mntp++;
     }
-#endif
-#else /* AIX */
-    struct vmount *vmp;
-    char *cp;
-    int i;
 
-    if ((state->mtab != NULL) && (state->aix_mtab_idx < state->aix_mtab_count))
+    if (ok)
     {
-        cp = (char *) state->mtab;
-        for (i=0; i<state->aix_mtab_idx; i++)
+        T_QUOTA_AGG_JOB job = { fs, is_grpquota, is_prjquota };
+
+        // release the GIL, as enumerating may take a while for large tables
+        Py_BEGIN_ALLOW_THREADS
+        FsQuota_RunParallel(fs_count, FSQUOTA_AGG_MAX_THREADS, FsQuota_AggWork, &job);
+        Py_END_ALLOW_THREADS
+
+        for (Py_ssize_t idx = 0; ok && (idx < fs_count); idx++)
         {
-            vmp = (struct vmount *) cp;
-            cp += vmp->vmt_length;
+            if (fs[idx].err.errnum != 0)
+            {
+                FsQuota_RaiseError((Quota_ObjectType *) PySequence_Fast_GET_ITEM(seq, idx),
+                                   &fs[idx].err);
+                ok = FALSE;
+            }
         }
-        vmp = (struct vmount *) cp;
-        state->aix_mtab_idx += 1;
+    }
 
-        if ((vmp->vmt_gfstype != MNT_NFS) && (vmp->vmt_gfstype != MNT_NFS3))
+    if (ok)
+    {
+        T_QAGG_SOURCE * srcs = PyMem_Calloc((fs_count > 0) ? fs_count : 1, sizeof(T_QAGG_SOURCE));
+        uint64_t ** src_cols = PyMem_Calloc((fs_count > 0) ? 2 * fs_count : 1, sizeof(uint64_t *));
+        PyObject * fs_bcount = PyList_New(fs_count);
+        PyObject * fs_icount = PyList_New(fs_count);
+        PyObject * cols[4] = { NULL, NULL, NULL, NULL };
+        size_t count = 0;
+
+        if ((srcs == NULL) || (src_cols == NULL))
         {
-            cp = vmt2dataptr(vmp, VMT_OBJECT);
-            str_buf->fsname = cp;
+            PyErr_NoMemory();
         }
-        else
+        else if ((fs_bcount != NULL) && (fs_icount != NULL))
         {
-            uchar *mp, *cp2;
-            cp = vmt2dataptr(vmp, VMT_HOST);
-            cp2 = vmt2dataptr(vmp, VMT_OBJECT);
-            mp = malloc(strlen(cp) + strlen(cp2) + 2);
-            if (mp != NULL)
+            for (Py_ssize_t idx = 0; idx < fs_count; idx++)
             {
-                strcpy(mp, cp);
-                strcat(mp, ":");
-                strcat(mp, cp2);
-                str_buf->fsname = mp;
-                free(mp);
+                srcs[idx] = fs[idx].src;
             }
-            else
+            Py_BEGIN_ALLOW_THREADS
+            count = ((fs_count > 0) ? qagg_count(srcs, fs_count) : 0);
+            Py_END_ALLOW_THREADS
+
+            // result columns are allocated as bytes objects, which are filled without copying
+            cols[0] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+            cols[1] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+            cols[2] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+            cols[3] = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+
+            int cols_ok = (cols[0] != NULL) && (cols[1] != NULL) && (cols[2] != NULL) && (cols[3] != NULL);
+            for (Py_ssize_t idx = 0; cols_ok && (idx < fs_count); idx++)
             {
-                cp = "?";
-                str_buf->fsname = cp;
+                PyObject * bcol = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+                PyObject * icol = PyBytes_FromStringAndSize(NULL, count * sizeof(uint64_t));
+
+                if ((bcol != NULL) && (icol != NULL))
+                {
+                    src_cols[idx] = (uint64_t *) PyBytes_AS_STRING(bcol);
+                    src_cols[fs_count + idx] = (uint64_t *) PyBytes_AS_STRING(icol);
+                }
+                else
+                {
+                    cols_ok = FALSE;
+                }
+                PyList_SET_ITEM(fs_bcount, idx, bcol);
+                PyList_SET_ITEM(fs_icount, idx, icol);
             }
-        }
-        cp = vmt2dataptr(vmp, VMT_STUB);
-        str_buf->path = cp;
 
-        switch(vmp->vmt_gfstype)
+            if (cols_ok)
+            {
+                T_QAGG_RESULT res;
+
+                res.ids = (uint32_t *) PyBytes_AS_STRING(cols[0]);
+                res.bcount = (uint64_t *) PyBytes_AS_STRING(cols[1]);
+                res.icount = (uint64_t *) PyBytes_AS_STRING(cols[2]);
+                res.src_cnt = (uint32_t *) PyBytes_AS_STRING(cols[3]);
+                res.src_bcount = src_cols;
+                res.src_icount = src_cols + fs_count;
+
+                if (fs_count > 0)
+                {
+                    Py_BEGIN_ALLOW_THREADS
+                    qagg_merge(srcs, fs_count, &res);
+                    Py_END_ALLOW_THREADS
+                }
+
+                for (Py_ssize_t idx = 0; cols_ok && (idx < fs_count); idx++)
+                {
+                    PyObject * bview = FsQuota_AggColumn(PyList_GET_ITEM(fs_bcount, idx), "Q");
+                    PyObject * iview = FsQuota_AggColumn(PyList_GET_ITEM(fs_icount, idx), "Q");
+
+                    // references to the bytes objects were stolen
+                    PyList_SET_ITEM(fs_bcount, idx, bview);
+                    PyList_SET_ITEM(fs_icount, idx, iview);
+                    cols_ok = ((bview != NULL) && (iview != NULL));
+                }
+                if (cols_ok)
+                {
+                    RETVAL = Py_BuildValue("{s:N,s:N,s:N,s:N,s:O,s:O}",
+                                           "id", FsQuota_AggColumn(cols[0], "I"),
+                                           "bcount", FsQuota_AggColumn(cols[1], "Q"),
+                                           "icount", FsQuota_AggColumn(cols[2], "Q"),
+                                           "fs_count", FsQuota_AggColumn(cols[3], "I"),
+                                           "fs_bcount", fs_bcount,
+                                           "fs_icount", fs_icount);
+                    memset(cols, 0, sizeof(cols));
+                }
+            }
+        }
+        for (unsigned idx = 0; idx < 4; idx++)
         {
-            case MNT_NFS:   cp = "nfs"; break;
-            case MNT_NFS3:  cp = "nfs"; break;
-            case MNT_JFS:   cp = "jfs"; break;
-#if defined(MNT_AIX) && defined(MNT_J2) && (MNT_AIX==MNT_J2)
-            case MNT_J2:    cp = "jfs2"; break;
-#else
-#if defined(MNT_J2)
-            case MNT_J2:    cp = "jfs2"; break;
-#endif
-            case MNT_AIX:   cp = "aix"; break;
-#endif
-            case 4:         cp = "afs"; break;
-            case MNT_CDROM: cp = "cdrom,ignore"; break;
-            default:        cp = "unknown,ignore"; break;
+            Py_XDECREF(cols[idx]);
         }
-        str_buf->fstyp = cp;
-
-        cp = vmt2dataptr(vmp, VMT_ARGS);
-        str_buf->fsopt = cp;
-        RETVAL = 0;
+        Py_XDECREF(fs_bcount);
+        Py_XDECREF(fs_icount);
+        PyMem_Free(src_cols);
+        PyMem_Free(srcs);
     }
-#endif  /* AIX */
-    return RETVAL;
-}
 
-//
-// Portable endmntent(): This function end the iteration and frees resources
-// (if needed). This function should be called once for each call to
-// setmntent(). getmntent must not be called afterward.
-//
-void
-my_endmntent(T_MY_MNTENT_STATE * state)
-{
-    if (state->mtab != NULL)
+    for (Py_ssize_t idx = 0; (fs != NULL) && (idx < fs_count); idx++)
     {
-#ifndef AIX
-#ifndef NO_MNTENT
-#ifndef NO_OPEN_MNTTAB
-        endmntent(state->mtab);   // returns always 1 in SunOS
-#else
-        fclose (state->mtab);
-#endif
-        // else: if (state->mtab != NULL) free(state->mtab);
-#endif
-#else /* AIX */
-        free(state->mtab);
-#endif
-        state->mtab = NULL;
+        free(fs[idx].qcarg);
+        qagg_source_free(&fs[idx].src);
     }
+    PyMem_Free(fs);
+    Py_DECREF(seq);
+    return RETVAL;
 }
 
-// ----------------------------------------------------------------------------
-//   Class "MntTab"
-// ----------------------------------------------------------------------------
-
 //
-// Container for instance state variables
+// Implementation of the FsQuota.scan_tree() function
 //
-typedef struct
-{
-    PyObject_HEAD
-    T_MY_MNTENT_STATE mntent;   // transparent state used by my_getmntent()
-    int iterIndex;              // index tracking calls of __next__()
-} MntTab_ObjectType;
+PyDoc_STRVAR(FsQuota_scan_tree__doc__,
+    "scan_tree(path, *, threads=8, prjquota=False, progress=None, interval=1.0) -> dict\n\n"
+    "Determine usage per user and group (and project, if prjquota is set) "
+    "by walking the directory tree below the given path, for file systems "
+    "without quota support. Hard-linked files are counted once. The tree "
+    "is walked by the given number of threads. If given, progress is called "
+    "once per interval with a dict of counters. Returns a dict with the "
+    "final counters, the first error (if any) and for keys \"user\", "
+    "\"group\" and \"project\" a list of tuples of ID and "
+    "FsQuota.QueryResult, as returned by Quota.scan_usage().");
 
-//
-// Allocate a new object and initialize the iteration state.
-// Raise an exception if setmntent reports an error.
-//
 static PyObject *
-MntTab_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+FsQuota_scan_tree(PyObject *self, PyObject *args, PyObject *kwds)
 {
-    MntTab_ObjectType *self;
-    self = (MntTab_ObjectType *) type->tp_alloc(type, 0);
+    PyObject * p_path = NULL;
+    unsigned int threads = QUOTA_SCAN_DEFAULT_THREADS;
+    int     is_prjquota = FALSE;
+    PyObject * progress = NULL;
+    double  interval = 1.0;
 
-    if (my_setmntent(&self->mntent) != 0)
+    static char * kwlist[] = {"path", "threads", "prjquota", "progress", "interval", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|$IpOd", kwlist,
+                                     PyUnicode_FSConverter, &p_path,
+                                     &threads, &is_prjquota, &progress, &interval))
     {
-        Py_DECREF(self);
-        return FsQuota_OsException(errno, "setmntent", NULL);
+        return NULL;
     }
-    self->iterIndex = 0;
-    return (PyObject *) self;
-}
-
-//
-// De-allocate an object and internal resources
-//
-static void
-MntTab_dealloc(MntTab_ObjectType *self)
-{
-    my_endmntent(&self->mntent);
-
-    Py_TYPE(self)->tp_free((PyObject *) self);
-}
 
-//
-// Implementation of the standard "__init__" function: Usually called after
-// "new": in this case the function does nothing as initialization is already
-// done within "new"; may be called again to re-initialize the object: if
-// __next__() was called at least once, iteration is re-initialized.
-//
-static int
-MntTab_init(MntTab_ObjectType *self, PyObject *args, PyObject *kwds)
-{
-    char *kwlist[] = {NULL};
+    PyObject * RETVAL = NULL;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "", kwlist))
+    if ((threads < 1) || (threads > QTREE_MAX_THREADS) || !(interval > 0.0))
     {
-        return -1;
+        PyErr_SetString(PyExc_ValueError, "threads or interval is out of range");
     }
-
-    if (self->iterIndex != 0)
+    else if (progress && (progress != Py_None) && !PyCallable_Check(progress))
     {
-        // re-initialize iterator
-        if (my_setmntent(&self->mntent) != 0)
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+    }
+    else
+    {
+        T_QUSAGE_RESULT res;
+
+        RETVAL = FsQuota_WalkUsage(PyBytes_AS_STRING(p_path), threads, is_prjquota,
+                                   progress, interval, &res);
+        if (RETVAL != NULL)
         {
-            FsQuota_OsException(errno, "setmntent", NULL);
-            return -1;
+            if (FsQuota_DictSetUsage(RETVAL, &res, is_prjquota) != 0)
+            {
+                Py_CLEAR(RETVAL);
+            }
+            qusage_free(&res);
         }
-        self->iterIndex = 0;
     }
-
-    return 0;
+    Py_DECREF(p_path);
+    return RETVAL;
 }
 
 //
-// Implementation of the standard "repr" function: Returns a "string
-// representation" of the object. Should include all parameters; in this
-// case we can only show the iteration index.
+// Implementation of the FsQuota.prewarm_names() function
 //
+PyDoc_STRVAR(FsQuota_prewarm_names__doc__,
+    "prewarm_names(*, grpquota=False, prjquota=False) -> int\n\n"
+    "Load all entries of the user database (or group database, or "
+    "/etc/projid respectively) into the cache used for option names of "
+    "methods Quota.query_all() and query_bulk(), via a single pass over "
+    "the database. Returns the number of entries.");
+
 static PyObject *
-MntTab_Repr(MntTab_ObjectType *self)
+FsQuota_prewarm_names(PyObject *self, PyObject *args, PyObject *kwds)
 {
-    if (self->iterIndex >= 0)
+    int     is_grpquota = FALSE;
+    int     is_prjquota = FALSE;
+
+    static char * kwlist[] = {"grpquota", "prjquota", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$pp", kwlist,
+                                     &is_grpquota, &is_prjquota))
     {
-        return PyUnicode_FromFormat("<FsQuota.MntTab iterator at index %d>", self->iterIndex);
+        return NULL;
     }
-    else
+
+    size_t count = 0;
+    int result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = qnames_prewarm(FsQuota_NameKind(is_grpquota, is_prjquota), &count);
+    Py_END_ALLOW_THREADS
+
+    if (result != 0)
     {
-        return PyUnicode_FromFormat("<FsQuota.MntTab iterator at EOL>");
+        return FsQuota_OsException(errno, "reading name database", NULL);
     }
+    return PyLong_FromSize_t(count);
 }
 
 //
-// Implementation of the standard "__iter__" function: Simply returns a
-// reference to itself, as the object is already set up for iteration.
+// Implementation of the FsQuota.clear_names() function
 //
+PyDoc_STRVAR(FsQuota_clear_names__doc__,
+    "clear_names()\n\n"
+    "Discard all cached user, group and project names, so that changes of "
+    "the databases become visible.");
+
 static PyObject *
-MntTab_Iter(MntTab_ObjectType *self)
+FsQuota_clear_names(PyObject *self, PyObject *args)
 {
-    Py_INCREF(self);
-    return (PyObject *) self;
+    qnames_clear();
+    Py_RETURN_NONE;
 }
 
 //
-// Implementation of the standard "__next__" function: Call C getmntent() and
-// return the resulting strings in form of a tuple, or raise an exception upon
-// end of iteration.
+// Implementation of the FsQuota.trace_record() function
 //
+PyDoc_STRVAR(FsQuota_trace_record__doc__,
+    "trace_record(path)\n\n"
+    "Start recording all quota operations and mount table scans, including "
+    "their results and durations, into the given file.");
+
 static PyObject *
-MntTab_IterNext(MntTab_ObjectType *self)
+FsQuota_trace_record(PyObject *self, PyObject *args)
 {
-    T_MY_MNTENT_BUF str_buf;
-    PyObject * RETVAL = NULL;
+    char * p_path = NULL;
 
-    if ((self->iterIndex >= 0) && my_getmntent(&self->mntent, &str_buf) == 0)
+    if (!PyArg_ParseTuple(args, "s", &p_path))
     {
-        RETVAL = PyStructSequence_New(FsQuota_MntTabType);
-        if (str_buf.fsname != NULL)
-            PyStructSequence_SetItem(RETVAL, 0, PyUnicode_DecodeFSDefault(str_buf.fsname));
-        if (str_buf.path != NULL)
-            PyStructSequence_SetItem(RETVAL, 1, PyUnicode_DecodeFSDefault(str_buf.path));
-        if (str_buf.fstyp != NULL)
-            PyStructSequence_SetItem(RETVAL, 2, PyUnicode_DecodeFSDefault(str_buf.fstyp));
-        if (str_buf.fsopt != NULL)
-            PyStructSequence_SetItem(RETVAL, 3, PyUnicode_DecodeFSDefault(str_buf.fsopt));
-
-        self->iterIndex += 1;
+        return NULL;
     }
-    else
+
+    PyObject * RETVAL = Py_None;
+    const char * err_str = NULL;
+
+    if (qtrace_record_start(p_path, &err_str) != 0)
     {
-        PyErr_SetNone(PyExc_StopIteration);
-        self->iterIndex = -1;
+        RETVAL = FsQuota_OsException(errno, err_str, p_path);
     }
+    Py_XINCREF(RETVAL);  // reference for Py_None
     return RETVAL;
 }
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-static PyTypeObject MntTabTypeDef =
-{
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "FsQuota.MntTab",
-    .tp_doc = PyDoc_STR("Class providing iterator for the file-system mount table"),
-    .tp_basicsize = sizeof(MntTab_ObjectType),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = MntTab_new,
-    .tp_init = (initproc) MntTab_init,
-    .tp_dealloc = (destructor) MntTab_dealloc,
-    .tp_repr = (PyObject * (*)(PyObject*)) MntTab_Repr,
-    .tp_iter = (PyObject * (*)(PyObject*)) MntTab_Iter,
-    .tp_iternext = (PyObject * (*)(PyObject*)) MntTab_IterNext,
-    //.tp_members = MntTab_Members,
-    //.tp_methods = MntTab_MethodsDef,
-};
-
-static PyStructSequence_Field MntEntType_Members[] =
-{
-    { "mnt_fsname", PyDoc_STR("Name of the filesystem (e.g. device name)") },
-    { "mnt_dir",    PyDoc_STR("Filesystem path prefix (aka mount point)") },
-    { "mnt_type",   PyDoc_STR("Mount type (aka file system type)") },
-    { "mnt_opts",   PyDoc_STR("Mount options, separated by colon.") },
-    { NULL, NULL }
-};
-
-static PyStructSequence_Desc MntEntType_Desc =
-{
-    "FsQuota.MntEnt",
-    PyDoc_STR("Mount table entry type, as returned by iterator of class FsQuota.MntTab"),
-    MntEntType_Members,
-    4
-};
-
-// ----------------------------------------------------------------------------
 //
-//  Determine "device" argument for the "Quota" class methods
+// Implementation of the FsQuota.trace_replay() function
 //
+PyDoc_STRVAR(FsQuota_trace_replay__doc__,
+    "trace_replay(path, *, latency_scale=1.0)\n\n"
+    "Load a trace file created via trace_record() and serve all following "
+    "quota operations and mount table scans from it, delayed by the recorded "
+    "durations multiplied with the given factor.");
 
-static int
-Quota_setqcarg(Quota_ObjectType *self)
+static PyObject *
+FsQuota_trace_replay(PyObject *self, PyObject *args, PyObject *kwds)
 {
-    struct stat statbuf_target;  // keep complete struct for comparison b/c type of st_dev varies b/w platforms
-    struct stat statbuf_ent;
+    char * p_path = NULL;
+    double latency_scale = 1.0;
 
-    // determine device ID at the given path for later comparison with mount points
-    if (stat(self->m_path, &statbuf_target) != 0)
-    {
-        FsQuota_OsException(errno, "Failed to access path", self->m_path);
-        return -1;
-    }
+    static char * kwlist[] = {"path", "latency_scale", NULL};
 
-    T_MY_MNTENT_STATE l_mntab;
-    memset(&l_mntab, 0, sizeof(l_mntab));
-    if (my_setmntent(&l_mntab) != 0)
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|$d", kwlist, &p_path, &latency_scale))
     {
-        FsQuota_OsException(errno, "setmntent", NULL);
-        return -1;
+        return NULL;
     }
 
-    // loop to search the given path's entry in the mount table
-    T_MY_MNTENT_BUF mntent;
-    while (my_getmntent(&l_mntab, &mntent) == 0)
-    {
-        if ((strcmp(mntent.fstyp, "lofs") == 0) ||
-            (strcmp(mntent.fstyp, "ignore") == 0) ||
-            (strcmp(mntent.fstyp, "proc") == 0) ||
-            (strcmp(mntent.fstyp, "rootfs") == 0) ||
-            (strncmp(mntent.fstyp, "auto", 4) == 0) )
-        {
-            continue;
-        }
+    PyObject * RETVAL = Py_None;
+    const char * err_str = NULL;
 
-        // compare device ID of mount point with that of target path
-        if ((stat(mntent.path, &statbuf_ent) == 0) &&
-            (statbuf_target.st_dev == statbuf_ent.st_dev))
-        {
-            const char * p = NULL;
+    if (qtrace_replay_start(p_path, latency_scale, &err_str) != 0)
+    {
+        RETVAL = FsQuota_OsException(errno, err_str, p_path);
+    }
+    Py_XINCREF(RETVAL);  // reference for Py_None
+    return RETVAL;
+}
 
-            // NFS host:/path
-            if ((mntent.fsname[0] != '/') &&
-                ((p = strchr(mntent.fsname, ':')) != NULL) && (p[1] == '/'))
-            {
-#ifndef NO_RPC
-                self->m_rpc_host = strdup(mntent.fsname);
-                self->m_rpc_host[p - mntent.fsname] = 0;
-                self->m_qcarg = strdup(p + 1);
-                self->m_dev_fs_type = QUOTA_DEV_NFS;
-#endif
-            }
-            // NFS /path@host -> swap to "host:/path"
-            else if ((strncmp(mntent.fstyp, "nfs", 3) == 0) &&
-                     (mntent.fsname[0] == '/') &&
-                     ((p = strchr(mntent.fsname, '@')) != NULL) &&
-                     (strchr(p + 1, '/') == NULL) )
-            {
-#ifndef NO_RPC
-                self->m_qcarg = (char*) malloc(strlen(mntent.fsname) + 1 + 1);
-                sprintf(self->m_qcarg, "%s:%.*s", p + 1, (int)(p - mntent.fsname), mntent.fsname);
+//
+// Implementation of the FsQuota.trace_stop() function
+//
+PyDoc_STRVAR(FsQuota_trace_stop__doc__,
+    "trace_stop() -> dict\n\n"
+    "Stop recording or replay. Returns a dict with the number of records "
+    "written or replayed respectively, and the number of operations for "
+    "which no record was found during replay.");
 
-                self->m_qcarg = strdup(mntent.fsname);
-                self->m_qcarg[p - mntent.fsname] = 0;
-                self->m_rpc_host = strdup(p + 1);
-                self->m_dev_fs_type = QUOTA_DEV_NFS;
-#endif
-            }
-            else  // local device
-            {
-                self->m_dev_fs_type = QUOTA_DEV_REGULAR;
+static PyObject *
+FsQuota_trace_stop(PyObject *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ""))
+    {
+        return NULL;
+    }
 
-                // XFS, VxFS and AFS quotas require separate access methods
-#if defined (SGI_XFS)
-                // (optional for VxFS: later versions use 'normal' quota interface)
-                if (strcmp(mntent.fstyp, "xfs") == 0)
-                    self->m_dev_fs_type = QUOTA_DEV_XFS;
-#endif
-#if defined (SOLARIS_VXFS)
-                if (strcmp(mntent.fstyp, "vxfs") == 0)
-                    self->m_dev_fs_type = QUOTA_DEV_VXFS;
-#endif
-#ifdef AFSQUOTA
-                if ((strcmp(mntent.fstyp, "afs") == 0) && (strcmp(mntent.fsname, "AFS") == 0))
-                    self->m_dev_fs_type = QUOTA_DEV_AFS;
-#endif
-#if defined(HAVE_JFS2)
-                if (strcmp(mntent.fstyp, "jfs2") == 0)
-                    self->m_dev_fs_type = QUOTA_DEV_JFS2;
-#endif
+    PyObject * RETVAL;
+    unsigned long records;
+    unsigned long misses;
 
-#if defined(USE_IOCTL) || defined(QCARG_MNTPT)
-                // use mount point
-                self->m_qcarg = strdup(mntent.path);
-#elif defined(HAVE_JFS2) || defined(AIX) || defined(OSF_QUOTA)
-                // use path of any file in the file system
-                self->m_qcarg = strdup(target_path);
-#elif defined (Q_CTL_V2)
-                // use path of "quotas" file directly under fs root path
-                self->m_qcarg = (char *) malloc(strlen(mntent.path) + 7 + 1);
-                strcpy(self->m_qcarg, mntent.path);
-                strcat(self->m_qcarg, "/quotas");
-#else
-                // use device path
-                // check for special case: Linux mount -o loop
-                if (((p = strstr(mntent.fsopt, "loop=/dev/")) != NULL) &&
-                    ((p == mntent.fsopt) || (*(p - 1) == ',')))
-                {
-                    const char * pe = strchr(p, ',');
-                    if (pe != NULL)
-                    {
-                        self->m_qcarg = strdup(p);
-                        self->m_qcarg[pe - p] = 0;
-                    }
-                    else
-                    {
-                        self->m_qcarg = strdup(p);
-                    }
-                }
-                else
-                {
-                    self->m_qcarg = strdup(mntent.fsname);
-                }
-#endif
-            }
-            // getmntent loop done
-            break;
-        }
+    if (qtrace_stop(&records, &misses) == 0)
+    {
+        RETVAL = Py_BuildValue("{s:k,s:k}", "records", records, "misses", misses);
     }
-    my_endmntent(&l_mntab);
-
-    if (self->m_qcarg == NULL)
+    else
     {
-        FsQuota_OsException(EINVAL, "Mount path not found or device unsupported", self->m_qcarg);
-        self->m_dev_fs_type = QUOTA_DEV_INVALID;
-        return -1;
+        RETVAL = FsQuota_OsException(errno, "writing trace file", NULL);
     }
-    return 0;
+    return RETVAL;
 }
 
+static PyMethodDef FsQuota_Methods[] =
+{
+    {"stats",     (PyCFunction) FsQuota_stats,   METH_VARARGS | METH_KEYWORDS, FsQuota_stats__doc__ },
+    {"aggregate", (PyCFunction) FsQuota_aggregate, METH_VARARGS | METH_KEYWORDS, FsQuota_aggregate__doc__ },
+    {"scan_tree", (PyCFunction) FsQuota_scan_tree, METH_VARARGS | METH_KEYWORDS, FsQuota_scan_tree__doc__ },
+    {"prewarm_names", (PyCFunction) FsQuota_prewarm_names, METH_VARARGS | METH_KEYWORDS, FsQuota_prewarm_names__doc__ },
+    {"clear_names", (PyCFunction) FsQuota_clear_names, METH_NOARGS, FsQuota_clear_names__doc__ },
+    {"trace_record", (PyCFunction) FsQuota_trace_record, METH_VARARGS, FsQuota_trace_record__doc__ },
+    {"trace_replay", (PyCFunction) FsQuota_trace_replay, METH_VARARGS | METH_KEYWORDS, FsQuota_trace_replay__doc__ },
+    {"trace_stop", (PyCFunction) FsQuota_trace_stop, METH_VARARGS, FsQuota_trace_stop__doc__ },
+    {NULL}  /* Sentinel */
+};
+
 // ----------------------------------------------------------------------------
 // Top-level definition of the module
-// - the module only contains the two classes, but no methods directly
 
 static struct PyModuleDef FsQuota_module =
 {
@@ -2102,17 +8789,30 @@ static struct PyModuleDef FsQuota_module =
     .m_name = "FsQuota",
     .m_doc = PyDoc_STR("The FsQuota module provides the Quota and MntTab classes"),
     .m_size = -1,
-    //.m_methods = FsQuota_Methods
+    .m_methods = FsQuota_Methods
 };
 
 PyMODINIT_FUNC
 PyInit_FsQuota(void)
 {
     if ((PyType_Ready(&QuotaTypeDef) < 0) ||
-        (PyType_Ready(&MntTabTypeDef) < 0))
+        (PyType_Ready(&MntTabTypeDef) < 0) ||
+        (PyType_Ready(&QuotaIterTypeDef) < 0))
+    {
+        return NULL;
+    }
+    if ((PyType_Ready(&SnapshotTypeDef) < 0) ||
+        (PyType_Ready(&DeltaScannerTypeDef) < 0) ||
+        (PyType_Ready(&WatcherTypeDef) < 0))
+    {
+        return NULL;
+    }
+#ifdef RQUOTA_SERVER
+    if (PyType_Ready(&RquotaServerTypeDef) < 0)
     {
         return NULL;
     }
+#endif
 
     PyObject * module = PyModule_Create(&FsQuota_module);
     if (module == NULL)
@@ -2131,6 +8831,21 @@ PyInit_FsQuota(void)
         return NULL;
     }
 
+    // pre-allocate error objects for common query errors, see FsQuota_ErrorObject()
+    {
+        static const int common_errnos[] = {ESRCH, ENOENT, EPERM, EACCES, EINVAL, ENODEV, EIO};
+        for (unsigned idx = 0; idx < sizeof(common_errnos) / sizeof(common_errnos[0]) * 2; idx++)
+        {
+            T_QUOTA_ERROR err = { common_errnos[idx / 2], NULL, FALSE };
+            PyObject * obj = FsQuota_ErrorObject(((idx & 1) ? QUOTA_DEV_XFS : QUOTA_DEV_REGULAR), &err);
+            if (obj == NULL)
+            {
+                PyErr_Clear();
+            }
+            Py_XDECREF(obj);
+        }
+    }
+
     // create class "FsQuota.Quota"
     Py_INCREF(&QuotaTypeDef);
     if (PyModule_AddObject(module, "Quota", (PyObject *) &QuotaTypeDef) < 0)
@@ -2154,6 +8869,85 @@ PyInit_FsQuota(void)
         return NULL;
     }
 
+    // create class "FsQuota.Snapshot"
+    Py_INCREF(&SnapshotTypeDef);
+    if (PyModule_AddObject(module, "Snapshot", (PyObject *) &SnapshotTypeDef) < 0)
+    {
+        Py_DECREF(&SnapshotTypeDef);
+        Py_DECREF(&MntTabTypeDef);
+        Py_DECREF(&QuotaTypeDef);
+        Py_XDECREF(FsQuotaError);
+        Py_CLEAR(FsQuotaError);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    // create class "FsQuota.DeltaScanner"
+    Py_INCREF(&DeltaScannerTypeDef);
+    if (PyModule_AddObject(module, "DeltaScanner", (PyObject *) &DeltaScannerTypeDef) < 0)
+    {
+        Py_DECREF(&DeltaScannerTypeDef);
+        Py_DECREF(&SnapshotTypeDef);
+        Py_DECREF(&MntTabTypeDef);
+        Py_DECREF(&QuotaTypeDef);
+        Py_XDECREF(FsQuotaError);
+        Py_CLEAR(FsQuotaError);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    // create class "FsQuota.Watcher"
+    Py_INCREF(&WatcherTypeDef);
+    if (PyModule_AddObject(module, "Watcher", (PyObject *) &WatcherTypeDef) < 0)
+    {
+        Py_DECREF(&WatcherTypeDef);
+        Py_DECREF(&DeltaScannerTypeDef);
+        Py_DECREF(&SnapshotTypeDef);
+        Py_DECREF(&MntTabTypeDef);
+        Py_DECREF(&QuotaTypeDef);
+        Py_XDECREF(FsQuotaError);
+        Py_CLEAR(FsQuotaError);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+#ifdef RQUOTA_SERVER
+    // create class "FsQuota.RquotaServer"
+    Py_INCREF(&RquotaServerTypeDef);
+    if (PyModule_AddObject(module, "RquotaServer", (PyObject *) &RquotaServerTypeDef) < 0)
+    {
+        Py_DECREF(&RquotaServerTypeDef);
+        Py_DECREF(&WatcherTypeDef);
+        Py_DECREF(&DeltaScannerTypeDef);
+        Py_DECREF(&SnapshotTypeDef);
+        Py_DECREF(&MntTabTypeDef);
+        Py_DECREF(&QuotaTypeDef);
+        Py_XDECREF(FsQuotaError);
+        Py_CLEAR(FsQuotaError);
+        Py_DECREF(module);
+        return NULL;
+    }
+#endif
+
+    // stop background threads of watchers before the interpreter is finalized
+    {
+        PyObject * atexit = PyImport_ImportModule("atexit");
+        PyObject * func = PyCFunction_New(&Watcher_StopAllDef, NULL);
+        PyObject * ret = (((atexit != NULL) && (func != NULL))
+                            ? PyObject_CallMethod(atexit, "register", "O", func) : NULL);
+        Py_XDECREF(func);
+        Py_XDECREF(atexit);
+        if (ret == NULL)
+        {
+            Py_DECREF(&MntTabTypeDef);
+            Py_XDECREF(FsQuotaError);
+            Py_CLEAR(FsQuotaError);
+            Py_DECREF(module);
+            return NULL;
+        }
+        Py_DECREF(ret);
+    }
+
 #if defined (NAMED_TUPLE_GC_BUG)
     if (PyStructSequence_InitType2(&FsQuota_QuotaQueryTypeBuf, &QuotaQuery_Desc) != 0)
 #else
@@ -11,6 +11,7 @@
 #include <signal.h>
 
 #include "myconfig.h"
+#include "src/qprobes.h"
 
 /* API v1 command definitions */
 #define Q_V1_GETQUOTA  0x0300
@@ -26,6 +27,7 @@
 #define Q_V3_SYNC      0x800001
 #define Q_V3_GETQUOTA  0x800007
 #define Q_V3_SETQUOTA  0x800008
+#define Q_V3_GETNEXTQUOTA  0x800009
 
 /* Interface versions */
 #define IFACE_UNSET 0
@@ -79,6 +81,19 @@ union dqblk_v3_wrap {
   u_int64_t foo[9];
 };
 
+/* result of Q_GETNEXTQUOTA: no padding issue, as the size is a multiple of 8 */
+struct nextdqblk_v3 {
+  u_int64_t dqb_bhardlimit;
+  u_int64_t dqb_bsoftlimit;
+  u_int64_t dqb_curspace;
+  u_int64_t dqb_ihardlimit;
+  u_int64_t dqb_isoftlimit;
+  u_int64_t dqb_curinodes;
+  u_int64_t dqb_btime;
+  u_int64_t dqb_itime;
+  u_int32_t dqb_valid;
+  u_int32_t dqb_id;
+};
 
 struct dqstats_v2 {
   u_int32_t lookups;
@@ -205,11 +220,15 @@ failure:
 /*
 ** Wrapper for the quotactl(GETQUOTA) call.
 ** For API v2 the results are copied back into a v1 structure.
+** Parameter qtype is USRQUOTA, GRPQUOTA or PRJQUOTA; project quotas are
+** only supported by the generic API, same as for the functions below.
 */
-int linuxquota_query( const char * dev, int uid, int isgrp, struct dqblk * dqb )
+int linuxquota_query( const char * dev, int uid, int qtype, struct dqblk * dqb )
 {
   int ret;
 
+  QPROBE3(linuxquota__query__entry, uid, qtype, dev);
+
   if (kernel_iface == IFACE_UNSET)
     linuxquota_get_api();
 
@@ -217,7 +236,7 @@ int linuxquota_query( const char * dev, int uid, int isgrp, struct dqblk * dqb )
   {
     union dqblk_v3_wrap dqb3;
 
-    ret = quotactl(QCMD(Q_V3_GETQUOTA, (isgrp ? GRPQUOTA : USRQUOTA)),
+    ret = quotactl(QCMD(Q_V3_GETQUOTA, qtype),
                    dev, uid, (caddr_t) &dqb3.dqblk);
     if (ret == 0)
     {
@@ -231,11 +250,17 @@ int linuxquota_query( const char * dev, int uid, int isgrp, struct dqblk * dqb )
       dqb->dqb_itime      = dqb3.dqblk.dqb_itime;
     }
   }
+  else if (qtype == PRJQUOTA)
+  {
+    /* project quota is supported only via the generic interface */
+    errno = ENOTSUP;
+    ret = -1;
+  }
   else if (kernel_iface == IFACE_VFSV0)
   {
     struct dqblk_v2 dqb2;
 
-    ret = quotactl(QCMD(Q_V2_GETQUOTA, (isgrp ? GRPQUOTA : USRQUOTA)),
+    ret = quotactl(QCMD(Q_V2_GETQUOTA, qtype),
                    dev, uid, (caddr_t) &dqb2);
     if (ret == 0)
     {
@@ -253,7 +278,7 @@ int linuxquota_query( const char * dev, int uid, int isgrp, struct dqblk * dqb )
   {
     struct dqblk_v1 dqb1;
 
-    ret = quotactl(QCMD(Q_V1_GETQUOTA, (isgrp ? GRPQUOTA : USRQUOTA)),
+    ret = quotactl(QCMD(Q_V1_GETQUOTA, qtype),
                    dev, uid, (caddr_t) &dqb1);
     if (ret == 0)
     {
@@ -267,6 +292,52 @@ int linuxquota_query( const char * dev, int uid, int isgrp, struct dqblk * dqb )
       dqb->dqb_itime      = dqb1.dqb_itime;
     }
   }
+
+  QPROBE4(linuxquota__query__return, uid, qtype, dev, (ret ? errno : 0));
+  return ret;
+}
+
+/*
+** Wrapper for the quotactl(GETNEXTQUOTA) call: returns the entry of the
+** first ID equal or larger than the given one that has a quota entry.
+** Only supported by the generic API (kernel 4.6 and later); upon the end
+** of the table the call fails with ENOENT.
+*/
+int linuxquota_query_next( const char * dev, int id, int qtype, int * next_id, struct dqblk * dqb )
+{
+  int ret;
+
+  QPROBE3(linuxquota__query_next__entry, id, qtype, dev);
+
+  if (kernel_iface == IFACE_UNSET)
+    linuxquota_get_api();
+
+  if (kernel_iface == IFACE_GENERIC)
+  {
+    struct nextdqblk_v3 dqb3;
+
+    ret = quotactl(QCMD(Q_V3_GETNEXTQUOTA, qtype),
+                   dev, id, (caddr_t) &dqb3);
+    if (ret == 0)
+    {
+      *next_id = dqb3.dqb_id;
+      dqb->dqb_bhardlimit = dqb3.dqb_bhardlimit;
+      dqb->dqb_bsoftlimit = dqb3.dqb_bsoftlimit;
+      dqb->dqb_curblocks  = dqb3.dqb_curspace / DEV_QBSIZE;
+      dqb->dqb_ihardlimit = dqb3.dqb_ihardlimit;
+      dqb->dqb_isoftlimit = dqb3.dqb_isoftlimit;
+      dqb->dqb_curinodes  = dqb3.dqb_curinodes;
+      dqb->dqb_btime      = dqb3.dqb_btime;
+      dqb->dqb_itime      = dqb3.dqb_itime;
+    }
+  }
+  else
+  {
+    errno = ENOTSUP;
+    ret = -1;
+  }
+
+  QPROBE4(linuxquota__query_next__return, id, qtype, dev, (ret ? errno : 0));
   return ret;
 }
 
@@ -274,10 +345,12 @@ int linuxquota_query( const char * dev, int uid, int isgrp, struct dqblk * dqb )
 ** Wrapper for the quotactl(GETQUOTA) call.
 ** For API v2 and v3 the parameters are copied into the internal structure.
 */
-int linuxquota_setqlim( const char * dev, int uid, int isgrp, struct dqblk * dqb )
+int linuxquota_setqlim( const char * dev, int uid, int qtype, struct dqblk * dqb )
 {
   int ret;
 
+  QPROBE3(linuxquota__setqlim__entry, uid, qtype, dev);
+
   if (kernel_iface == IFACE_UNSET)
     linuxquota_get_api();
 
@@ -295,9 +368,15 @@ int linuxquota_setqlim( const char * dev, int uid, int isgrp, struct dqblk * dqb
     dqb3.dqblk.dqb_itime      = dqb->dqb_itime;
     dqb3.dqblk.dqb_valid      = (QIF_BLIMITS | QIF_ILIMITS);
 
-    ret = quotactl (QCMD(Q_V3_SETQUOTA, (isgrp ? GRPQUOTA : USRQUOTA)),
+    ret = quotactl (QCMD(Q_V3_SETQUOTA, qtype),
                     dev, uid, (caddr_t) &dqb3.dqblk);
   }
+  else if (qtype == PRJQUOTA)
+  {
+    /* project quota is supported only via the generic interface */
+    errno = ENOTSUP;
+    ret = -1;
+  }
   else if (kernel_iface == IFACE_VFSV0)
   {
     struct dqblk_v2 dqb2;
@@ -311,7 +390,7 @@ int linuxquota_setqlim( const char * dev, int uid, int isgrp, struct dqblk * dqb
     dqb2.dqb_btime      = dqb->dqb_btime;
     dqb2.dqb_itime      = dqb->dqb_itime;
 
-    ret = quotactl (QCMD(Q_V2_SETQLIM, (isgrp ? GRPQUOTA : USRQUOTA)),
+    ret = quotactl (QCMD(Q_V2_SETQLIM, qtype),
                     dev, uid, (caddr_t) &dqb2);
   }
   else /* if (kernel_iface == IFACE_VFSOLD) */
@@ -327,36 +406,46 @@ int linuxquota_setqlim( const char * dev, int uid, int isgrp, struct dqblk * dqb
     dqb1.dqb_btime      = dqb->dqb_btime;
     dqb1.dqb_itime      = dqb->dqb_itime;
 
-    ret = quotactl (QCMD(Q_V1_SETQLIM, (isgrp ? GRPQUOTA : USRQUOTA)),
+    ret = quotactl (QCMD(Q_V1_SETQLIM, qtype),
                     dev, uid, (caddr_t) &dqb1);
   }
 
+  QPROBE4(linuxquota__setqlim__return, uid, qtype, dev, (ret ? errno : 0));
   return ret;
 }
 
 /*
 ** Wrapper for the quotactl(SYNC) call.
 */
-int linuxquota_sync( const char * dev, int isgrp )
+int linuxquota_sync( const char * dev, int qtype )
 {
   int ret;
 
+  QPROBE2(linuxquota__sync__entry, qtype, dev);
+
   if (kernel_iface == IFACE_UNSET)
     linuxquota_get_api();
 
   if (kernel_iface == IFACE_GENERIC)
   {
-    ret = quotactl (QCMD(Q_V3_SYNC, (isgrp ? GRPQUOTA : USRQUOTA)), dev, 0, NULL);
+    ret = quotactl (QCMD(Q_V3_SYNC, qtype), dev, 0, NULL);
+  }
+  else if (qtype == PRJQUOTA)
+  {
+    /* project quota is supported only via the generic interface */
+    errno = ENOTSUP;
+    ret = -1;
   }
   else if (kernel_iface == IFACE_VFSV0)
   {
-    ret = quotactl (QCMD(Q_V2_SYNC, (isgrp ? GRPQUOTA : USRQUOTA)), dev, 0, NULL);
+    ret = quotactl (QCMD(Q_V2_SYNC, qtype), dev, 0, NULL);
   }
   else /* if (kernel_iface == IFACE_VFSOLD) */
   {
-    ret = quotactl (QCMD(Q_V1_SYNC, (isgrp ? GRPQUOTA : USRQUOTA)), dev, 0, NULL);
+    ret = quotactl (QCMD(Q_V1_SYNC, qtype), dev, 0, NULL);
   }
 
+  QPROBE3(linuxquota__sync__return, qtype, dev, (ret ? errno : 0));
   return ret;
 }
 
@@ -369,10 +458,10 @@ main()
   linuxquota_get_api();
   printf("API=%d\n", kernel_iface);
 
-  if (linuxquota_sync(DEVICE_PATH, FALSE) != 0)
+  if (linuxquota_sync(DEVICE_PATH, USRQUOTA) != 0)
      perror("Q_SYNC");
 
-  if (linuxquota_query(DEVICE_PATH, getuid(), 0, &dqb) == 0)
+  if (linuxquota_query(DEVICE_PATH, getuid(), USRQUOTA, &dqb) == 0)
   {
      printf("blocks: usage %d soft %d hard %d expire %s",
             dqb.dqb_curblocks, dqb.dqb_bhardlimit, dqb.dqb_bsoftlimit,
@@ -0,0 +1,153 @@
+/*
+**  Aggregation of quota entries of multiple file systems per ID
+**
+**  Entries of each file system are collected into separate arrays by
+**  enumeration, which delivers IDs in ascending order, so that the arrays
+**  can be merged without sorting. Merging is done in two passes: the first
+**  only counts distinct IDs, so that result columns can be allocated with
+**  their final size by the caller (i.e. directly as Python buffer objects),
+**  the second fills them. The minimum ID among the sources is searched
+**  linearly, which is efficient for the typical small number of file
+**  systems.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "src/qagg.h"
+
+void qagg_source_init( T_QAGG_SOURCE * src )
+{
+    memset(src, 0, sizeof(*src));
+}
+
+void qagg_source_free( T_QAGG_SOURCE * src )
+{
+    free(src->ids);
+    free(src->bcount);
+    free(src->icount);
+    memset(src, 0, sizeof(*src));
+}
+
+/*
+** Append an entry; IDs have to be passed in strictly ascending order.
+*/
+int qagg_source_add( T_QAGG_SOURCE * src, uint32_t id, uint64_t bcount, uint64_t icount )
+{
+    if ((src->count != 0) && (id <= src->ids[src->count - 1]))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (src->count >= src->size)
+    {
+        size_t new_size = (src->size != 0) ? (src->size * 2) : 1024;
+        uint32_t * new_ids = realloc(src->ids, new_size * sizeof(uint32_t));
+        if (new_ids != NULL)
+            src->ids = new_ids;
+        uint64_t * new_bcount = realloc(src->bcount, new_size * sizeof(uint64_t));
+        if (new_bcount != NULL)
+            src->bcount = new_bcount;
+        uint64_t * new_icount = realloc(src->icount, new_size * sizeof(uint64_t));
+        if (new_icount != NULL)
+            src->icount = new_icount;
+
+        if ((new_ids == NULL) || (new_bcount == NULL) || (new_icount == NULL))
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        src->size = new_size;
+    }
+    src->ids[src->count] = id;
+    src->bcount[src->count] = bcount;
+    src->icount[src->count] = icount;
+    src->count += 1;
+    return 0;
+}
+
+/*
+** Search the lowest ID among the current positions of all sources. Returns
+** zero when all sources are exhausted.
+*/
+static int qagg_next_id( const T_QAGG_SOURCE * srcs, unsigned src_count,
+                         const size_t * pos, uint32_t * p_id )
+{
+    int found = 0;
+
+    for (unsigned idx = 0; idx < src_count; idx++)
+    {
+        if ((pos[idx] < srcs[idx].count) &&
+            (!found || (srcs[idx].ids[pos[idx]] < *p_id)))
+        {
+            *p_id = srcs[idx].ids[pos[idx]];
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/*
+** Return the number of distinct IDs across all sources.
+*/
+size_t qagg_count( const T_QAGG_SOURCE * srcs, unsigned src_count )
+{
+    size_t pos[src_count];
+    size_t count = 0;
+    uint32_t id = 0;
+
+    memset(pos, 0, sizeof(pos));
+    while (qagg_next_id(srcs, src_count, pos, &id))
+    {
+        for (unsigned idx = 0; idx < src_count; idx++)
+        {
+            if ((pos[idx] < srcs[idx].count) && (srcs[idx].ids[pos[idx]] == id))
+                pos[idx] += 1;
+        }
+        count += 1;
+    }
+    return count;
+}
+
+/*
+** Fill the result columns, which have to be allocated for the number of
+** rows returned by qagg_count().
+*/
+void qagg_merge( const T_QAGG_SOURCE * srcs, unsigned src_count, const T_QAGG_RESULT * res )
+{
+    size_t pos[src_count];
+    size_t row = 0;
+    uint32_t id = 0;
+
+    memset(pos, 0, sizeof(pos));
+    while (qagg_next_id(srcs, src_count, pos, &id))
+    {
+        uint64_t bcount = 0;
+        uint64_t icount = 0;
+        uint32_t cnt = 0;
+
+        for (unsigned idx = 0; idx < src_count; idx++)
+        {
+            if ((pos[idx] < srcs[idx].count) && (srcs[idx].ids[pos[idx]] == id))
+            {
+                res->src_bcount[idx][row] = srcs[idx].bcount[pos[idx]];
+                res->src_icount[idx][row] = srcs[idx].icount[pos[idx]];
+                bcount += srcs[idx].bcount[pos[idx]];
+                icount += srcs[idx].icount[pos[idx]];
+                cnt += 1;
+                pos[idx] += 1;
+            }
+            else
+            {
+                res->src_bcount[idx][row] = 0;
+                res->src_icount[idx][row] = 0;
+            }
+        }
+        res->ids[row] = id;
+        res->bcount[row] = bcount;
+        res->icount[row] = icount;
+        res->src_cnt[row] = cnt;
+        row += 1;
+    }
+}
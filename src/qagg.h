@@ -0,0 +1,40 @@
+#ifndef INC_QAGG_H
+#define INC_QAGG_H
+
+/*
+ *  Interface for aggregating quota entries of multiple file systems per ID
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* usage of all entries of one file system, in ascending order of IDs */
+typedef struct
+{
+    uint32_t *      ids;
+    uint64_t *      bcount;
+    uint64_t *      icount;
+    size_t          count;
+    size_t          size;           /* allocated number of elements */
+} T_QAGG_SOURCE;
+
+/* merged result in form of columns with one row per distinct ID; all arrays
+ * are allocated by the caller with the size returned by qagg_count() */
+typedef struct
+{
+    uint32_t *      ids;
+    uint64_t *      bcount;         /* sum across all sources */
+    uint64_t *      icount;
+    uint32_t *      src_cnt;        /* number of sources with an entry for the ID */
+    uint64_t **     src_bcount;     /* one array per source; zero if no entry */
+    uint64_t **     src_icount;
+} T_QAGG_RESULT;
+
+void qagg_source_init(T_QAGG_SOURCE * src);
+int qagg_source_add(T_QAGG_SOURCE * src, uint32_t id, uint64_t bcount, uint64_t icount);
+void qagg_source_free(T_QAGG_SOURCE * src);
+
+size_t qagg_count(const T_QAGG_SOURCE * srcs, unsigned src_count);
+void qagg_merge(const T_QAGG_SOURCE * srcs, unsigned src_count, const T_QAGG_RESULT * res);
+
+#endif /* INC_QAGG_H */
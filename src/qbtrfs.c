@@ -0,0 +1,353 @@
+/*
+**  Btrfs qgroup access
+**
+**  Btrfs does not implement the quotactl() interface; instead, usage and
+**  limits are tracked per "qgroup", which is identified by a 64-bit ID
+**  composed of a level and a sub-ID. Level 0 qgroups are created
+**  implicitly for each subvolume, with the subvolume ID as sub-ID. Usage
+**  and limits are stored as info and limit items in the quota tree, which
+**  is read via ioctl BTRFS_IOC_TREE_SEARCH_V2. All items of the tree are
+**  sorted by key, i.e. first all info items, then all limit items, each
+**  ordered by qgroup ID, so that a single search with a sufficiently large
+**  buffer returns the complete table. Note searching the tree requires
+**  admin privileges.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/ioctl.h>
+#include <linux/btrfs.h>
+#include <linux/btrfs_tree.h>
+
+#include "src/qbtrfs.h"
+
+/* initial size of the result buffer, sufficient for about 3600 qgroups; the
+ * buffer is enlarged up to the maximum supported by the kernel when full */
+#define QBTRFS_SEARCH_BUF   (256 * 1024)
+#define QBTRFS_SEARCH_MAX   (16 * 1024 * 1024)
+
+/* largest item returned by the search; info and limit items have equal size */
+#define QBTRFS_ITEM_MAX     (sizeof(struct btrfs_ioctl_search_header) + \
+                             sizeof(struct btrfs_qgroup_info_item))
+
+typedef struct
+{
+    T_QBTRFS_QGROUP *   tab;
+    size_t              count;
+    size_t              max_count;
+    int                 growable;
+} T_QBTRFS_TABLE;
+
+static int qbtrfs_open( const char * path )
+{
+    return open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+}
+
+/*
+** Binary search for a qgroup in the table, which is sorted by ID
+*/
+static T_QBTRFS_QGROUP * qbtrfs_find( T_QBTRFS_TABLE * tbl, uint64_t qgroupid )
+{
+    size_t lo = 0;
+    size_t hi = tbl->count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tbl->tab[mid].qgroupid < qgroupid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return ((lo < tbl->count) && (tbl->tab[lo].qgroupid == qgroupid)) ? &tbl->tab[lo] : NULL;
+}
+
+/*
+** Add an item returned by the tree search to the table: info items append
+** a qgroup, limit items are merged into the respective entry.
+*/
+static int qbtrfs_add_item( T_QBTRFS_TABLE * tbl, const struct btrfs_ioctl_search_header * sh,
+                            const void * data )
+{
+    if ((sh->type == BTRFS_QGROUP_INFO_KEY) &&
+        (sh->len >= sizeof(struct btrfs_qgroup_info_item)))
+    {
+        struct btrfs_qgroup_info_item info;
+        memcpy(&info, data, sizeof(info));
+
+        if (tbl->count >= tbl->max_count)
+        {
+            if (!tbl->growable)
+                return 0;
+
+            size_t new_max = ((tbl->max_count != 0) ? (tbl->max_count * 2) : 256);
+            T_QBTRFS_QGROUP * new_tab = realloc(tbl->tab, new_max * sizeof(T_QBTRFS_QGROUP));
+            if (new_tab == NULL)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+            tbl->tab = new_tab;
+            tbl->max_count = new_max;
+        }
+        T_QBTRFS_QGROUP * ent = &tbl->tab[tbl->count++];
+        memset(ent, 0, sizeof(*ent));
+        ent->qgroupid = sh->offset;
+        ent->rfer = le64toh(info.rfer);
+        ent->excl = le64toh(info.excl);
+    }
+    else if ((sh->type == BTRFS_QGROUP_LIMIT_KEY) &&
+             (sh->len >= sizeof(struct btrfs_qgroup_limit_item)))
+    {
+        struct btrfs_qgroup_limit_item lim;
+        memcpy(&lim, data, sizeof(lim));
+
+        T_QBTRFS_QGROUP * ent = qbtrfs_find(tbl, sh->offset);
+        if (ent != NULL)
+        {
+            uint64_t flags = le64toh(lim.flags);
+            if (flags & BTRFS_QGROUP_LIMIT_MAX_RFER)
+                ent->max_rfer = le64toh(lim.max_rfer);
+            if (flags & BTRFS_QGROUP_LIMIT_MAX_EXCL)
+                ent->max_excl = le64toh(lim.max_excl);
+        }
+    }
+    return 0;
+}
+
+/*
+** Search items of the given types and range of qgroup IDs in the quota
+** tree. The search is repeated only if the result buffer was filled.
+*/
+static int qbtrfs_search( int fd, uint32_t min_type, uint32_t max_type,
+                          uint64_t min_id, uint64_t max_id, T_QBTRFS_TABLE * tbl )
+{
+    struct btrfs_ioctl_search_args_v2 * args;
+    size_t buf_size = ((min_id == max_id) ? (2 * QBTRFS_ITEM_MAX) : QBTRFS_SEARCH_BUF);
+    int result = 0;
+
+    args = malloc(sizeof(*args) + buf_size);
+    if (args == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(&args->key, 0, sizeof(args->key));
+    args->key.tree_id = BTRFS_QUOTA_TREE_OBJECTID;
+    args->key.min_objectid = 0;
+    args->key.max_objectid = 0;
+    args->key.min_type = min_type;
+    args->key.max_type = max_type;
+    args->key.min_offset = min_id;
+    args->key.max_offset = max_id;
+    args->key.min_transid = 0;
+    args->key.max_transid = UINT64_MAX;
+
+    for (;;)
+    {
+        const struct btrfs_ioctl_search_header * sh = NULL;
+        size_t pos = 0;
+
+        args->key.nr_items = UINT32_MAX;
+        args->buf_size = buf_size;
+        if (ioctl(fd, BTRFS_IOC_TREE_SEARCH_V2, args) != 0)
+        {
+            result = -1;
+            break;
+        }
+        if (args->key.nr_items == 0)
+            break;
+
+        for (uint32_t idx = 0; idx < args->key.nr_items; idx++)
+        {
+            sh = (const struct btrfs_ioctl_search_header *) ((const char *)args->buf + pos);
+            pos += sizeof(*sh);
+            if ((result = qbtrfs_add_item(tbl, sh, (const char *)args->buf + pos)) != 0)
+                break;
+            pos += sh->len;
+        }
+        // the search is complete when the buffer had room for another item
+        if ((result != 0) || (buf_size - pos >= QBTRFS_ITEM_MAX) || (min_id == max_id))
+            break;
+
+        // else continue after the last key, with a larger buffer
+        uint32_t last_type = sh->type;
+        uint64_t last_offset = sh->offset;
+
+        if (buf_size < QBTRFS_SEARCH_MAX)
+        {
+            struct btrfs_ioctl_search_key key = args->key;
+            void * new_args = realloc(args, sizeof(*args) + buf_size * 2);
+            if (new_args != NULL)
+            {
+                args = new_args;
+                args->key = key;
+                buf_size *= 2;
+            }
+        }
+        if (last_offset < UINT64_MAX)
+        {
+            args->key.min_type = last_type;
+            args->key.min_offset = last_offset + 1;
+        }
+        else if (last_type < max_type)
+        {
+            args->key.min_type = last_type + 1;
+            args->key.min_offset = 0;
+        }
+        else
+            break;
+    }
+    free(args);
+    return result;
+}
+
+/*
+** Read usage and limits of a single qgroup
+*/
+int qbtrfs_get( const char * mntpt, uint64_t qgroupid, T_QBTRFS_QGROUP * ent )
+{
+    T_QBTRFS_TABLE tbl = { ent, 0, 1, 0 };
+    int result = -1;
+    int fd = qbtrfs_open(mntpt);
+
+    if (fd >= 0)
+    {
+        if (qbtrfs_search(fd, BTRFS_QGROUP_INFO_KEY, BTRFS_QGROUP_INFO_KEY,
+                          qgroupid, qgroupid, &tbl) == 0)
+        {
+            if (tbl.count == 0)
+                errno = ENOENT;
+            else if (qbtrfs_search(fd, BTRFS_QGROUP_LIMIT_KEY, BTRFS_QGROUP_LIMIT_KEY,
+                                   qgroupid, qgroupid, &tbl) == 0)
+                result = 0;
+        }
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    return result;
+}
+
+/*
+** Read usage and limits of all qgroups; the returned table is sorted by
+** qgroup ID and has to be freed by the caller.
+*/
+int qbtrfs_get_all( const char * mntpt, T_QBTRFS_QGROUP ** p_tab, size_t * p_count )
+{
+    T_QBTRFS_TABLE tbl = { NULL, 0, 0, 1 };
+    int result = -1;
+    int fd = qbtrfs_open(mntpt);
+
+    if (fd >= 0)
+    {
+        result = qbtrfs_search(fd, BTRFS_QGROUP_INFO_KEY, BTRFS_QGROUP_LIMIT_KEY,
+                               0, UINT64_MAX, &tbl);
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    if (result == 0)
+    {
+        *p_tab = tbl.tab;
+        *p_count = tbl.count;
+    }
+    else
+        free(tbl.tab);
+
+    return result;
+}
+
+/*
+** Set the limit of referenced bytes of a qgroup; zero removes the limit
+*/
+int qbtrfs_set_limit( const char * mntpt, uint64_t qgroupid, uint64_t max_rfer )
+{
+    struct btrfs_ioctl_qgroup_limit_args args;
+    int result = -1;
+    int fd = qbtrfs_open(mntpt);
+
+    if (fd >= 0)
+    {
+        memset(&args, 0, sizeof(args));
+        args.qgroupid = qgroupid;
+        args.lim.flags = BTRFS_QGROUP_LIMIT_MAX_RFER;
+        // all bits set is interpreted by the kernel as removal of the limit
+        args.lim.max_rfer = ((max_rfer != 0) ? max_rfer : UINT64_MAX);
+
+        result = ioctl(fd, BTRFS_IOC_QGROUP_LIMIT, &args);
+
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    return result;
+}
+
+/*
+** Determine the ID of the subvolume containing the given path, which is
+** the sub-ID of the corresponding level 0 qgroup. Fails with EXDEV if the
+** path is not located on the same file system as mntpt.
+*/
+int qbtrfs_subvol_id( const char * mntpt, const char * path, uint64_t * p_id )
+{
+    struct btrfs_ioctl_fs_info_args fs_info[2];
+    struct btrfs_ioctl_ino_lookup_args lookup;
+    int result = -1;
+    int fd = qbtrfs_open(path);
+    int mnt_fd = qbtrfs_open(mntpt);
+
+    if ((fd >= 0) && (mnt_fd >= 0))
+    {
+        memset(fs_info, 0, sizeof(fs_info));
+        if ((ioctl(fd, BTRFS_IOC_FS_INFO, &fs_info[0]) != 0) ||
+            (ioctl(mnt_fd, BTRFS_IOC_FS_INFO, &fs_info[1]) != 0) ||
+            (memcmp(fs_info[0].fsid, fs_info[1].fsid, BTRFS_FSID_SIZE) != 0))
+        {
+            errno = EXDEV;
+        }
+        else
+        {
+            // tree ID 0 selects the subvolume of the descriptor; for the
+            // ID of its root directory only the tree ID is returned
+            memset(&lookup, 0, sizeof(lookup));
+            lookup.treeid = 0;
+            lookup.objectid = BTRFS_FIRST_FREE_OBJECTID;
+            if (ioctl(fd, BTRFS_IOC_INO_LOOKUP, &lookup) == 0)
+            {
+                *p_id = lookup.treeid;
+                result = 0;
+            }
+        }
+    }
+    int saved_errno = errno;
+    if (fd >= 0)
+        close(fd);
+    if (mnt_fd >= 0)
+        close(mnt_fd);
+    errno = saved_errno;
+    return result;
+}
+
+/*
+** Commit the current transaction, which updates qgroup usage
+*/
+int qbtrfs_sync( const char * mntpt )
+{
+    int result = -1;
+    int fd = qbtrfs_open(mntpt);
+
+    if (fd >= 0)
+    {
+        result = ioctl(fd, BTRFS_IOC_SYNC, NULL);
+
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    return result;
+}
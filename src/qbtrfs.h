@@ -0,0 +1,32 @@
+#ifndef INC_QBTRFS_H
+#define INC_QBTRFS_H
+
+/*
+ *  Interface for reading and limiting Btrfs qgroups
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* level of a qgroup ID; level 0 qgroups correspond to subvolumes */
+#define QBTRFS_LEVEL(QGROUPID)   ((QGROUPID) >> 48)
+
+/* usage and limits of a qgroup in bytes; limits are zero when not set */
+typedef struct
+{
+    uint64_t        qgroupid;
+    uint64_t        rfer;           /* referenced */
+    uint64_t        excl;           /* exclusive */
+    uint64_t        max_rfer;
+    uint64_t        max_excl;
+} T_QBTRFS_QGROUP;
+
+/* mntpt is any directory on the file system; errno ENOENT indicates that
+ * quotas are not enabled, or that the qgroup does not exist */
+int qbtrfs_get(const char * mntpt, uint64_t qgroupid, T_QBTRFS_QGROUP * ent);
+int qbtrfs_get_all(const char * mntpt, T_QBTRFS_QGROUP ** p_tab, size_t * p_count);
+int qbtrfs_set_limit(const char * mntpt, uint64_t qgroupid, uint64_t max_rfer);
+int qbtrfs_subvol_id(const char * mntpt, const char * path, uint64_t * p_id);
+int qbtrfs_sync(const char * mntpt);
+
+#endif /* INC_QBTRFS_H */
@@ -0,0 +1,209 @@
+/*
+**  Usage per user, group and project of an XFS file system via bulkstat
+**
+**  When quota accounting is not enabled on a file system, usage can only be
+**  determined by summing up the allocated blocks of all inodes. Instead of
+**  walking the directory tree, XFS allows reading inode records in bulk in
+**  order of inode numbers via ioctl XFS_IOC_BULKSTAT, which avoids
+**  directory lookups and random access to inodes. Since version 5 of the
+**  interface (Linux 5.2), the scan can be restricted to an allocation
+**  group, so that allocation groups are scanned in parallel by a pool of
+**  threads. Each thread sums up usage in private hash tables, which are
+**  merged when all threads are done. Note bulkstat requires admin
+**  privileges.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "src/qbulkstat.h"
+#include "src/xfs_bulkstat.h"
+
+/* number of inode records read per ioctl */
+#define QBULKSTAT_CHUNK     4096
+
+typedef struct qbulkstat_scan T_QBULKSTAT_SCAN;
+
+typedef struct
+{
+    T_QBULKSTAT_SCAN *  scan;
+    T_QUSAGE_MAP        map[QUSAGE_KINDS];
+    uint64_t            inodes;
+} T_QBULKSTAT_WORKER;
+
+struct qbulkstat_scan
+{
+    int                 fd;
+    unsigned            ag_count;
+    unsigned            next_ag;        /* accessed atomically */
+    int                 errnum;         /* first error; accessed atomically */
+    T_QBULKSTAT_WORKER  worker[QBULKSTAT_MAX_THREADS];
+};
+
+static void qbulkstat_set_error( T_QBULKSTAT_SCAN * scan, int errnum )
+{
+    int expected = 0;
+    __atomic_compare_exchange_n(&scan->errnum, &expected, ((errnum != 0) ? errnum : EIO),
+                                0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/*
+** Thread main function: scan allocation groups not yet taken by another
+** thread, until all are done or an error occurred
+*/
+static void * qbulkstat_worker( void * arg )
+{
+    T_QBULKSTAT_WORKER * wrk = (T_QBULKSTAT_WORKER *) arg;
+    T_QBULKSTAT_SCAN * scan = wrk->scan;
+    struct xfs_bulkstat_req * req;
+    unsigned agno;
+
+    req = malloc(sizeof(*req) + QBULKSTAT_CHUNK * sizeof(struct xfs_bulkstat));
+    if (req == NULL)
+    {
+        qbulkstat_set_error(scan, ENOMEM);
+        return NULL;
+    }
+
+    while ((__atomic_load_n(&scan->errnum, __ATOMIC_RELAXED) == 0) &&
+           ((agno = __atomic_fetch_add(&scan->next_ag, 1, __ATOMIC_RELAXED)) < scan->ag_count))
+    {
+        memset(&req->hdr, 0, sizeof(req->hdr));
+        req->hdr.flags = XFS_BULK_IREQ_AGNO;
+        req->hdr.agno = agno;
+        req->hdr.ino = 0;
+
+        while (__atomic_load_n(&scan->errnum, __ATOMIC_RELAXED) == 0)
+        {
+            req->hdr.icount = QBULKSTAT_CHUNK;
+            if (ioctl(scan->fd, XFS_IOC_BULKSTAT, req) != 0)
+            {
+                qbulkstat_set_error(scan, ((errno == ENOTTY) ? ENOTSUP : errno));
+                break;
+            }
+            if (req->hdr.ocount == 0)
+                break;
+
+            for (uint32_t idx = 0; idx < req->hdr.ocount; idx++)
+            {
+                const struct xfs_bulkstat * bs = &req->bulkstat[idx];
+                // blocks are counted in units of the file system block size
+                uint64_t blocks = bs->bs_blocks * ((bs->bs_blksize >= 512) ? (bs->bs_blksize / 512) : 1);
+
+                if ((qusage_map_add(&wrk->map[QUSAGE_USER], bs->bs_uid, blocks, 1) != 0) ||
+                    (qusage_map_add(&wrk->map[QUSAGE_GROUP], bs->bs_gid, blocks, 1) != 0) ||
+                    (qusage_map_add(&wrk->map[QUSAGE_PROJECT], bs->bs_projectid, blocks, 1) != 0))
+                {
+                    qbulkstat_set_error(scan, ENOMEM);
+                    break;
+                }
+            }
+            wrk->inodes += req->hdr.ocount;
+        }
+    }
+    free(req);
+    return NULL;
+}
+
+/*
+** Merge the tables of all workers into the result, sorted by ID
+*/
+static int qbulkstat_merge( T_QBULKSTAT_SCAN * scan, unsigned thread_cnt, T_QUSAGE_RESULT * res )
+{
+    for (unsigned kind = 0; kind < QUSAGE_KINDS; kind++)
+    {
+        T_QUSAGE_MAP * map = &scan->worker[0].map[kind];
+
+        for (unsigned wrk_idx = 1; wrk_idx < thread_cnt; wrk_idx++)
+        {
+            if (qusage_map_merge(map, &scan->worker[wrk_idx].map[kind]) != 0)
+                return -1;
+        }
+        if (qusage_map_table(map, &res->tab[kind], &res->count[kind]) != 0)
+            return -1;
+    }
+    for (unsigned wrk_idx = 0; wrk_idx < thread_cnt; wrk_idx++)
+    {
+        res->inodes += scan->worker[wrk_idx].inodes;
+    }
+    return 0;
+}
+
+/*
+** Scan all inodes of the file system containing the given path, using up
+** to the given number of threads. Upon success, the result tables have to
+** be freed via qusage_free().
+*/
+int qbulkstat_scan( const char * path, unsigned threads, T_QUSAGE_RESULT * res )
+{
+    struct xfs_fsop_geom_v1 geo;
+    T_QBULKSTAT_SCAN * scan;
+    pthread_t tids[QBULKSTAT_MAX_THREADS];
+    unsigned thread_cnt = 1;
+    int result = -1;
+
+    memset(res, 0, sizeof(*res));
+
+    scan = calloc(1, sizeof(*scan));
+    if (scan == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    scan->fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (scan->fd < 0)
+    {
+        free(scan);
+        return -1;
+    }
+
+    if (ioctl(scan->fd, XFS_IOC_FSGEOMETRY_V1, &geo) != 0)
+    {
+        scan->errnum = ((errno == ENOTTY) ? ENOTSUP : errno);
+    }
+    else
+    {
+        scan->ag_count = geo.agcount;
+
+        if (threads > QBULKSTAT_MAX_THREADS)
+            threads = QBULKSTAT_MAX_THREADS;
+        if (threads > geo.agcount)
+            threads = geo.agcount;
+
+        for (unsigned idx = 0; idx < QBULKSTAT_MAX_THREADS; idx++)
+            scan->worker[idx].scan = scan;
+
+        // the calling thread works as well, as worker 0
+        while ((thread_cnt < threads) &&
+               (pthread_create(&tids[thread_cnt], NULL, qbulkstat_worker, &scan->worker[thread_cnt]) == 0))
+        {
+            thread_cnt += 1;
+        }
+        qbulkstat_worker(&scan->worker[0]);
+
+        for (unsigned idx = 1; idx < thread_cnt; idx++)
+            pthread_join(tids[idx], NULL);
+
+        if ((scan->errnum == 0) && (qbulkstat_merge(scan, thread_cnt, res) != 0))
+            scan->errnum = errno;
+    }
+
+    if (scan->errnum == 0)
+        result = 0;
+    else
+        qusage_free(res);
+
+    for (unsigned idx = 0; idx < thread_cnt; idx++)
+        for (unsigned kind = 0; kind < QUSAGE_KINDS; kind++)
+            qusage_map_free(&scan->worker[idx].map[kind]);
+
+    close(scan->fd);
+    errno = scan->errnum;
+    free(scan);
+    return result;
+}
@@ -0,0 +1,17 @@
+#ifndef INC_QBULKSTAT_H
+#define INC_QBULKSTAT_H
+
+/*
+ *  Interface for determining usage per user, group and project of an XFS
+ *  file system by reading all inodes via bulkstat
+ */
+
+#include "src/qusage.h"
+
+#define QBULKSTAT_MAX_THREADS  64
+
+/* path is any file on the file system; errno ENOTSUP indicates missing
+ * support for bulkstat v5; the result is freed via qusage_free() */
+int qbulkstat_scan(const char * path, unsigned threads, T_QUSAGE_RESULT * res);
+
+#endif /* INC_QBULKSTAT_H */
@@ -0,0 +1,365 @@
+/*
+**  Incremental comparison of quota table scans
+**
+**  The result of a scan (i.e. enumeration of all quota entries of a file
+**  system) is kept in compact form: entries are sorted by ID, and each is
+**  encoded as the difference of its ID to that of the preceding entry,
+**  followed by its values, all as variable-length quantities (7 bits per
+**  byte, least significant first). Time values are signed and thus mapped
+**  via "zig-zag" encoding. Typical entries take 10 to 25 bytes instead of
+**  68 bytes in binary form.
+**
+**  As enumeration delivers entries in ascending order of IDs, the previous
+**  state can be decoded in parallel to the new scan and compared entry by
+**  entry, while the new state is encoded. Only inserted, removed and
+**  changed entries are collected for reporting, so that the cost of
+**  processing the result scales with churn rather than with table size.
+**  Entries are considered changed when usage or limits differ; grace
+**  times alone are not compared, but are updated in the new state.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "src/qdelta.h"
+
+#define QDELTA_MAGIC        "FSQDLT\0\1"
+#define QDELTA_MAGIC_LEN    8
+
+/* indices of values that are signed, i.e. times; see FsQuota.QueryResult */
+#define QDELTA_IS_TIME(IDX)  (((IDX) == 3) || ((IDX) == 7))
+
+/* ------------------------------------------------------------------------ */
+/* Encoding */
+
+static int qdelta_reserve( T_QDELTA_STATE * state, size_t len )
+{
+    if (state->len + len > state->size)
+    {
+        size_t new_size = (state->size != 0) ? (state->size * 2) : 4096;
+        while (new_size < state->len + len)
+            new_size *= 2;
+
+        unsigned char * new_buf = realloc(state->buf, new_size);
+        if (new_buf == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        state->buf = new_buf;
+        state->size = new_size;
+    }
+    return 0;
+}
+
+/* space has to be reserved by the caller: at most 10 bytes per value */
+static void qdelta_put_uvar( T_QDELTA_STATE * state, uint64_t val )
+{
+    while (val >= 0x80)
+    {
+        state->buf[state->len++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    state->buf[state->len++] = val;
+}
+
+static int qdelta_put_entry( T_QDELTA_STATE * state, uint32_t id, const uint64_t * val )
+{
+    if (qdelta_reserve(state, (QDELTA_VAL_COUNT + 1) * 10) != 0)
+        return -1;
+
+    qdelta_put_uvar(state, id - state->last_id);
+    for (unsigned idx = 0; idx < QDELTA_VAL_COUNT; idx++)
+    {
+        if (QDELTA_IS_TIME(idx))
+            qdelta_put_uvar(state, (val[idx] << 1) ^ (uint64_t)((int64_t)val[idx] >> 63));
+        else
+            qdelta_put_uvar(state, val[idx]);
+    }
+    state->last_id = id;
+    state->count += 1;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Decoding */
+
+static int qdelta_get_uvar( const unsigned char * buf, size_t len, size_t * p_pos, uint64_t * p_val )
+{
+    uint64_t val = 0;
+    unsigned shift = 0;
+
+    while (*p_pos < len)
+    {
+        if (shift > 63)
+            return -1;
+        unsigned char c = buf[(*p_pos)++];
+        val |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+        if ((c & 0x80) == 0)
+        {
+            *p_val = val;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+** Decode the entry at the given position. The ID is given as the ID of the
+** preceding entry and replaced with that of the decoded entry. IDs have to
+** be strictly ascending, except for the first entry, which may be zero.
+*/
+static int qdelta_get_entry( const unsigned char * buf, size_t len, size_t * p_pos,
+                             int is_first, uint32_t * p_id, uint64_t * val )
+{
+    uint64_t delta;
+
+    if ((qdelta_get_uvar(buf, len, p_pos, &delta) != 0) ||
+        (delta > UINT32_MAX - *p_id) ||
+        ((delta == 0) && !is_first))
+    {
+        return -1;
+    }
+    *p_id += delta;
+
+    for (unsigned idx = 0; idx < QDELTA_VAL_COUNT; idx++)
+    {
+        if (qdelta_get_uvar(buf, len, p_pos, &val[idx]) != 0)
+            return -1;
+        if (QDELTA_IS_TIME(idx))
+            val[idx] = (val[idx] >> 1) ^ (0 - (val[idx] & 1));
+    }
+    return 0;
+}
+
+/*
+** Advance to the next entry of the previous state; returns zero at the end.
+** The state was validated when created, so decoding errors cannot occur.
+*/
+static int qdelta_scan_next_prev( T_QDELTA_SCAN * scan )
+{
+    scan->prev_valid = 0;
+    if (scan->prev_left > 0)
+    {
+        int is_first = (scan->prev_left == scan->prev->count);
+        if (qdelta_get_entry(scan->prev->buf, scan->prev->len, &scan->prev_pos,
+                             is_first, &scan->prev_id, scan->prev_cur) == 0)
+        {
+            scan->prev_cur_id = scan->prev_id;
+            scan->prev_valid = 1;
+            scan->prev_left -= 1;
+        }
+        else
+        {
+            scan->prev_left = 0;
+        }
+    }
+    return scan->prev_valid;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Comparison */
+
+static int qdelta_add_change( T_QDELTA_SCAN * scan, uint32_t id,
+                              const uint64_t * old_val, const uint64_t * new_val )
+{
+    if (scan->change_cnt >= scan->change_size)
+    {
+        size_t new_size = (scan->change_size != 0) ? (scan->change_size * 2) : 256;
+        T_QDELTA_CHANGE * new_list = realloc(scan->changes, new_size * sizeof(T_QDELTA_CHANGE));
+        if (new_list == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        scan->changes = new_list;
+        scan->change_size = new_size;
+    }
+    T_QDELTA_CHANGE * chg = &scan->changes[scan->change_cnt++];
+    chg->id = id;
+    chg->has_old = (old_val != NULL);
+    chg->has_new = (new_val != NULL);
+    if (old_val != NULL)
+        memcpy(chg->old_val, old_val, sizeof(chg->old_val));
+    if (new_val != NULL)
+        memcpy(chg->new_val, new_val, sizeof(chg->new_val));
+
+    if (old_val == NULL)
+        scan->totals.inserted += 1;
+    else if (new_val == NULL)
+        scan->totals.removed += 1;
+    else
+        scan->totals.changed += 1;
+    return 0;
+}
+
+void qdelta_scan_init( T_QDELTA_SCAN * scan, const T_QDELTA_STATE * prev )
+{
+    memset(scan, 0, sizeof(*scan));
+    scan->prev = prev;
+    scan->prev_left = prev->count;
+    qdelta_scan_next_prev(scan);
+}
+
+/*
+** Process the next entry of the new scan; IDs have to be passed in strictly
+** ascending order.
+*/
+int qdelta_scan_add( T_QDELTA_SCAN * scan, uint32_t id, const uint64_t * val )
+{
+    if ((scan->next.count != 0) && (id <= scan->next.last_id))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* entries of the previous scan with lower IDs were removed */
+    while (scan->prev_valid && (scan->prev_cur_id < id))
+    {
+        if (qdelta_add_change(scan, scan->prev_cur_id, scan->prev_cur, NULL) != 0)
+            return -1;
+        qdelta_scan_next_prev(scan);
+    }
+
+    if (scan->prev_valid && (scan->prev_cur_id == id))
+    {
+        for (unsigned idx = 0; idx < QDELTA_VAL_COUNT; idx++)
+        {
+            if ((val[idx] != scan->prev_cur[idx]) && !QDELTA_IS_TIME(idx))
+            {
+                if (qdelta_add_change(scan, id, scan->prev_cur, val) != 0)
+                    return -1;
+                break;
+            }
+        }
+        qdelta_scan_next_prev(scan);
+    }
+    else if (qdelta_add_change(scan, id, NULL, val) != 0)
+    {
+        return -1;
+    }
+
+    scan->totals.entries += 1;
+    scan->totals.bcount += val[0];
+    scan->totals.icount += val[4];
+
+    return qdelta_put_entry(&scan->next, id, val);
+}
+
+/*
+** Complete the scan: remaining entries of the previous scan were removed.
+*/
+int qdelta_scan_finish( T_QDELTA_SCAN * scan )
+{
+    while (scan->prev_valid)
+    {
+        if (qdelta_add_change(scan, scan->prev_cur_id, scan->prev_cur, NULL) != 0)
+            return -1;
+        qdelta_scan_next_prev(scan);
+    }
+    return 0;
+}
+
+void qdelta_scan_free( T_QDELTA_SCAN * scan )
+{
+    qdelta_state_free(&scan->next);
+    free(scan->changes);
+    scan->changes = NULL;
+    scan->change_cnt = scan->change_size = 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* State */
+
+/*
+** Replace the destination state with the source, which is left empty.
+*/
+void qdelta_state_move( T_QDELTA_STATE * dst, T_QDELTA_STATE * src )
+{
+    qdelta_state_free(dst);
+    *dst = *src;
+    memset(src, 0, sizeof(*src));
+}
+
+void qdelta_state_free( T_QDELTA_STATE * state )
+{
+    free(state->buf);
+    memset(state, 0, sizeof(*state));
+}
+
+/*
+** Serialize the state for storage, preceded by a magic and a header. The
+** returned buffer has to be freed by the caller.
+*/
+int qdelta_state_export( const T_QDELTA_STATE * state, unsigned qtype,
+                         unsigned char ** p_buf, size_t * p_len )
+{
+    T_QDELTA_STATE hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (qdelta_reserve(&hdr, QDELTA_MAGIC_LEN + 2 * 10 + state->len) != 0)
+        return -1;
+
+    memcpy(hdr.buf, QDELTA_MAGIC, QDELTA_MAGIC_LEN);
+    hdr.len = QDELTA_MAGIC_LEN;
+    qdelta_put_uvar(&hdr, qtype);
+    qdelta_put_uvar(&hdr, state->count);
+    if (state->len != 0)
+        memcpy(hdr.buf + hdr.len, state->buf, state->len);
+
+    *p_buf = hdr.buf;
+    *p_len = hdr.len + state->len;
+    return 0;
+}
+
+/*
+** Load a state serialized via qdelta_state_export(). The content is decoded
+** completely for validation, so that no checks are needed later.
+*/
+int qdelta_state_import( T_QDELTA_STATE * state, unsigned qtype,
+                         const unsigned char * buf, size_t len )
+{
+    size_t pos = QDELTA_MAGIC_LEN;
+    uint64_t val[QDELTA_VAL_COUNT];
+    uint64_t file_qtype;
+    uint64_t count;
+    uint32_t id = 0;
+
+    if ((len < QDELTA_MAGIC_LEN) ||
+        (memcmp(buf, QDELTA_MAGIC, QDELTA_MAGIC_LEN) != 0) ||
+        (qdelta_get_uvar(buf, len, &pos, &file_qtype) != 0) ||
+        (qdelta_get_uvar(buf, len, &pos, &count) != 0) ||
+        (file_qtype != qtype))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t start = pos;
+    for (uint64_t idx = 0; idx < count; idx++)
+    {
+        if (qdelta_get_entry(buf, len, &pos, (idx == 0), &id, val) != 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if (pos != len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    T_QDELTA_STATE tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    if (qdelta_reserve(&tmp, len - start + 1) != 0)
+        return -1;
+    memcpy(tmp.buf, buf + start, len - start);
+    tmp.len = len - start;
+    tmp.count = count;
+    tmp.last_id = id;
+    qdelta_state_move(state, &tmp);
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef INC_QDELTA_H
+#define INC_QDELTA_H
+
+/*
+ *  Interface for incremental comparison of quota table scans
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of values per entry; order as in FsQuota.QueryResult */
+#define QDELTA_VAL_COUNT  8
+
+/* compact encoding of the entries of one scan, sorted by ID */
+typedef struct
+{
+    unsigned char * buf;
+    size_t          len;
+    size_t          size;           /* allocated size of buf */
+    uint64_t        count;          /* number of entries */
+    uint32_t        last_id;        /* ID of the last entry (encoding state) */
+} T_QDELTA_STATE;
+
+/* inserted, removed or changed entry */
+typedef struct
+{
+    uint32_t        id;
+    uint8_t         has_old;        /* FALSE for inserted entries */
+    uint8_t         has_new;        /* FALSE for removed entries */
+    uint64_t        old_val[QDELTA_VAL_COUNT];
+    uint64_t        new_val[QDELTA_VAL_COUNT];
+} T_QDELTA_CHANGE;
+
+typedef struct
+{
+    uint64_t        entries;        /* number of entries in the new scan */
+    uint64_t        bcount;         /* sum of block usage */
+    uint64_t        icount;         /* sum of inode usage */
+    uint64_t        inserted;
+    uint64_t        changed;
+    uint64_t        removed;
+} T_QDELTA_TOTALS;
+
+/* state of an ongoing scan: members are private to qdelta.c, except for
+ * "changes" and "totals", which are valid after qdelta_scan_finish() */
+typedef struct
+{
+    const T_QDELTA_STATE * prev;
+    size_t          prev_pos;       /* decoding position in prev */
+    uint64_t        prev_left;      /* entries not yet decoded */
+    uint32_t        prev_id;        /* last decoded ID */
+    int             prev_valid;     /* TRUE if prev_cur holds an entry */
+    uint32_t        prev_cur_id;
+    uint64_t        prev_cur[QDELTA_VAL_COUNT];
+    T_QDELTA_STATE  next;           /* encoding of the new scan */
+    T_QDELTA_CHANGE * changes;
+    size_t          change_cnt;
+    size_t          change_size;
+    T_QDELTA_TOTALS totals;
+} T_QDELTA_SCAN;
+
+void qdelta_scan_init(T_QDELTA_SCAN * scan, const T_QDELTA_STATE * prev);
+int qdelta_scan_add(T_QDELTA_SCAN * scan, uint32_t id, const uint64_t * val);
+int qdelta_scan_finish(T_QDELTA_SCAN * scan);
+void qdelta_scan_free(T_QDELTA_SCAN * scan);
+
+void qdelta_state_move(T_QDELTA_STATE * dst, T_QDELTA_STATE * src);
+void qdelta_state_free(T_QDELTA_STATE * state);
+int qdelta_state_export(const T_QDELTA_STATE * state, unsigned qtype,
+                        unsigned char ** p_buf, size_t * p_len);
+int qdelta_state_import(T_QDELTA_STATE * state, unsigned qtype,
+                        const unsigned char * buf, size_t len);
+
+#endif /* INC_QDELTA_H */
@@ -0,0 +1,366 @@
+/*
+**  Usage of a directory tree
+**
+**  For file systems without quota support (e.g. tmpfs on older kernels,
+**  overlay or FUSE), usage per user, group and project can only be
+**  determined by summing up the allocated blocks of all inodes below a
+**  directory. The tree is walked by the thread pool of qtree.c, which
+**  reads directories via getdents64; attributes are read per entry via
+**  statx() relative to the directory descriptor, requesting only the
+**  fields needed (which allows network and FUSE file systems to skip
+**  others), and without forcing synchronization with a server.
+**
+**  Inodes with multiple hard links are counted only once: their device and
+**  inode numbers are recorded in a process-wide set shared by all threads.
+**  As most files have a single link, contention on its mutex is low.
+**
+**  Project IDs are not returned by statx(). When requested, they are read
+**  via ioctl FS_IOC_FSGETXATTR, which requires opening each regular file.
+**  Other entries (e.g. symbolic links) are attributed to the project of
+**  their directory, which is the project ID they inherit upon creation.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* for statx() */
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#endif
+
+#include "src/qdu.h"
+
+/* initial number of slots of the set of hard-linked inodes */
+#define QDU_LINKS_MIN       1024
+
+typedef struct
+{
+    T_QUSAGE_MAP    map[QUSAGE_KINDS];
+    uint64_t        inodes;
+    uint64_t        hardlinks;      /* further links of inodes already counted */
+    uint32_t        dir_projid;     /* project of the directory in progress */
+} T_QDU_WORKER;
+
+struct qdu_scan
+{
+    unsigned        thread_cnt;
+    int             with_projects;
+    int             errnum;         /* first allocation failure */
+
+    T_QDU_LINKS     links;
+
+    T_QDU_WORKER    worker[];
+};
+
+/*
+** Read the attributes required for accounting of an entry relative to the
+** given directory descriptor, or of the descriptor itself for an empty name
+*/
+int qdu_stat( int dirfd, const char * name, T_QDU_STAT * st )
+{
+#if defined(__linux__) && defined(STATX_BLOCKS)
+    struct statx stx;
+    int flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC |
+                ((name[0] == 0) ? AT_EMPTY_PATH : 0);
+
+    if (statx(dirfd, name, flags, STATX_TYPE | STATX_UID | STATX_GID | STATX_NLINK | STATX_INO | STATX_BLOCKS,
+              &stx) != 0)
+        return -1;
+
+    st->dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st->ino = stx.stx_ino;
+    st->blocks = stx.stx_blocks;
+    st->uid = stx.stx_uid;
+    st->gid = stx.stx_gid;
+    st->nlink = stx.stx_nlink;
+    st->mode = stx.stx_mode;
+#else
+    struct stat sb;
+
+    if (((name[0] == 0) ? fstat(dirfd, &sb) : fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW)) != 0)
+        return -1;
+
+    st->dev = sb.st_dev;
+    st->ino = sb.st_ino;
+    st->blocks = sb.st_blocks;
+    st->uid = sb.st_uid;
+    st->gid = sb.st_gid;
+    st->nlink = sb.st_nlink;
+    st->mode = sb.st_mode;
+#endif
+    return 0;
+}
+
+/*
+** Read the project ID of the file or directory referenced by the descriptor
+*/
+int qdu_get_projid( int fd, uint32_t * p_projid )
+{
+#if defined(__linux__) && defined(FS_IOC_FSGETXATTR)
+    struct fsxattr fsx;
+
+    if (ioctl(fd, FS_IOC_FSGETXATTR, &fsx) != 0)
+    {
+        if (errno == ENOTTY)
+            errno = ENOTSUP;
+        return -1;
+    }
+    *p_projid = fsx.fsx_projid;
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+static inline size_t qdu_link_hash( uint64_t dev, uint64_t ino, size_t size )
+{
+    uint64_t key = (ino * 0x9E3779B97F4A7C15ull) ^ dev;
+    return (size_t)((key ^ (key >> 29)) & (size - 1));
+}
+
+void qdu_links_init( T_QDU_LINKS * set )
+{
+    memset(set, 0, sizeof(*set));
+    pthread_mutex_init(&set->mutex, NULL);
+}
+
+/*
+** Add an inode to the set of inodes with multiple links; returns 1 if it
+** was added, 0 if it was already present, or -1 upon allocation failure
+*/
+int qdu_links_add( T_QDU_LINKS * set, uint64_t dev, uint64_t ino )
+{
+    int result = 1;
+
+    pthread_mutex_lock(&set->mutex);
+    if ((set->count + 1) * 2 > set->size)
+    {
+        size_t new_size = ((set->size != 0) ? (set->size * 2) : QDU_LINKS_MIN);
+        T_QDU_LINK * links = calloc(new_size, sizeof(T_QDU_LINK));
+        if (links == NULL)
+        {
+            pthread_mutex_unlock(&set->mutex);
+            return -1;
+        }
+
+        // inode number 0 is not used by file systems, so it marks free slots
+        for (size_t idx = 0; idx < set->size; idx++)
+        {
+            if (set->links[idx].ino != 0)
+            {
+                size_t pos = qdu_link_hash(set->links[idx].dev, set->links[idx].ino, new_size);
+                while (links[pos].ino != 0)
+                    pos = (pos + 1) & (new_size - 1);
+                links[pos] = set->links[idx];
+            }
+        }
+        free(set->links);
+        set->links = links;
+        set->size = new_size;
+    }
+
+    size_t pos = qdu_link_hash(dev, ino, set->size);
+    while (set->links[pos].ino != 0)
+    {
+        if ((set->links[pos].ino == ino) && (set->links[pos].dev == dev))
+        {
+            result = 0;
+            break;
+        }
+        pos = (pos + 1) & (set->size - 1);
+    }
+    if (result != 0)
+    {
+        set->links[pos].dev = dev;
+        set->links[pos].ino = ino;
+        set->count += 1;
+    }
+    pthread_mutex_unlock(&set->mutex);
+    return result;
+}
+
+void qdu_links_free( T_QDU_LINKS * set )
+{
+    pthread_mutex_destroy(&set->mutex);
+    free(set->links);
+    set->links = NULL;
+}
+
+static int qdu_account( T_QDU_SCAN * scan, T_QDU_WORKER * wrk, const T_QDU_STAT * st, uint32_t projid )
+{
+    if ((qusage_map_add(&wrk->map[QUSAGE_USER], st->uid, st->blocks, 1) != 0) ||
+        (qusage_map_add(&wrk->map[QUSAGE_GROUP], st->gid, st->blocks, 1) != 0) ||
+        (scan->with_projects &&
+         (qusage_map_add(&wrk->map[QUSAGE_PROJECT], projid, st->blocks, 1) != 0)))
+    {
+        __atomic_store_n(&scan->errnum, ENOMEM, __ATOMIC_RELAXED);
+        return ENOMEM;
+    }
+    wrk->inodes += 1;
+    return 0;
+}
+
+/*
+** Callbacks for the tree walk, invoked by worker threads
+*/
+static int qdu_dir_cb( void * ctx, unsigned worker, int fd, const char * relpath )
+{
+    T_QDU_SCAN * scan = (T_QDU_SCAN *) ctx;
+    T_QDU_WORKER * wrk = &scan->worker[worker];
+    T_QDU_STAT st;
+
+    // entries of the directory are processed next by the same thread
+    wrk->dir_projid = 0;
+    if (qdu_stat(fd, "", &st) != 0)
+        return errno;
+
+    if (scan->with_projects && (qdu_get_projid(fd, &wrk->dir_projid) != 0))
+    {
+        int errnum = errno;
+        qdu_account(scan, wrk, &st, 0);
+        return errnum;
+    }
+    return qdu_account(scan, wrk, &st, wrk->dir_projid);
+}
+
+static int qdu_entry_cb( void * ctx, unsigned worker, int dirfd, const char * name, unsigned char d_type )
+{
+    T_QDU_SCAN * scan = (T_QDU_SCAN *) ctx;
+    T_QDU_WORKER * wrk = &scan->worker[worker];
+    uint32_t projid = wrk->dir_projid;
+    int errnum = 0;
+    T_QDU_STAT st;
+
+    if (qdu_stat(dirfd, name, &st) != 0)
+        return errno;
+
+    if (st.nlink > 1)
+    {
+        int added = qdu_links_add(&scan->links, st.dev, st.ino);
+
+        if (added == 0)
+        {
+            wrk->hardlinks += 1;
+            return 0;
+        }
+        if (added < 0)
+        {
+            __atomic_store_n(&scan->errnum, ENOMEM, __ATOMIC_RELAXED);
+            return ENOMEM;
+        }
+    }
+
+    if (scan->with_projects && (d_type == DT_REG))
+    {
+        int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+        if ((fd < 0) || (qdu_get_projid(fd, &projid) != 0))
+            errnum = errno;
+        if (fd >= 0)
+            close(fd);
+    }
+
+    int acc_err = qdu_account(scan, wrk, &st, projid);
+    return ((errnum != 0) ? errnum : acc_err);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Interface */
+
+/*
+** Create a scan for a walk with the given number of threads. Project IDs
+** are determined only when requested, as that requires opening each file.
+*/
+T_QDU_SCAN * qdu_create( unsigned threads, int with_projects )
+{
+    T_QDU_SCAN * scan;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > QTREE_MAX_THREADS)
+        threads = QTREE_MAX_THREADS;
+
+    scan = calloc(1, sizeof(*scan) + threads * sizeof(T_QDU_WORKER));
+    if (scan == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    scan->thread_cnt = threads;
+    scan->with_projects = with_projects;
+    qdu_links_init(&scan->links);
+    return scan;
+}
+
+/*
+** Fill in the callbacks for qtree_start()
+*/
+void qdu_ops( T_QDU_SCAN * scan, T_QTREE_OPS * ops )
+{
+    ops->dir_cb = qdu_dir_cb;
+    ops->entry_cb = qdu_entry_cb;
+    ops->ctx = scan;
+}
+
+/*
+** Merge the results of all threads, after the walk is finished. Upon
+** success, the result has to be freed via qusage_free(). The table of
+** project IDs is empty unless requested at creation.
+*/
+int qdu_result( T_QDU_SCAN * scan, T_QUSAGE_RESULT * res, uint64_t * p_hardlinks )
+{
+    memset(res, 0, sizeof(*res));
+    *p_hardlinks = 0;
+
+    if (scan->errnum != 0)
+    {
+        errno = scan->errnum;
+        return -1;
+    }
+    for (unsigned kind = 0; kind < QUSAGE_KINDS; kind++)
+    {
+        T_QUSAGE_MAP * map = &scan->worker[0].map[kind];
+
+        for (unsigned wrk_idx = 1; wrk_idx < scan->thread_cnt; wrk_idx++)
+        {
+            if (qusage_map_merge(map, &scan->worker[wrk_idx].map[kind]) != 0)
+            {
+                qusage_free(res);
+                return -1;
+            }
+        }
+        if (qusage_map_table(map, &res->tab[kind], &res->count[kind]) != 0)
+        {
+            qusage_free(res);
+            return -1;
+        }
+    }
+    for (unsigned wrk_idx = 0; wrk_idx < scan->thread_cnt; wrk_idx++)
+    {
+        res->inodes += scan->worker[wrk_idx].inodes;
+        *p_hardlinks += scan->worker[wrk_idx].hardlinks;
+    }
+    return 0;
+}
+
+void qdu_destroy( T_QDU_SCAN * scan )
+{
+    if (scan != NULL)
+    {
+        for (unsigned wrk_idx = 0; wrk_idx < scan->thread_cnt; wrk_idx++)
+            for (unsigned kind = 0; kind < QUSAGE_KINDS; kind++)
+                qusage_map_free(&scan->worker[wrk_idx].map[kind]);
+
+        qdu_links_free(&scan->links);
+        free(scan);
+    }
+}
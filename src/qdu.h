@@ -0,0 +1,63 @@
+#ifndef INC_QDU_H
+#define INC_QDU_H
+
+/*
+ *  Interface for determining usage per user, group and project of a
+ *  directory tree by walking it, for file systems without quota support
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "src/qtree.h"
+#include "src/qusage.h"
+
+/* attributes of an inode as required for accounting */
+typedef struct
+{
+    uint64_t        dev;
+    uint64_t        ino;
+    uint64_t        blocks;         /* in units of 512 bytes */
+    uint32_t        uid;
+    uint32_t        gid;
+    uint32_t        nlink;
+    uint32_t        mode;           /* file type and permissions */
+} T_QDU_STAT;
+
+/* set of inodes with multiple links, shared by all threads of a walk */
+typedef struct
+{
+    uint64_t        dev;
+    uint64_t        ino;
+} T_QDU_LINK;
+
+typedef struct
+{
+    pthread_mutex_t mutex;          /* protects the following */
+    T_QDU_LINK *    links;          /* open-addressing hash set */
+    size_t          size;           /* power of 2 */
+    size_t          count;
+} T_QDU_LINKS;
+
+struct qdu_scan;
+typedef struct qdu_scan T_QDU_SCAN;
+
+/* callbacks are for a walk via qtree_start() with the same thread count */
+T_QDU_SCAN * qdu_create(unsigned threads, int with_projects);
+void qdu_ops(T_QDU_SCAN * scan, T_QTREE_OPS * ops);
+int qdu_result(T_QDU_SCAN * scan, T_QUSAGE_RESULT * res, uint64_t * p_hardlinks);
+void qdu_destroy(T_QDU_SCAN * scan);
+
+/* Helpers for scanners based on tree walks: read the attributes of an
+ * entry relative to a directory descriptor (or of the descriptor itself
+ * for an empty name), or the project ID of an open file; and record
+ * inodes with multiple links, for counting them only once (returns 1 if
+ * the inode was added, 0 if it was already present). */
+int qdu_stat(int dirfd, const char * name, T_QDU_STAT * st);
+int qdu_get_projid(int fd, uint32_t * p_projid);
+void qdu_links_init(T_QDU_LINKS * set);
+int qdu_links_add(T_QDU_LINKS * set, uint64_t dev, uint64_t ino);
+void qdu_links_free(T_QDU_LINKS * set);
+
+#endif /* INC_QDU_H */
@@ -0,0 +1,241 @@
+/*
+**  Filtering of quota entries
+**
+**  Scans looking for a small number of entries among millions (e.g. users
+**  above 90% of their soft limit, or the top 100 users by block usage) are
+**  evaluated here, so that only matching entries need to be converted into
+**  Python objects. Entries are passed either one at a time (enumeration
+**  and bulk queries), or as arrays of columns (snapshots). In the latter
+**  case predicates are evaluated block-wise over the columns into a match
+**  mask, with loops free of branches and data dependencies, which the
+**  compiler can vectorize; only rows passing the mask are gathered.
+**
+**  Top-K selection uses a min-heap of K rows keyed by the selected value,
+**  so that each further row costs a single comparison with the heap root
+**  unless it belongs into the result. Among rows with equal key, those with
+**  lower ID are preferred.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "src/qfilter.h"
+
+/* indices of grace time values; see FsQuota.QueryResult */
+#define QFILTER_BTIME   3
+#define QFILTER_ITIME   7
+
+/* number of rows evaluated per block by qfilter_add_columns() */
+#define QFILTER_BLOCK   1024
+
+void qfilter_result_init( T_QFILTER_RESULT * res )
+{
+    memset(res, 0, sizeof(*res));
+}
+
+void qfilter_result_free( T_QFILTER_RESULT * res )
+{
+    free(res->rows);
+    memset(res, 0, sizeof(*res));
+}
+
+/*
+** Evaluate the predicates of the filter for a single row; top-K selection
+** is not applied.
+*/
+int qfilter_match( const T_QFILTER * flt, const uint64_t * val )
+{
+    if (flt->use_ratio)
+    {
+        uint64_t limit = val[flt->ratio_limit];
+        if ((limit == 0) || ((double) val[flt->ratio_usage] < flt->ratio * (double) limit))
+            return 0;
+    }
+    if (flt->grace_expired)
+    {
+        int64_t btime = (int64_t) val[QFILTER_BTIME];
+        int64_t itime = (int64_t) val[QFILTER_ITIME];
+        if (!(((btime != 0) && (btime <= flt->now)) || ((itime != 0) && (itime <= flt->now))))
+            return 0;
+    }
+    return 1;
+}
+
+/* heap order: TRUE if row A is to be dropped before row B */
+static inline int qfilter_heap_less( const T_QFILTER * flt, const T_QFILTER_ROW * a, const T_QFILTER_ROW * b )
+{
+    return (a->val[flt->top_col] < b->val[flt->top_col]) ||
+           ((a->val[flt->top_col] == b->val[flt->top_col]) && (a->id > b->id));
+}
+
+static void qfilter_sift_down( const T_QFILTER * flt, T_QFILTER_ROW * rows, size_t count, size_t pos )
+{
+    for (;;)
+    {
+        size_t min = pos;
+        size_t child = 2 * pos + 1;
+
+        if ((child < count) && qfilter_heap_less(flt, &rows[child], &rows[min]))
+            min = child;
+        if ((child + 1 < count) && qfilter_heap_less(flt, &rows[child + 1], &rows[min]))
+            min = child + 1;
+        if (min == pos)
+            break;
+
+        T_QFILTER_ROW tmp = rows[pos];
+        rows[pos] = rows[min];
+        rows[min] = tmp;
+        pos = min;
+    }
+}
+
+static void qfilter_sift_up( const T_QFILTER * flt, T_QFILTER_ROW * rows, size_t pos )
+{
+    while (pos > 0)
+    {
+        size_t parent = (pos - 1) / 2;
+        if (!qfilter_heap_less(flt, &rows[pos], &rows[parent]))
+            break;
+
+        T_QFILTER_ROW tmp = rows[pos];
+        rows[pos] = rows[parent];
+        rows[parent] = tmp;
+        pos = parent;
+    }
+}
+
+/*
+** Add a row that matched the predicates to the result
+*/
+static int qfilter_push( const T_QFILTER * flt, T_QFILTER_RESULT * res, const T_QFILTER_ROW * row )
+{
+    if ((flt->top_k != 0) && (res->count >= flt->top_k))
+    {
+        if (qfilter_heap_less(flt, &res->rows[0], row))
+        {
+            res->rows[0] = *row;
+            qfilter_sift_down(flt, res->rows, res->count, 0);
+        }
+        return 0;
+    }
+
+    if (res->count >= res->size)
+    {
+        size_t new_size = (res->size != 0) ? (res->size * 2) : 64;
+        if ((flt->top_k != 0) && (new_size > flt->top_k))
+            new_size = flt->top_k;
+
+        T_QFILTER_ROW * new_rows = realloc(res->rows, new_size * sizeof(T_QFILTER_ROW));
+        if (new_rows == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        res->rows = new_rows;
+        res->size = new_size;
+    }
+    res->rows[res->count++] = *row;
+
+    if (flt->top_k != 0)
+        qfilter_sift_up(flt, res->rows, res->count - 1);
+    return 0;
+}
+
+/*
+** Evaluate the filter for a single row given with its values in the order
+** of FsQuota.QueryResult
+*/
+int qfilter_add_row( const T_QFILTER * flt, T_QFILTER_RESULT * res,
+                     uint32_t id, const uint64_t * val )
+{
+    res->scanned += 1;
+
+    if (qfilter_match(flt, val))
+    {
+        T_QFILTER_ROW row;
+
+        row.id = id;
+        memcpy(row.val, val, sizeof(row.val));
+        return qfilter_push(flt, res, &row);
+    }
+    return 0;
+}
+
+/*
+** Evaluate the filter for an array of rows given as columns, i.e. an array
+** of IDs and one array for each value in the order of FsQuota.QueryResult.
+*/
+int qfilter_add_columns( const T_QFILTER * flt, T_QFILTER_RESULT * res, const uint32_t * ids,
+                         const uint64_t * const * cols, uint64_t count )
+{
+    unsigned char mask[QFILTER_BLOCK];
+
+    for (uint64_t base = 0; base < count; base += QFILTER_BLOCK)
+    {
+        unsigned blk_cnt = ((count - base < QFILTER_BLOCK) ? (count - base) : QFILTER_BLOCK);
+
+        memset(mask, 1, blk_cnt);
+
+        if (flt->use_ratio)
+        {
+            const uint64_t * usage = cols[flt->ratio_usage] + base;
+            const uint64_t * limit = cols[flt->ratio_limit] + base;
+            double ratio = flt->ratio;
+
+            for (unsigned idx = 0; idx < blk_cnt; idx++)
+                mask[idx] &= (limit[idx] != 0) & ((double) usage[idx] >= ratio * (double) limit[idx]);
+        }
+        if (flt->grace_expired)
+        {
+            const int64_t * btime = (const int64_t *) cols[QFILTER_BTIME] + base;
+            const int64_t * itime = (const int64_t *) cols[QFILTER_ITIME] + base;
+            int64_t now = flt->now;
+
+            for (unsigned idx = 0; idx < blk_cnt; idx++)
+                mask[idx] &= ((btime[idx] != 0) & (btime[idx] <= now)) |
+                             ((itime[idx] != 0) & (itime[idx] <= now));
+        }
+
+        const uint64_t * top_key = ((flt->top_k != 0) ? (cols[flt->top_col] + base) : NULL);
+
+        for (unsigned idx = 0; idx < blk_cnt; idx++)
+        {
+            if (mask[idx] == 0)
+                continue;
+
+            // quick rejection of rows not belonging into a full top-K heap
+            if ((top_key != NULL) && (res->count >= flt->top_k) &&
+                (top_key[idx] < res->rows[0].val[flt->top_col]))
+                continue;
+
+            T_QFILTER_ROW row;
+            row.id = ids[base + idx];
+            for (unsigned col = 0; col < QFILTER_VAL_COUNT; col++)
+                row.val[col] = cols[col][base + idx];
+
+            if (qfilter_push(flt, res, &row) != 0)
+                return -1;
+        }
+        res->scanned += blk_cnt;
+    }
+    return 0;
+}
+
+/*
+** Complete filtering: for top-K selection, the heap is sorted into
+** descending order of the key value (i.e. heap-sort)
+*/
+void qfilter_result_finish( const T_QFILTER * flt, T_QFILTER_RESULT * res )
+{
+    if (flt->top_k != 0)
+    {
+        for (size_t cnt = res->count; cnt > 1; cnt--)
+        {
+            T_QFILTER_ROW tmp = res->rows[0];
+            res->rows[0] = res->rows[cnt - 1];
+            res->rows[cnt - 1] = tmp;
+            qfilter_sift_down(flt, res->rows, cnt - 1, 0);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef INC_QFILTER_H
+#define INC_QFILTER_H
+
+/*
+ *  Interface for filtering quota entries by predicates and top-K selection
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of values per entry; order as in FsQuota.QueryResult */
+#define QFILTER_VAL_COUNT  8
+
+/* filter specification; all given predicates have to match */
+typedef struct
+{
+    int             use_ratio;      /* match if usage >= ratio * limit, limit != 0 */
+    unsigned        ratio_usage;    /* index of the usage value (bcount or icount) */
+    unsigned        ratio_limit;    /* index of the limit value */
+    double          ratio;
+    int             grace_expired;  /* match if btime or itime is set and <= now */
+    int64_t         now;
+    uint64_t        top_k;          /* if non-zero: keep only K largest entries ... */
+    unsigned        top_col;        /* ... by this value */
+} T_QFILTER;
+
+typedef struct
+{
+    uint32_t        id;
+    uint64_t        val[QFILTER_VAL_COUNT];
+} T_QFILTER_ROW;
+
+/* matching rows; organized as min-heap by the top_col value when top_k is
+ * set, until qfilter_result_finish() sorts in descending order */
+typedef struct
+{
+    T_QFILTER_ROW * rows;
+    size_t          count;
+    size_t          size;           /* allocated number of rows */
+    uint64_t        scanned;        /* number of rows evaluated */
+} T_QFILTER_RESULT;
+
+int qfilter_match(const T_QFILTER * flt, const uint64_t * val);
+void qfilter_result_init(T_QFILTER_RESULT * res);
+int qfilter_add_row(const T_QFILTER * flt, T_QFILTER_RESULT * res,
+                    uint32_t id, const uint64_t * val);
+int qfilter_add_columns(const T_QFILTER * flt, T_QFILTER_RESULT * res, const uint32_t * ids,
+                        const uint64_t * const * cols, uint64_t count);
+void qfilter_result_finish(const T_QFILTER * flt, T_QFILTER_RESULT * res);
+void qfilter_result_free(T_QFILTER_RESULT * res);
+
+#endif /* INC_QFILTER_H */
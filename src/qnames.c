@@ -0,0 +1,484 @@
+/*
+**  Resolution of user, group and project IDs into names
+**
+**  Reports on quota usage typically list names rather than IDs. Resolving
+**  these via the name service switch one ID at a time (e.g. pwd.getpwuid()
+**  in Python) may involve a network round-trip to a directory server per
+**  ID, which can take longer than the quota queries themselves. Therefore
+**  results are kept in a process-wide cache per kind of ID, including
+**  negative results for IDs without name. The cache can be pre-warmed by a
+**  single pass over the complete database (getpwent() or getgrent()), which
+**  is cheaper than individual lookups when most entries are needed.
+**
+**  Additionally, a pool of threads can resolve IDs in the background while
+**  the caller is busy with quota queries or enumeration, so that latency
+**  of the name service overlaps with that of the quota queries.
+**
+**  Project names are read from /etc/projid, which has lines of the form
+**  "name:id"; the file is always loaded completely upon first use.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+
+#include "src/qnames.h"
+
+#define QNAMES_PROJID_PATH  "/etc/projid"
+
+typedef struct
+{
+    uint32_t        id;
+    uint8_t         used;
+    char *          name;           /* NULL if the ID has no name */
+} T_QNAMES_ENTRY;
+
+/* open-addressing hash table of resolved IDs */
+typedef struct
+{
+    T_QNAMES_ENTRY * entries;
+    size_t          size;           /* number of slots; power of two */
+    size_t          count;
+    int             prewarmed;
+} T_QNAMES_CACHE;
+
+static pthread_mutex_t qnames_mutex = PTHREAD_MUTEX_INITIALIZER;
+static T_QNAMES_CACHE qnames_cache[QNAMES_KIND_COUNT];
+
+/* getpwent() and getgrent() share a global position, so passes over the
+ * database are serialized; lookup via the cache is not blocked meanwhile */
+static pthread_mutex_t qnames_ent_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* ------------------------------------------------------------------------ */
+/* Cache; all functions require the caller to hold qnames_mutex */
+
+static inline size_t qnames_hash( uint32_t id, size_t size )
+{
+    return (size_t)((id * 2654435761u) & (size - 1));
+}
+
+static T_QNAMES_ENTRY * qnames_cache_find( T_QNAMES_CACHE * cache, uint32_t id )
+{
+    if (cache->size != 0)
+    {
+        for (size_t pos = qnames_hash(id, cache->size); cache->entries[pos].used;
+             pos = (pos + 1) & (cache->size - 1))
+        {
+            if (cache->entries[pos].id == id)
+                return &cache->entries[pos];
+        }
+    }
+    return NULL;
+}
+
+static int qnames_cache_grow( T_QNAMES_CACHE * cache )
+{
+    size_t new_size = (cache->size != 0) ? (cache->size * 2) : 1024;
+    T_QNAMES_ENTRY * new_entries = calloc(new_size, sizeof(T_QNAMES_ENTRY));
+    if (new_entries == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (size_t idx = 0; idx < cache->size; idx++)
+    {
+        if (cache->entries[idx].used)
+        {
+            size_t pos = qnames_hash(cache->entries[idx].id, new_size);
+            while (new_entries[pos].used)
+                pos = (pos + 1) & (new_size - 1);
+            new_entries[pos] = cache->entries[idx];
+        }
+    }
+    free(cache->entries);
+    cache->entries = new_entries;
+    cache->size = new_size;
+    return 0;
+}
+
+/*
+** Add or replace the name of an ID; name may be NULL for IDs without name.
+*/
+static int qnames_cache_insert( T_QNAMES_CACHE * cache, uint32_t id, const char * name )
+{
+    char * copy = NULL;
+
+    if ((name != NULL) && ((copy = strdup(name)) == NULL))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    T_QNAMES_ENTRY * ent = qnames_cache_find(cache, id);
+    if (ent != NULL)
+    {
+        free(ent->name);
+        ent->name = copy;
+        return 0;
+    }
+
+    // keep the load factor below 1/2
+    if ((2 * (cache->count + 1) > cache->size) && (qnames_cache_grow(cache) != 0))
+    {
+        free(copy);
+        return -1;
+    }
+    size_t pos = qnames_hash(id, cache->size);
+    while (cache->entries[pos].used)
+        pos = (pos + 1) & (cache->size - 1);
+
+    cache->entries[pos].id = id;
+    cache->entries[pos].used = 1;
+    cache->entries[pos].name = copy;
+    cache->count += 1;
+    return 0;
+}
+
+static void qnames_cache_free( T_QNAMES_CACHE * cache )
+{
+    for (size_t idx = 0; idx < cache->size; idx++)
+        free(cache->entries[idx].name);
+    free(cache->entries);
+    memset(cache, 0, sizeof(*cache));
+}
+
+/*
+** Look up an ID in the cache: returns 1 and copies the name if found, 0 if
+** the ID is known to have no name, or -1 if the ID is not cached.
+*/
+static int qnames_cache_get( unsigned kind, uint32_t id, char * buf, size_t len )
+{
+    int result = -1;
+
+    pthread_mutex_lock(&qnames_mutex);
+    T_QNAMES_ENTRY * ent = qnames_cache_find(&qnames_cache[kind], id);
+    if (ent != NULL)
+    {
+        if (ent->name != NULL)
+        {
+            strncpy(buf, ent->name, len - 1);
+            buf[len - 1] = 0;
+            result = 1;
+        }
+        else
+            result = 0;
+    }
+    else if ((kind == QNAMES_PROJECT) && qnames_cache[kind].prewarmed)
+    {
+        result = 0;
+    }
+    pthread_mutex_unlock(&qnames_mutex);
+    return result;
+}
+
+static void qnames_cache_put( unsigned kind, uint32_t id, const char * name )
+{
+    pthread_mutex_lock(&qnames_mutex);
+    qnames_cache_insert(&qnames_cache[kind], id, name);  // failure is not fatal
+    pthread_mutex_unlock(&qnames_mutex);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Name service */
+
+/*
+** Resolve a single ID via the name service. Returns 1 if a name was found,
+** 0 if the ID has no name, or -1 upon errors of the name service, which
+** are not cached.
+*/
+static int qnames_nss_lookup( unsigned kind, uint32_t id, char * name, size_t len )
+{
+    long init_size = sysconf((kind == QNAMES_USER) ? _SC_GETPW_R_SIZE_MAX : _SC_GETGR_R_SIZE_MAX);
+    size_t buf_size = (init_size > 0) ? init_size : 1024;
+    char * buf = NULL;
+    int result = -1;
+
+    for (;;)
+    {
+        char * new_buf = realloc(buf, buf_size);
+        if (new_buf == NULL)
+            break;
+        buf = new_buf;
+
+        const char * found = NULL;
+        int err;
+        if (kind == QNAMES_USER)
+        {
+            struct passwd pwd;
+            struct passwd * p_pwd = NULL;
+            err = getpwuid_r(id, &pwd, buf, buf_size, &p_pwd);
+            if ((err == 0) && (p_pwd != NULL))
+                found = pwd.pw_name;
+        }
+        else
+        {
+            struct group grp;
+            struct group * p_grp = NULL;
+            err = getgrgid_r(id, &grp, buf, buf_size, &p_grp);
+            if ((err == 0) && (p_grp != NULL))
+                found = grp.gr_name;
+        }
+
+        if ((err == ERANGE) && (buf_size < 1024 * 1024))
+        {
+            buf_size *= 2;
+            continue;
+        }
+        if (found != NULL)
+        {
+            strncpy(name, found, len - 1);
+            name[len - 1] = 0;
+            result = 1;
+        }
+        else if (err == 0)
+            result = 0;
+        break;
+    }
+    free(buf);
+    return result;
+}
+
+/*
+** Load all entries of the project database into the cache
+*/
+static int qnames_prewarm_projects( size_t * p_count )
+{
+    FILE * fp = fopen(QNAMES_PROJID_PATH, "r");
+    int open_errno = errno;
+    char line[QNAMES_NAME_MAX + 32];
+    size_t count = 0;
+
+    pthread_mutex_lock(&qnames_mutex);
+    if (fp != NULL)
+    {
+        while (fgets(line, sizeof(line), fp) != NULL)
+        {
+            char * sep = strchr(line, ':');
+            char * end;
+
+            if ((line[0] == '#') || (sep == NULL) || (sep == line))
+                continue;
+            *sep = 0;
+            unsigned long id = strtoul(sep + 1, &end, 10);
+            if ((end == sep + 1) || (id > UINT32_MAX))
+                continue;
+            if (qnames_cache_insert(&qnames_cache[QNAMES_PROJECT], id, line) == 0)
+                count += 1;
+        }
+        fclose(fp);
+    }
+    // a missing file means that no projects have names
+    qnames_cache[QNAMES_PROJECT].prewarmed = 1;
+    pthread_mutex_unlock(&qnames_mutex);
+
+    if (p_count != NULL)
+        *p_count = count;
+    if ((fp == NULL) && (open_errno != ENOENT))
+    {
+        errno = open_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Interface */
+
+/*
+** Return the name of the given ID: returns 1 and copies the name into the
+** given buffer, or 0 if the ID has no name (or the name service failed).
+*/
+int qnames_lookup( unsigned kind, uint32_t id, char * buf, size_t len )
+{
+    int result = qnames_cache_get(kind, id, buf, len);
+
+    if (result < 0)
+    {
+        if (kind == QNAMES_PROJECT)
+        {
+            qnames_prewarm_projects(NULL);
+            result = qnames_cache_get(kind, id, buf, len);
+        }
+        else
+        {
+            result = qnames_nss_lookup(kind, id, buf, len);
+            if (result >= 0)
+                qnames_cache_put(kind, id, (result > 0) ? buf : NULL);
+        }
+    }
+    return (result > 0) ? 1 : 0;
+}
+
+/*
+** Load all entries of the user, group or project database into the cache.
+** The number of entries is returned.
+*/
+int qnames_prewarm( unsigned kind, size_t * p_count )
+{
+    size_t count = 0;
+
+    if (kind == QNAMES_PROJECT)
+        return qnames_prewarm_projects(p_count);
+
+    pthread_mutex_lock(&qnames_ent_mutex);
+    if (kind == QNAMES_USER)
+    {
+        struct passwd * pwd;
+        setpwent();
+        while ((pwd = getpwent()) != NULL)
+        {
+            qnames_cache_put(kind, pwd->pw_uid, pwd->pw_name);
+            count += 1;
+        }
+        endpwent();
+    }
+    else
+    {
+        struct group * grp;
+        setgrent();
+        while ((grp = getgrent()) != NULL)
+        {
+            qnames_cache_put(kind, grp->gr_gid, grp->gr_name);
+            count += 1;
+        }
+        endgrent();
+    }
+    pthread_mutex_unlock(&qnames_ent_mutex);
+
+    pthread_mutex_lock(&qnames_mutex);
+    qnames_cache[kind].prewarmed = 1;
+    pthread_mutex_unlock(&qnames_mutex);
+
+    if (p_count != NULL)
+        *p_count = count;
+    return 0;
+}
+
+/*
+** Discard all cached names, e.g. after changes of the user database
+*/
+void qnames_clear( void )
+{
+    pthread_mutex_lock(&qnames_mutex);
+    for (unsigned kind = 0; kind < QNAMES_KIND_COUNT; kind++)
+        qnames_cache_free(&qnames_cache[kind]);
+    pthread_mutex_unlock(&qnames_mutex);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Background resolution */
+
+static void * qnames_resolver_thread( void * arg )
+{
+    T_QNAMES_RESOLVER * res = (T_QNAMES_RESOLVER *) arg;
+    char name[QNAMES_NAME_MAX];
+
+    pthread_mutex_lock(&res->mutex);
+    for (;;)
+    {
+        while ((res->next >= res->count) && !res->finished)
+            pthread_cond_wait(&res->cond, &res->mutex);
+
+        if (res->next >= res->count)
+            break;
+
+        uint32_t id = res->ids[res->next++];
+        pthread_mutex_unlock(&res->mutex);
+
+        qnames_lookup(res->kind, id, name, sizeof(name));
+
+        pthread_mutex_lock(&res->mutex);
+    }
+    pthread_mutex_unlock(&res->mutex);
+    return NULL;
+}
+
+/*
+** Start the given number of threads, which resolve IDs passed via
+** qnames_resolver_add() until qnames_resolver_finish() is called. Upon
+** return, the caller has to call the latter, also in case of failure.
+*/
+int qnames_resolver_start( T_QNAMES_RESOLVER * res, unsigned kind, unsigned threads )
+{
+    memset(res, 0, sizeof(*res));
+    res->kind = kind;
+    pthread_mutex_init(&res->mutex, NULL);
+    pthread_cond_init(&res->cond, NULL);
+
+    // project names are loaded at once, so background threads are no use
+    if (kind == QNAMES_PROJECT)
+        threads = 0;
+    if (threads > QNAMES_MAX_THREADS)
+        threads = QNAMES_MAX_THREADS;
+
+    for (unsigned idx = 0; idx < threads; idx++)
+    {
+        int err = pthread_create(&res->threads[idx], NULL, qnames_resolver_thread, res);
+        if (err != 0)
+        {
+            errno = err;
+            return -1;
+        }
+        res->thread_cnt += 1;
+    }
+    return 0;
+}
+
+/*
+** Queue an ID for resolution. IDs remaining unresolved due to failure are
+** resolved upon conversion of the results.
+*/
+int qnames_resolver_add( T_QNAMES_RESOLVER * res, uint32_t id )
+{
+    int result = 0;
+
+    if (res->thread_cnt == 0)
+        return 0;
+
+    pthread_mutex_lock(&res->mutex);
+    if (res->count >= res->size)
+    {
+        size_t new_size = (res->size != 0) ? (res->size * 2) : 1024;
+        uint32_t * new_ids = realloc(res->ids, new_size * sizeof(uint32_t));
+        if (new_ids != NULL)
+        {
+            res->ids = new_ids;
+            res->size = new_size;
+        }
+        else
+        {
+            errno = ENOMEM;
+            result = -1;
+        }
+    }
+    if (result == 0)
+    {
+        res->ids[res->count++] = id;
+        pthread_cond_signal(&res->cond);
+    }
+    pthread_mutex_unlock(&res->mutex);
+    return result;
+}
+
+/*
+** Wait for resolution of all queued IDs and terminate the threads
+*/
+void qnames_resolver_finish( T_QNAMES_RESOLVER * res )
+{
+    pthread_mutex_lock(&res->mutex);
+    res->finished = 1;
+    pthread_cond_broadcast(&res->cond);
+    pthread_mutex_unlock(&res->mutex);
+
+    for (unsigned idx = 0; idx < res->thread_cnt; idx++)
+        pthread_join(res->threads[idx], NULL);
+
+    pthread_mutex_destroy(&res->mutex);
+    pthread_cond_destroy(&res->cond);
+    free(res->ids);
+    memset(res, 0, sizeof(*res));
+}
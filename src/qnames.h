@@ -0,0 +1,48 @@
+#ifndef INC_QNAMES_H
+#define INC_QNAMES_H
+
+/*
+ *  Interface for resolving user, group and project IDs into names via a
+ *  process-wide cache
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* kinds of IDs; order as quota types */
+#define QNAMES_USER         0
+#define QNAMES_GROUP        1
+#define QNAMES_PROJECT      2
+#define QNAMES_KIND_COUNT   3
+
+/* buffer size for names; longer names are truncated */
+#define QNAMES_NAME_MAX     256
+
+#define QNAMES_MAX_THREADS  16
+
+/* pool of threads resolving IDs in the background, which are passed in
+ * while the caller proceeds with other work (e.g. querying quota) */
+typedef struct
+{
+    unsigned        kind;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint32_t *      ids;            /* queue of IDs to be resolved */
+    size_t          count;
+    size_t          size;           /* allocated number of elements */
+    size_t          next;           /* index of the next ID to be resolved */
+    int             finished;       /* TRUE when no more IDs will be added */
+    unsigned        thread_cnt;
+    pthread_t       threads[QNAMES_MAX_THREADS];
+} T_QNAMES_RESOLVER;
+
+int qnames_lookup(unsigned kind, uint32_t id, char * buf, size_t len);
+int qnames_prewarm(unsigned kind, size_t * p_count);
+void qnames_clear(void);
+
+int qnames_resolver_start(T_QNAMES_RESOLVER * res, unsigned kind, unsigned threads);
+int qnames_resolver_add(T_QNAMES_RESOLVER * res, uint32_t id);
+void qnames_resolver_finish(T_QNAMES_RESOLVER * res);
+
+#endif /* INC_QNAMES_H */
@@ -0,0 +1,225 @@
+/*
+**  Determination of the quota ID of a path
+**
+**  For user and group quotas, the ID is the owner or group of the file as
+**  returned by stat(). For project quotas, the ID is an attribute of the
+**  inode, which is read via ioctl FS_IOC_FSGETXATTR (supported by XFS and
+**  ext4 on Linux 4.5 and later). As that requires opening the file, the
+**  project ID is cached per inode (i.e. device and inode number) for
+**  repeated queries of the same directories. Changing the project ID of an
+**  inode updates its status change time, so that stale entries are
+**  detected via the result of stat(), which is done in any case.
+**
+**  The cache is process-wide, protected by a mutex. When full, it is
+**  simply discarded, as the typical use is a bounded set of directories
+**  (e.g. one per container) queried periodically.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "src/qpathid.h"
+
+/* maximum number of cached inodes; the table has twice as many slots */
+#define QPATHID_CACHE_MAX   65536
+
+typedef struct
+{
+    dev_t           dev;
+    ino_t           ino;
+    struct timespec ctime;
+    uint32_t        projid;
+    uint8_t         used;
+} T_QPATHID_ENTRY;
+
+static pthread_mutex_t qpathid_mutex = PTHREAD_MUTEX_INITIALIZER;
+static T_QPATHID_ENTRY * qpathid_table;     /* 2 * QPATHID_CACHE_MAX slots */
+static size_t qpathid_count;
+
+static inline size_t qpathid_hash( dev_t dev, ino_t ino )
+{
+    uint64_t key = ((uint64_t) ino * 0x9E3779B97F4A7C15ull) ^ (uint64_t) dev;
+    return (size_t)((key ^ (key >> 29)) & (2 * QPATHID_CACHE_MAX - 1));
+}
+
+/*
+** Search the cache for the given inode; returns the slot where the entry
+** is or would be stored. The caller has to hold the mutex.
+*/
+static T_QPATHID_ENTRY * qpathid_find( const struct stat * st )
+{
+    size_t pos = qpathid_hash(st->st_dev, st->st_ino);
+
+    while (qpathid_table[pos].used &&
+           ((qpathid_table[pos].dev != st->st_dev) || (qpathid_table[pos].ino != st->st_ino)))
+    {
+        pos = (pos + 1) & (2 * QPATHID_CACHE_MAX - 1);
+    }
+    return &qpathid_table[pos];
+}
+
+static int qpathid_cache_get( const struct stat * st, uint32_t * p_projid )
+{
+    int found = 0;
+
+    pthread_mutex_lock(&qpathid_mutex);
+    if (qpathid_table != NULL)
+    {
+        T_QPATHID_ENTRY * ent = qpathid_find(st);
+        if (ent->used &&
+            (ent->ctime.tv_sec == st->st_ctim.tv_sec) && (ent->ctime.tv_nsec == st->st_ctim.tv_nsec))
+        {
+            *p_projid = ent->projid;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&qpathid_mutex);
+    return found;
+}
+
+static void qpathid_cache_put( const struct stat * st, uint32_t projid )
+{
+    pthread_mutex_lock(&qpathid_mutex);
+    if ((qpathid_table != NULL) && (qpathid_count >= QPATHID_CACHE_MAX))
+    {
+        memset(qpathid_table, 0, 2 * QPATHID_CACHE_MAX * sizeof(T_QPATHID_ENTRY));
+        qpathid_count = 0;
+    }
+    if (qpathid_table == NULL)
+        qpathid_table = calloc(2 * QPATHID_CACHE_MAX, sizeof(T_QPATHID_ENTRY));
+
+    if (qpathid_table != NULL)  /* failure is not fatal */
+    {
+        T_QPATHID_ENTRY * ent = qpathid_find(st);
+        if (!ent->used)
+        {
+            ent->used = 1;
+            ent->dev = st->st_dev;
+            ent->ino = st->st_ino;
+            qpathid_count += 1;
+        }
+        ent->ctime = st->st_ctim;
+        ent->projid = projid;
+    }
+    pthread_mutex_unlock(&qpathid_mutex);
+}
+
+/*
+** Read the project ID of the given path from the file system
+*/
+static int qpathid_read_projid( const char * path, uint32_t * p_projid )
+{
+#if defined(__linux__) && defined(FS_IOC_FSGETXATTR)
+    struct fsxattr fsx;
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    int result = ioctl(fd, FS_IOC_FSGETXATTR, &fsx);
+    int saved_errno = errno;
+    close(fd);
+
+    if (result != 0)
+    {
+        errno = ((saved_errno == ENOTTY) ? ENOTSUP : saved_errno);
+        return -1;
+    }
+    *p_projid = fsx.fsx_projid;
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/*
+** Determine the user, group or project ID of the given path. If p_dev is
+** not NULL, the path has to be located on the given device, else the call
+** fails with EXDEV.
+*/
+int qpathid_get( const char * path, unsigned kind, const dev_t * p_dev, uint32_t * p_id )
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+        return -1;
+
+    if ((p_dev != NULL) && (st.st_dev != *p_dev))
+    {
+        errno = EXDEV;
+        return -1;
+    }
+
+    if (kind == QPATHID_USER)
+    {
+        *p_id = st.st_uid;
+    }
+    else if (kind == QPATHID_GROUP)
+    {
+        *p_id = st.st_gid;
+    }
+    else if (!qpathid_cache_get(&st, p_id))
+    {
+        if (qpathid_read_projid(path, p_id) != 0)
+            return -1;
+
+        qpathid_cache_put(&st, *p_id);
+    }
+    return 0;
+}
+
+/*
+** Set the project ID of the file or directory referenced by the given
+** descriptor. For directories, the inherit flag is set as well, so that
+** new entries get the same project ID. Attributes are written only when
+** they differ, so that repeated assignment of a tree is cheap.
+*/
+int qpathid_set_project( int fd, uint32_t projid, int is_dir )
+{
+#if defined(__linux__) && defined(FS_IOC_FSSETXATTR)
+    struct fsxattr fsx;
+
+    if (ioctl(fd, FS_IOC_FSGETXATTR, &fsx) != 0)
+        return -1;
+
+    uint32_t xflags = fsx.fsx_xflags | (is_dir ? FS_XFLAG_PROJINHERIT : 0);
+    if ((fsx.fsx_projid != projid) || (fsx.fsx_xflags != xflags))
+    {
+        fsx.fsx_projid = projid;
+        fsx.fsx_xflags = xflags;
+        if (ioctl(fd, FS_IOC_FSSETXATTR, &fsx) != 0)
+            return -1;
+    }
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/*
+** Set the project ID of a regular file, given by name relative to the
+** descriptor of its directory
+*/
+int qpathid_set_project_at( int dirfd, const char * name, uint32_t projid )
+{
+    int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    int result = qpathid_set_project(fd, projid, 0);
+    int saved_errno = errno;
+    close(fd);
+
+    errno = saved_errno;
+    return result;
+}
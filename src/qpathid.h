@@ -0,0 +1,22 @@
+#ifndef INC_QPATHID_H
+#define INC_QPATHID_H
+
+/*
+ *  Interface for determining the user, group or project ID of files, for
+ *  querying quotas by path
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* kinds of IDs; order as quota types */
+#define QPATHID_USER        0
+#define QPATHID_GROUP       1
+#define QPATHID_PROJECT     2
+
+int qpathid_get(const char * path, unsigned kind, const dev_t * p_dev, uint32_t * p_id);
+int qpathid_set_project(int fd, uint32_t projid, int is_dir);
+int qpathid_set_project_at(int dirfd, const char * name, uint32_t projid);
+
+#endif /* INC_QPATHID_H */
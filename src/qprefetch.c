@@ -0,0 +1,147 @@
+/*
+**  Bounded queue for passing chunks of quota entries between threads
+**
+**  A producer thread enumerating quota entries fills chunks of rows and
+**  appends them to the queue, while the consumer (i.e. the Python thread
+**  iterating over the entries) takes chunks from the head. The producer
+**  blocks while the configured number of chunks is queued, so that memory
+**  use is bounded, and the consumer blocks only when the producer has not
+**  yet completed the next chunk. Thus enumeration in the kernel overlaps
+**  with processing of the previous chunk in Python.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "src/qprefetch.h"
+
+int qprefetch_init( T_QPREFETCH_QUEUE * q, unsigned depth )
+{
+    memset(q, 0, sizeof(*q));
+
+    q->slots = calloc(depth, sizeof(T_QPREFETCH_CHUNK *));
+    if (q->slots == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    q->depth = depth;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    return 0;
+}
+
+/*
+** Free the queue including chunks not consumed; the producer has to be
+** terminated already.
+*/
+void qprefetch_destroy( T_QPREFETCH_QUEUE * q )
+{
+    if (q->slots != NULL)
+    {
+        for (unsigned idx = 0; idx < q->count; idx++)
+            free(q->slots[(q->head + idx) % q->depth]);
+        free(q->slots);
+        pthread_mutex_destroy(&q->mutex);
+        pthread_cond_destroy(&q->cond);
+    }
+    memset(q, 0, sizeof(*q));
+}
+
+T_QPREFETCH_CHUNK * qprefetch_chunk_alloc( size_t rows )
+{
+    T_QPREFETCH_CHUNK * chunk = malloc(sizeof(T_QPREFETCH_CHUNK) + rows * sizeof(T_QPREFETCH_ROW));
+    if (chunk != NULL)
+        chunk->count = 0;
+    else
+        errno = ENOMEM;
+    return chunk;
+}
+
+/*
+** Append a chunk, waiting while the queue is full. Fails with ECANCELED
+** when the consumer cancelled; the chunk then remains owned by the caller.
+*/
+int qprefetch_push( T_QPREFETCH_QUEUE * q, T_QPREFETCH_CHUNK * chunk )
+{
+    int result = 0;
+
+    pthread_mutex_lock(&q->mutex);
+    while ((q->count >= q->depth) && !q->cancelled)
+        pthread_cond_wait(&q->cond, &q->mutex);
+
+    if (!q->cancelled)
+    {
+        q->slots[(q->head + q->count) % q->depth] = chunk;
+        q->count += 1;
+        pthread_cond_broadcast(&q->cond);
+    }
+    else
+    {
+        errno = ECANCELED;
+        result = -1;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return result;
+}
+
+/*
+** Take the chunk at the head of the queue, waiting while the queue is empty.
+** Returns NULL when the producer is finished and all chunks were taken. The
+** returned chunk has to be freed by the caller.
+*/
+T_QPREFETCH_CHUNK * qprefetch_pop( T_QPREFETCH_QUEUE * q )
+{
+    T_QPREFETCH_CHUNK * chunk = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    while ((q->count == 0) && !q->finished && !q->cancelled)
+        pthread_cond_wait(&q->cond, &q->mutex);
+
+    if ((q->count > 0) && !q->cancelled)
+    {
+        chunk = q->slots[q->head];
+        q->head = (q->head + 1) % q->depth;
+        q->count -= 1;
+        pthread_cond_broadcast(&q->cond);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return chunk;
+}
+
+/*
+** Called by the producer after appending the last chunk.
+*/
+void qprefetch_finish( T_QPREFETCH_QUEUE * q )
+{
+    pthread_mutex_lock(&q->mutex);
+    q->finished = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/*
+** Called by the consumer for terminating the producer early.
+*/
+void qprefetch_cancel( T_QPREFETCH_QUEUE * q )
+{
+    pthread_mutex_lock(&q->mutex);
+    q->cancelled = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/*
+** Called by the producer for checking for cancellation between pushes,
+** e.g. while skipping entries.
+*/
+int qprefetch_cancelled( T_QPREFETCH_QUEUE * q )
+{
+    int result;
+
+    pthread_mutex_lock(&q->mutex);
+    result = q->cancelled;
+    pthread_mutex_unlock(&q->mutex);
+    return result;
+}
@@ -0,0 +1,50 @@
+#ifndef INC_QPREFETCH_H
+#define INC_QPREFETCH_H
+
+/*
+ *  Interface for passing chunks of quota entries from a producer thread to
+ *  a consumer via a bounded queue
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* number of values per entry; order as in FsQuota.QueryResult */
+#define QPREFETCH_VAL_COUNT  8
+
+typedef struct
+{
+    uint32_t        id;
+    uint64_t        val[QPREFETCH_VAL_COUNT];
+} T_QPREFETCH_ROW;
+
+typedef struct
+{
+    size_t          count;          /* number of valid rows */
+    T_QPREFETCH_ROW rows[];
+} T_QPREFETCH_CHUNK;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    T_QPREFETCH_CHUNK ** slots;     /* ring buffer of queued chunks */
+    unsigned        depth;          /* maximum number of queued chunks */
+    unsigned        head;
+    unsigned        count;
+    int             finished;       /* TRUE when the producer is done */
+    int             cancelled;      /* TRUE when the consumer is gone */
+} T_QPREFETCH_QUEUE;
+
+int qprefetch_init(T_QPREFETCH_QUEUE * q, unsigned depth);
+void qprefetch_destroy(T_QPREFETCH_QUEUE * q);
+
+T_QPREFETCH_CHUNK * qprefetch_chunk_alloc(size_t rows);
+int qprefetch_push(T_QPREFETCH_QUEUE * q, T_QPREFETCH_CHUNK * chunk);
+T_QPREFETCH_CHUNK * qprefetch_pop(T_QPREFETCH_QUEUE * q);
+void qprefetch_finish(T_QPREFETCH_QUEUE * q);
+void qprefetch_cancel(T_QPREFETCH_QUEUE * q);
+int qprefetch_cancelled(T_QPREFETCH_QUEUE * q);
+
+#endif /* INC_QPREFETCH_H */
@@ -0,0 +1,45 @@
+#ifndef INC_QPROBES_H
+#define INC_QPROBES_H
+
+/*
+ *  Static user-space tracing probes (USDT)
+ *
+ *  Probes are placed at entry and exit of quota operations, so that their
+ *  latency can be traced via perf, bpftrace or SystemTap, e.g.:
+ *
+ *    bpftrace -e 'usdt:./FsQuota*.so:fsquota:query__return { @[arg3] = count(); }'
+ *
+ *  All probes are in provider "fsquota". When sys/sdt.h is not available,
+ *  the probes compile to nothing. Else a probe costs a single NOP
+ *  instruction while no tracer is attached.
+ *
+ *  Argument conventions: "id" is the user, group or project ID; "qtype" is
+ *  0 for user, 1 for group and 2 for project quota; "dev" is the device
+ *  argument string as reported by attribute Quota.dev; "errnum" is zero
+ *  upon success, else the errno value.
+ */
+
+#define QPROBE_QTYPE(IS_GRP, IS_PRJ)  ((IS_PRJ) ? 2 : ((IS_GRP) ? 1 : 0))
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define QPROBE1(NAME, A1)  DTRACE_PROBE1(fsquota, NAME, A1)
+#define QPROBE2(NAME, A1, A2)  DTRACE_PROBE2(fsquota, NAME, A1, A2)
+#define QPROBE3(NAME, A1, A2, A3)  DTRACE_PROBE3(fsquota, NAME, A1, A2, A3)
+#define QPROBE4(NAME, A1, A2, A3, A4)  DTRACE_PROBE4(fsquota, NAME, A1, A2, A3, A4)
+#define QPROBE5(NAME, A1, A2, A3, A4, A5)  DTRACE_PROBE5(fsquota, NAME, A1, A2, A3, A4, A5)
+
+#else /* !HAVE_SYS_SDT_H */
+
+/* arguments are referenced only for avoiding "unused variable" warnings */
+#define QPROBE1(NAME, A1)  do { (void)(A1); } while (0)
+#define QPROBE2(NAME, A1, A2)  do { (void)(A1); (void)(A2); } while (0)
+#define QPROBE3(NAME, A1, A2, A3)  do { (void)(A1); (void)(A2); (void)(A3); } while (0)
+#define QPROBE4(NAME, A1, A2, A3, A4)  do { (void)(A1); (void)(A2); (void)(A3); (void)(A4); } while (0)
+#define QPROBE5(NAME, A1, A2, A3, A4, A5)  do { (void)(A1); (void)(A2); (void)(A3); (void)(A4); (void)(A5); } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* INC_QPROBES_H */
@@ -0,0 +1,131 @@
+/*
+**  Summarizing distributions of quota usage in constant memory
+**
+**  Usage values are counted in a log-linear histogram: values below
+**  2^SUB_BITS have a bucket each; larger values are mapped to a bucket by
+**  their exponent (i.e. the position of the highest set bit) and the
+**  following SUB_BITS bits of the mantissa. Thus the bucket index is
+**  derived by bit operations only, memory is fixed (about 15 kB per value)
+**  independent of the number of entries, and quantiles are estimated with
+**  a relative error below 2^-SUB_BITS (i.e. about 3%). Sums and extremes
+**  are exact. Histograms of different scans can be merged by adding
+**  bucket counts, which is why no sampling is used.
+*/
+
+#include <string.h>
+
+#include "src/qsketch.h"
+
+#define QSKETCH_SUB_COUNT   (1 << QSKETCH_SUB_BITS)
+
+static unsigned qsketch_index( uint64_t val )
+{
+    if (val < QSKETCH_SUB_COUNT)
+        return val;
+
+    unsigned exp = 63 - __builtin_clzll(val);
+    unsigned sub = (val >> (exp - QSKETCH_SUB_BITS)) & (QSKETCH_SUB_COUNT - 1);
+
+    return ((exp - QSKETCH_SUB_BITS + 1) << QSKETCH_SUB_BITS) | sub;
+}
+
+/*
+** Return the value in the middle of the range of values mapped to a bucket
+*/
+static uint64_t qsketch_bucket_value( unsigned idx )
+{
+    if (idx < QSKETCH_SUB_COUNT)
+        return idx;
+
+    unsigned exp = (idx >> QSKETCH_SUB_BITS) + QSKETCH_SUB_BITS - 1;
+    unsigned shift = exp - QSKETCH_SUB_BITS;
+    uint64_t low = (uint64_t)(QSKETCH_SUB_COUNT | (idx & (QSKETCH_SUB_COUNT - 1))) << shift;
+
+    return low + (((uint64_t)1 << shift) - 1) / 2;
+}
+
+void qsketch_init( T_QSKETCH * sk, const double * bounds, unsigned bound_cnt )
+{
+    memset(sk, 0, sizeof(*sk));
+
+    if (bound_cnt > QSKETCH_MAX_BOUNDS)
+        bound_cnt = QSKETCH_MAX_BOUNDS;
+    sk->bound_cnt = bound_cnt;
+    memcpy(sk->bounds, bounds, bound_cnt * sizeof(double));
+}
+
+static void qsketch_add_ratio( const T_QSKETCH * sk, T_QSKETCH_RATIO * ratio,
+                               uint64_t usage, uint64_t soft, uint64_t hard )
+{
+    uint64_t limit = ((soft != 0) ? soft : hard);
+
+    if (limit == 0)
+    {
+        ratio->no_limit += 1;
+    }
+    else
+    {
+        double val = (double) usage / (double) limit;
+        unsigned idx = 0;
+
+        while ((idx < sk->bound_cnt) && (val >= sk->bounds[idx]))
+            idx++;
+        ratio->counts[idx] += 1;
+    }
+}
+
+static void qsketch_add_dist( T_QSKETCH_DIST * dist, uint64_t val )
+{
+    if ((dist->count == 0) || (val < dist->min))
+        dist->min = val;
+    if (val > dist->max)
+        dist->max = val;
+    dist->count += 1;
+    dist->sum += val;
+    dist->buckets[qsketch_index(val)] += 1;
+}
+
+/*
+** Account an entry given with its values in the order of FsQuota.QueryResult
+*/
+void qsketch_add( T_QSKETCH * sk, const uint64_t * val )
+{
+    qsketch_add_dist(&sk->usage[0], val[0]);
+    qsketch_add_dist(&sk->usage[1], val[4]);
+
+    qsketch_add_ratio(sk, &sk->ratio[0], val[0], val[1], val[2]);
+    qsketch_add_ratio(sk, &sk->ratio[1], val[4], val[5], val[6]);
+}
+
+/*
+** Estimate the given quantile (0.0 to 1.0) via the nearest-rank method.
+** The result is clamped into the exact range of values.
+*/
+uint64_t qsketch_quantile( const T_QSKETCH_DIST * dist, double quantile )
+{
+    if (dist->count == 0)
+        return 0;
+
+    double rank_f = quantile * (double) dist->count;
+    uint64_t rank = (uint64_t) rank_f;
+    if ((double) rank < rank_f)
+        rank += 1;
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t cumul = 0;
+    for (unsigned idx = 0; idx < QSKETCH_BUCKETS; idx++)
+    {
+        cumul += dist->buckets[idx];
+        if (cumul >= rank)
+        {
+            uint64_t val = qsketch_bucket_value(idx);
+            if (val < dist->min)
+                val = dist->min;
+            if (val > dist->max)
+                val = dist->max;
+            return val;
+        }
+    }
+    return dist->max;
+}
@@ -0,0 +1,53 @@
+#ifndef INC_QSKETCH_H
+#define INC_QSKETCH_H
+
+/*
+ *  Interface for summarizing distributions of quota usage in constant memory
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of values per entry; order as in FsQuota.QueryResult */
+#define QSKETCH_VAL_COUNT   8
+
+/* log-linear histogram: values are mapped to 2^SUB_BITS buckets per power
+ * of two, i.e. quantiles are estimated with relative error below 2^-SUB_BITS */
+#define QSKETCH_SUB_BITS    5
+#define QSKETCH_BUCKETS     ((64 - QSKETCH_SUB_BITS + 1) << QSKETCH_SUB_BITS)
+
+/* maximum number of boundaries of usage/limit ratio histograms */
+#define QSKETCH_MAX_BOUNDS  16
+
+/* distribution of one usage value (block or inode count) */
+typedef struct
+{
+    uint64_t        count;
+    uint64_t        sum;
+    uint64_t        min;
+    uint64_t        max;
+    uint64_t        buckets[QSKETCH_BUCKETS];
+} T_QSKETCH_DIST;
+
+/* histogram of usage relative to the soft limit, or the hard limit if no
+ * soft limit is set: counts[i] holds entries with ratio below bounds[i] and
+ * at least bounds[i-1]; the last element counts ratios >= the last bound */
+typedef struct
+{
+    uint64_t        counts[QSKETCH_MAX_BOUNDS + 1];
+    uint64_t        no_limit;       /* entries without limit */
+} T_QSKETCH_RATIO;
+
+typedef struct
+{
+    unsigned        bound_cnt;
+    double          bounds[QSKETCH_MAX_BOUNDS];
+    T_QSKETCH_DIST  usage[2];       /* index 0: blocks, 1: inodes */
+    T_QSKETCH_RATIO ratio[2];
+} T_QSKETCH;
+
+void qsketch_init(T_QSKETCH * sk, const double * bounds, unsigned bound_cnt);
+void qsketch_add(T_QSKETCH * sk, const uint64_t * val);
+uint64_t qsketch_quantile(const T_QSKETCH_DIST * dist, double quantile);
+
+#endif /* INC_QSKETCH_H */
@@ -0,0 +1,413 @@
+/*
+**  Quota snapshot files
+**
+**  A snapshot holds the quota usage and limits of all IDs with a quota
+**  entry on one file system for one quota type. The file is designed for
+**  being memory-mapped read-only by many processes, so that no parsing is
+**  needed for loading: it starts with a fixed-size header, followed by an
+**  open-addressing hash table mapping IDs to row numbers, followed by one
+**  array per column (see T_QSNAP_COL). All integers are stored in host
+**  byte order; the header contains a marker for detecting files written on
+**  hosts with different byte order, which are rejected. All sections start
+**  at 8-byte aligned offsets, so that columns can be accessed in place.
+**
+**  Hash table slots contain the row number plus one, or zero for empty
+**  slots. The table has at least twice as many slots as there are rows,
+**  so that lookups need only few probes on average.
+**
+**  Files are written under a temporary name and then renamed, so that
+**  readers never see a partially written snapshot.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "src/qsnap.h"
+
+#define QSNAP_MAGIC         "FSQSNAP\0"
+#define QSNAP_VERSION       1
+#define QSNAP_BYTE_ORDER    0x01020304
+#define QSNAP_ALIGN(X)      (((X) + 7) & ~(uint64_t)7)
+#define QSNAP_WRITE_BUF     4096
+
+struct qsnap_builder
+{
+    uint64_t *      rows;           /* ID and values, QSNAP_COL_COUNT per row */
+    uint64_t        count;
+    uint64_t        size;           /* allocated number of rows */
+};
+
+/*
+** Hash function for IDs: multiplicative hashing, folded so that the low
+** bits used for indexing depend on all bits of the ID.
+*/
+static inline uint32_t qsnap_hash( uint32_t id )
+{
+    uint32_t h = id * 0x9E3779B1U;
+    return h ^ (h >> 16);
+}
+
+T_QSNAP_BUILDER * qsnap_builder_create( void )
+{
+    return calloc(1, sizeof(T_QSNAP_BUILDER));
+}
+
+void qsnap_builder_free( T_QSNAP_BUILDER * bld )
+{
+    if (bld != NULL)
+    {
+        free(bld->rows);
+        free(bld);
+    }
+}
+
+uint64_t qsnap_builder_count( const T_QSNAP_BUILDER * bld )
+{
+    return bld->count;
+}
+
+/*
+** Append a row; the given array holds values in the order of the columns
+** following the ID. Returns -1 and sets errno upon error.
+*/
+int qsnap_builder_add( T_QSNAP_BUILDER * bld, uint32_t id, const uint64_t * val )
+{
+    if (bld->count >= bld->size)
+    {
+        /* slot values are stored as row + 1 in 32 bits */
+        if (bld->count >= UINT32_MAX - 1)
+        {
+            errno = EOVERFLOW;
+            return -1;
+        }
+        uint64_t new_size = (bld->size != 0) ? (bld->size * 2) : 1024;
+        uint64_t * new_rows = realloc(bld->rows, new_size * QSNAP_COL_COUNT * sizeof(uint64_t));
+        if (new_rows == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        bld->rows = new_rows;
+        bld->size = new_size;
+    }
+    uint64_t * row = bld->rows + bld->count * QSNAP_COL_COUNT;
+    row[QSNAP_COL_ID] = id;
+    memcpy(row + 1, val, QSNAP_VAL_COUNT * sizeof(uint64_t));
+    bld->count += 1;
+    return 0;
+}
+
+/*
+** Write the given data and pad with zero up to the next 8-byte boundary.
+*/
+static int qsnap_write_padded( FILE * fp, const void * data, uint64_t len )
+{
+    static const char zero[8];
+
+    if ((len != 0) && (fwrite(data, len, 1, fp) != 1))
+        return -1;
+    if ((QSNAP_ALIGN(len) != len) && (fwrite(zero, QSNAP_ALIGN(len) - len, 1, fp) != 1))
+        return -1;
+    return 0;
+}
+
+/*
+** Write one column, converting it from row-wise storage in the builder.
+*/
+static int qsnap_write_column( FILE * fp, const T_QSNAP_BUILDER * bld, T_QSNAP_COL col )
+{
+    uint64_t buf[QSNAP_WRITE_BUF];
+    uint64_t idx = 0;
+
+    while (idx < bld->count)
+    {
+        uint64_t cnt = bld->count - idx;
+        if (cnt > QSNAP_WRITE_BUF)
+            cnt = QSNAP_WRITE_BUF;
+
+        if (col == QSNAP_COL_ID)
+        {
+            uint32_t * ids = (uint32_t *) buf;
+            for (uint64_t off = 0; off < cnt; off++)
+                ids[off] = bld->rows[(idx + off) * QSNAP_COL_COUNT + col];
+            if (fwrite(ids, sizeof(uint32_t), cnt, fp) != cnt)
+                return -1;
+        }
+        else
+        {
+            for (uint64_t off = 0; off < cnt; off++)
+                buf[off] = bld->rows[(idx + off) * QSNAP_COL_COUNT + col];
+            if (fwrite(buf, sizeof(uint64_t), cnt, fp) != cnt)
+                return -1;
+        }
+        idx += cnt;
+    }
+    if ((col == QSNAP_COL_ID) && (bld->count & 1))
+    {
+        uint32_t pad = 0;
+        if (fwrite(&pad, sizeof(pad), 1, fp) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+** Write the snapshot file. Returns -1 and sets errno upon error; in some
+** cases an error description is returned additionally via p_errstr.
+*/
+int qsnap_builder_write( T_QSNAP_BUILDER * bld, const char * path,
+                         const T_QSNAP_INFO * info, const char ** p_errstr )
+{
+    T_QSNAP_HEADER hdr;
+    uint32_t * slots;
+    char * tmp_path;
+    FILE * fp;
+    int fd;
+    int ret = -1;
+
+    *p_errstr = NULL;
+
+    if ((strlen(info->dev) >= QSNAP_DEV_LEN) || (strlen(info->fstype) >= QSNAP_FSTYPE_LEN))
+    {
+        *p_errstr = "device name too long for snapshot header";
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, QSNAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = QSNAP_VERSION;
+    hdr.byte_order = QSNAP_BYTE_ORDER;
+    hdr.hdr_size = sizeof(hdr);
+    hdr.qtype = info->qtype;
+    hdr.count = bld->count;
+    hdr.timestamp = info->timestamp;
+    strcpy(hdr.dev, info->dev);
+    strcpy(hdr.fstype, info->fstype);
+
+    hdr.index_slots = 2;
+    while (hdr.index_slots < bld->count * 2)
+        hdr.index_slots *= 2;
+
+    hdr.index_off = QSNAP_ALIGN(sizeof(hdr));
+    hdr.col_off[QSNAP_COL_ID] = hdr.index_off + QSNAP_ALIGN(hdr.index_slots * sizeof(uint32_t));
+    hdr.col_off[QSNAP_COL_ID + 1] = hdr.col_off[QSNAP_COL_ID] + QSNAP_ALIGN(bld->count * sizeof(uint32_t));
+    for (unsigned col = QSNAP_COL_ID + 2; col < QSNAP_COL_COUNT; col++)
+        hdr.col_off[col] = hdr.col_off[col - 1] + bld->count * sizeof(uint64_t);
+
+    slots = calloc(hdr.index_slots, sizeof(uint32_t));
+    if (slots == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (uint64_t row = 0; row < bld->count; row++)
+    {
+        uint64_t pos = qsnap_hash(bld->rows[row * QSNAP_COL_COUNT + QSNAP_COL_ID]) & (hdr.index_slots - 1);
+        while (slots[pos] != 0)
+            pos = (pos + 1) & (hdr.index_slots - 1);
+        slots[pos] = row + 1;
+    }
+
+    tmp_path = malloc(strlen(path) + 32);
+    if (tmp_path == NULL)
+    {
+        free(slots);
+        errno = ENOMEM;
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp%d", path, (int) getpid());
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if ((fd >= 0) && ((fp = fdopen(fd, "wb")) != NULL))
+    {
+        if ((qsnap_write_padded(fp, &hdr, sizeof(hdr)) == 0) &&
+            (qsnap_write_padded(fp, slots, hdr.index_slots * sizeof(uint32_t)) == 0))
+        {
+            ret = 0;
+            for (unsigned col = 0; (col < QSNAP_COL_COUNT) && (ret == 0); col++)
+                ret = qsnap_write_column(fp, bld, col);
+        }
+        if (fclose(fp) != 0)
+            ret = -1;
+        if (ret == 0)
+        {
+            ret = rename(tmp_path, path);
+        }
+        if (ret != 0)
+        {
+            int errno_bak = errno;
+            unlink(tmp_path);
+            errno = errno_bak;
+        }
+    }
+    else if (fd >= 0)
+    {
+        int errno_bak = errno;
+        close(fd);
+        unlink(tmp_path);
+        errno = errno_bak;
+    }
+    free(tmp_path);
+    free(slots);
+    return ret;
+}
+
+/*
+** Check that a section of the given size at the given offset lies within
+** the file; written such that the sum cannot overflow.
+*/
+static int qsnap_check_section( const T_QSNAP_MAP * map, uint64_t off, uint64_t elem_cnt, uint64_t elem_size )
+{
+    return ((off % 8) == 0) &&
+           (off >= map->hdr->hdr_size) &&
+           (off <= map->size) &&
+           (elem_cnt <= (map->size - off) / elem_size);
+}
+
+/*
+** Map the given snapshot file into memory and validate the header, so that
+** later accesses cannot exceed the mapping. Returns -1 and sets errno upon
+** error; an error description is returned additionally via p_errstr in case
+** of format errors.
+*/
+int qsnap_open( const char * path, T_QSNAP_MAP * map, const char ** p_errstr )
+{
+    struct stat st;
+    const T_QSNAP_HEADER * hdr;
+    void * base;
+    int fd;
+
+    *p_errstr = NULL;
+    memset(map, 0, sizeof(*map));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) != 0)
+    {
+        int errno_bak = errno;
+        close(fd);
+        errno = errno_bak;
+        return -1;
+    }
+    if ((uint64_t) st.st_size < sizeof(T_QSNAP_HEADER))
+    {
+        close(fd);
+        *p_errstr = "not a quota snapshot file";
+        errno = EINVAL;
+        return -1;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        int errno_bak = errno;
+        close(fd);
+        errno = errno_bak;
+        return -1;
+    }
+    close(fd);
+
+    map->base = base;
+    map->size = st.st_size;
+    map->hdr = hdr = base;
+
+    if (memcmp(hdr->magic, QSNAP_MAGIC, sizeof(hdr->magic)) != 0)
+    {
+        *p_errstr = "not a quota snapshot file";
+    }
+    else if (hdr->byte_order != QSNAP_BYTE_ORDER)
+    {
+        *p_errstr = "snapshot was written on a host with different byte order";
+    }
+    else if ((hdr->version != QSNAP_VERSION) || (hdr->hdr_size != sizeof(T_QSNAP_HEADER)))
+    {
+        *p_errstr = "unsupported snapshot format version";
+    }
+    else if ((memchr(hdr->dev, 0, sizeof(hdr->dev)) == NULL) ||
+             (memchr(hdr->fstype, 0, sizeof(hdr->fstype)) == NULL) ||
+             (hdr->count >= UINT32_MAX) ||
+             (hdr->index_slots <= hdr->count) ||
+             ((hdr->index_slots & (hdr->index_slots - 1)) != 0) ||
+             !qsnap_check_section(map, hdr->index_off, hdr->index_slots, sizeof(uint32_t)) ||
+             !qsnap_check_section(map, hdr->col_off[QSNAP_COL_ID], hdr->count, sizeof(uint32_t)))
+    {
+        *p_errstr = "corrupt snapshot header";
+    }
+    else
+    {
+        for (unsigned col = QSNAP_COL_ID + 1; col < QSNAP_COL_COUNT; col++)
+        {
+            if (!qsnap_check_section(map, hdr->col_off[col], hdr->count, sizeof(uint64_t)))
+            {
+                *p_errstr = "corrupt snapshot header";
+                break;
+            }
+        }
+    }
+
+    if (*p_errstr != NULL)
+    {
+        qsnap_close(map);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+void qsnap_close( T_QSNAP_MAP * map )
+{
+    if (map->base != NULL)
+    {
+        munmap((void *) map->base, map->size);
+        memset(map, 0, sizeof(*map));
+    }
+}
+
+const void * qsnap_column( const T_QSNAP_MAP * map, T_QSNAP_COL col )
+{
+    return map->base + map->hdr->col_off[col];
+}
+
+/*
+** Return the row index of the given ID, or -1 if the snapshot contains no
+** entry for the ID.
+*/
+int64_t qsnap_lookup( const T_QSNAP_MAP * map, uint32_t id )
+{
+    const uint32_t * slots = (const uint32_t *) (map->base + map->hdr->index_off);
+    const uint32_t * ids = qsnap_column(map, QSNAP_COL_ID);
+    uint64_t mask = map->hdr->index_slots - 1;
+    uint64_t pos = qsnap_hash(id) & mask;
+
+    for (uint64_t cnt = 0; cnt <= mask; cnt++)
+    {
+        uint32_t slot = slots[pos];
+        if (slot == 0)
+            break;
+        /* slot content is not trusted, as the file may be corrupt */
+        if ((slot <= map->hdr->count) && (ids[slot - 1] == id))
+            return slot - 1;
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+/*
+** Copy the values of the given row, in the order of the columns following
+** the ID.
+*/
+void qsnap_get_row( const T_QSNAP_MAP * map, uint64_t row, uint64_t * val )
+{
+    for (unsigned col = QSNAP_COL_ID + 1; col < QSNAP_COL_COUNT; col++)
+        val[col - 1] = ((const uint64_t *) qsnap_column(map, col))[row];
+}
@@ -0,0 +1,81 @@
+#ifndef INC_QSNAP_H
+#define INC_QSNAP_H
+
+/*
+ *  Interface for writing and memory-mapping quota snapshot files
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* columns of a snapshot; values are used in the file format */
+typedef enum
+{
+    QSNAP_COL_ID,               /* user, group or project ID (uint32) */
+    QSNAP_COL_BCOUNT,           /* following as in FsQuota.QueryResult (uint64) */
+    QSNAP_COL_BSOFT,
+    QSNAP_COL_BHARD,
+    QSNAP_COL_BTIME,            /* int64 */
+    QSNAP_COL_ICOUNT,
+    QSNAP_COL_ISOFT,
+    QSNAP_COL_IHARD,
+    QSNAP_COL_ITIME,            /* int64 */
+    QSNAP_COL_COUNT
+} T_QSNAP_COL;
+
+/* number of value columns, i.e. excluding the ID */
+#define QSNAP_VAL_COUNT  (QSNAP_COL_COUNT - 1)
+
+#define QSNAP_DEV_LEN       256
+#define QSNAP_FSTYPE_LEN    16
+
+/* file header; all integers in host byte order, all offsets 8-byte aligned */
+typedef struct
+{
+    char            magic[8];       /* QSNAP_MAGIC */
+    uint32_t        version;        /* QSNAP_VERSION */
+    uint32_t        byte_order;     /* QSNAP_BYTE_ORDER in byte order of the writer */
+    uint32_t        hdr_size;       /* sizeof(T_QSNAP_HEADER) */
+    uint32_t        qtype;          /* 0: user, 1: group, 2: project */
+    uint64_t        count;          /* number of entries, i.e. rows */
+    int64_t         timestamp;      /* creation time in seconds since epoch */
+    char            dev[QSNAP_DEV_LEN];         /* device argument, zero-terminated */
+    char            fstype[QSNAP_FSTYPE_LEN];   /* access method: "vfs" or "xfs" */
+    uint64_t        index_off;      /* offset of the ID hash table */
+    uint64_t        index_slots;    /* number of uint32 slots; power of 2 */
+    uint64_t        col_off[QSNAP_COL_COUNT];   /* offset of each column */
+} T_QSNAP_HEADER;
+
+/* descriptive parameters for writing a snapshot */
+typedef struct
+{
+    const char *    dev;
+    const char *    fstype;
+    unsigned        qtype;
+    int64_t         timestamp;
+} T_QSNAP_INFO;
+
+typedef struct qsnap_builder T_QSNAP_BUILDER;
+
+/* state of a memory-mapped snapshot file */
+typedef struct
+{
+    const char *            base;
+    size_t                  size;
+    const T_QSNAP_HEADER *  hdr;
+} T_QSNAP_MAP;
+
+T_QSNAP_BUILDER * qsnap_builder_create(void);
+int qsnap_builder_add(T_QSNAP_BUILDER * bld, uint32_t id, const uint64_t * val);
+int qsnap_builder_write(T_QSNAP_BUILDER * bld, const char * path,
+                        const T_QSNAP_INFO * info, const char ** p_errstr);
+uint64_t qsnap_builder_count(const T_QSNAP_BUILDER * bld);
+void qsnap_builder_free(T_QSNAP_BUILDER * bld);
+
+int qsnap_open(const char * path, T_QSNAP_MAP * map, const char ** p_errstr);
+void qsnap_close(T_QSNAP_MAP * map);
+int64_t qsnap_lookup(const T_QSNAP_MAP * map, uint32_t id);
+const void * qsnap_column(const T_QSNAP_MAP * map, T_QSNAP_COL col);
+void qsnap_get_row(const T_QSNAP_MAP * map, uint64_t row, uint64_t * val);
+
+#endif /* INC_QSNAP_H */
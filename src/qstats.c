@@ -0,0 +1,120 @@
+/*
+**  Performance counters
+**
+**  Call counts, error counts by errno and latency histograms for quota
+**  operations, kept per access method. Counters are plain integers updated
+**  via atomic increments, so that they are cheap enough to be always
+**  enabled. Readers may see slightly inconsistent values while operations
+**  are in progress in other threads.
+*/
+
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "src/qstats.h"
+
+T_QSTAT_SET qstat_backend[QSTAT_BE_COUNT];
+T_QSTAT_LAT qstat_mntscan;
+
+#if defined(__GNUC__)
+#define QSTAT_ADD(CNT, VAL)  ((void) __atomic_fetch_add(&(CNT), (VAL), __ATOMIC_RELAXED))
+#else
+#define QSTAT_ADD(CNT, VAL)  ((void) ((CNT) += (VAL)))
+#endif
+
+/*
+** Get a monotonic timestamp in nanoseconds
+*/
+uint64_t qstat_now(void)
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+    }
+}
+
+/*
+** Find the counter slot for the given errno value; a free slot is claimed
+** if the value is not yet known. Values for which no slot is left are
+** counted in the last element.
+*/
+static unsigned qstat_errno_slot(T_QSTAT_LAT * lat, int errnum)
+{
+    unsigned idx;
+
+    if (errnum != 0)
+    {
+        for (idx = 0; idx < QSTAT_ERRNO_SLOTS; idx++)
+        {
+#if defined(__GNUC__)
+            int cur = __atomic_load_n(&lat->err_no[idx], __ATOMIC_RELAXED);
+            if (cur == 0)
+            {
+                /* claim the slot, unless another thread was faster */
+                if (__atomic_compare_exchange_n(&lat->err_no[idx], &cur, errnum, 0,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    cur = errnum;
+            }
+#else
+            int cur = lat->err_no[idx];
+            if (cur == 0)
+            {
+                lat->err_no[idx] = errnum;
+                cur = errnum;
+            }
+#endif
+            if (cur == errnum)
+                return idx;
+        }
+    }
+    return QSTAT_ERRNO_SLOTS;
+}
+
+/*
+** Account one call with the given start and end timestamps and result;
+** errnum is zero when the call was successful.
+*/
+void qstat_record(T_QSTAT_LAT * lat, uint64_t t_start, uint64_t t_end, int errnum)
+{
+    uint64_t dur = (t_end > t_start) ? (t_end - t_start) : 0;
+    uint64_t usec = dur / 1000;
+    unsigned bucket = 0;
+
+    while ((bucket < QSTAT_HIST_BUCKETS - 1) && (usec >= ((uint64_t)1 << bucket)))
+        bucket++;
+
+    QSTAT_INC(lat->calls);
+    QSTAT_ADD(lat->time_ns, dur);
+    QSTAT_INC(lat->hist[bucket]);
+
+    if (errnum != 0)
+    {
+        QSTAT_INC(lat->errors);
+        QSTAT_INC(lat->err_cnt[qstat_errno_slot(lat, errnum)]);
+    }
+}
+
+/*
+** Reset all counters; not synchronized with concurrent updates, so counts
+** of calls in progress may be lost.
+*/
+void qstat_reset_lat(T_QSTAT_LAT * lat)
+{
+    memset(lat, 0, sizeof(*lat));
+}
+
+void qstat_reset_set(T_QSTAT_SET * set)
+{
+    memset(set, 0, sizeof(*set));
+}
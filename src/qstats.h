@@ -0,0 +1,78 @@
+#ifndef INC_QSTATS_H
+#define INC_QSTATS_H
+
+/*
+ *  Interface of the performance counters
+ */
+
+#include <stdint.h>
+
+/* access methods for which counters are kept separately */
+typedef enum
+{
+    QSTAT_BE_VFS,       /* generic quotactl() interface of the platform */
+    QSTAT_BE_XFS,       /* XFS specific quotactl() commands */
+    QSTAT_BE_RPC,       /* NFS mounts, i.e. queries via rquotad */
+    QSTAT_BE_BTRFS,     /* Btrfs qgroup ioctls */
+    QSTAT_BE_COUNT
+} T_QSTAT_BACKEND;
+
+/* operations for which counters are kept separately */
+typedef enum
+{
+    QSTAT_OP_QUERY,
+    QSTAT_OP_SETQLIM,
+    QSTAT_OP_SYNC,
+    QSTAT_OP_COUNT
+} T_QSTAT_OP;
+
+/* histogram bucket N counts durations below 2^N microseconds;
+ * the last bucket counts all longer durations */
+#define QSTAT_HIST_BUCKETS      24
+/* number of distinct errno values counted separately */
+#define QSTAT_ERRNO_SLOTS       8
+
+typedef struct
+{
+    unsigned long   calls;
+    unsigned long   errors;
+    uint64_t        time_ns;        /* sum of durations of all calls */
+    unsigned long   hist[QSTAT_HIST_BUCKETS];
+    int             err_no[QSTAT_ERRNO_SLOTS];  /* errno per slot; 0 if unused */
+    unsigned long   err_cnt[QSTAT_ERRNO_SLOTS + 1];  /* last: other errno values */
+} T_QSTAT_LAT;
+
+typedef struct
+{
+    unsigned long   connects;       /* RPC client handles created */
+    unsigned long   connect_errors; /* failures to create client handles */
+    unsigned long   calls;          /* RPC calls sent */
+    unsigned long   timeouts;       /* RPC calls failed due to timeout */
+    unsigned long   fallbacks;      /* retries with RQUOTAVERS after EXT_RQUOTAVERS failed */
+} T_QSTAT_RPC;
+
+typedef struct
+{
+    T_QSTAT_LAT     op[QSTAT_OP_COUNT];
+    T_QSTAT_RPC     rpc;            /* only used for backend QSTAT_BE_RPC */
+} T_QSTAT_SET;
+
+/* process-wide counters */
+extern T_QSTAT_SET qstat_backend[QSTAT_BE_COUNT];
+extern T_QSTAT_LAT qstat_mntscan;
+
+/* Counters are updated without locks; atomic operations are used where
+ * supported by the compiler, so that counters can be updated by threads
+ * not holding the Python GIL. */
+#if defined(__GNUC__)
+#define QSTAT_INC(CNT)  ((void) __atomic_fetch_add(&(CNT), 1, __ATOMIC_RELAXED))
+#else
+#define QSTAT_INC(CNT)  ((void) ((CNT) += 1))
+#endif
+
+uint64_t qstat_now(void);
+void qstat_record(T_QSTAT_LAT * lat, uint64_t t_start, uint64_t t_end, int errnum);
+void qstat_reset_lat(T_QSTAT_LAT * lat);
+void qstat_reset_set(T_QSTAT_SET * set);
+
+#endif /* INC_QSTATS_H */
@@ -0,0 +1,582 @@
+/*
+**  Largest consumers of quota of a given ID in a directory tree
+**
+**  For answering the question which files use up the quota of a user,
+**  group or project, the tree is walked by the thread pool of qtree.c,
+**  reading attributes via the same helpers as the usage scan of qdu.c.
+**  As a file owned by the ID may be located in any directory, no
+**  directories can be skipped.
+**
+**  Each thread keeps a bounded min-heap of the largest files it has seen,
+**  so that memory use is independent of the number of files, and records
+**  the usage of the ID directly in each directory that contains any. As
+**  the entries of a directory are processed by the thread that opened it,
+**  that usage is summed up without locking. Inodes with multiple links are
+**  counted only once, at the first link found, same as by quota
+**  accounting. After the walk, the heaps are merged, and the usage of each
+**  directory is added to all of its parent directories, for determining
+**  the largest sub-trees.
+**
+**  Unlike for files, memory for directories is not bounded by the number
+**  of requested entries: it grows with the number of directories holding
+**  files of the ID, plus their parents while summing up. The usage of a
+**  sub-tree is final only when all directories below it were processed,
+**  but these are distributed across all threads via the queue of qtree.c
+**  in no particular order, so that there is no point during the walk at
+**  which a sub-tree is known to be complete and could be folded into a
+**  bounded heap. Directories without files of the ID take no memory.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "src/qtop.h"
+#include "src/qdu.h"
+#include "src/qusage.h"
+
+/* initial number of slots of the table of directories */
+#define QTOP_DIRS_MIN       256
+
+typedef struct
+{
+    T_QTOP_ENTRY *  heap;           /* min-heap of the largest files */
+    size_t          heap_count;
+
+    T_QTOP_ENTRY *  dirs;           /* usage directly within directories */
+    size_t          dir_count;
+    size_t          dir_max;
+
+    char *          cur_path;       /* directory in progress */
+    size_t          cur_size;
+    uint64_t        cur_blocks;
+    uint64_t        cur_inodes;
+    uint32_t        cur_projid;
+
+    uint64_t        blocks;
+    uint64_t        inodes;
+} T_QTOP_WORKER;
+
+struct qtop_scan
+{
+    unsigned        thread_cnt;
+    unsigned        kind;
+    uint32_t        id;
+    size_t          top_n;
+    int             errnum;         /* first allocation failure */
+    T_QDU_LINKS     links;
+    T_QTOP_WORKER   worker[];
+};
+
+/* hash table of sub-tree usage by path, used while building the result */
+typedef struct
+{
+    T_QTOP_ENTRY *  slots;          /* free slots have a NULL path */
+    size_t          size;           /* power of 2 */
+    size_t          count;
+} T_QTOP_PATH_MAP;
+
+static void qtop_set_error( T_QTOP_SCAN * scan )
+{
+    __atomic_store_n(&scan->errnum, ENOMEM, __ATOMIC_RELAXED);
+}
+
+static char * qtop_join( const char * relpath, const char * name )
+{
+    size_t rel_len = strlen(relpath);
+    size_t name_len = strlen(name);
+    char * path;
+
+    if ((rel_len == 1) && (relpath[0] == '.'))
+        rel_len = 0;
+
+    path = malloc(rel_len + 1 + name_len + 1);
+    if (path != NULL)
+    {
+        if (rel_len != 0)
+        {
+            memcpy(path, relpath, rel_len);
+            path[rel_len++] = '/';
+        }
+        memcpy(path + rel_len, name, name_len + 1);
+    }
+    return path;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Heap of largest files */
+
+static void qtop_heap_sift_down( T_QTOP_ENTRY * heap, size_t count, size_t pos )
+{
+    for (;;)
+    {
+        size_t min = pos;
+        size_t child = 2 * pos + 1;
+
+        if ((child < count) && (heap[child].blocks < heap[min].blocks))
+            min = child;
+        if ((child + 1 < count) && (heap[child + 1].blocks < heap[min].blocks))
+            min = child + 1;
+        if (min == pos)
+            break;
+
+        T_QTOP_ENTRY tmp = heap[pos];
+        heap[pos] = heap[min];
+        heap[min] = tmp;
+        pos = min;
+    }
+}
+
+/*
+** Add a file to the heap of the worker, if it is larger than the smallest
+** one in the heap, or the heap is not yet full
+*/
+static int qtop_heap_add( T_QTOP_SCAN * scan, T_QTOP_WORKER * wrk, const char * name, uint64_t blocks )
+{
+    if ((wrk->heap_count >= scan->top_n) && (blocks <= wrk->heap[0].blocks))
+        return 0;
+
+    char * path = qtop_join(wrk->cur_path, name);
+    if (path == NULL)
+        return -1;
+
+    if (wrk->heap_count < scan->top_n)
+    {
+        // append and sift up
+        size_t pos = wrk->heap_count++;
+        while ((pos > 0) && (wrk->heap[(pos - 1) / 2].blocks > blocks))
+        {
+            wrk->heap[pos] = wrk->heap[(pos - 1) / 2];
+            pos = (pos - 1) / 2;
+        }
+        wrk->heap[pos].path = path;
+        wrk->heap[pos].blocks = blocks;
+        wrk->heap[pos].inodes = 1;
+    }
+    else
+    {
+        // replace the smallest entry
+        free(wrk->heap[0].path);
+        wrk->heap[0].path = path;
+        wrk->heap[0].blocks = blocks;
+        qtop_heap_sift_down(wrk->heap, wrk->heap_count, 0);
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Usage per directory */
+
+/*
+** Record the usage within the directory processed previously by the worker;
+** this is kept until the end of the walk, see the header comment
+*/
+static int qtop_flush_dir( T_QTOP_WORKER * wrk )
+{
+    if ((wrk->cur_blocks != 0) || (wrk->cur_inodes != 0))
+    {
+        if (wrk->dir_count >= wrk->dir_max)
+        {
+            size_t new_max = ((wrk->dir_max != 0) ? (wrk->dir_max * 2) : QTOP_DIRS_MIN);
+            T_QTOP_ENTRY * dirs = realloc(wrk->dirs, new_max * sizeof(T_QTOP_ENTRY));
+            if (dirs == NULL)
+                return -1;
+            wrk->dirs = dirs;
+            wrk->dir_max = new_max;
+        }
+        char * path = strdup(wrk->cur_path);
+        if (path == NULL)
+            return -1;
+
+        wrk->dirs[wrk->dir_count].path = path;
+        wrk->dirs[wrk->dir_count].blocks = wrk->cur_blocks;
+        wrk->dirs[wrk->dir_count].inodes = wrk->cur_inodes;
+        wrk->dir_count += 1;
+
+        wrk->cur_blocks = 0;
+        wrk->cur_inodes = 0;
+    }
+    return 0;
+}
+
+static size_t qtop_path_hash( const char * path, size_t size )
+{
+    uint64_t hash = 0xcbf29ce484222325ull;      /* FNV-1a */
+    for ( ; *path != 0; path++)
+        hash = (hash ^ (unsigned char) *path) * 0x100000001b3ull;
+    return (size_t)((hash ^ (hash >> 32)) & (size - 1));
+}
+
+/*
+** Add usage to the entry of the given path in the table; the path is
+** copied if it is not yet present
+*/
+static int qtop_path_add( T_QTOP_PATH_MAP * map, const char * path, uint64_t blocks, uint64_t inodes )
+{
+    if ((map->count + 1) * 2 > map->size)
+    {
+        size_t new_size = ((map->size != 0) ? (map->size * 2) : QTOP_DIRS_MIN);
+        T_QTOP_ENTRY * slots = calloc(new_size, sizeof(T_QTOP_ENTRY));
+        if (slots == NULL)
+            return -1;
+
+        for (size_t idx = 0; idx < map->size; idx++)
+        {
+            if (map->slots[idx].path != NULL)
+            {
+                size_t pos = qtop_path_hash(map->slots[idx].path, new_size);
+                while (slots[pos].path != NULL)
+                    pos = (pos + 1) & (new_size - 1);
+                slots[pos] = map->slots[idx];
+            }
+        }
+        free(map->slots);
+        map->slots = slots;
+        map->size = new_size;
+    }
+
+    size_t pos = qtop_path_hash(path, map->size);
+    while ((map->slots[pos].path != NULL) && (strcmp(map->slots[pos].path, path) != 0))
+        pos = (pos + 1) & (map->size - 1);
+
+    if (map->slots[pos].path == NULL)
+    {
+        map->slots[pos].path = strdup(path);
+        if (map->slots[pos].path == NULL)
+            return -1;
+        map->count += 1;
+    }
+    map->slots[pos].blocks += blocks;
+    map->slots[pos].inodes += inodes;
+    return 0;
+}
+
+/*
+** Add usage within a directory to the directory and all of its parents,
+** up to the root of the walk, which has path "."
+*/
+static int qtop_path_add_parents( T_QTOP_PATH_MAP * map, const T_QTOP_ENTRY * dir )
+{
+    int result = 0;
+
+    if (strcmp(dir->path, ".") != 0)
+    {
+        char * path = strdup(dir->path);
+        if (path == NULL)
+            return -1;
+
+        // strip one path component after another
+        size_t len = strlen(path);
+        while ((result == 0) && (len > 0))
+        {
+            result = qtop_path_add(map, path, dir->blocks, dir->inodes);
+
+            while ((len > 0) && (path[len - 1] != '/'))
+                len -= 1;
+            if (len > 0)
+                path[--len] = 0;
+        }
+        free(path);
+    }
+    if (result == 0)
+        result = qtop_path_add(map, ".", dir->blocks, dir->inodes);
+    return result;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Callbacks for the tree walk, invoked by worker threads */
+
+static int qtop_match( const T_QTOP_SCAN * scan, const T_QDU_STAT * st, uint32_t projid )
+{
+    uint32_t id = ((scan->kind == QUSAGE_USER) ? st->uid :
+                   ((scan->kind == QUSAGE_GROUP) ? st->gid : projid));
+    return (id == scan->id);
+}
+
+static int qtop_dir_cb( void * ctx, unsigned worker, int fd, const char * relpath )
+{
+    T_QTOP_SCAN * scan = (T_QTOP_SCAN *) ctx;
+    T_QTOP_WORKER * wrk = &scan->worker[worker];
+    size_t len = strlen(relpath);
+    T_QDU_STAT st;
+
+    // the usage of the previous directory is complete, as its entries have
+    // been processed by this thread
+    if ((wrk->cur_path != NULL) && (qtop_flush_dir(wrk) != 0))
+    {
+        qtop_set_error(scan);
+        return ENOMEM;
+    }
+    if (len + 1 > wrk->cur_size)
+    {
+        char * buf = realloc(wrk->cur_path, len + 1);
+        if (buf == NULL)
+        {
+            qtop_set_error(scan);
+            return ENOMEM;
+        }
+        wrk->cur_path = buf;
+        wrk->cur_size = len + 1;
+    }
+    memcpy(wrk->cur_path, relpath, len + 1);
+
+    wrk->cur_projid = 0;
+    if (qdu_stat(fd, "", &st) != 0)
+        return errno;
+
+    if ((scan->kind == QUSAGE_PROJECT) && (qdu_get_projid(fd, &wrk->cur_projid) != 0))
+        return errno;
+
+    if (qtop_match(scan, &st, wrk->cur_projid))
+    {
+        wrk->cur_blocks += st.blocks;
+        wrk->cur_inodes += 1;
+    }
+    return 0;
+}
+
+static int qtop_entry_cb( void * ctx, unsigned worker, int dirfd, const char * name, unsigned char d_type )
+{
+    T_QTOP_SCAN * scan = (T_QTOP_SCAN *) ctx;
+    T_QTOP_WORKER * wrk = &scan->worker[worker];
+    uint32_t projid = wrk->cur_projid;
+    T_QDU_STAT st;
+
+    if (qdu_stat(dirfd, name, &st) != 0)
+        return errno;
+
+    if ((scan->kind == QUSAGE_PROJECT) && (d_type == DT_REG))
+    {
+        int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+        int errnum = 0;
+
+        if ((fd < 0) || (qdu_get_projid(fd, &projid) != 0))
+            errnum = errno;
+        if (fd >= 0)
+            close(fd);
+        if (errnum != 0)
+            return errnum;
+    }
+
+    if (qtop_match(scan, &st, projid))
+    {
+        // inodes with multiple links are counted at the first link found
+        if (st.nlink > 1)
+        {
+            int added = qdu_links_add(&scan->links, st.dev, st.ino);
+            if (added == 0)
+                return 0;
+            if (added < 0)
+            {
+                qtop_set_error(scan);
+                return ENOMEM;
+            }
+        }
+        wrk->cur_blocks += st.blocks;
+        wrk->cur_inodes += 1;
+
+        if ((d_type == DT_REG) && (qtop_heap_add(scan, wrk, name, st.blocks) != 0))
+        {
+            qtop_set_error(scan);
+            return ENOMEM;
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Interface */
+
+/*
+** Create a scan for a walk with the given number of threads, determining
+** the given number of largest files and directories owned by the given ID
+*/
+T_QTOP_SCAN * qtop_create( unsigned threads, unsigned kind, uint32_t id, size_t top_n )
+{
+    T_QTOP_SCAN * scan;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > QTREE_MAX_THREADS)
+        threads = QTREE_MAX_THREADS;
+    if (top_n < 1)
+        top_n = 1;
+    if (top_n > QTOP_MAX_COUNT)
+        top_n = QTOP_MAX_COUNT;
+
+    scan = calloc(1, sizeof(*scan) + threads * sizeof(T_QTOP_WORKER));
+    if (scan == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    scan->thread_cnt = threads;
+    scan->kind = kind;
+    scan->id = id;
+    scan->top_n = top_n;
+    qdu_links_init(&scan->links);
+
+    for (unsigned idx = 0; idx < threads; idx++)
+    {
+        scan->worker[idx].heap = calloc(top_n, sizeof(T_QTOP_ENTRY));
+        if (scan->worker[idx].heap == NULL)
+        {
+            qtop_destroy(scan);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    return scan;
+}
+
+/*
+** Fill in the callbacks for qtree_start()
+*/
+void qtop_ops( T_QTOP_SCAN * scan, T_QTREE_OPS * ops )
+{
+    ops->dir_cb = qtop_dir_cb;
+    ops->entry_cb = qtop_entry_cb;
+    ops->ctx = scan;
+}
+
+static int qtop_cmp_blocks( const void * a, const void * b )
+{
+    uint64_t blocks_a = ((const T_QTOP_ENTRY *) a)->blocks;
+    uint64_t blocks_b = ((const T_QTOP_ENTRY *) b)->blocks;
+    if (blocks_a != blocks_b)
+        return (blocks_a > blocks_b) ? -1 : 1;
+    return strcmp(((const T_QTOP_ENTRY *) a)->path, ((const T_QTOP_ENTRY *) b)->path);
+}
+
+/*
+** Sort the given entries in descending order of blocks, and free all
+** beyond the given count
+*/
+static void qtop_select( T_QTOP_ENTRY * tab, size_t * p_count, size_t top_n )
+{
+    qsort(tab, *p_count, sizeof(T_QTOP_ENTRY), qtop_cmp_blocks);
+    for (size_t idx = top_n; idx < *p_count; idx++)
+        free(tab[idx].path);
+    if (*p_count > top_n)
+        *p_count = top_n;
+}
+
+/*
+** Merge the results of all threads, after the walk is finished. Upon
+** success, the result has to be freed via qtop_free().
+*/
+int qtop_result( T_QTOP_SCAN * scan, T_QTOP_RESULT * res )
+{
+    T_QTOP_PATH_MAP map = { NULL, 0, 0 };
+    size_t file_total = 0;
+
+    memset(res, 0, sizeof(*res));
+
+    for (unsigned wrk_idx = 0; wrk_idx < scan->thread_cnt; wrk_idx++)
+    {
+        if ((scan->worker[wrk_idx].cur_path != NULL) && (qtop_flush_dir(&scan->worker[wrk_idx]) != 0))
+            qtop_set_error(scan);
+        file_total += scan->worker[wrk_idx].heap_count;
+    }
+    if (scan->errnum != 0)
+    {
+        errno = scan->errnum;
+        return -1;
+    }
+
+    // merge heaps; ownership of paths moves to the result
+    res->files = malloc((file_total + 1) * sizeof(T_QTOP_ENTRY));
+    if (res->files == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (unsigned wrk_idx = 0; wrk_idx < scan->thread_cnt; wrk_idx++)
+    {
+        T_QTOP_WORKER * wrk = &scan->worker[wrk_idx];
+
+        memcpy(&res->files[res->file_count], wrk->heap, wrk->heap_count * sizeof(T_QTOP_ENTRY));
+        res->file_count += wrk->heap_count;
+        wrk->heap_count = 0;
+    }
+    qtop_select(res->files, &res->file_count, scan->top_n);
+
+    // sum up usage of sub-trees
+    for (unsigned wrk_idx = 0; (wrk_idx < scan->thread_cnt) && (scan->errnum == 0); wrk_idx++)
+    {
+        const T_QTOP_WORKER * wrk = &scan->worker[wrk_idx];
+
+        for (size_t idx = 0; idx < wrk->dir_count; idx++)
+        {
+            if (qtop_path_add_parents(&map, &wrk->dirs[idx]) != 0)
+            {
+                scan->errnum = ENOMEM;
+                break;
+            }
+            res->blocks += wrk->dirs[idx].blocks;
+            res->inodes += wrk->dirs[idx].inodes;
+        }
+    }
+    if (scan->errnum == 0)
+    {
+        res->dirs = malloc((map.count + 1) * sizeof(T_QTOP_ENTRY));
+        if (res->dirs == NULL)
+            scan->errnum = ENOMEM;
+    }
+    for (size_t idx = 0; idx < map.size; idx++)
+    {
+        if (map.slots[idx].path != NULL)
+        {
+            if (res->dirs != NULL)
+                res->dirs[res->dir_count++] = map.slots[idx];
+            else
+                free(map.slots[idx].path);
+        }
+    }
+    free(map.slots);
+
+    if (scan->errnum != 0)
+    {
+        qtop_free(res);
+        errno = scan->errnum;
+        return -1;
+    }
+    qtop_select(res->dirs, &res->dir_count, scan->top_n);
+    return 0;
+}
+
+void qtop_free( T_QTOP_RESULT * res )
+{
+    for (size_t idx = 0; idx < res->file_count; idx++)
+        free(res->files[idx].path);
+    for (size_t idx = 0; idx < res->dir_count; idx++)
+        free(res->dirs[idx].path);
+    free(res->files);
+    free(res->dirs);
+    memset(res, 0, sizeof(*res));
+}
+
+void qtop_destroy( T_QTOP_SCAN * scan )
+{
+    if (scan != NULL)
+    {
+        for (unsigned wrk_idx = 0; wrk_idx < scan->thread_cnt; wrk_idx++)
+        {
+            T_QTOP_WORKER * wrk = &scan->worker[wrk_idx];
+
+            if (wrk->heap != NULL)
+                for (size_t idx = 0; idx < wrk->heap_count; idx++)
+                    free(wrk->heap[idx].path);
+            for (size_t idx = 0; idx < wrk->dir_count; idx++)
+                free(wrk->dirs[idx].path);
+            free(wrk->heap);
+            free(wrk->dirs);
+            free(wrk->cur_path);
+        }
+        qdu_links_free(&scan->links);
+        free(scan);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef INC_QTOP_H
+#define INC_QTOP_H
+
+/*
+ *  Interface for determining the largest files and directory sub-trees
+ *  owned by a given user, group or project, by walking a directory tree
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "src/qtree.h"
+
+#define QTOP_MAX_COUNT      10000
+
+typedef struct
+{
+    char *          path;           /* relative to the root of the walk */
+    uint64_t        blocks;         /* in units of 512 bytes */
+    uint64_t        inodes;
+} T_QTOP_ENTRY;
+
+/* result of a scan: entries in descending order of blocks */
+typedef struct
+{
+    T_QTOP_ENTRY *  files;
+    size_t          file_count;
+    T_QTOP_ENTRY *  dirs;           /* usage of the ID in the sub-tree */
+    size_t          dir_count;
+    uint64_t        blocks;         /* total usage of the ID */
+    uint64_t        inodes;
+} T_QTOP_RESULT;
+
+struct qtop_scan;
+typedef struct qtop_scan T_QTOP_SCAN;
+
+/* callbacks are for a walk via qtree_start() with the same thread count */
+T_QTOP_SCAN * qtop_create(unsigned threads, unsigned kind, uint32_t id, size_t top_n);
+void qtop_ops(T_QTOP_SCAN * scan, T_QTREE_OPS * ops);
+int qtop_result(T_QTOP_SCAN * scan, T_QTOP_RESULT * res);
+void qtop_free(T_QTOP_RESULT * res);
+void qtop_destroy(T_QTOP_SCAN * scan);
+
+#endif /* INC_QTOP_H */
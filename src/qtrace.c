@@ -0,0 +1,758 @@
+/*
+**  Recording and replay of quota backend traffic
+**
+**  In recording mode, each quota operation and each mount table scan is
+**  logged with its arguments, result and duration to a binary trace file.
+**  In replay mode, a trace file is loaded into memory and the operations
+**  are served from the trace instead of the backend, delayed by the
+**  recorded durations (optionally scaled). This allows replaying a
+**  workload recorded on a production system deterministically in a lab,
+**  for comparing throughput of different versions of the module.
+**
+**  File format: an 8-byte magic, followed by a sequence of records, each
+**  starting with the record type in one byte. All integers are stored as
+**  variable-length quantities (7 bits per byte, least significant first),
+**  so that the format is compact and independent of the host byte order.
+**  Strings are stored once in a string table record and then referenced
+**  via their index (starting at 1; zero denotes NULL). Timestamps are
+**  stored as difference to the timestamp of the preceding record.
+**
+**  Replay matches records by type, device argument (or path), quota type
+**  and ID. Records with the same key are replayed in the recorded order,
+**  wrapping around at the end.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "src/qstats.h"
+#include "src/qtrace.h"
+
+#define QTRACE_MAGIC        "FSQTRC\0\1"
+#define QTRACE_MAGIC_LEN    8
+#define QTRACE_STR_BUCKETS  1024
+
+typedef struct qtrace_str
+{
+    struct qtrace_str * next;
+    uint32_t        idx;
+    char            str[1];
+} T_QTRACE_STR;
+
+typedef struct
+{
+    uint32_t        first;          /* index of first record with this key */
+    uint32_t        last;           /* index of last record with this key */
+    uint32_t        cursor;         /* index of the record to be replayed next */
+    int             used;
+} T_QTRACE_KEY;
+
+struct qtrace_replay
+{
+    int             refcnt;
+    char *          buf;            /* file content; strings point into it */
+    const char **   strs;           /* string table; element 0 is NULL */
+    uint32_t        str_cnt;
+    T_QTRACE_REC *  recs;
+    uint32_t        rec_cnt;
+    T_QTRACE_KEY *  keys;           /* hash table of record keys */
+    uint32_t        key_mask;
+    double          latency_scale;
+    unsigned long   replayed;
+    unsigned long   misses;
+};
+
+T_QTRACE_MODE qtrace_mode = QTRACE_OFF;
+
+static struct
+{
+    FILE *          fp;
+    int             err;            /* errno of the first write error */
+    uint64_t        t_prev;         /* timestamp of the previous record */
+    uint32_t        str_cnt;
+    unsigned long   records;
+    T_QTRACE_STR *  str_hash[QTRACE_STR_BUCKETS];
+} qtrace_wr;
+
+static T_QTRACE_REPLAY * qtrace_replay_cur;
+
+/*
+** Hash function for strings (FNV-1a)
+*/
+static uint32_t qtrace_hash_str(const char * str)
+{
+    uint32_t h = 2166136261u;
+
+    if (str != NULL)
+    {
+        while (*str != 0)
+        {
+            h = (h ^ (unsigned char)*(str++)) * 16777619u;
+        }
+    }
+    return h;
+}
+
+static uint32_t qtrace_hash_key(unsigned type, const char * str, unsigned qtype, uint32_t id)
+{
+    uint32_t h = qtrace_hash_str(str);
+
+    h = (h ^ type) * 16777619u;
+    h = (h ^ qtype) * 16777619u;
+    h = (h ^ id) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Recording */
+
+static void qtrace_put_byte(unsigned val)
+{
+    if (putc(val, qtrace_wr.fp) == EOF)
+    {
+        if (qtrace_wr.err == 0)
+            qtrace_wr.err = ((errno != 0) ? errno : EIO);
+    }
+}
+
+static void qtrace_put_uvar(uint64_t val)
+{
+    while (val >= 0x80)
+    {
+        qtrace_put_byte((val & 0x7F) | 0x80);
+        val >>= 7;
+    }
+    qtrace_put_byte(val);
+}
+
+/* signed values are mapped to unsigned via "zig-zag" encoding */
+static void qtrace_put_svar(int64_t val)
+{
+    qtrace_put_uvar(((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+/*
+** Return the string table index of the given string; the string is added
+** to the table and written to the file if not yet present.
+*/
+static uint32_t qtrace_put_str(const char * str)
+{
+    T_QTRACE_STR * ent;
+    size_t len;
+    uint32_t h;
+
+    if (str == NULL)
+        return 0;
+
+    h = qtrace_hash_str(str) % QTRACE_STR_BUCKETS;
+    for (ent = qtrace_wr.str_hash[h]; ent != NULL; ent = ent->next)
+    {
+        if (strcmp(ent->str, str) == 0)
+            return ent->idx;
+    }
+
+    len = strlen(str);
+    ent = malloc(sizeof(T_QTRACE_STR) + len);
+    if (ent == NULL)
+    {
+        if (qtrace_wr.err == 0)
+            qtrace_wr.err = ENOMEM;
+        return 0;
+    }
+    memcpy(ent->str, str, len + 1);
+    ent->idx = ++qtrace_wr.str_cnt;
+    ent->next = qtrace_wr.str_hash[h];
+    qtrace_wr.str_hash[h] = ent;
+
+    /* the terminating zero is included so that strings can be used in place
+     * after loading the file */
+    qtrace_put_byte(QTRACE_REC_STR);
+    qtrace_put_uvar(len);
+    if (fwrite(str, 1, len + 1, qtrace_wr.fp) != len + 1)
+    {
+        if (qtrace_wr.err == 0)
+            qtrace_wr.err = ((errno != 0) ? errno : EIO);
+    }
+    return ent->idx;
+}
+
+/*
+** Append the given record to the trace file
+*/
+void qtrace_put(const T_QTRACE_REC * rec)
+{
+    uint32_t str_idx, str2_idx, str3_idx;
+    uint32_t * mnt_idx = NULL;
+    unsigned val_cnt = 0;
+    uint64_t cnt;
+
+    if (qtrace_mode != QTRACE_RECORD)
+        return;
+
+    /* string table entries have to precede the record referencing them */
+    str_idx = qtrace_put_str(rec->str);
+    str2_idx = qtrace_put_str(rec->str2);
+    str3_idx = qtrace_put_str(rec->str3);
+    if (rec->type == QTRACE_REC_MNTTAB)
+    {
+        mnt_idx = malloc(sizeof(uint32_t) * 4 * (rec->val[0] + 1));
+        if (mnt_idx == NULL)
+        {
+            if (qtrace_wr.err == 0)
+                qtrace_wr.err = ENOMEM;
+            return;
+        }
+        for (cnt = 0; cnt < rec->val[0] * 4; cnt++)
+        {
+            mnt_idx[cnt] = qtrace_put_str(rec->mnt[cnt]);
+        }
+    }
+
+    qtrace_put_byte(rec->type);
+    qtrace_put_svar((int64_t)(rec->t_start - qtrace_wr.t_prev));
+    qtrace_put_uvar(rec->duration);
+    qtrace_wr.t_prev = rec->t_start;
+
+    switch (rec->type)
+    {
+        case QTRACE_REC_QUERY:
+        case QTRACE_REC_SETQLIM:
+        case QTRACE_REC_SYNC:
+            if (rec->type == QTRACE_REC_QUERY)
+                val_cnt = ((rec->errnum == 0) ? 8 : 0);
+            else if (rec->type == QTRACE_REC_SETQLIM)
+                val_cnt = 5;
+
+            qtrace_put_byte(rec->backend);
+            qtrace_put_byte(rec->qtype);
+            qtrace_put_uvar(rec->id);
+            qtrace_put_uvar(str_idx);
+            qtrace_put_uvar(rec->errnum);
+            qtrace_put_uvar(val_cnt);
+            for (unsigned idx = 0; idx < val_cnt; idx++)
+            {
+                qtrace_put_uvar(rec->val[idx]);
+            }
+            break;
+
+        case QTRACE_REC_RESOLVE:
+            qtrace_put_uvar(str_idx);
+            qtrace_put_uvar(rec->errnum);
+            qtrace_put_uvar(rec->val[0]);
+            qtrace_put_uvar(str2_idx);
+            qtrace_put_uvar(str3_idx);
+            break;
+
+        case QTRACE_REC_MNTTAB:
+            qtrace_put_uvar(rec->val[0]);
+            for (cnt = 0; cnt < rec->val[0] * 4; cnt++)
+            {
+                qtrace_put_uvar(mnt_idx[cnt]);
+            }
+            break;
+
+        default:
+            break;
+    }
+    qtrace_wr.records += 1;
+
+    if (mnt_idx != NULL)
+        free(mnt_idx);
+}
+
+/*
+** Start recording into the given file; an existing file is overwritten.
+** Returns -1 and sets errno upon error.
+*/
+int qtrace_record_start(const char * path, const char ** p_errstr)
+{
+    if (qtrace_mode != QTRACE_OFF)
+    {
+        *p_errstr = "Recording or replay is already active";
+        errno = EBUSY;
+        return -1;
+    }
+
+    memset(&qtrace_wr, 0, sizeof(qtrace_wr));
+    qtrace_wr.fp = fopen(path, "wb");
+    if (qtrace_wr.fp == NULL)
+    {
+        *p_errstr = "Failed to create trace file";
+        return -1;
+    }
+    if (fwrite(QTRACE_MAGIC, 1, QTRACE_MAGIC_LEN, qtrace_wr.fp) != QTRACE_MAGIC_LEN)
+    {
+        int errno_bak = errno;
+        fclose(qtrace_wr.fp);
+        qtrace_wr.fp = NULL;
+        *p_errstr = "Failed to write trace file";
+        errno = errno_bak;
+        return -1;
+    }
+    qtrace_wr.t_prev = qstat_now();
+    qtrace_mode = QTRACE_RECORD;
+    return 0;
+}
+
+static int qtrace_record_stop(void)
+{
+    int err = qtrace_wr.err;
+
+    if ((fclose(qtrace_wr.fp) != 0) && (err == 0))
+        err = errno;
+    qtrace_wr.fp = NULL;
+
+    for (unsigned idx = 0; idx < QTRACE_STR_BUCKETS; idx++)
+    {
+        while (qtrace_wr.str_hash[idx] != NULL)
+        {
+            T_QTRACE_STR * ent = qtrace_wr.str_hash[idx];
+            qtrace_wr.str_hash[idx] = ent->next;
+            free(ent);
+        }
+    }
+    errno = err;
+    return ((err != 0) ? -1 : 0);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Replay */
+
+static int qtrace_get_uvar(const char ** p_ptr, const char * end, uint64_t * p_val)
+{
+    const unsigned char * p = (const unsigned char *) *p_ptr;
+    uint64_t val = 0;
+    unsigned shift = 0;
+
+    while ((const char *)p < end)
+    {
+        if (shift > 63)
+            return -1;
+        val |= (uint64_t)(*p & 0x7F) << shift;
+        shift += 7;
+        if ((*(p++) & 0x80) == 0)
+        {
+            *p_ptr = (const char *) p;
+            *p_val = val;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int qtrace_get_str(T_QTRACE_REPLAY * replay, const char ** p_ptr, const char * end,
+                          const char ** p_str)
+{
+    uint64_t idx;
+
+    if ((qtrace_get_uvar(p_ptr, end, &idx) != 0) || (idx > replay->str_cnt))
+        return -1;
+    *p_str = replay->strs[idx];
+    return 0;
+}
+
+/*
+** Add a record to the key hash table, appending it to the list of
+** records with the same key
+*/
+static void qtrace_add_key(T_QTRACE_REPLAY * replay, uint32_t rec_idx)
+{
+    T_QTRACE_REC * rec = &replay->recs[rec_idx];
+    uint32_t h = qtrace_hash_key(rec->type, rec->str, rec->qtype, rec->id);
+    T_QTRACE_KEY * key;
+
+    for (;;)
+    {
+        key = &replay->keys[h & replay->key_mask];
+        if (!key->used)
+        {
+            key->used = 1;
+            key->first = key->last = key->cursor = rec_idx;
+            rec->next = rec_idx;
+            break;
+        }
+        else
+        {
+            const T_QTRACE_REC * other = &replay->recs[key->first];
+            if ((other->type == rec->type) && (other->qtype == rec->qtype) &&
+                (other->id == rec->id) &&
+                ((other->str == rec->str) ||
+                 ((other->str != NULL) && (rec->str != NULL) && (strcmp(other->str, rec->str) == 0))))
+            {
+                replay->recs[key->last].next = rec_idx;
+                rec->next = key->first;
+                key->last = rec_idx;
+                break;
+            }
+        }
+        h += 1;
+    }
+}
+
+static void qtrace_replay_free(T_QTRACE_REPLAY * replay)
+{
+    if (replay->recs != NULL)
+    {
+        for (uint32_t idx = 0; idx < replay->rec_cnt; idx++)
+        {
+            if (replay->recs[idx].mnt != NULL)
+                free((void *) replay->recs[idx].mnt);
+        }
+        free(replay->recs);
+    }
+    if (replay->strs != NULL)
+        free(replay->strs);
+    if (replay->keys != NULL)
+        free(replay->keys);
+    if (replay->buf != NULL)
+        free(replay->buf);
+    free(replay);
+}
+
+/*
+** Parse the content of a trace file; returns -1 if the content is invalid
+** or memory allocation failed.
+*/
+static int qtrace_parse(T_QTRACE_REPLAY * replay, size_t size)
+{
+    const char * p = replay->buf + QTRACE_MAGIC_LEN;
+    const char * end = replay->buf + size;
+    uint32_t str_max = 0;
+    uint32_t rec_max = 0;
+    uint64_t t_prev = 0;
+    uint64_t val;
+
+    while (p < end)
+    {
+        unsigned type = (unsigned char) *(p++);
+
+        if (type == QTRACE_REC_STR)
+        {
+            if ((qtrace_get_uvar(&p, end, &val) != 0) ||
+                (val >= (uint64_t)(end - p)) || (p[val] != 0))
+                return -1;
+            if (replay->str_cnt + 1 >= str_max)
+            {
+                str_max = (str_max != 0) ? (str_max * 2) : 256;
+                const char ** strs = realloc(replay->strs, sizeof(char *) * str_max);
+                if (strs == NULL)
+                    return -1;
+                replay->strs = strs;
+                replay->strs[0] = NULL;
+            }
+            replay->strs[++replay->str_cnt] = p;
+            p += val + 1;
+            continue;
+        }
+
+        if (replay->rec_cnt >= rec_max)
+        {
+            rec_max = (rec_max != 0) ? (rec_max * 2) : 1024;
+            T_QTRACE_REC * recs = realloc(replay->recs, sizeof(T_QTRACE_REC) * rec_max);
+            if (recs == NULL)
+                return -1;
+            replay->recs = recs;
+        }
+        T_QTRACE_REC * rec = &replay->recs[replay->rec_cnt];
+        memset(rec, 0, sizeof(*rec));
+        rec->type = type;
+
+        if ((qtrace_get_uvar(&p, end, &val) != 0))
+            return -1;
+        /* zig-zag decoding of the signed difference */
+        t_prev += (val >> 1) ^ -(val & 1);
+        rec->t_start = t_prev;
+        if (qtrace_get_uvar(&p, end, &rec->duration) != 0)
+            return -1;
+
+        switch (type)
+        {
+            case QTRACE_REC_QUERY:
+            case QTRACE_REC_SETQLIM:
+            case QTRACE_REC_SYNC:
+                if (end - p < 2)
+                    return -1;
+                rec->backend = *(p++);
+                rec->qtype = *(p++);
+                if (qtrace_get_uvar(&p, end, &val) != 0)
+                    return -1;
+                rec->id = val;
+                if ((qtrace_get_str(replay, &p, end, &rec->str) != 0) ||
+                    (qtrace_get_uvar(&p, end, &val) != 0))
+                    return -1;
+                rec->errnum = val;
+                if ((qtrace_get_uvar(&p, end, &val) != 0) || (val > QTRACE_VAL_COUNT))
+                    return -1;
+                for (unsigned idx = 0; idx < val; idx++)
+                {
+                    if (qtrace_get_uvar(&p, end, &rec->val[idx]) != 0)
+                        return -1;
+                }
+                break;
+
+            case QTRACE_REC_RESOLVE:
+                if ((qtrace_get_str(replay, &p, end, &rec->str) != 0) ||
+                    (qtrace_get_uvar(&p, end, &val) != 0) ||
+                    (qtrace_get_uvar(&p, end, &rec->val[0]) != 0) ||
+                    (qtrace_get_str(replay, &p, end, &rec->str2) != 0) ||
+                    (qtrace_get_str(replay, &p, end, &rec->str3) != 0))
+                    return -1;
+                rec->errnum = val;
+                break;
+
+            case QTRACE_REC_MNTTAB:
+                /* each entry needs at least 4 bytes, which limits the allocation size */
+                if ((qtrace_get_uvar(&p, end, &rec->val[0]) != 0) ||
+                    (rec->val[0] > (uint64_t)(end - p) / 4))
+                    return -1;
+                {
+                    const char ** mnt = malloc(sizeof(char *) * 4 * (rec->val[0] + 1));
+                    if (mnt == NULL)
+                        return -1;
+                    rec->mnt = mnt;
+                    for (uint64_t idx = 0; idx < rec->val[0] * 4; idx++)
+                    {
+                        if (qtrace_get_str(replay, &p, end, &mnt[idx]) != 0)
+                        {
+                            replay->rec_cnt += 1;  /* for freeing the array */
+                            return -1;
+                        }
+                    }
+                }
+                break;
+
+            default:
+                return -1;
+        }
+        replay->rec_cnt += 1;
+    }
+
+    /* build hash table with a load factor of at most 50% */
+    replay->key_mask = 1024 - 1;
+    while (replay->key_mask < replay->rec_cnt * 2)
+        replay->key_mask = (replay->key_mask << 1) | 1;
+    replay->keys = calloc(replay->key_mask + 1, sizeof(T_QTRACE_KEY));
+    if (replay->keys == NULL)
+        return -1;
+    for (uint32_t idx = 0; idx < replay->rec_cnt; idx++)
+    {
+        qtrace_add_key(replay, idx);
+    }
+    return 0;
+}
+
+/*
+** Load the given trace file and start serving operations from it.
+** Returns -1 and sets errno upon error.
+*/
+int qtrace_replay_start(const char * path, double latency_scale, const char ** p_errstr)
+{
+    T_QTRACE_REPLAY * replay;
+    size_t size = 0;
+    size_t buf_size = 0;
+    FILE * fp;
+
+    if (qtrace_mode != QTRACE_OFF)
+    {
+        *p_errstr = "Recording or replay is already active";
+        errno = EBUSY;
+        return -1;
+    }
+
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        *p_errstr = "Failed to open trace file";
+        return -1;
+    }
+
+    replay = calloc(1, sizeof(T_QTRACE_REPLAY));
+    if (replay == NULL)
+    {
+        fclose(fp);
+        *p_errstr = "Failed to load trace file";
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (;;)
+    {
+        if (size + 1 >= buf_size)
+        {
+            buf_size = (buf_size != 0) ? (buf_size * 2) : (64 * 1024);
+            char * buf = realloc(replay->buf, buf_size);
+            if (buf == NULL)
+            {
+                fclose(fp);
+                qtrace_replay_free(replay);
+                *p_errstr = "Failed to load trace file";
+                errno = ENOMEM;
+                return -1;
+            }
+            replay->buf = buf;
+        }
+        size_t len = fread(replay->buf + size, 1, buf_size - size, fp);
+        if (len == 0)
+            break;
+        size += len;
+    }
+    if (ferror(fp))
+    {
+        int errno_bak = errno;
+        fclose(fp);
+        qtrace_replay_free(replay);
+        *p_errstr = "Failed to read trace file";
+        errno = errno_bak;
+        return -1;
+    }
+    fclose(fp);
+
+    if ((size < QTRACE_MAGIC_LEN) || (memcmp(replay->buf, QTRACE_MAGIC, QTRACE_MAGIC_LEN) != 0))
+    {
+        qtrace_replay_free(replay);
+        *p_errstr = "Not a FsQuota trace file";
+        errno = EINVAL;
+        return -1;
+    }
+    if (qtrace_parse(replay, size) != 0)
+    {
+        qtrace_replay_free(replay);
+        *p_errstr = "Trace file is corrupt or too large";
+        errno = EINVAL;
+        return -1;
+    }
+
+    replay->refcnt = 1;
+    replay->latency_scale = latency_scale;
+    qtrace_replay_cur = replay;
+    qtrace_mode = QTRACE_REPLAY;
+    return 0;
+}
+
+/*
+** Look up the next record for the given key in the replay trace; returns
+** NULL if there is no matching record. The record remains valid until
+** replay is stopped.
+*/
+const T_QTRACE_REC * qtrace_lookup(T_QTRACE_REC_TYPE type, const char * str,
+                                   unsigned qtype, uint32_t id)
+{
+    T_QTRACE_REPLAY * replay = qtrace_replay_cur;
+    uint32_t h;
+
+    if (replay == NULL)
+        return NULL;
+
+    h = qtrace_hash_key(type, str, qtype, id);
+    for (;;)
+    {
+        T_QTRACE_KEY * key = &replay->keys[h & replay->key_mask];
+        if (!key->used)
+            break;
+
+        const T_QTRACE_REC * rec = &replay->recs[key->first];
+        if ((rec->type == type) && (rec->qtype == qtype) && (rec->id == id) &&
+            ((rec->str == str) ||
+             ((rec->str != NULL) && (str != NULL) && (strcmp(rec->str, str) == 0))))
+        {
+            rec = &replay->recs[key->cursor];
+            key->cursor = rec->next;
+            replay->replayed += 1;
+            return rec;
+        }
+        h += 1;
+    }
+    replay->misses += 1;
+    return NULL;
+}
+
+/*
+** Return the delay for replaying the given record
+*/
+uint64_t qtrace_delay_ns(const T_QTRACE_REC * rec)
+{
+    if ((qtrace_replay_cur == NULL) || (qtrace_replay_cur->latency_scale <= 0.0))
+        return 0;
+    return (uint64_t)(rec->duration * qtrace_replay_cur->latency_scale);
+}
+
+/*
+** Sleep for the given delay; this function can be called without holding
+** the GIL. As sleeping usually overshoots by up to some ten microseconds
+** due to timer slack, the last part of the delay is busy-waiting, so that
+** short latencies such as of local quotactl() are reproduced accurately.
+*/
+#define QTRACE_SPIN_NS  100000
+
+void qtrace_sleep(uint64_t delay_ns)
+{
+    if (delay_ns != 0)
+    {
+        uint64_t deadline = qstat_now() + delay_ns;
+
+        if (delay_ns > QTRACE_SPIN_NS)
+        {
+            struct timespec ts;
+            ts.tv_sec = (delay_ns - QTRACE_SPIN_NS) / 1000000000;
+            ts.tv_nsec = (delay_ns - QTRACE_SPIN_NS) % 1000000000;
+            while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR))
+                ;
+        }
+        while (qstat_now() < deadline)
+            ;
+    }
+}
+
+/*
+** Acquire a reference on the current replay trace, for keeping records
+** valid beyond the end of replay
+*/
+T_QTRACE_REPLAY * qtrace_replay_hold(void)
+{
+    if (qtrace_replay_cur != NULL)
+        qtrace_replay_cur->refcnt += 1;
+    return qtrace_replay_cur;
+}
+
+void qtrace_replay_release(T_QTRACE_REPLAY * replay)
+{
+    if ((replay != NULL) && (--replay->refcnt == 0))
+        qtrace_replay_free(replay);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+** Stop recording or replay. The number of records written, or respectively
+** replayed, is returned, as well as the number of operations in replay for
+** which no record was found. Returns -1 and sets errno if writing the trace
+** file failed.
+*/
+int qtrace_stop(unsigned long * p_records, unsigned long * p_misses)
+{
+    int err = 0;
+
+    *p_records = 0;
+    *p_misses = 0;
+
+    if (qtrace_mode == QTRACE_RECORD)
+    {
+        qtrace_mode = QTRACE_OFF;
+        *p_records = qtrace_wr.records;
+        err = qtrace_record_stop();
+    }
+    else if (qtrace_mode == QTRACE_REPLAY)
+    {
+        T_QTRACE_REPLAY * replay = qtrace_replay_cur;
+
+        qtrace_mode = QTRACE_OFF;
+        qtrace_replay_cur = NULL;
+        *p_records = replay->replayed;
+        *p_misses = replay->misses;
+        qtrace_replay_release(replay);
+    }
+    return err;
+}
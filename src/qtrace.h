@@ -0,0 +1,78 @@
+#ifndef INC_QTRACE_H
+#define INC_QTRACE_H
+
+/*
+ *  Interface for recording and replaying quota backend traffic
+ */
+
+#include <stdint.h>
+#include <errno.h>
+
+typedef enum
+{
+    QTRACE_OFF,
+    QTRACE_RECORD,
+    QTRACE_REPLAY,
+} T_QTRACE_MODE;
+
+/* record types; values are used in the trace file format */
+typedef enum
+{
+    QTRACE_REC_STR = 1,         /* string table entry (file format only) */
+    QTRACE_REC_QUERY = 2,       /* Quota.query() */
+    QTRACE_REC_SETQLIM = 3,     /* Quota.setqlim() */
+    QTRACE_REC_SYNC = 4,        /* Quota.sync() */
+    QTRACE_REC_RESOLVE = 5,     /* mount table search for Quota(path) */
+    QTRACE_REC_MNTTAB = 6,      /* mount table snapshot, i.e. MntTab() iteration */
+} T_QTRACE_REC_TYPE;
+
+/* errno value for operations without matching record in replay */
+#ifdef ENODATA
+#define QTRACE_ERR_NO_RECORD  ENODATA
+#else
+#define QTRACE_ERR_NO_RECORD  ENOENT
+#endif
+
+/* number of values in member "val" */
+#define QTRACE_VAL_COUNT  8
+
+typedef struct
+{
+    uint8_t         type;           /* T_QTRACE_REC_TYPE */
+    uint8_t         backend;        /* T_QSTAT_BACKEND */
+    uint8_t         qtype;          /* 0: user, 1: group, 2: project */
+    int             errnum;         /* zero upon success */
+    uint32_t        id;             /* user, group or project ID */
+    uint64_t        t_start;        /* timestamp in nanoseconds */
+    uint64_t        duration;       /* in nanoseconds */
+    const char *    str;            /* device argument; RESOLVE: path */
+    const char *    str2;           /* RESOLVE: device argument or error description */
+    const char *    str3;           /* RESOLVE: RPC host or NULL */
+    uint64_t        val[QTRACE_VAL_COUNT];  /* QUERY: result; SETQLIM: limits and
+                                             * timereset flag; RESOLVE: device type;
+                                             * MNTTAB: number of entries */
+    const char * const * mnt;       /* MNTTAB: four strings per entry (or NULL) */
+    uint32_t        next;           /* replay: index of next record with same key */
+} T_QTRACE_REC;
+
+typedef struct qtrace_replay T_QTRACE_REPLAY;
+
+/* The following are not thread-safe: all calls have to be serialized by
+ * the caller, i.e. made while holding the Python GIL. */
+extern T_QTRACE_MODE qtrace_mode;
+
+int qtrace_record_start(const char * path, const char ** p_errstr);
+int qtrace_replay_start(const char * path, double latency_scale, const char ** p_errstr);
+int qtrace_stop(unsigned long * p_records, unsigned long * p_misses);
+
+void qtrace_put(const T_QTRACE_REC * rec);
+
+const T_QTRACE_REC * qtrace_lookup(T_QTRACE_REC_TYPE type, const char * str,
+                                   unsigned qtype, uint32_t id);
+uint64_t qtrace_delay_ns(const T_QTRACE_REC * rec);
+void qtrace_sleep(uint64_t delay_ns);
+
+T_QTRACE_REPLAY * qtrace_replay_hold(void);
+void qtrace_replay_release(T_QTRACE_REPLAY * replay);
+
+#endif /* INC_QTRACE_H */
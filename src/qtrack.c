@@ -0,0 +1,878 @@
+/*
+**  Incremental usage tracking via fanotify
+**
+**  For file systems without quota accounting, usage per ID otherwise has to
+**  be determined by walking the complete tree each time. Instead, usage is
+**  determined once by a walk and then kept up to date by processing
+**  fanotify events. The whole file system is marked (FAN_MARK_FILESYSTEM),
+**  so that no watches per directory are needed, and events report file
+**  handles instead of descriptors (FAN_REPORT_FID), so that events do not
+**  keep files open; for created entries, the handle of the directory and
+**  the name are reported (FAN_REPORT_DFID_NAME, Linux 5.9 and later).
+**
+**  Events indicate that an inode changed, but not by how much. Therefore
+**  the accounted attributes (owner, group, project and blocks) of every
+**  inode are kept in a hash table keyed by file handle. Upon an event, the
+**  inode is re-read via open_by_handle_at() and the difference to the
+**  recorded attributes is applied to the usage per ID; deleted inodes are
+**  removed with their recorded usage. As updates are based on current
+**  attributes rather than on the event, processing is idempotent: the
+**  subscription is made before the walk, and events queued in the meantime
+**  are applied afterwards without counting changes twice. Inodes with
+**  multiple links have a single handle, so they are counted once.
+**
+**  The table is split in shards with separate locks, so that the threads of
+**  the walk insert in parallel. As events cover the whole file system, the
+**  walk has to start at its root; inodes created afterward are added upon
+**  their first event. When the event queue of the kernel overflowed,
+**  lost changes cannot be recovered, so that queries fail until tracking is
+**  restarted. Note fanotify and opening files by handle require admin
+**  privileges.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* for name_to_handle_at(), open_by_handle_at() */
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/fanotify.h>
+
+#include "src/qtrack.h"
+#include "src/qdu.h"
+
+/* number of separately locked parts of the inode table; power of 2 */
+#define QTRACK_SHARDS       64
+/* initial number of slots per shard */
+#define QTRACK_SHARD_MIN    256
+/* largest file handle supported, sufficient for common local file systems */
+#define QTRACK_HANDLE_MAX   32
+/* size of the buffer for reading events */
+#define QTRACK_EVENT_BUF    (64 * 1024)
+
+#define QTRACK_EVENT_MASK   (FAN_CREATE | FAN_DELETE_SELF | FAN_MODIFY | FAN_CLOSE_WRITE | \
+                             FAN_ATTRIB | FAN_ONDIR)
+
+/* accounted attributes of an inode */
+typedef struct
+{
+    uint64_t        hash;           /* of the handle; zero marks free slots */
+    uint64_t        blocks;         /* in units of 512 bytes */
+    uint32_t        uid;
+    uint32_t        gid;
+    uint32_t        projid;
+    int32_t         handle_type;
+    uint32_t        handle_len;
+    unsigned char   handle[QTRACK_HANDLE_MAX];
+} T_QTRACK_INODE;
+
+typedef struct
+{
+    pthread_mutex_t mutex;          /* protects the following */
+    T_QTRACK_INODE * slots;         /* open-addressing hash table */
+    size_t          size;           /* power of 2 */
+    size_t          count;
+} T_QTRACK_SHARD;
+
+/* reference to a file handle, as returned by the kernel */
+typedef struct
+{
+    int32_t         type;
+    uint32_t        len;
+    const unsigned char * bytes;
+} T_QTRACK_KEY;
+
+/* buffer for a file handle of maximum size, aligned as struct file_handle */
+typedef struct
+{
+    uint64_t        buf[(sizeof(struct file_handle) + MAX_HANDLE_SZ + 7) / 8];
+} T_QTRACK_FH;
+
+typedef struct
+{
+    T_QUSAGE_MAP    map[QUSAGE_KINDS];
+    uint32_t        dir_projid;     /* project of the directory in progress */
+} T_QTRACK_WORKER;
+
+struct qtrack
+{
+    int             fan_fd;
+    int             mount_fd;       /* for opening files by handle */
+    uint64_t        root_dev;       /* device of the walked tree */
+    int             stop_pipe[2];
+    int             with_projects;
+    unsigned        thread_cnt;
+    int             started;
+    pthread_t       tid;
+    int             errnum;         /* first fatal error; accessed atomically */
+    T_QTRACK_STATS  stats;          /* counters are accessed atomically */
+
+    T_QTRACK_SHARD  shard[QTRACK_SHARDS];
+
+    pthread_mutex_t usage_mutex;    /* protects the following */
+    T_QUSAGE_MAP    usage[QUSAGE_KINDS];
+
+    T_QTRACK_WORKER worker[];       /* used only while seeding */
+};
+
+static void qtrack_fail( T_QTRACK * trk, int errnum )
+{
+    int expected = 0;
+    __atomic_compare_exchange_n(&trk->errnum, &expected, errnum,
+                                0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static uint64_t qtrack_hash( const T_QTRACK_KEY * key )
+{
+    uint64_t hash = 0xcbf29ce484222325ull ^ (uint32_t) key->type;
+
+    for (uint32_t idx = 0; idx < key->len; idx++)
+        hash = (hash ^ key->bytes[idx]) * 0x100000001b3ull;
+
+    hash ^= hash >> 29;
+    return ((hash != 0) ? hash : 1);
+}
+
+/* low bits select the shard, further bits the slot */
+static inline size_t qtrack_slot( uint64_t hash, size_t size )
+{
+    return (size_t)(hash >> 6) & (size - 1);
+}
+
+static T_QTRACK_SHARD * qtrack_shard( T_QTRACK * trk, uint64_t hash )
+{
+    return &trk->shard[hash & (QTRACK_SHARDS - 1)];
+}
+
+/* ------------------------------------------------------------------------ */
+/* Inode table */
+
+static T_QTRACK_INODE * qtrack_find( T_QTRACK_SHARD * shard, uint64_t hash, const T_QTRACK_KEY * key )
+{
+    if (shard->size == 0)
+        return NULL;
+
+    size_t pos = qtrack_slot(hash, shard->size);
+    while (shard->slots[pos].hash != 0)
+    {
+        T_QTRACK_INODE * ent = &shard->slots[pos];
+
+        if ((ent->hash == hash) && (ent->handle_type == key->type) &&
+            (ent->handle_len == key->len) && (memcmp(ent->handle, key->bytes, key->len) == 0))
+            return ent;
+
+        pos = (pos + 1) & (shard->size - 1);
+    }
+    return NULL;
+}
+
+/*
+** Add an entry for the given handle, which must not be present yet; the
+** attributes are filled in by the caller
+*/
+static T_QTRACK_INODE * qtrack_insert( T_QTRACK_SHARD * shard, uint64_t hash, const T_QTRACK_KEY * key )
+{
+    if ((shard->count + 1) * 2 > shard->size)
+    {
+        size_t new_size = ((shard->size != 0) ? (shard->size * 2) : QTRACK_SHARD_MIN);
+        T_QTRACK_INODE * slots = calloc(new_size, sizeof(T_QTRACK_INODE));
+        if (slots == NULL)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        for (size_t idx = 0; idx < shard->size; idx++)
+        {
+            if (shard->slots[idx].hash != 0)
+            {
+                size_t pos = qtrack_slot(shard->slots[idx].hash, new_size);
+                while (slots[pos].hash != 0)
+                    pos = (pos + 1) & (new_size - 1);
+                slots[pos] = shard->slots[idx];
+            }
+        }
+        free(shard->slots);
+        shard->slots = slots;
+        shard->size = new_size;
+    }
+
+    size_t pos = qtrack_slot(hash, shard->size);
+    while (shard->slots[pos].hash != 0)
+        pos = (pos + 1) & (shard->size - 1);
+
+    T_QTRACK_INODE * ent = &shard->slots[pos];
+    ent->hash = hash;
+    ent->handle_type = key->type;
+    ent->handle_len = key->len;
+    memcpy(ent->handle, key->bytes, key->len);
+    shard->count += 1;
+    return ent;
+}
+
+/*
+** Remove an entry: following entries of the same probe sequence are moved
+** back into the gap, so that no deletion markers are needed
+*/
+static void qtrack_erase( T_QTRACK_SHARD * shard, T_QTRACK_INODE * ent )
+{
+    size_t mask = shard->size - 1;
+    size_t hole = ent - shard->slots;
+    size_t pos = hole;
+
+    for (;;)
+    {
+        pos = (pos + 1) & mask;
+        if (shard->slots[pos].hash == 0)
+            break;
+
+        // move the entry unless its home slot lies between the gap and its position
+        size_t home = qtrack_slot(shard->slots[pos].hash, shard->size);
+        if (((pos - home) & mask) >= ((pos - hole) & mask))
+        {
+            shard->slots[hole] = shard->slots[pos];
+            hole = pos;
+        }
+    }
+    shard->slots[hole].hash = 0;
+    shard->count -= 1;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Usage per ID */
+
+static int qtrack_usage_add( T_QUSAGE_MAP * map, int with_projects, const T_QTRACK_INODE * ent )
+{
+    if ((qusage_map_add(&map[QUSAGE_USER], ent->uid, ent->blocks, 1) != 0) ||
+        (qusage_map_add(&map[QUSAGE_GROUP], ent->gid, ent->blocks, 1) != 0) ||
+        (with_projects &&
+         (qusage_map_add(&map[QUSAGE_PROJECT], ent->projid, ent->blocks, 1) != 0)))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void qtrack_usage_sub( T_QUSAGE_MAP * map, int with_projects, const T_QTRACK_INODE * ent )
+{
+    // entries were created when the inode was added, so this cannot fail
+    qusage_map_sub(&map[QUSAGE_USER], ent->uid, ent->blocks, 1);
+    qusage_map_sub(&map[QUSAGE_GROUP], ent->gid, ent->blocks, 1);
+    if (with_projects)
+        qusage_map_sub(&map[QUSAGE_PROJECT], ent->projid, ent->blocks, 1);
+}
+
+/* ------------------------------------------------------------------------ */
+/* File handles */
+
+/*
+** Determine the handle of an entry relative to the given directory
+** descriptor, or of the descriptor itself for an empty name
+*/
+static int qtrack_name_to_key( int dirfd, const char * name, T_QTRACK_FH * fhb, T_QTRACK_KEY * key )
+{
+    struct file_handle * fh = (struct file_handle *) fhb->buf;
+    int mount_id;
+
+    fh->handle_bytes = MAX_HANDLE_SZ;
+    if (name_to_handle_at(dirfd, name, fh, &mount_id, ((name[0] == 0) ? AT_EMPTY_PATH : 0)) != 0)
+        return -1;
+
+    if (fh->handle_bytes > QTRACK_HANDLE_MAX)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    key->type = fh->handle_type;
+    key->len = fh->handle_bytes;
+    key->bytes = fh->f_handle;
+    return 0;
+}
+
+static int qtrack_open_key( T_QTRACK * trk, const T_QTRACK_KEY * key, int flags )
+{
+    T_QTRACK_FH fhb;
+    struct file_handle * fh = (struct file_handle *) fhb.buf;
+
+    fh->handle_type = key->type;
+    fh->handle_bytes = key->len;
+    memcpy(fh->f_handle, key->bytes, key->len);
+
+    return open_by_handle_at(trk->mount_fd, fh, flags | O_NOFOLLOW | O_CLOEXEC);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Seeding */
+
+/*
+** Add an inode found by the walk to the table and the usage of the thread,
+** unless it was already added via another link
+*/
+static int qtrack_seed( T_QTRACK * trk, T_QTRACK_WORKER * wrk, int dirfd, const char * name,
+                        const T_QDU_STAT * st, uint32_t projid )
+{
+    T_QTRACK_FH fhb;
+    T_QTRACK_KEY key;
+
+    if (qtrack_name_to_key(dirfd, name, &fhb, &key) != 0)
+        return errno;
+
+    uint64_t hash = qtrack_hash(&key);
+    T_QTRACK_SHARD * shard = qtrack_shard(trk, hash);
+    T_QTRACK_INODE * ent;
+    T_QTRACK_INODE attr;
+    int result = 0;
+
+    pthread_mutex_lock(&shard->mutex);
+    if (qtrack_find(shard, hash, &key) != NULL)
+    {
+        ent = NULL;
+    }
+    else if ((ent = qtrack_insert(shard, hash, &key)) != NULL)
+    {
+        ent->blocks = st->blocks;
+        ent->uid = st->uid;
+        ent->gid = st->gid;
+        ent->projid = projid;
+        attr = *ent;
+    }
+    else
+        result = ENOMEM;
+    pthread_mutex_unlock(&shard->mutex);
+
+    if ((ent != NULL) && (qtrack_usage_add(wrk->map, trk->with_projects, &attr) != 0))
+        result = ENOMEM;
+
+    if (result != 0)
+        qtrack_fail(trk, result);
+    return result;
+}
+
+/*
+** Callbacks for the tree walk, invoked by worker threads
+*/
+static int qtrack_dir_cb( void * ctx, unsigned worker, int fd, const char * relpath )
+{
+    T_QTRACK * trk = (T_QTRACK *) ctx;
+    T_QTRACK_WORKER * wrk = &trk->worker[worker];
+    int errnum = 0;
+    T_QDU_STAT st;
+
+    // entries of the directory are processed next by the same thread
+    wrk->dir_projid = 0;
+    if (qdu_stat(fd, "", &st) != 0)
+        return errno;
+
+    if (trk->with_projects && (qdu_get_projid(fd, &wrk->dir_projid) != 0))
+        errnum = errno;
+
+    int seed_err = qtrack_seed(trk, wrk, fd, "", &st, wrk->dir_projid);
+    return ((errnum != 0) ? errnum : seed_err);
+}
+
+static int qtrack_entry_cb( void * ctx, unsigned worker, int dirfd, const char * name, unsigned char d_type )
+{
+    T_QTRACK * trk = (T_QTRACK *) ctx;
+    T_QTRACK_WORKER * wrk = &trk->worker[worker];
+    uint32_t projid = wrk->dir_projid;
+    int errnum = 0;
+    T_QDU_STAT st;
+
+    if (qdu_stat(dirfd, name, &st) != 0)
+        return errno;
+
+    if (trk->with_projects && (d_type == DT_REG))
+    {
+        int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+        if ((fd < 0) || (qdu_get_projid(fd, &projid) != 0))
+            errnum = errno;
+        if (fd >= 0)
+            close(fd);
+    }
+
+    int seed_err = qtrack_seed(trk, wrk, dirfd, name, &st, projid);
+    return ((errnum != 0) ? errnum : seed_err);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Event processing */
+
+/*
+** Apply the current attributes of an inode: the difference to the recorded
+** attributes is applied to usage. Inodes not known yet are added, unless
+** already deleted or located on another device than the walked tree (e.g.
+** another Btrfs subvolume), as the walk does not cross devices either.
+*/
+static int qtrack_update( T_QTRACK * trk, const T_QTRACK_KEY * key, const T_QDU_STAT * st,
+                          uint32_t projid, int has_projid )
+{
+    uint64_t hash = qtrack_hash(key);
+    T_QTRACK_SHARD * shard = qtrack_shard(trk, hash);
+    T_QTRACK_INODE * ent;
+    int result = 0;
+
+    pthread_mutex_lock(&shard->mutex);
+    ent = qtrack_find(shard, hash, key);
+    if ((ent == NULL) && (st->nlink != 0) && (st->dev == trk->root_dev))
+    {
+        ent = qtrack_insert(shard, hash, key);
+        if (ent != NULL)
+        {
+            pthread_mutex_lock(&trk->usage_mutex);
+            ent->blocks = st->blocks;
+            ent->uid = st->uid;
+            ent->gid = st->gid;
+            ent->projid = projid;
+            result = qtrack_usage_add(trk->usage, trk->with_projects, ent);
+            pthread_mutex_unlock(&trk->usage_mutex);
+        }
+        else
+            result = -1;
+    }
+    else if (ent != NULL)
+    {
+        pthread_mutex_lock(&trk->usage_mutex);
+        qtrack_usage_sub(trk->usage, trk->with_projects, ent);
+        ent->blocks = st->blocks;
+        ent->uid = st->uid;
+        ent->gid = st->gid;
+        if (has_projid)
+            ent->projid = projid;
+        result = qtrack_usage_add(trk->usage, trk->with_projects, ent);
+        pthread_mutex_unlock(&trk->usage_mutex);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (result != 0)
+        qtrack_fail(trk, ENOMEM);
+    return result;
+}
+
+static void qtrack_remove( T_QTRACK * trk, const T_QTRACK_KEY * key )
+{
+    uint64_t hash = qtrack_hash(key);
+    T_QTRACK_SHARD * shard = qtrack_shard(trk, hash);
+    T_QTRACK_INODE * ent;
+
+    pthread_mutex_lock(&shard->mutex);
+    ent = qtrack_find(shard, hash, key);
+    if (ent != NULL)
+    {
+        pthread_mutex_lock(&trk->usage_mutex);
+        qtrack_usage_sub(trk->usage, trk->with_projects, ent);
+        pthread_mutex_unlock(&trk->usage_mutex);
+
+        qtrack_erase(shard, ent);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+/*
+** Re-read an inode referenced by handle. The project ID can only be read
+** from regular files and directories, which are opened a second time, as
+** opening other types may have side effects.
+*/
+static int qtrack_refresh( T_QTRACK * trk, const T_QTRACK_KEY * key )
+{
+    uint32_t projid = 0;
+    int has_projid = 0;
+    int result = -1;
+    T_QDU_STAT st;
+
+    int fd = qtrack_open_key(trk, key, O_PATH);
+    if (fd < 0)
+    {
+        // inode was deleted in the meantime
+        if ((errno == ESTALE) || (errno == ENOENT))
+        {
+            qtrack_remove(trk, key);
+            return 0;
+        }
+        return -1;
+    }
+    if (qdu_stat(fd, "", &st) == 0)
+    {
+        if (trk->with_projects && (S_ISREG(st.mode) || S_ISDIR(st.mode)))
+        {
+            int rd_fd = qtrack_open_key(trk, key, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+            if (rd_fd >= 0)
+            {
+                has_projid = (qdu_get_projid(rd_fd, &projid) == 0);
+                close(rd_fd);
+            }
+        }
+        result = qtrack_update(trk, key, &st, projid, has_projid);
+    }
+    close(fd);
+    return result;
+}
+
+/*
+** Process creation of a directory entry: add the new inode, and re-read the
+** directory, which may have grown. Entries of other types than regular
+** files and directories inherit the project of the directory.
+*/
+static int qtrack_refresh_name( T_QTRACK * trk, const T_QTRACK_KEY * dir_key, const char * name )
+{
+    uint32_t dir_projid = 0;
+    int has_dir_projid = 0;
+    int result = 0;
+    T_QTRACK_FH fhb;
+    T_QTRACK_KEY key;
+    T_QDU_STAT st;
+
+    int dirfd = qtrack_open_key(trk, dir_key, O_RDONLY | O_DIRECTORY);
+    if (dirfd < 0)
+        return (((errno == ESTALE) || (errno == ENOENT)) ? 0 : -1);
+
+    if (trk->with_projects)
+        has_dir_projid = (qdu_get_projid(dirfd, &dir_projid) == 0);
+
+    if (qdu_stat(dirfd, "", &st) == 0)
+        result = qtrack_update(trk, dir_key, &st, dir_projid, has_dir_projid);
+
+    if ((qtrack_name_to_key(dirfd, name, &fhb, &key) == 0) &&
+        (qdu_stat(dirfd, name, &st) == 0))
+    {
+        uint32_t projid = dir_projid;
+        int has_projid = has_dir_projid;
+
+        if (trk->with_projects && (S_ISREG(st.mode) || S_ISDIR(st.mode)))
+        {
+            int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+            has_projid = ((fd >= 0) && (qdu_get_projid(fd, &projid) == 0));
+            if (fd >= 0)
+                close(fd);
+        }
+        if (qtrack_update(trk, &key, &st, projid, has_projid) != 0)
+            result = -1;
+    }
+    else if (errno != ENOENT)   // else removed again in the meantime
+        result = -1;
+
+    close(dirfd);
+    return result;
+}
+
+static void qtrack_event( T_QTRACK * trk, const struct fanotify_event_metadata * meta )
+{
+    T_QTRACK_KEY obj_key = { 0, 0, NULL };
+    T_QTRACK_KEY dir_key = { 0, 0, NULL };
+    const char * name = NULL;
+    size_t pos = meta->metadata_len;
+    int result = 0;
+
+    __atomic_add_fetch(&trk->stats.events, 1, __ATOMIC_RELAXED);
+
+    if (meta->mask & FAN_Q_OVERFLOW)
+    {
+        qtrack_fail(trk, EOVERFLOW);
+        return;
+    }
+
+    // information records: handle of the inode, or handle of the directory
+    // and name of the entry
+    while (pos + sizeof(struct fanotify_event_info_fid) + sizeof(struct file_handle) <= meta->event_len)
+    {
+        const struct fanotify_event_info_fid * info =
+            (const struct fanotify_event_info_fid *) ((const char *)meta + pos);
+        const struct file_handle * fh = (const struct file_handle *) info->handle;
+
+        if ((info->hdr.len == 0) || (pos + info->hdr.len > meta->event_len))
+            break;
+
+        if ((info->hdr.info_type == FAN_EVENT_INFO_TYPE_FID) && (fh->handle_bytes <= QTRACK_HANDLE_MAX))
+        {
+            obj_key.type = fh->handle_type;
+            obj_key.len = fh->handle_bytes;
+            obj_key.bytes = fh->f_handle;
+        }
+        else if ((info->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) && (fh->handle_bytes <= QTRACK_HANDLE_MAX))
+        {
+            dir_key.type = fh->handle_type;
+            dir_key.len = fh->handle_bytes;
+            dir_key.bytes = fh->f_handle;
+            name = (const char *) fh->f_handle + fh->handle_bytes;
+        }
+        pos += info->hdr.len;
+    }
+
+    // events of an inode may be merged, so all types are handled in order
+    if ((meta->mask & FAN_CREATE) && (name != NULL))
+    {
+        result |= qtrack_refresh_name(trk, &dir_key, name);
+        __atomic_add_fetch(&trk->stats.updates, 1, __ATOMIC_RELAXED);
+    }
+    if ((meta->mask & (FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ATTRIB)) && (obj_key.bytes != NULL))
+    {
+        result |= qtrack_refresh(trk, &obj_key);
+        __atomic_add_fetch(&trk->stats.updates, 1, __ATOMIC_RELAXED);
+    }
+    if ((meta->mask & FAN_DELETE_SELF) && (obj_key.bytes != NULL))
+    {
+        qtrack_remove(trk, &obj_key);
+        __atomic_add_fetch(&trk->stats.updates, 1, __ATOMIC_RELAXED);
+    }
+    if ((result != 0) || ((obj_key.bytes == NULL) && (name == NULL)))
+    {
+        __atomic_add_fetch(&trk->stats.errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+** Thread main function: read and process events until stopped
+*/
+static void * qtrack_thread( void * arg )
+{
+    T_QTRACK * trk = (T_QTRACK *) arg;
+    struct pollfd pfd[2];
+    uint64_t * buf = malloc(QTRACK_EVENT_BUF);
+
+    if (buf == NULL)
+    {
+        qtrack_fail(trk, ENOMEM);
+        return NULL;
+    }
+    pfd[0].fd = trk->fan_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = trk->stop_pipe[0];
+    pfd[1].events = POLLIN;
+
+    for (;;)
+    {
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            qtrack_fail(trk, errno);
+            break;
+        }
+        if (pfd[1].revents != 0)
+            break;
+
+        ssize_t len = read(trk->fan_fd, buf, QTRACK_EVENT_BUF);
+        if (len < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EINTR))
+                continue;
+            qtrack_fail(trk, errno);
+            break;
+        }
+
+        const struct fanotify_event_metadata * meta = (const struct fanotify_event_metadata *) buf;
+        while (FAN_EVENT_OK(meta, len))
+        {
+            if (meta->vers == FANOTIFY_METADATA_VERSION)
+                qtrack_event(trk, meta);
+            meta = FAN_EVENT_NEXT(meta, len);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Interface */
+
+/*
+** Create a tracker for the file system with the given root directory and
+** subscribe to its events. Usage is seeded by a walk with the given number
+** of threads. Project IDs are tracked only when requested, as that
+** requires opening each file.
+*/
+T_QTRACK * qtrack_create( const char * path, unsigned threads, int with_projects )
+{
+    T_QTRACK * trk;
+    T_QTRACK_FH fhb;
+    T_QTRACK_KEY key;
+    T_QDU_STAT st;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > QTREE_MAX_THREADS)
+        threads = QTREE_MAX_THREADS;
+
+    trk = calloc(1, sizeof(*trk) + threads * sizeof(T_QTRACK_WORKER));
+    if (trk == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    trk->thread_cnt = threads;
+    trk->with_projects = with_projects;
+    trk->fan_fd = -1;
+    trk->stop_pipe[0] = -1;
+    trk->stop_pipe[1] = -1;
+    for (unsigned idx = 0; idx < QTRACK_SHARDS; idx++)
+        pthread_mutex_init(&trk->shard[idx].mutex, NULL);
+    pthread_mutex_init(&trk->usage_mutex, NULL);
+
+    trk->mount_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOCTTY | O_CLOEXEC);
+    if ((trk->mount_fd < 0) ||
+        (qdu_stat(trk->mount_fd, "", &st) != 0) ||
+        (qtrack_name_to_key(trk->mount_fd, "", &fhb, &key) != 0) ||
+        (pipe2(trk->stop_pipe, O_CLOEXEC) != 0))
+    {
+        goto failed;
+    }
+    trk->root_dev = st.dev;
+
+    trk->fan_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_UNLIMITED_QUEUE |
+                                FAN_REPORT_FID | FAN_REPORT_DFID_NAME,
+                                O_RDONLY | O_LARGEFILE);
+    if (trk->fan_fd < 0)
+    {
+        // flags for reporting file handles are not supported by older kernels
+        if (errno == EINVAL)
+            errno = ENOTSUP;
+        goto failed;
+    }
+    if (fanotify_mark(trk->fan_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, QTRACK_EVENT_MASK,
+                      trk->mount_fd, NULL) != 0)
+    {
+        // file system does not support file handles
+        if ((errno == ENODEV) || (errno == EOPNOTSUPP))
+            errno = ENOTSUP;
+        goto failed;
+    }
+    return trk;
+
+failed:
+    {
+        int saved_errno = errno;
+        qtrack_destroy(trk);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+/*
+** Fill in the callbacks for seeding via qtree_start()
+*/
+void qtrack_ops( T_QTRACK * trk, T_QTREE_OPS * ops )
+{
+    ops->dir_cb = qtrack_dir_cb;
+    ops->entry_cb = qtrack_entry_cb;
+    ops->ctx = trk;
+}
+
+/*
+** Merge usage of all threads of the walk and start processing events,
+** after the walk is finished
+*/
+int qtrack_start( T_QTRACK * trk )
+{
+    int result = 0;
+
+    if (trk->errnum != 0)
+    {
+        errno = trk->errnum;
+        return -1;
+    }
+    for (unsigned wrk_idx = 0; wrk_idx < trk->thread_cnt; wrk_idx++)
+    {
+        for (unsigned kind = 0; kind < QUSAGE_KINDS; kind++)
+        {
+            if ((result == 0) && (qusage_map_merge(&trk->usage[kind], &trk->worker[wrk_idx].map[kind]) != 0))
+                result = -1;
+            qusage_map_free(&trk->worker[wrk_idx].map[kind]);
+        }
+    }
+    if (result == 0)
+    {
+        int errnum = pthread_create(&trk->tid, NULL, qtrack_thread, trk);
+        if (errnum == 0)
+            trk->started = 1;
+        else
+        {
+            errno = errnum;
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/*
+** Query current usage of an ID; IDs without inodes have zero usage
+*/
+int qtrack_get( T_QTRACK * trk, unsigned kind, uint32_t id, uint64_t * p_blocks, uint64_t * p_inodes )
+{
+    int errnum = __atomic_load_n(&trk->errnum, __ATOMIC_RELAXED);
+
+    if (errnum != 0)
+    {
+        errno = errnum;
+        return -1;
+    }
+    if ((kind >= QUSAGE_KINDS) || ((kind == QUSAGE_PROJECT) && !trk->with_projects))
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    pthread_mutex_lock(&trk->usage_mutex);
+    const T_QUSAGE_ENTRY * ent = qusage_map_get(&trk->usage[kind], id);
+    *p_blocks = ((ent != NULL) ? ent->blocks : 0);
+    *p_inodes = ((ent != NULL) ? ent->inodes : 0);
+    pthread_mutex_unlock(&trk->usage_mutex);
+    return 0;
+}
+
+void qtrack_stats( T_QTRACK * trk, T_QTRACK_STATS * stats )
+{
+    stats->events = __atomic_load_n(&trk->stats.events, __ATOMIC_RELAXED);
+    stats->updates = __atomic_load_n(&trk->stats.updates, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&trk->stats.errors, __ATOMIC_RELAXED);
+    stats->overflow = (__atomic_load_n(&trk->errnum, __ATOMIC_RELAXED) == EOVERFLOW);
+    stats->inodes = 0;
+
+    for (unsigned idx = 0; idx < QTRACK_SHARDS; idx++)
+    {
+        pthread_mutex_lock(&trk->shard[idx].mutex);
+        stats->inodes += trk->shard[idx].count;
+        pthread_mutex_unlock(&trk->shard[idx].mutex);
+    }
+}
+
+/*
+** Stop processing events and free all resources
+*/
+void qtrack_destroy( T_QTRACK * trk )
+{
+    if (trk != NULL)
+    {
+        if (trk->started)
+        {
+            char cmd = 0;
+            while ((write(trk->stop_pipe[1], &cmd, 1) < 0) && (errno == EINTR))
+                ;
+            pthread_join(trk->tid, NULL);
+        }
+        if (trk->fan_fd >= 0)
+            close(trk->fan_fd);
+        if (trk->mount_fd >= 0)
+            close(trk->mount_fd);
+        if (trk->stop_pipe[0] >= 0)
+            close(trk->stop_pipe[0]);
+        if (trk->stop_pipe[1] >= 0)
+            close(trk->stop_pipe[1]);
+
+        for (unsigned idx = 0; idx < QTRACK_SHARDS; idx++)
+        {
+            free(trk->shard[idx].slots);
+            pthread_mutex_destroy(&trk->shard[idx].mutex);
+        }
+        for (unsigned kind = 0; kind < QUSAGE_KINDS; kind++)
+        {
+            qusage_map_free(&trk->usage[kind]);
+            for (unsigned wrk_idx = 0; wrk_idx < trk->thread_cnt; wrk_idx++)
+                qusage_map_free(&trk->worker[wrk_idx].map[kind]);
+        }
+        pthread_mutex_destroy(&trk->usage_mutex);
+        free(trk);
+    }
+}
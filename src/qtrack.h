@@ -0,0 +1,37 @@
+#ifndef INC_QTRACK_H
+#define INC_QTRACK_H
+
+/*
+ *  Interface for tracking usage per user, group and project of a file
+ *  system incrementally via fanotify events
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "src/qtree.h"
+#include "src/qusage.h"
+
+/* counters of a tracker, for monitoring */
+typedef struct
+{
+    uint64_t        events;         /* events read from the kernel */
+    uint64_t        updates;        /* inodes re-read or removed upon events */
+    uint64_t        errors;         /* events that could not be processed */
+    uint64_t        inodes;         /* inodes currently tracked */
+    int             overflow;       /* TRUE if events were lost */
+} T_QTRACK_STATS;
+
+struct qtrack;
+typedef struct qtrack T_QTRACK;
+
+/* seeding walk via qtree_start() from the file system root with the same
+ * thread count; qtrack_get() fails with EOVERFLOW after events were lost */
+T_QTRACK * qtrack_create(const char * path, unsigned threads, int with_projects);
+void qtrack_ops(T_QTRACK * trk, T_QTREE_OPS * ops);
+int qtrack_start(T_QTRACK * trk);
+int qtrack_get(T_QTRACK * trk, unsigned kind, uint32_t id, uint64_t * p_blocks, uint64_t * p_inodes);
+void qtrack_stats(T_QTRACK * trk, T_QTRACK_STATS * stats);
+void qtrack_destroy(T_QTRACK * trk);
+
+#endif /* INC_QTRACK_H */
@@ -0,0 +1,626 @@
+/*
+**  Parallel walk of directory trees
+**
+**  Operations on all inodes of a tree (e.g. assigning a project ID, or
+**  summing up usage) are limited by the latency of metadata I/O when done
+**  by a single thread. Therefore directories are processed by a pool of
+**  threads: each thread reads the entries of one directory at a time via
+**  getdents64, invokes the callback for each non-directory entry relative
+**  to the directory's descriptor (i.e. without path resolution), and
+**  queues sub-directories for processing.
+**
+**  Each thread has its own queue of directories. A thread takes the most
+**  recently queued directory from its own queue, which keeps the walk
+**  depth-first and the number of queued directories low. Idle threads
+**  steal the oldest directory from another thread's queue, which is
+**  usually the root of a large sub-tree, so that stealing is rare. The
+**  walk ends when no directory is queued or in progress.
+**
+**  Sub-directories are queued by name together with a reference to the
+**  descriptor of their parent, and opened via openat() relative to it with
+**  O_NOFOLLOW. Thus no path with multiple components is resolved: replacing
+**  a directory by a symbolic link while the walk is in progress cannot
+**  redirect the walk outside of the tree, and the depth of the tree is not
+**  limited by PATH_MAX. The descriptor of a directory is closed as soon as
+**  all its queued sub-directories are opened, so that the number of open
+**  descriptors is bounded by the depth of the tree per thread, rather than
+**  by the number of queued directories. The walk does not descend into
+**  mount points of other file systems.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "src/qtree.h"
+
+/* buffer size for reading directory entries */
+#define QTREE_DENTS_BUF     (64 * 1024)
+
+/* interval for re-checking queues while idle */
+#define QTREE_IDLE_WAIT_NS  (1000 * 1000)
+
+#ifdef SYS_getdents64
+/* layout of records returned by getdents64 */
+struct qtree_dirent64
+{
+    uint64_t        d_ino;
+    int64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+};
+#endif
+
+/* descriptor of a directory, shared by its queued sub-directories */
+typedef struct
+{
+    int             fd;
+    unsigned        refs;           /* accessed atomically */
+} T_QTREE_DIR;
+
+/* queued directory */
+typedef struct
+{
+    T_QTREE_DIR *   parent;         /* NULL for the root */
+    char *          relpath;        /* path relative to the root, for callbacks */
+    const char *    name;           /* last component of relpath */
+} T_QTREE_ITEM;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    T_QTREE_ITEM *  items;
+    size_t          first;          /* index of the oldest item */
+    size_t          count;          /* index after the newest item */
+    size_t          size;
+} T_QTREE_QUEUE;
+
+struct qtree_walk
+{
+    T_QTREE_OPS     ops;
+    int             root_fd;
+    dev_t           root_dev;
+    unsigned        thread_cnt;     /* number of queues */
+    unsigned        started;        /* number of threads started */
+    pthread_t       threads[QTREE_MAX_THREADS];
+    T_QTREE_QUEUE   queues[QTREE_MAX_THREADS];
+
+    uint64_t        pending;        /* directories queued or in progress */
+    int             cancelled;
+    T_QTREE_PROGRESS prog;
+
+    pthread_mutex_t mutex;          /* protects the following */
+    pthread_cond_t  cond;           /* signals queued directories or completion */
+    pthread_cond_t  done_cond;      /* signals termination of a thread */
+    unsigned        idle;           /* number of threads waiting for work */
+    unsigned        running;        /* number of threads not terminated */
+    int             first_errno;
+    char *          first_err_path;
+};
+
+typedef struct
+{
+    T_QTREE_WALK *  walk;
+    unsigned        worker;
+} T_QTREE_WORKER;
+
+#define QTREE_ADD(CNT, VAL)  ((void) __atomic_fetch_add(&(CNT), (VAL), __ATOMIC_RELAXED))
+#define QTREE_GET(CNT)       __atomic_load_n(&(CNT), __ATOMIC_RELAXED)
+
+/* ------------------------------------------------------------------------ */
+/* Queues */
+
+static void qtree_dir_release( T_QTREE_DIR * dir )
+{
+    if ((dir != NULL) && (__atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) == 0))
+    {
+        close(dir->fd);
+        free(dir);
+    }
+}
+
+static void qtree_item_free( T_QTREE_ITEM * item )
+{
+    qtree_dir_release(item->parent);
+    free(item->relpath);
+}
+
+static int qtree_push( T_QTREE_WALK * walk, unsigned worker, const T_QTREE_ITEM * item )
+{
+    T_QTREE_QUEUE * q = &walk->queues[worker];
+    int result = 0;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->count >= q->size)
+    {
+        if (q->first > 0)
+        {
+            memmove(q->items, q->items + q->first, (q->count - q->first) * sizeof(T_QTREE_ITEM));
+            q->count -= q->first;
+            q->first = 0;
+        }
+        if (q->count >= q->size)
+        {
+            size_t new_size = (q->size != 0) ? (q->size * 2) : 256;
+            T_QTREE_ITEM * new_items = realloc(q->items, new_size * sizeof(T_QTREE_ITEM));
+            if (new_items != NULL)
+            {
+                q->items = new_items;
+                q->size = new_size;
+            }
+            else
+                result = -1;
+        }
+    }
+    if (result == 0)
+    {
+        q->items[q->count++] = *item;
+        __atomic_fetch_add(&walk->pending, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    if ((result == 0) && (QTREE_GET(walk->idle) != 0))
+    {
+        pthread_mutex_lock(&walk->mutex);
+        pthread_cond_signal(&walk->cond);
+        pthread_mutex_unlock(&walk->mutex);
+    }
+    return result;
+}
+
+/* take the newest item from the own queue, or else the oldest of another */
+static int qtree_pop( T_QTREE_WALK * walk, unsigned worker, T_QTREE_ITEM * item )
+{
+    int found = 0;
+
+    for (unsigned off = 0; (off < walk->thread_cnt) && !found; off++)
+    {
+        T_QTREE_QUEUE * q = &walk->queues[(worker + off) % walk->thread_cnt];
+
+        pthread_mutex_lock(&q->mutex);
+        if (q->count > q->first)
+        {
+            if (off == 0)
+                *item = q->items[--q->count];
+            else
+                *item = q->items[q->first++];
+            found = 1;
+
+            if (q->first == q->count)
+                q->first = q->count = 0;
+        }
+        pthread_mutex_unlock(&q->mutex);
+    }
+    return found;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Processing */
+
+static void qtree_error( T_QTREE_WALK * walk, int errnum, const char * relpath, const char * name )
+{
+    QTREE_ADD(walk->prog.errors, 1);
+
+    pthread_mutex_lock(&walk->mutex);
+    if (walk->first_errno == 0)
+    {
+        size_t len = strlen(relpath) + ((name != NULL) ? strlen(name) + 1 : 0) + 1;
+        walk->first_errno = errnum;
+        walk->first_err_path = malloc(len);
+        if (walk->first_err_path != NULL)
+        {
+            strcpy(walk->first_err_path, relpath);
+            if (name != NULL)
+            {
+                strcat(walk->first_err_path, "/");
+                strcat(walk->first_err_path, name);
+            }
+        }
+    }
+    pthread_mutex_unlock(&walk->mutex);
+}
+
+static char * qtree_child_path( const char * relpath, const char * name )
+{
+    size_t rel_len = strlen(relpath);
+    size_t name_len = strlen(name);
+    char * path;
+
+    if ((rel_len == 1) && (relpath[0] == '.'))
+    {
+        path = malloc(name_len + 1);
+        if (path != NULL)
+            memcpy(path, name, name_len + 1);
+    }
+    else
+    {
+        path = malloc(rel_len + 1 + name_len + 1);
+        if (path != NULL)
+        {
+            memcpy(path, relpath, rel_len);
+            path[rel_len] = '/';
+            memcpy(path + rel_len + 1, name, name_len + 1);
+        }
+    }
+    return path;
+}
+
+/* handle one directory entry read from the given directory */
+static void qtree_entry( T_QTREE_WALK * walk, unsigned worker, T_QTREE_DIR * dir, const char * relpath,
+                         const char * name, unsigned char d_type )
+{
+    int fd = dir->fd;
+
+    if ((name[0] == '.') && ((name[1] == 0) || ((name[1] == '.') && (name[2] == 0))))
+        return;
+
+    if (d_type == DT_UNKNOWN)
+    {
+        struct stat st;
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            qtree_error(walk, errno, relpath, name);
+            return;
+        }
+        d_type = IFTODT(st.st_mode);
+    }
+
+    if (d_type == DT_DIR)
+    {
+        T_QTREE_ITEM child;
+
+        child.parent = dir;
+        child.relpath = qtree_child_path(relpath, name);
+        if (child.relpath != NULL)
+        {
+            const char * sep = strrchr(child.relpath, '/');
+            child.name = ((sep != NULL) ? (sep + 1) : child.relpath);
+            __atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+        }
+        if ((child.relpath == NULL) || (qtree_push(walk, worker, &child) != 0))
+        {
+            if (child.relpath != NULL)
+                qtree_item_free(&child);
+            qtree_error(walk, ENOMEM, relpath, name);
+        }
+    }
+    else
+    {
+        int errnum = ((walk->ops.entry_cb != NULL)
+                        ? walk->ops.entry_cb(walk->ops.ctx, worker, fd, name, d_type) : 0);
+        if (errnum != 0)
+            qtree_error(walk, errnum, relpath, name);
+        QTREE_ADD(walk->prog.entries, 1);
+    }
+}
+
+static void qtree_process_dir( T_QTREE_WALK * walk, unsigned worker, const T_QTREE_ITEM * item, char * buf )
+{
+    const char * relpath = item->relpath;
+    T_QTREE_DIR * dir;
+    struct stat st;
+    int fd;
+
+    // open only a single component, so that symbolic links are not followed
+    if (item->parent != NULL)
+        fd = openat(item->parent->fd, item->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    else
+        fd = openat(walk->root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        qtree_error(walk, errno, relpath, NULL);
+        return;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        qtree_error(walk, errno, relpath, NULL);
+        close(fd);
+        return;
+    }
+    if (st.st_dev != walk->root_dev)
+    {
+        QTREE_ADD(walk->prog.skipped, 1);
+        close(fd);
+        return;
+    }
+    dir = malloc(sizeof(T_QTREE_DIR));
+    if (dir == NULL)
+    {
+        qtree_error(walk, ENOMEM, relpath, NULL);
+        close(fd);
+        return;
+    }
+    dir->fd = fd;
+    dir->refs = 1;
+
+    int errnum = ((walk->ops.dir_cb != NULL) ? walk->ops.dir_cb(walk->ops.ctx, worker, fd, relpath) : 0);
+    if (errnum != 0)
+        qtree_error(walk, errnum, relpath, NULL);
+
+#ifdef SYS_getdents64
+    for (;;)
+    {
+        long len = syscall(SYS_getdents64, fd, buf, QTREE_DENTS_BUF);
+        if (len <= 0)
+        {
+            if (len < 0)
+                qtree_error(walk, errno, relpath, NULL);
+            break;
+        }
+        for (long off = 0; off < len; )
+        {
+            struct qtree_dirent64 * ent = (struct qtree_dirent64 *) (buf + off);
+            qtree_entry(walk, worker, dir, relpath, ent->d_name, ent->d_type);
+            off += ent->d_reclen;
+        }
+        if (QTREE_GET(walk->cancelled))
+            break;
+    }
+#else
+    // the stream uses a duplicate, as the descriptor is shared with sub-directories
+    int dup_fd = dup(fd);
+    DIR * dirp = ((dup_fd >= 0) ? fdopendir(dup_fd) : NULL);
+    if (dirp != NULL)
+    {
+        struct dirent * ent;
+        while (((ent = readdir(dirp)) != NULL) && !QTREE_GET(walk->cancelled))
+            qtree_entry(walk, worker, dir, relpath, ent->d_name, ent->d_type);
+        closedir(dirp);
+    }
+    else
+    {
+        qtree_error(walk, errno, relpath, NULL);
+        if (dup_fd >= 0)
+            close(dup_fd);
+    }
+#endif
+    qtree_dir_release(dir);
+    QTREE_ADD(walk->prog.dirs, 1);
+}
+
+static void * qtree_worker( void * arg )
+{
+    T_QTREE_WORKER * wrk = (T_QTREE_WORKER *) arg;
+    T_QTREE_WALK * walk = wrk->walk;
+    unsigned worker = wrk->worker;
+    char * buf = malloc(QTREE_DENTS_BUF);
+
+    free(wrk);
+
+    for (;;)
+    {
+        T_QTREE_ITEM item = { NULL, NULL, NULL };
+
+        if (qtree_pop(walk, worker, &item))
+        {
+            if ((buf != NULL) && !QTREE_GET(walk->cancelled))
+                qtree_process_dir(walk, worker, &item, buf);
+            else if (buf == NULL)
+                qtree_error(walk, ENOMEM, item.relpath, NULL);
+            qtree_item_free(&item);
+
+            if (__atomic_sub_fetch(&walk->pending, 1, __ATOMIC_SEQ_CST) == 0)
+            {
+                pthread_mutex_lock(&walk->mutex);
+                pthread_cond_broadcast(&walk->cond);
+                pthread_mutex_unlock(&walk->mutex);
+            }
+        }
+        else
+        {
+            pthread_mutex_lock(&walk->mutex);
+            if (__atomic_load_n(&walk->pending, __ATOMIC_SEQ_CST) == 0)
+            {
+                pthread_mutex_unlock(&walk->mutex);
+                break;
+            }
+            // wait for queued directories; the timeout covers signals
+            // sent between the failed pop and incrementing the idle count
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += QTREE_IDLE_WAIT_NS;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000;
+            }
+            walk->idle += 1;
+            pthread_cond_timedwait(&walk->cond, &walk->mutex, &ts);
+            walk->idle -= 1;
+            pthread_mutex_unlock(&walk->mutex);
+        }
+    }
+    free(buf);
+
+    pthread_mutex_lock(&walk->mutex);
+    walk->running -= 1;
+    pthread_cond_broadcast(&walk->done_cond);
+    pthread_mutex_unlock(&walk->mutex);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Interface */
+
+/*
+** Start walking the tree below the given directory by the given number of
+** threads. Callbacks are invoked for the root directory as well. Upon
+** success, qtree_finish() has to be called for releasing resources.
+*/
+int qtree_start( T_QTREE_WALK ** p_walk, const char * root, const T_QTREE_OPS * ops, unsigned threads )
+{
+    struct stat st;
+    T_QTREE_WALK * walk;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > QTREE_MAX_THREADS)
+        threads = QTREE_MAX_THREADS;
+
+    walk = calloc(1, sizeof(*walk));
+    if (walk == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    walk->ops = *ops;
+    walk->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if ((walk->root_fd < 0) || (fstat(walk->root_fd, &st) != 0))
+    {
+        int errnum = errno;
+        if (walk->root_fd >= 0)
+            close(walk->root_fd);
+        free(walk);
+        errno = errnum;
+        return -1;
+    }
+    walk->root_dev = st.st_dev;
+    walk->thread_cnt = threads;
+    pthread_mutex_init(&walk->mutex, NULL);
+    pthread_cond_init(&walk->cond, NULL);
+    pthread_cond_init(&walk->done_cond, NULL);
+    for (unsigned idx = 0; idx < QTREE_MAX_THREADS; idx++)
+        pthread_mutex_init(&walk->queues[idx].mutex, NULL);
+
+    T_QTREE_ITEM start = { NULL, strdup("."), "." };
+    if ((start.relpath == NULL) || (qtree_push(walk, 0, &start) != 0))
+    {
+        free(start.relpath);
+        qtree_finish(walk);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // directories are only queued by the thread owning the queue, so the
+    // queues of threads failing to start stay empty
+    unsigned started = 0;
+    int err = 0;
+    for ( ; started < threads; started++)
+    {
+        T_QTREE_WORKER * wrk = malloc(sizeof(T_QTREE_WORKER));
+        if (wrk == NULL)
+        {
+            err = ENOMEM;
+            break;
+        }
+        wrk->walk = walk;
+        wrk->worker = started;
+
+        pthread_mutex_lock(&walk->mutex);
+        walk->running += 1;
+        pthread_mutex_unlock(&walk->mutex);
+
+        err = pthread_create(&walk->threads[started], NULL, qtree_worker, wrk);
+        if (err != 0)
+        {
+            pthread_mutex_lock(&walk->mutex);
+            walk->running -= 1;
+            pthread_mutex_unlock(&walk->mutex);
+            free(wrk);
+            break;
+        }
+    }
+    walk->started = started;
+    if (started == 0)
+    {
+        qtree_finish(walk);
+        errno = err;
+        return -1;
+    }
+    *p_walk = walk;
+    return 0;
+}
+
+/*
+** Wait for completion of the walk up to the given timeout. Returns 1 when
+** the walk is complete, else 0.
+*/
+int qtree_wait( T_QTREE_WALK * walk, unsigned timeout_ms )
+{
+    struct timespec ts;
+    int done;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&walk->mutex);
+    while ((walk->running != 0) &&
+           (pthread_cond_timedwait(&walk->done_cond, &walk->mutex, &ts) == 0))
+        ;
+    done = (walk->running == 0);
+    pthread_mutex_unlock(&walk->mutex);
+    return done;
+}
+
+void qtree_progress( T_QTREE_WALK * walk, T_QTREE_PROGRESS * prog )
+{
+    prog->dirs = QTREE_GET(walk->prog.dirs);
+    prog->entries = QTREE_GET(walk->prog.entries);
+    prog->errors = QTREE_GET(walk->prog.errors);
+    prog->skipped = QTREE_GET(walk->prog.skipped);
+}
+
+/*
+** Request termination: queued directories are discarded.
+*/
+void qtree_cancel( T_QTREE_WALK * walk )
+{
+    __atomic_store_n(&walk->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+/*
+** Return the errno value of the first error, or zero, and copy the path
+** relative to the root where it occurred.
+*/
+int qtree_first_error( T_QTREE_WALK * walk, char * path, size_t len )
+{
+    int errnum;
+
+    pthread_mutex_lock(&walk->mutex);
+    errnum = walk->first_errno;
+    if (len > 0)
+    {
+        strncpy(path, ((walk->first_err_path != NULL) ? walk->first_err_path : ""), len - 1);
+        path[len - 1] = 0;
+    }
+    pthread_mutex_unlock(&walk->mutex);
+    return errnum;
+}
+
+/*
+** Wait for termination of all threads and release all resources.
+*/
+void qtree_finish( T_QTREE_WALK * walk )
+{
+    for (unsigned idx = 0; idx < walk->started; idx++)
+        pthread_join(walk->threads[idx], NULL);
+
+    for (unsigned idx = 0; idx < QTREE_MAX_THREADS; idx++)
+    {
+        T_QTREE_QUEUE * q = &walk->queues[idx];
+        for (size_t pos = q->first; pos < q->count; pos++)
+            qtree_item_free(&q->items[pos]);
+        free(q->items);
+        pthread_mutex_destroy(&q->mutex);
+    }
+    pthread_mutex_destroy(&walk->mutex);
+    pthread_cond_destroy(&walk->cond);
+    pthread_cond_destroy(&walk->done_cond);
+    close(walk->root_fd);
+    free(walk->first_err_path);
+    free(walk);
+}
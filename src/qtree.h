@@ -0,0 +1,49 @@
+#ifndef INC_QTREE_H
+#define INC_QTREE_H
+
+/*
+ *  Interface for walking directory trees by a pool of threads
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <dirent.h>
+
+#define QTREE_MAX_THREADS   64
+
+/* Callbacks invoked by worker threads; worker is the index of the calling
+ * thread, for accumulating results per thread without locking. Callbacks
+ * return zero, or an errno value which is counted as error for the given
+ * name, without stopping the walk. */
+typedef struct
+{
+    /* directory opened via the given descriptor, before reading entries */
+    int  (*dir_cb)(void * ctx, unsigned worker, int fd, const char * relpath);
+    /* entry of a directory other than a sub-directory; d_type as defined
+     * for struct dirent, after resolving DT_UNKNOWN */
+    int  (*entry_cb)(void * ctx, unsigned worker, int dirfd, const char * name, unsigned char d_type);
+    void *  ctx;
+} T_QTREE_OPS;
+
+/* counters, which are updated while the walk is in progress */
+typedef struct
+{
+    uint64_t        dirs;           /* directories processed */
+    uint64_t        entries;        /* other entries processed */
+    uint64_t        errors;
+    uint64_t        skipped;        /* mount points of other file systems */
+} T_QTREE_PROGRESS;
+
+struct qtree_walk;
+typedef struct qtree_walk T_QTREE_WALK;
+
+int qtree_start(T_QTREE_WALK ** p_walk, const char * root, const T_QTREE_OPS * ops, unsigned threads);
+int qtree_wait(T_QTREE_WALK * walk, unsigned timeout_ms);
+void qtree_progress(T_QTREE_WALK * walk, T_QTREE_PROGRESS * prog);
+void qtree_cancel(T_QTREE_WALK * walk);
+int qtree_first_error(T_QTREE_WALK * walk, char * path, size_t len);
+void qtree_finish(T_QTREE_WALK * walk);
+
+#endif /* INC_QTREE_H */
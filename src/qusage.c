@@ -0,0 +1,182 @@
+/*
+**  Usage per ID
+**
+**  Scans of all inodes sum up blocks and inodes per user, group and
+**  project ID. Each scanning thread adds to private hash tables, so that
+**  no locking is needed per inode; tables of all threads are merged when
+**  the scan is done, and converted to arrays sorted by ID.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "src/qusage.h"
+
+/* initial number of slots */
+#define QUSAGE_MAP_MIN      1024
+
+static inline size_t qusage_hash( uint32_t id, size_t size )
+{
+    return ((size_t) id * 2654435761u) & (size - 1);
+}
+
+static int qusage_map_resize( T_QUSAGE_MAP * map, size_t new_size )
+{
+    T_QUSAGE_ENTRY * slots = malloc(new_size * sizeof(T_QUSAGE_ENTRY));
+    uint8_t * used = calloc(new_size, 1);
+
+    if ((slots == NULL) || (used == NULL))
+    {
+        free(slots);
+        free(used);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (size_t idx = 0; idx < map->size; idx++)
+    {
+        if (map->used[idx])
+        {
+            size_t pos = qusage_hash(map->slots[idx].id, new_size);
+            while (used[pos])
+                pos = (pos + 1) & (new_size - 1);
+            slots[pos] = map->slots[idx];
+            used[pos] = 1;
+        }
+    }
+    free(map->slots);
+    free(map->used);
+    map->slots = slots;
+    map->used = used;
+    map->size = new_size;
+    return 0;
+}
+
+/*
+** Add usage to the entry of the given ID, creating it if necessary
+*/
+int qusage_map_add( T_QUSAGE_MAP * map, uint32_t id, uint64_t blocks, uint64_t inodes )
+{
+    if ((map->count + 1) * 2 > map->size)
+    {
+        if (qusage_map_resize(map, ((map->size != 0) ? (map->size * 2) : QUSAGE_MAP_MIN)) != 0)
+            return -1;
+    }
+    size_t pos = qusage_hash(id, map->size);
+    while (map->used[pos] && (map->slots[pos].id != id))
+        pos = (pos + 1) & (map->size - 1);
+
+    if (!map->used[pos])
+    {
+        map->used[pos] = 1;
+        map->slots[pos].id = id;
+        map->slots[pos].blocks = 0;
+        map->slots[pos].inodes = 0;
+        map->count += 1;
+    }
+    map->slots[pos].blocks += blocks;
+    map->slots[pos].inodes += inodes;
+    return 0;
+}
+
+/*
+** Look up the entry of the given ID; returns NULL if not present
+*/
+const T_QUSAGE_ENTRY * qusage_map_get( const T_QUSAGE_MAP * map, uint32_t id )
+{
+    if (map->count != 0)
+    {
+        size_t pos = qusage_hash(id, map->size);
+        while (map->used[pos])
+        {
+            if (map->slots[pos].id == id)
+                return &map->slots[pos];
+            pos = (pos + 1) & (map->size - 1);
+        }
+    }
+    return NULL;
+}
+
+/*
+** Subtract usage from the entry of the given ID, as done by incremental
+** accounting when an inode is removed or shrinks. Usage is clamped at zero;
+** entries are kept when reaching zero.
+*/
+int qusage_map_sub( T_QUSAGE_MAP * map, uint32_t id, uint64_t blocks, uint64_t inodes )
+{
+    T_QUSAGE_ENTRY * ent = (T_QUSAGE_ENTRY *) qusage_map_get(map, id);
+
+    if (ent == NULL)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    ent->blocks = ((ent->blocks > blocks) ? (ent->blocks - blocks) : 0);
+    ent->inodes = ((ent->inodes > inodes) ? (ent->inodes - inodes) : 0);
+    return 0;
+}
+
+/*
+** Add all entries of the second table to the first one
+*/
+int qusage_map_merge( T_QUSAGE_MAP * dst, const T_QUSAGE_MAP * src )
+{
+    for (size_t idx = 0; idx < src->size; idx++)
+    {
+        if (src->used[idx] &&
+            (qusage_map_add(dst, src->slots[idx].id, src->slots[idx].blocks,
+                            src->slots[idx].inodes) != 0))
+            return -1;
+    }
+    return 0;
+}
+
+static int qusage_cmp_id( const void * a, const void * b )
+{
+    uint32_t id_a = ((const T_QUSAGE_ENTRY *) a)->id;
+    uint32_t id_b = ((const T_QUSAGE_ENTRY *) b)->id;
+    return (id_a < id_b) ? -1 : ((id_a > id_b) ? 1 : 0);
+}
+
+/*
+** Copy all entries of a table into an array sorted by ID, which has to be
+** freed by the caller
+*/
+int qusage_map_table( const T_QUSAGE_MAP * map, T_QUSAGE_ENTRY ** p_tab, size_t * p_count )
+{
+    T_QUSAGE_ENTRY * tab = malloc((map->count + 1) * sizeof(T_QUSAGE_ENTRY));
+    size_t count = 0;
+
+    if (tab == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (size_t idx = 0; idx < map->size; idx++)
+    {
+        if (map->used[idx])
+            tab[count++] = map->slots[idx];
+    }
+    qsort(tab, count, sizeof(T_QUSAGE_ENTRY), qusage_cmp_id);
+
+    *p_tab = tab;
+    *p_count = count;
+    return 0;
+}
+
+void qusage_map_free( T_QUSAGE_MAP * map )
+{
+    free(map->slots);
+    free(map->used);
+    memset(map, 0, sizeof(*map));
+}
+
+void qusage_free( T_QUSAGE_RESULT * res )
+{
+    for (unsigned kind = 0; kind < QUSAGE_KINDS; kind++)
+    {
+        free(res->tab[kind]);
+        res->tab[kind] = NULL;
+        res->count[kind] = 0;
+    }
+}
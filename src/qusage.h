@@ -0,0 +1,51 @@
+#ifndef INC_QUSAGE_H
+#define INC_QUSAGE_H
+
+/*
+ *  Interface for summing up usage per user, group and project ID, as done
+ *  by scans of all inodes of a file system or directory tree
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* kinds of IDs; order as quota types */
+#define QUSAGE_USER         0
+#define QUSAGE_GROUP        1
+#define QUSAGE_PROJECT      2
+#define QUSAGE_KINDS        3
+
+typedef struct
+{
+    uint32_t        id;
+    uint64_t        blocks;         /* in units of 512 bytes */
+    uint64_t        inodes;
+} T_QUSAGE_ENTRY;
+
+/* open-addressing hash table of usage per ID; zero-initialized when empty */
+typedef struct
+{
+    T_QUSAGE_ENTRY * slots;
+    uint8_t *       used;
+    size_t          size;           /* power of 2 */
+    size_t          count;
+} T_QUSAGE_MAP;
+
+/* result of a scan: one table per kind, sorted by ID */
+typedef struct
+{
+    T_QUSAGE_ENTRY * tab[QUSAGE_KINDS];
+    size_t          count[QUSAGE_KINDS];
+    uint64_t        inodes;         /* total number of inodes scanned */
+} T_QUSAGE_RESULT;
+
+/* a map must not be used by multiple threads concurrently */
+int qusage_map_add(T_QUSAGE_MAP * map, uint32_t id, uint64_t blocks, uint64_t inodes);
+int qusage_map_sub(T_QUSAGE_MAP * map, uint32_t id, uint64_t blocks, uint64_t inodes);
+const T_QUSAGE_ENTRY * qusage_map_get(const T_QUSAGE_MAP * map, uint32_t id);
+int qusage_map_merge(T_QUSAGE_MAP * dst, const T_QUSAGE_MAP * src);
+int qusage_map_table(const T_QUSAGE_MAP * map, T_QUSAGE_ENTRY ** p_tab, size_t * p_count);
+void qusage_map_free(T_QUSAGE_MAP * map);
+void qusage_free(T_QUSAGE_RESULT * res);
+
+#endif /* INC_QUSAGE_H */
@@ -0,0 +1,138 @@
+/*
+**  Detection of transitions of quota entries across thresholds
+**
+**  Between scans, only the IDs of entries matching the threshold condition
+**  (e.g. usage above the soft limit) are kept, as a sorted array. As each
+**  scan visits entries in ascending order of IDs, the new state is compared
+**  with the previous one by merging, so that a transition event is produced
+**  only for entries that started or stopped matching. Entries of the
+**  previous state not visited by the scan are reported as stopped matching,
+**  as their quota entry was removed.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "src/qwatch.h"
+
+static int qwatch_set_add( T_QWATCH_SET * set, uint32_t id )
+{
+    if (set->count >= set->size)
+    {
+        size_t new_size = (set->size != 0) ? (set->size * 2) : 64;
+        uint32_t * new_ids = realloc(set->ids, new_size * sizeof(uint32_t));
+        if (new_ids == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        set->ids = new_ids;
+        set->size = new_size;
+    }
+    set->ids[set->count++] = id;
+    return 0;
+}
+
+static int qwatch_add_event( T_QWATCH_SCAN * scan, uint32_t id, int matched, const uint64_t * val )
+{
+    if (scan->event_cnt >= scan->event_size)
+    {
+        size_t new_size = (scan->event_size != 0) ? (scan->event_size * 2) : 16;
+        T_QWATCH_EVENT * new_list = realloc(scan->events, new_size * sizeof(T_QWATCH_EVENT));
+        if (new_list == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        scan->events = new_list;
+        scan->event_size = new_size;
+    }
+    T_QWATCH_EVENT * ev = &scan->events[scan->event_cnt++];
+    ev->id = id;
+    ev->matched = matched;
+    ev->has_val = (val != NULL);
+    if (val != NULL)
+        memcpy(ev->val, val, sizeof(ev->val));
+    return 0;
+}
+
+void qwatch_scan_init( T_QWATCH_SCAN * scan, const T_QWATCH_SET * prev )
+{
+    memset(scan, 0, sizeof(*scan));
+    scan->prev = prev;
+}
+
+/*
+** Process the next entry of the scan; IDs have to be passed in strictly
+** ascending order.
+*/
+int qwatch_scan_add( T_QWATCH_SCAN * scan, uint32_t id, int matched, const uint64_t * val )
+{
+    const T_QWATCH_SET * prev = scan->prev;
+    int was_matched = 0;
+
+    /* matching entries of the previous scan with lower IDs were removed */
+    while ((scan->prev_pos < prev->count) && (prev->ids[scan->prev_pos] < id))
+    {
+        if (qwatch_add_event(scan, prev->ids[scan->prev_pos], 0, NULL) != 0)
+            return -1;
+        scan->prev_pos += 1;
+    }
+    if ((scan->prev_pos < prev->count) && (prev->ids[scan->prev_pos] == id))
+    {
+        was_matched = 1;
+        scan->prev_pos += 1;
+    }
+
+    if (matched != was_matched)
+    {
+        if (qwatch_add_event(scan, id, matched, val) != 0)
+            return -1;
+    }
+    if (matched)
+    {
+        if (qwatch_set_add(&scan->next, id) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+** Complete the scan: remaining matching entries of the previous scan were
+** removed.
+*/
+int qwatch_scan_finish( T_QWATCH_SCAN * scan )
+{
+    while (scan->prev_pos < scan->prev->count)
+    {
+        if (qwatch_add_event(scan, scan->prev->ids[scan->prev_pos], 0, NULL) != 0)
+            return -1;
+        scan->prev_pos += 1;
+    }
+    return 0;
+}
+
+void qwatch_scan_free( T_QWATCH_SCAN * scan )
+{
+    qwatch_set_free(&scan->next);
+    free(scan->events);
+    scan->events = NULL;
+    scan->event_cnt = scan->event_size = 0;
+}
+
+/*
+** Replace the destination set with the source, which is left empty.
+*/
+void qwatch_set_move( T_QWATCH_SET * dst, T_QWATCH_SET * src )
+{
+    qwatch_set_free(dst);
+    *dst = *src;
+    memset(src, 0, sizeof(*src));
+}
+
+void qwatch_set_free( T_QWATCH_SET * set )
+{
+    free(set->ids);
+    memset(set, 0, sizeof(*set));
+}
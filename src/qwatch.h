@@ -0,0 +1,51 @@
+#ifndef INC_QWATCH_H
+#define INC_QWATCH_H
+
+/*
+ *  Interface for detecting transitions of quota entries across thresholds
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of values per entry; order as in FsQuota.QueryResult */
+#define QWATCH_VAL_COUNT  8
+
+/* IDs of entries matching the threshold condition, in ascending order */
+typedef struct
+{
+    uint32_t *      ids;
+    size_t          count;
+    size_t          size;           /* allocated number of elements */
+} T_QWATCH_SET;
+
+/* entry that started or stopped matching the condition */
+typedef struct
+{
+    uint32_t        id;
+    uint8_t         matched;        /* TRUE if the entry started matching */
+    uint8_t         has_val;        /* FALSE if the entry no longer exists */
+    uint64_t        val[QWATCH_VAL_COUNT];
+} T_QWATCH_EVENT;
+
+/* state of an ongoing scan: members are private to qwatch.c, except for
+ * "next" and "events", which are valid after qwatch_scan_finish() */
+typedef struct
+{
+    const T_QWATCH_SET * prev;
+    size_t          prev_pos;
+    T_QWATCH_SET    next;
+    T_QWATCH_EVENT * events;
+    size_t          event_cnt;
+    size_t          event_size;
+} T_QWATCH_SCAN;
+
+void qwatch_scan_init(T_QWATCH_SCAN * scan, const T_QWATCH_SET * prev);
+int qwatch_scan_add(T_QWATCH_SCAN * scan, uint32_t id, int matched, const uint64_t * val);
+int qwatch_scan_finish(T_QWATCH_SCAN * scan);
+void qwatch_scan_free(T_QWATCH_SCAN * scan);
+
+void qwatch_set_move(T_QWATCH_SET * dst, T_QWATCH_SET * src);
+void qwatch_set_free(T_QWATCH_SET * set);
+
+#endif /* INC_QWATCH_H */
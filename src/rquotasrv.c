@@ -0,0 +1,560 @@
+/*
+**  Embedded rquotad server
+**
+**  Answers RQUOTAPROC_GETQUOTA and RQUOTAPROC_GETACTIVEQUOTA requests of
+**  RQUOTAPROG version 1 and extended version 2 via UDP. Requests are served
+**  by a pool of threads all reading from the same socket; each thread
+**  decodes requests and encodes replies in place within its own message
+**  buffers (i.e. via XDR memory streams, without intermediate copies).
+**  Query results are kept in a cache for a short time, so that repeated
+**  requests for the same ID (e.g. from many NFS clients at login) do not
+**  cause a quotactl() each. The source of query results is defined by a
+**  callback, which allows using the server as caching proxy for a remote
+**  rquotad as well.
+*/
+
+#include "myconfig.h"
+
+#ifdef RQUOTA_SERVER
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <rpc/pmap_clnt.h>
+
+#include "src/rquotasrv.h"
+
+/* maximum size of UDP request and reply messages (same as in SUN-RPC) */
+#define RQSRV_MSG_SIZE          8800
+/* number of buckets in the query result hash table */
+#define RQSRV_CACHE_BUCKETS     4096
+/* interval in milliseconds for polling the stop flag */
+#define RQSRV_POLL_INTERVAL     250
+
+typedef struct rqsrv_cache_ent
+{
+    struct rqsrv_cache_ent * next;
+    uint64_t        expire;         /* expiry timestamp in milliseconds */
+    int             pending;        /* query in progress */
+    int             qtype;
+    int             id;
+    getquota_rslt   rslt;
+    char            path[1];        /* variable length */
+} T_RQSRV_CACHE_ENT;
+
+struct rqsrv_state
+{
+    int             sock;
+    unsigned        port;
+    unsigned        thread_cnt;
+    unsigned        cache_ttl;
+    int             registered;
+    volatile int    stop;
+    T_RQSRV_QUERY_CB query_cb;
+    void *          query_ctx;
+    pthread_mutex_t cache_mutex;
+    pthread_cond_t  cache_cond;     /* signaled when a pending query completes */
+    T_RQSRV_STATS   stats;          /* protected by cache_mutex */
+    T_RQSRV_CACHE_ENT * cache[RQSRV_CACHE_BUCKETS];
+};
+
+/* message buffers owned by a single server thread */
+typedef struct
+{
+    char            in_buf[RQSRV_MSG_SIZE];
+    char            out_buf[RQSRV_MSG_SIZE];
+    char            cred_area[2 * MAX_AUTH_BYTES];
+    char            path_buf[RQ_PATHLEN + 1];
+} T_RQSRV_THREAD_BUF;
+
+
+/*
+**  Monotonic time in milliseconds, for cache expiry
+*/
+static uint64_t rqsrv_now( void )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned rqsrv_hash( const char * path, int qtype, int id )
+{
+    unsigned hash = 2166136261u;   /* FNV-1a */
+
+    while (*path != 0)
+        hash = (hash ^ (unsigned char)*(path++)) * 16777619u;
+    hash = (hash ^ (unsigned)qtype) * 16777619u;
+    hash = (hash ^ (unsigned)id) * 16777619u;
+
+    return hash % RQSRV_CACHE_BUCKETS;
+}
+
+/*
+**  Search the hash chain for an entry with the given key; optionally also
+**  return an expired entry that can be reused for a different key.
+*/
+static T_RQSRV_CACHE_ENT * rqsrv_cache_find( T_RQSRV * srv, unsigned hash,
+                                             const char * path, int qtype, int id,
+                                             uint64_t now, T_RQSRV_CACHE_ENT ** p_free_ent )
+{
+    T_RQSRV_CACHE_ENT * ent;
+
+    for (ent = srv->cache[hash]; ent != NULL; ent = ent->next)
+    {
+        if ((ent->id == id) && (ent->qtype == qtype) && (strcmp(ent->path, path) == 0))
+            break;
+        if ((p_free_ent != NULL) && (*p_free_ent == NULL) &&
+            !ent->pending && (ent->expire <= now) && (strlen(ent->path) >= strlen(path)))
+        {
+            *p_free_ent = ent;
+        }
+    }
+    return ent;
+}
+
+/*
+**  Answer a query from the cache, or via the callback & add the result to
+**  the cache. While the callback is in progress, the entry is marked as
+**  pending, so that identical requests arriving in the mean time wait for
+**  the same result instead of issuing another query (this matters most in
+**  proxy mode, where a query is a round-trip to the upstream server.)
+**  Entries are refreshed in place; expired entries in the same hash chain
+**  are reused, so that the cache does not grow beyond the number of
+**  distinct keys queried within the TTL. Returns -1 if no result could be
+**  obtained, in which case the request is not answered at all.
+*/
+static int rqsrv_query( T_RQSRV * srv, const char * path, int qtype, int id,
+                        getquota_rslt * rslt )
+{
+    T_RQSRV_CACHE_ENT * ent;
+    T_RQSRV_CACHE_ENT * free_ent = NULL;
+    unsigned hash;
+    uint64_t now;
+    int ret;
+
+    if (srv->cache_ttl == 0)
+    {
+        return srv->query_cb(srv->query_ctx, path, qtype, id, rslt);
+    }
+
+    hash = rqsrv_hash(path, qtype, id);
+    now = rqsrv_now();
+
+    pthread_mutex_lock(&srv->cache_mutex);
+    ent = rqsrv_cache_find(srv, hash, path, qtype, id, now, &free_ent);
+    if ((ent != NULL) && ent->pending)
+    {
+        srv->stats.coalesced += 1;
+        while (ent->pending)
+            pthread_cond_wait(&srv->cache_cond, &srv->cache_mutex);
+
+        /* check the entry was not reused for another key in the mean time */
+        if ((ent->id == id) && (ent->qtype == qtype) && (strcmp(ent->path, path) == 0) &&
+            (ent->expire > now))
+        {
+            *rslt = ent->rslt;
+            ret = 0;
+        }
+        else
+            ret = -1;
+        pthread_mutex_unlock(&srv->cache_mutex);
+        return ret;
+    }
+    if ((ent != NULL) && (ent->expire > now))
+    {
+        srv->stats.hits += 1;
+        *rslt = ent->rslt;
+        pthread_mutex_unlock(&srv->cache_mutex);
+        return 0;
+    }
+    srv->stats.misses += 1;
+
+    if ((ent == NULL) && (free_ent != NULL))
+    {
+        ent = free_ent;
+        strcpy(ent->path, path);
+    }
+    else if (ent == NULL)
+    {
+        ent = malloc(sizeof(T_RQSRV_CACHE_ENT) + strlen(path));
+        if (ent != NULL)
+        {
+            strcpy(ent->path, path);
+            ent->next = srv->cache[hash];
+            srv->cache[hash] = ent;
+        }
+    }
+    if (ent != NULL)
+    {
+        ent->qtype = qtype;
+        ent->id = id;
+        ent->expire = 0;
+        ent->pending = 1;
+    }
+    pthread_mutex_unlock(&srv->cache_mutex);
+
+    ret = srv->query_cb(srv->query_ctx, path, qtype, id, rslt);
+
+    if (ent != NULL)
+    {
+        pthread_mutex_lock(&srv->cache_mutex);
+        if (ret == 0)
+        {
+            ent->rslt = *rslt;
+            ent->expire = rqsrv_now() + srv->cache_ttl;
+        }
+        ent->pending = 0;
+        pthread_cond_broadcast(&srv->cache_cond);
+        pthread_mutex_unlock(&srv->cache_mutex);
+    }
+    return ret;
+}
+
+/*
+**  Decode a request message, process it and encode the reply. Returns the
+**  length of the reply, or 0 if the message is to be dropped.
+*/
+static size_t rqsrv_handle_msg( T_RQSRV * srv, T_RQSRV_THREAD_BUF * tb, size_t in_len )
+{
+    struct rpc_msg call;
+    struct rpc_msg reply;
+    getquota_rslt rslt;
+    XDR xdr_in;
+    XDR xdr_out;
+    size_t out_len = 0;
+
+    memset(&call, 0, sizeof(call));
+    call.rm_call.cb_cred.oa_base = tb->cred_area;
+    call.rm_call.cb_verf.oa_base = tb->cred_area + MAX_AUTH_BYTES;
+
+    xdrmem_create(&xdr_in, tb->in_buf, in_len, XDR_DECODE);
+    if (xdr_callmsg(&xdr_in, &call) && (call.rm_direction == CALL))
+    {
+        memset(&reply, 0, sizeof(reply));
+        reply.rm_xid = call.rm_xid;
+        reply.rm_direction = REPLY;
+        reply.rm_reply.rp_stat = MSG_ACCEPTED;
+        reply.acpted_rply.ar_verf = _null_auth;
+        reply.acpted_rply.ar_stat = SUCCESS;
+        reply.acpted_rply.ar_results.where = NULL;
+        reply.acpted_rply.ar_results.proc = (xdrproc_t) xdr_void;
+
+        if (call.rm_call.cb_rpcvers != RPC_MSG_VERSION)
+        {
+            reply.rm_reply.rp_stat = MSG_DENIED;
+            reply.rjcted_rply.rj_stat = RPC_MISMATCH;
+            reply.rjcted_rply.rj_vers.low = RPC_MSG_VERSION;
+            reply.rjcted_rply.rj_vers.high = RPC_MSG_VERSION;
+        }
+        else if (call.rm_call.cb_prog != RQUOTAPROG)
+        {
+            reply.acpted_rply.ar_stat = PROG_UNAVAIL;
+        }
+#ifdef USE_EXT_RQUOTA
+        else if ((call.rm_call.cb_vers != RQUOTAVERS) && (call.rm_call.cb_vers != EXT_RQUOTAVERS))
+#else
+        else if (call.rm_call.cb_vers != RQUOTAVERS)
+#endif
+        {
+            reply.acpted_rply.ar_stat = PROG_MISMATCH;
+            reply.acpted_rply.ar_vers.low = RQUOTAVERS;
+#ifdef USE_EXT_RQUOTA
+            reply.acpted_rply.ar_vers.high = EXT_RQUOTAVERS;
+#else
+            reply.acpted_rply.ar_vers.high = RQUOTAVERS;
+#endif
+        }
+        else if (call.rm_call.cb_proc == NULLPROC)
+        {
+            /* ping: empty reply */
+        }
+        else if ((call.rm_call.cb_proc == RQUOTAPROC_GETQUOTA) ||
+                 (call.rm_call.cb_proc == RQUOTAPROC_GETACTIVEQUOTA))
+        {
+            int ok, qtype, id;
+            char * path = tb->path_buf;
+
+#ifdef USE_EXT_RQUOTA
+            if (call.rm_call.cb_vers == EXT_RQUOTAVERS)
+            {
+                ext_getquota_args ext_gq_args;
+                ext_gq_args.gqa_pathp = path;
+                ok = xdr_ext_getquota_args(&xdr_in, &ext_gq_args);
+                qtype = ext_gq_args.gqa_type;
+                id = ext_gq_args.gqa_id;
+            }
+            else
+#endif
+            {
+                getquota_args gq_args;
+                gq_args.gqa_pathp = path;
+                ok = xdr_getquota_args(&xdr_in, &gq_args);
+                qtype = GQA_TYPE_USR;
+                id = gq_args.gqa_uid;
+            }
+
+            if (ok)
+            {
+                if (rqsrv_query(srv, path, qtype, id, &rslt) != 0)
+                {
+                    xdr_destroy(&xdr_in);
+                    return 0;  /* no answer: client will retry or time out */
+                }
+                reply.acpted_rply.ar_results.where = (caddr_t) &rslt;
+                reply.acpted_rply.ar_results.proc = (xdrproc_t) xdr_getquota_rslt;
+            }
+            else
+            {
+                reply.acpted_rply.ar_stat = GARBAGE_ARGS;
+            }
+        }
+        else
+        {
+            reply.acpted_rply.ar_stat = PROC_UNAVAIL;
+        }
+
+        xdrmem_create(&xdr_out, tb->out_buf, sizeof(tb->out_buf), XDR_ENCODE);
+        if (xdr_replymsg(&xdr_out, &reply))
+        {
+            out_len = xdr_getpos(&xdr_out);
+        }
+        xdr_destroy(&xdr_out);
+    }
+    xdr_destroy(&xdr_in);
+
+    return out_len;
+}
+
+/*
+**  Main loop of a server thread. Only the thread that called rqsrv_run()
+**  passes an idle callback.
+*/
+static int rqsrv_serve( T_RQSRV * srv, T_RQSRV_IDLE_CB idle_cb, void * idle_ctx )
+{
+    T_RQSRV_THREAD_BUF * tb;
+    uint64_t next_idle = rqsrv_now() + RQSRV_POLL_INTERVAL;
+    int ret = 0;
+
+    tb = malloc(sizeof(T_RQSRV_THREAD_BUF));
+    if (tb == NULL)
+        return -1;
+
+    while (!srv->stop)
+    {
+        struct pollfd pfd;
+        int cnt;
+
+        pfd.fd = srv->sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        cnt = poll(&pfd, 1, RQSRV_POLL_INTERVAL);
+        if (cnt > 0)
+        {
+            struct sockaddr_storage from;
+            socklen_t from_len = sizeof(from);
+            ssize_t len;
+
+            /* non-blocking, as other threads may have consumed the message */
+            len = recvfrom(srv->sock, tb->in_buf, sizeof(tb->in_buf), MSG_DONTWAIT,
+                           (struct sockaddr *) &from, &from_len);
+            if (len > 0)
+            {
+                size_t out_len = rqsrv_handle_msg(srv, tb, len);
+                if (out_len > 0)
+                {
+                    sendto(srv->sock, tb->out_buf, out_len, 0,
+                           (struct sockaddr *) &from, from_len);
+                }
+            }
+        }
+        else if ((cnt < 0) && (errno != EINTR))
+        {
+            ret = -1;
+            srv->stop = 1;
+            break;
+        }
+
+        if ((idle_cb != NULL) && (rqsrv_now() >= next_idle))
+        {
+            if (idle_cb(idle_ctx) != 0)
+                srv->stop = 1;
+            next_idle = rqsrv_now() + RQSRV_POLL_INTERVAL;
+        }
+    }
+
+    free(tb);
+    return ret;
+}
+
+static void * rqsrv_thread( void * arg )
+{
+    rqsrv_serve((T_RQSRV *) arg, NULL, NULL);
+    return NULL;
+}
+
+/*
+**  Create the server socket and state. When the given port is zero, an
+**  arbitrary free port is used. Returns NULL and sets errno upon error.
+*/
+T_RQSRV * rqsrv_create( unsigned port, unsigned thread_cnt, unsigned cache_ttl,
+                        T_RQSRV_QUERY_CB query_cb, void * query_ctx )
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    T_RQSRV * srv;
+    int on = 1;
+
+    srv = calloc(1, sizeof(T_RQSRV));
+    if (srv == NULL)
+        return NULL;
+
+    srv->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (srv->sock < 0)
+    {
+        free(srv);
+        return NULL;
+    }
+    setsockopt(srv->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if ((bind(srv->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) ||
+        (getsockname(srv->sock, (struct sockaddr *) &addr, &addr_len) != 0))
+    {
+        int errno_bak = errno;
+        close(srv->sock);
+        free(srv);
+        errno = errno_bak;
+        return NULL;
+    }
+
+    srv->port = ntohs(addr.sin_port);
+    srv->thread_cnt = (thread_cnt > 0) ? thread_cnt : 1;
+    srv->cache_ttl = cache_ttl;
+    srv->query_cb = query_cb;
+    srv->query_ctx = query_ctx;
+    pthread_mutex_init(&srv->cache_mutex, NULL);
+    pthread_cond_init(&srv->cache_cond, NULL);
+
+    return srv;
+}
+
+/*
+**  Register the server port with the local portmapper (aka rpcbind)
+*/
+int rqsrv_register( T_RQSRV * srv )
+{
+    pmap_unset(RQUOTAPROG, RQUOTAVERS);
+    if (!pmap_set(RQUOTAPROG, RQUOTAVERS, IPPROTO_UDP, srv->port))
+        return -1;
+#ifdef USE_EXT_RQUOTA
+    pmap_unset(RQUOTAPROG, EXT_RQUOTAVERS);
+    if (!pmap_set(RQUOTAPROG, EXT_RQUOTAVERS, IPPROTO_UDP, srv->port))
+    {
+        pmap_unset(RQUOTAPROG, RQUOTAVERS);
+        return -1;
+    }
+#endif
+    srv->registered = 1;
+    return 0;
+}
+
+unsigned rqsrv_get_port( const T_RQSRV * srv )
+{
+    return srv->port;
+}
+
+/*
+**  Serve requests until rqsrv_stop() is called or the idle callback
+**  requests stopping. The calling thread is used as one of the server
+**  threads; the others are created here and joined before returning.
+**  When rqsrv_stop() was called before, the function returns immediately.
+**  The stop flag is cleared only upon returning, so that the server can be
+**  run again afterward.
+*/
+int rqsrv_run( T_RQSRV * srv, T_RQSRV_IDLE_CB idle_cb, void * idle_ctx )
+{
+    pthread_t * threads;
+    unsigned idx;
+    unsigned started = 0;
+    int ret;
+
+    if (srv->stop)
+    {
+        srv->stop = 0;
+        return 0;
+    }
+
+    threads = malloc(sizeof(pthread_t) * srv->thread_cnt);
+    if (threads == NULL)
+        return -1;
+
+    for (idx = 1; idx < srv->thread_cnt; idx++)
+    {
+        if (pthread_create(&threads[started], NULL, rqsrv_thread, srv) == 0)
+            started += 1;
+    }
+
+    ret = rqsrv_serve(srv, idle_cb, idle_ctx);
+
+    srv->stop = 1;
+    for (idx = 0; idx < started; idx++)
+    {
+        pthread_join(threads[idx], NULL);
+    }
+    free(threads);
+    srv->stop = 0;
+
+    return ret;
+}
+
+void rqsrv_get_stats( T_RQSRV * srv, T_RQSRV_STATS * stats )
+{
+    pthread_mutex_lock(&srv->cache_mutex);
+    *stats = srv->stats;
+    pthread_mutex_unlock(&srv->cache_mutex);
+}
+
+void rqsrv_stop( T_RQSRV * srv )
+{
+    srv->stop = 1;
+}
+
+void rqsrv_destroy( T_RQSRV * srv )
+{
+    unsigned idx;
+
+    if (srv->registered)
+    {
+        pmap_unset(RQUOTAPROG, RQUOTAVERS);
+#ifdef USE_EXT_RQUOTA
+        pmap_unset(RQUOTAPROG, EXT_RQUOTAVERS);
+#endif
+    }
+    close(srv->sock);
+
+    for (idx = 0; idx < RQSRV_CACHE_BUCKETS; idx++)
+    {
+        while (srv->cache[idx] != NULL)
+        {
+            T_RQSRV_CACHE_ENT * ent = srv->cache[idx];
+            srv->cache[idx] = ent->next;
+            free(ent);
+        }
+    }
+    pthread_cond_destroy(&srv->cache_cond);
+    pthread_mutex_destroy(&srv->cache_mutex);
+    free(srv);
+}
+
+#endif /* RQUOTA_SERVER */
@@ -0,0 +1,37 @@
+#ifndef INC_RQUOTASRV_H
+#define INC_RQUOTASRV_H
+
+/*
+ *  Interface of the embedded rquotad server
+ */
+
+/* Callback for answering a quota query: must fill in the result status and
+ * (if status is Q_OK) the rquota struct. The callback is invoked concurrently
+ * by all server threads. When returning non-zero, the request is dropped
+ * (i.e. not answered) and the result not cached. */
+typedef int (*T_RQSRV_QUERY_CB)(void * ctx, const char * path,
+                                int qtype, int id, getquota_rslt * rslt);
+
+/* Callback invoked periodically by the thread that called rqsrv_run();
+ * the server is stopped when the function returns non-zero. */
+typedef int (*T_RQSRV_IDLE_CB)(void * ctx);
+
+typedef struct rqsrv_state T_RQSRV;
+
+typedef struct
+{
+    unsigned long   hits;           /* requests answered from the cache */
+    unsigned long   misses;         /* requests passed to the query callback */
+    unsigned long   coalesced;      /* requests that waited for a pending query */
+} T_RQSRV_STATS;
+
+T_RQSRV * rqsrv_create(unsigned port, unsigned thread_cnt, unsigned cache_ttl,
+                       T_RQSRV_QUERY_CB query_cb, void * query_ctx);
+int rqsrv_register(T_RQSRV * srv);
+unsigned rqsrv_get_port(const T_RQSRV * srv);
+int rqsrv_run(T_RQSRV * srv, T_RQSRV_IDLE_CB idle_cb, void * idle_ctx);
+void rqsrv_get_stats(T_RQSRV * srv, T_RQSRV_STATS * stats);
+void rqsrv_stop(T_RQSRV * srv);
+void rqsrv_destroy(T_RQSRV * srv);
+
+#endif /* INC_RQUOTASRV_H */
@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: LGPL-2.1+ WITH Linux-syscall-note */
+/*
+ * Copyright (c) 1995-2005 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef _XFS_BULKSTAT_H
+#define _XFS_BULKSTAT_H
+
+/*
+ * Subset of the XFS ioctl interface (xfs_fs.h of xfsprogs) required for
+ * reading inode records in bulk. Copied here, as the header is usually not
+ * installed.
+ */
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+/*
+ * Output for XFS_IOC_FSGEOMETRY_V1
+ */
+struct xfs_fsop_geom_v1 {
+	uint32_t	blocksize;	/* filesystem (data) block size */
+	uint32_t	rtextsize;	/* realtime extent size		*/
+	uint32_t	agblocks;	/* fsblocks in an AG		*/
+	uint32_t	agcount;	/* number of allocation groups	*/
+	uint32_t	logblocks;	/* fsblocks in the log		*/
+	uint32_t	sectsize;	/* (data) sector size, bytes	*/
+	uint32_t	inodesize;	/* inode size in bytes		*/
+	uint32_t	imaxpct;	/* max allowed inode space(%)	*/
+	uint64_t	datablocks;	/* fsblocks in data subvolume	*/
+	uint64_t	rtblocks;	/* fsblocks in realtime subvol	*/
+	uint64_t	rtextents;	/* rt extents in realtime subvol*/
+	uint64_t	logstart;	/* starting fsblock of the log	*/
+	unsigned char	uuid[16];	/* unique id of the filesystem	*/
+	uint32_t	sunit;		/* stripe unit, fsblocks	*/
+	uint32_t	swidth;		/* stripe width, fsblocks	*/
+	int32_t		version;	/* structure version		*/
+	uint32_t	flags;		/* superblock version flags	*/
+	uint32_t	logsectsize;	/* log sector size, bytes	*/
+	uint32_t	rtsectsize;	/* realtime sector size, bytes	*/
+	uint32_t	dirblocksize;	/* directory block size, bytes	*/
+};
+
+/*
+ * Inode record returned by XFS_IOC_BULKSTAT (v5, Linux 5.2 and later)
+ */
+struct xfs_bulkstat {
+	uint64_t	bs_ino;		/* inode number			*/
+	uint64_t	bs_size;	/* file size			*/
+
+	uint64_t	bs_blocks;	/* number of blocks of bs_blksize */
+	uint64_t	bs_xflags;	/* extended flags		*/
+
+	int64_t		bs_atime;	/* access time, seconds		*/
+	int64_t		bs_mtime;	/* modify time, seconds		*/
+
+	int64_t		bs_ctime;	/* inode change time, seconds	*/
+	int64_t		bs_btime;	/* creation time, seconds	*/
+
+	uint32_t	bs_gen;		/* generation count		*/
+	uint32_t	bs_uid;		/* user id			*/
+	uint32_t	bs_gid;		/* group id			*/
+	uint32_t	bs_projectid;	/* project id			*/
+
+	uint32_t	bs_atime_nsec;	/* access time, nanoseconds	*/
+	uint32_t	bs_mtime_nsec;	/* modify time, nanoseconds	*/
+	uint32_t	bs_ctime_nsec;	/* inode change time, nanoseconds */
+	uint32_t	bs_btime_nsec;	/* creation time, nanoseconds	*/
+
+	uint32_t	bs_blksize;	/* block size			*/
+	uint32_t	bs_rdev;	/* device value			*/
+	uint32_t	bs_cowextsize_blks; /* cow extent size hint, blocks */
+	uint32_t	bs_extsize_blks; /* extent size hint, blocks	*/
+
+	uint32_t	bs_nlink;	/* number of links		*/
+	uint32_t	bs_extents;	/* 32-bit data fork extent counter */
+	uint32_t	bs_aextents;	/* attribute number of extents	*/
+	uint16_t	bs_version;	/* structure version		*/
+	uint16_t	bs_forkoff;	/* inode fork offset in bytes	*/
+
+	uint16_t	bs_sick;	/* sick inode metadata		*/
+	uint16_t	bs_checked;	/* checked inode metadata	*/
+	uint16_t	bs_mode;	/* type and mode		*/
+	uint16_t	bs_pad2;	/* zeroed			*/
+	uint64_t	bs_extents64;	/* 64-bit data fork extent counter */
+
+	uint64_t	bs_pad[6];	/* zeroed			*/
+};
+
+/*
+ * Header of bulk inode requests
+ */
+struct xfs_bulk_ireq {
+	uint64_t	ino;		/* I/O: start with this inode	*/
+	uint32_t	flags;		/* I/O: operation flags		*/
+	uint32_t	icount;		/* I: count of entries in buffer */
+	uint32_t	ocount;		/* O: count of entries filled out */
+	uint32_t	agno;		/* I: see comment for IREQ_AGNO	*/
+	uint64_t	reserved[5];	/* must be zero			*/
+};
+
+/* Only return results from the specified allocation group number. */
+#define XFS_BULK_IREQ_AGNO	(1U << 0)
+
+struct xfs_bulkstat_req {
+	struct xfs_bulk_ireq	hdr;
+	struct xfs_bulkstat	bulkstat[];
+};
+
+#define XFS_IOC_FSGEOMETRY_V1	_IOR ('X', 100, struct xfs_fsop_geom_v1)
+#define XFS_IOC_BULKSTAT	_IOR ('X', 127, struct xfs_bulkstat_req)
+
+#endif /* _XFS_BULKSTAT_H */
@@ -0,0 +1,222 @@
+#!/usr/bin/python3
+#
+# Micro-benchmark for the fixed cost per call of the FsQuota interfaces:
+# - reports time per operation in nanoseconds and memory allocation per
+#   operation (i.e. blocks retained after the call, which should be zero,
+#   and peak of transient allocations in bytes during a single call)
+# - for query(), setqlim() and sync() the time is split up using the
+#   performance counters of the module (see Quota.stats()): "py+args" is
+#   the interpreter call overhead plus argument parsing; "backend" is
+#   dispatch, system call and result or exception construction; on Linux
+#   additionally the pure system call cost is measured via ctypes, which
+#   allows showing "dispatch" separately
+# - results can be saved as JSON baseline and compared with a previous
+#   baseline; note baselines are only comparable on the same machine
+#
+# Usage: benchmark.py [--count N] [--save FILE] [--compare FILE]
+#
+# Author: T. Zoerner
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import json
+import argparse
+import tracemalloc
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path  = "."
+ugid  = os.getuid()
+dogrp = False
+# UID for which setqlim() is benchmarked: the current limits are written
+# back unchanged, but still this requires root and should not be a real user;
+# None: skip setqlim
+setqlim_uid = None
+# remote host and path for benchmarking queries via RPC; None: skip
+rpc_host = None
+rpc_path = "/"
+
+# relative slow-down beyond which a comparison is reported as regression
+tolerance = 0.20
+
+def time_loop(func, count):
+    """Return time per call of func in nanoseconds, minus loop overhead"""
+    def empty():
+        pass
+    best = None
+    for rep in range(5):
+        t0 = time.perf_counter_ns()
+        for idx in range(count):
+            func()
+        t1 = time.perf_counter_ns()
+        for idx in range(count):
+            empty()
+        t2 = time.perf_counter_ns()
+        ns = ((t1 - t0) - (t2 - t1)) / count
+        if (best is None) or (ns < best):
+            best = ns
+    return max(best, 0.0)
+
+def alloc_per_op(func, count):
+    """Return retained blocks per call and peak bytes of a single call"""
+    func()  # warm-up, e.g. for interned strings
+    blocks_before = sys.getallocatedblocks()
+    for idx in range(count):
+        func()
+    blocks = (sys.getallocatedblocks() - blocks_before) / count
+
+    tracemalloc.start()
+    base = tracemalloc.get_traced_memory()[0]
+    func()
+    peak = tracemalloc.get_traced_memory()[1] - base
+    tracemalloc.stop()
+    return blocks, peak
+
+def ignore_error(func):
+    """Wrapper for benchmarking calls which may raise FsQuota.error"""
+    def wrapped():
+        try:
+            func()
+        except FsQuota.error:
+            pass
+    return wrapped
+
+def stats_ns(qObj, op):
+    """Return sum of durations and count of calls for the given method"""
+    st = qObj.stats()[op]
+    return st["time_ns"], st["calls"]
+
+def syscall_query_ns(qObj, count):
+    """Measure raw quotactl(Q_GETQUOTA) via ctypes, minus ctypes overhead"""
+    if not sys.platform.startswith("linux") or qObj.is_nfs:
+        return None
+    import ctypes
+    libc = ctypes.CDLL(None, use_errno=True)
+    buf = ctypes.create_string_buffer(128)
+    dev = qObj.dev.encode()
+    cmd = ((0x800007 << 8) | (1 if dogrp else 0))  # QCMD(Q_GETQUOTA, type)
+    cmd -= (1 << 32)  # C type is signed int
+    quotactl = libc.quotactl
+    snprintf = libc.snprintf
+    t_sys = time_loop(lambda: quotactl(cmd, dev, ugid, buf), count)
+    # reference call with equivalent parameter conversions, which returns immediately
+    t_nop = time_loop(lambda: snprintf(buf, 0, dev, ugid), count)
+    return max(t_sys - t_nop, 0.0)
+
+def bench_method(name, qObj, op, func, count, results):
+    t_st0, n_st0 = stats_ns(qObj, op)
+    total = time_loop(func, count)
+    t_st1, n_st1 = stats_ns(qObj, op)
+    blocks, peak = alloc_per_op(func, count)
+
+    ent = {"ns": total, "blocks": blocks, "peak_bytes": peak}
+    if n_st1 > n_st0:
+        ent["backend_ns"] = (t_st1 - t_st0) / (n_st1 - n_st0)
+        ent["py+args_ns"] = max(total - ent["backend_ns"], 0.0)
+    results[name] = ent
+
+def bench_plain(name, func, count, results):
+    total = time_loop(func, count)
+    blocks, peak = alloc_per_op(func, count)
+    results[name] = {"ns": total, "blocks": blocks, "peak_bytes": peak}
+
+def run_all(count):
+    results = {}
+    qObj = FsQuota.Quota(path)
+
+    bench_method("query", qObj, "query",
+                 ignore_error(lambda: qObj.query(ugid, grpquota=dogrp)), count, results)
+    sys_ns = syscall_query_ns(qObj, count)
+    if (sys_ns is not None) and ("backend_ns" in results["query"]):
+        results["query"]["syscall_ns"] = sys_ns
+        results["query"]["dispatch_ns"] = max(results["query"]["backend_ns"] - sys_ns, 0.0)
+
+    bench_method("query_noraise", qObj, "query",
+                 lambda: qObj.query(ugid, grpquota=dogrp, noraise=True), count, results)
+
+    bench_method("query_kw", qObj, "query",
+                 ignore_error(lambda: qObj.query(uid=ugid, grpquota=dogrp, prjquota=False)),
+                 count, results)
+
+    if setqlim_uid is not None:
+        lim = qObj.query(setqlim_uid, grpquota=dogrp)
+        bench_method("setqlim", qObj, "setqlim",
+                     ignore_error(lambda: qObj.setqlim(setqlim_uid, lim.bsoft, lim.bhard,
+                                                       lim.isoft, lim.ihard, grpquota=dogrp)),
+                     count, results)
+
+    bench_method("sync", qObj, "sync", ignore_error(qObj.sync), max(count // 100, 10), results)
+
+    bench_plain("Quota()", lambda: FsQuota.Quota(path), max(count // 10, 10), results)
+    bench_plain("Quota.dev", lambda: qObj.dev, count, results)
+    bench_plain("Quota.is_nfs", lambda: qObj.is_nfs, count, results)
+
+    mnt_cnt = len(list(FsQuota.MntTab()))
+    bench_plain("MntTab()", lambda: list(FsQuota.MntTab()), max(count // 10, 10), results)
+    results["MntTab()"]["entries"] = mnt_cnt
+
+    if rpc_host is not None:
+        rObj = FsQuota.Quota(rpc_path, rpc_host=rpc_host)
+        bench_method("query_rpc", rObj, "query",
+                     ignore_error(lambda: rObj.query(ugid, grpquota=dogrp)),
+                     max(count // 100, 10), results)
+
+    return results
+
+def print_results(results, baseline):
+    print("%-14s %10s %10s %10s %10s %10s %8s %8s" %
+          ("operation", "ns/op", "py+args", "dispatch", "syscall", "backend", "blocks", "peak"))
+    regressions = 0
+    for name, ent in results.items():
+        def col(key):
+            return ("%10.0f" % ent[key]) if key in ent else "%10s" % "-"
+        line = ("%-14s %10.0f %s %s %s %s %8.2f %8d" %
+                (name, ent["ns"], col("py+args_ns"), col("dispatch_ns"), col("syscall_ns"),
+                 col("backend_ns"), ent["blocks"], ent["peak_bytes"]))
+        if (baseline is not None) and (name in baseline):
+            base = baseline[name]
+            ratio = ent["ns"] / base["ns"] if base["ns"] else 1.0
+            line += "  (%+.0f%%)" % ((ratio - 1.0) * 100)
+            if (ratio > 1.0 + tolerance) or (ent["blocks"] > base["blocks"] + 0.01):
+                line += " REGRESSION"
+                regressions += 1
+        print(line)
+    return regressions
+
+parser = argparse.ArgumentParser(description="Micro-benchmark for FsQuota")
+parser.add_argument("--count", type=int, default=100000, help="iterations per operation")
+parser.add_argument("--save", metavar="FILE", help="store results as JSON baseline")
+parser.add_argument("--compare", metavar="FILE", help="compare with JSON baseline")
+args = parser.parse_args()
+
+baseline = None
+if args.compare:
+    with open(args.compare) as fh:
+        baseline = json.load(fh)["results"]
+
+try:
+    results = run_all(args.count)
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
+    sys.exit(1)
+
+regressions = print_results(results, baseline)
+
+if args.save:
+    with open(args.save, "w") as fh:
+        json.dump({"python": sys.version, "platform": os.uname().sysname + " " + os.uname().release,
+                   "count": args.count, "results": results}, fh, indent=2)
+
+if regressions:
+    print("ERROR: %d regression(s) compared to baseline" % regressions, file=sys.stderr)
+    sys.exit(1)
@@ -0,0 +1,806 @@
+/*
+**  Quota simulator for testing and benchmarking without root privileges
+**
+**  This library is loaded via LD_PRELOAD in front of the C library and
+**  intercepts quotactl(), quotactl_fd(), ioctl() and setmntent(). It adds a
+**  simulated file system to the mount table, and serves all quotactl()
+**  commands for that file system from an in-memory table, so that the
+**  FsQuota module can be exercised (unchanged) with large numbers of quota
+**  entries. Both the generic Linux quota interface and the XFS specific
+**  commands are supported; for Btrfs, the project quota entries are served
+**  as qgroups via the respective ioctls on the mount point. For XFS, a set
+**  of synthetic inodes is served via bulkstat ioctls. Calls for other
+**  devices are passed to the C library.
+**
+**  Usage:
+**    python3 setup.py build_quotasim
+**    LD_PRELOAD=$PWD/tests/quotasim.so QUOTASIM_IDS=10000000 python3 ...
+**
+**  Configuration via environment variables:
+**    QUOTASIM_MOUNT       mount point of the simulated file system; the
+**                         directory must exist (default: "/")
+**    QUOTASIM_DEV         device name (default: "/dev/quotasim")
+**    QUOTASIM_FSTYPE      "ext4" for the generic or "xfs" for the XFS
+**                         quotactl interface, or "btrfs" for qgroup
+**                         ioctls (default: "ext4")
+**    QUOTASIM_IDS         number of IDs with quota entries per quota type
+**                         (default: 1000)
+**    QUOTASIM_STRIDE      distance between IDs with quota entries, i.e.
+**                         entries exist for IDs BASE, BASE+STRIDE, ...
+**                         (default: 1)
+**    QUOTASIM_BASE        first ID with a quota entry (default: 0)
+**    QUOTASIM_LATENCY_US  delay per quotactl() call in microseconds
+**                         (default: 0)
+**    QUOTASIM_INODES      number of inodes returned by XFS bulkstat; owner
+**                         IDs are taken from those with quota entries
+**                         (default: 100000)
+**    QUOTASIM_AGS         number of XFS allocation groups (default: 4)
+**    QUOTASIM_KEEP_MOUNTS when set to 1, the real mount table entries
+**                         follow the simulated one (default: 0)
+**
+**  Usage and limits of each entry are derived from its ID via a hash
+**  function, so that memory consumption is independent of the number of
+**  entries. Limits modified via Q_SETQUOTA or Q_XSETQLIM are stored in a
+**  hash table. About a quarter of the entries have no limits; some exceed
+**  their soft limit and have a grace time set.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <mntent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <stdarg.h>
+#include <endian.h>
+#include <linux/quota.h>
+#include <linux/dqblk_xfs.h>
+#include <linux/btrfs.h>
+#include <linux/btrfs_tree.h>
+#include "../src/xfs_bulkstat.h"
+
+#define QSIM_QTYPES  3                  /* user, group, project */
+
+typedef struct
+{
+    uint64_t    bhard;                  /* limits in 1 kB units */
+    uint64_t    bsoft;
+    uint64_t    ihard;
+    uint64_t    isoft;
+} T_QSIM_LIMITS;
+
+typedef struct qsim_override
+{
+    struct qsim_override * next;
+    int         qtype;
+    uint32_t    id;
+    T_QSIM_LIMITS lim;
+} T_QSIM_OVERRIDE;
+
+#define QSIM_OVR_BUCKETS  4096
+
+static struct
+{
+    const char *    mount;
+    const char *    dev;
+    const char *    fstype;
+    int             is_xfs;
+    int             is_btrfs;
+    uint64_t        id_cnt;
+    uint64_t        stride;
+    uint64_t        base;
+    unsigned        latency_us;
+    uint64_t        inode_cnt;
+    uint32_t        ag_cnt;
+    int             keep_mounts;
+    dev_t           st_dev;             /* device ID of the mount point */
+    int             have_st_dev;
+    pthread_mutex_t ovr_mutex;
+    T_QSIM_OVERRIDE * ovr[QSIM_OVR_BUCKETS];
+    size_t          ovr_cnt;            /* number of entries in ovr */
+} qsim;
+
+static int (*real_quotactl)(int, const char *, int, caddr_t);
+static FILE * (*real_setmntent)(const char *, const char *);
+static int (*real_ioctl)(int, unsigned long, void *);
+
+static const char * qsim_getenv( const char * name, const char * def )
+{
+    const char * val = getenv(name);
+    return ((val != NULL) && (*val != 0)) ? val : def;
+}
+
+__attribute__((constructor))
+static void qsim_init( void )
+{
+    struct stat st;
+
+    real_quotactl = (int (*)(int, const char *, int, caddr_t)) dlsym(RTLD_NEXT, "quotactl");
+    real_setmntent = (FILE * (*)(const char *, const char *)) dlsym(RTLD_NEXT, "setmntent");
+    real_ioctl = (int (*)(int, unsigned long, void *)) dlsym(RTLD_NEXT, "ioctl");
+
+    qsim.mount = qsim_getenv("QUOTASIM_MOUNT", "/");
+    qsim.dev = qsim_getenv("QUOTASIM_DEV", "/dev/quotasim");
+    qsim.fstype = qsim_getenv("QUOTASIM_FSTYPE", "ext4");
+    qsim.is_xfs = (strcmp(qsim.fstype, "xfs") == 0);
+    qsim.is_btrfs = (strcmp(qsim.fstype, "btrfs") == 0);
+    qsim.id_cnt = strtoull(qsim_getenv("QUOTASIM_IDS", "1000"), NULL, 0);
+    qsim.stride = strtoull(qsim_getenv("QUOTASIM_STRIDE", "1"), NULL, 0);
+    qsim.base = strtoull(qsim_getenv("QUOTASIM_BASE", "0"), NULL, 0);
+    qsim.latency_us = strtoul(qsim_getenv("QUOTASIM_LATENCY_US", "0"), NULL, 0);
+    qsim.inode_cnt = strtoull(qsim_getenv("QUOTASIM_INODES", "100000"), NULL, 0);
+    qsim.ag_cnt = strtoul(qsim_getenv("QUOTASIM_AGS", "4"), NULL, 0);
+    qsim.keep_mounts = (atoi(qsim_getenv("QUOTASIM_KEEP_MOUNTS", "0")) != 0);
+
+    if (qsim.stride == 0)
+        qsim.stride = 1;
+    if (qsim.ag_cnt == 0)
+        qsim.ag_cnt = 1;
+    if (stat(qsim.mount, &st) == 0)
+    {
+        qsim.st_dev = st.st_dev;
+        qsim.have_st_dev = 1;
+    }
+    pthread_mutex_init(&qsim.ovr_mutex, NULL);
+}
+
+/*
+** Simulate system call latency
+*/
+static void qsim_delay( void )
+{
+    if (qsim.latency_us != 0)
+    {
+        struct timespec ts;
+        ts.tv_sec = qsim.latency_us / 1000000;
+        ts.tv_nsec = (qsim.latency_us % 1000000) * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+/*
+** Mixing function for deriving pseudo-random quota values from IDs
+*/
+static uint64_t qsim_hash( uint64_t x )
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+** Check if the given ID has a quota entry
+*/
+static int qsim_id_exists( uint64_t id )
+{
+    return (id >= qsim.base) &&
+           ((id - qsim.base) % qsim.stride == 0) &&
+           ((id - qsim.base) / qsim.stride < qsim.id_cnt);
+}
+
+/*
+** Find the lowest ID with a quota entry that is >= the given ID, including
+** entries created via setting limits; returns -1 if there is none
+*/
+static int64_t qsim_next_id( int qtype, uint64_t id )
+{
+    T_QSIM_OVERRIDE * ovr;
+    int64_t next = -1;
+    uint64_t idx;
+
+    if (id <= qsim.base)
+        idx = 0;
+    else
+        idx = (id - qsim.base + qsim.stride - 1) / qsim.stride;
+
+    if ((idx < qsim.id_cnt) && (qsim.base + idx * qsim.stride <= UINT32_MAX))
+        next = qsim.base + idx * qsim.stride;
+
+    /* entries created via setting limits are rare: skip scanning all buckets */
+    pthread_mutex_lock(&qsim.ovr_mutex);
+    for (idx = 0; (qsim.ovr_cnt != 0) && (idx < QSIM_OVR_BUCKETS); idx++)
+    {
+        for (ovr = qsim.ovr[idx]; ovr != NULL; ovr = ovr->next)
+        {
+            if ((ovr->qtype == qtype) && (ovr->id >= id) &&
+                ((next < 0) || (ovr->id < next)))
+                next = ovr->id;
+        }
+    }
+    pthread_mutex_unlock(&qsim.ovr_mutex);
+
+    return next;
+}
+
+/*
+** Generate usage and limits of an entry; block values in 1 kB units.
+** Returns 0 if the entry does not exist.
+*/
+static int qsim_get_entry( int qtype, uint32_t id, T_QSIM_LIMITS * lim,
+                           uint64_t * bcur, uint64_t * icur,
+                           uint64_t * btime, uint64_t * itime )
+{
+    uint64_t h = qsim_hash(((uint64_t)qtype << 32) | id);
+    T_QSIM_OVERRIDE * ovr;
+    int exists = qsim_id_exists(id);
+
+    *bcur = exists ? (h & 0xFFFFF) : 0;            /* up to 1 GB */
+    *icur = exists ? ((h >> 20) & 0x3FFF) : 0;     /* up to 16k files */
+
+    if (!exists || (((h >> 40) & 3) == 0))
+    {
+        memset(lim, 0, sizeof(*lim));
+    }
+    else
+    {
+        /* limits around usage, so that some entries exceed soft limits */
+        lim->bsoft = (*bcur / 8) * (6 + ((h >> 42) & 7)) + 1024;
+        lim->bhard = lim->bsoft + lim->bsoft / 4;
+        lim->isoft = (*icur / 8) * (6 + ((h >> 45) & 7)) + 100;
+        lim->ihard = lim->isoft + lim->isoft / 4;
+    }
+
+    pthread_mutex_lock(&qsim.ovr_mutex);
+    for (ovr = qsim.ovr[id % QSIM_OVR_BUCKETS]; ovr != NULL; ovr = ovr->next)
+    {
+        if ((ovr->id == id) && (ovr->qtype == qtype))
+        {
+            *lim = ovr->lim;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&qsim.ovr_mutex);
+
+    *btime = ((lim->bsoft != 0) && (*bcur > lim->bsoft)) ? (time(NULL) + 3600 + (h & 0xFFFF)) : 0;
+    *itime = ((lim->isoft != 0) && (*icur > lim->isoft)) ? (time(NULL) + 3600 + (h & 0xFFFF)) : 0;
+
+    return (exists || (ovr != NULL));
+}
+
+/*
+** Store modified limits of an entry
+*/
+static int qsim_set_limits( int qtype, uint32_t id, const T_QSIM_LIMITS * lim )
+{
+    T_QSIM_OVERRIDE * ovr;
+
+    pthread_mutex_lock(&qsim.ovr_mutex);
+    for (ovr = qsim.ovr[id % QSIM_OVR_BUCKETS]; ovr != NULL; ovr = ovr->next)
+    {
+        if ((ovr->id == id) && (ovr->qtype == qtype))
+            break;
+    }
+    if (ovr == NULL)
+    {
+        ovr = (T_QSIM_OVERRIDE *) calloc(1, sizeof(*ovr));
+        if (ovr != NULL)
+        {
+            ovr->id = id;
+            ovr->qtype = qtype;
+            ovr->next = qsim.ovr[id % QSIM_OVR_BUCKETS];
+            qsim.ovr[id % QSIM_OVR_BUCKETS] = ovr;
+            qsim.ovr_cnt += 1;
+        }
+    }
+    if (ovr != NULL)
+        ovr->lim = *lim;
+    pthread_mutex_unlock(&qsim.ovr_mutex);
+
+    return (ovr != NULL) ? 0 : ENOMEM;
+}
+
+/*
+** Commands of the generic quota interface
+*/
+static int qsim_generic( int subcmd, int qtype, uint32_t id, caddr_t addr )
+{
+    T_QSIM_LIMITS lim;
+    uint64_t bcur, icur, btime, itime;
+
+    switch (subcmd)
+    {
+        case Q_SYNC:
+        case Q_QUOTAON:
+        case Q_QUOTAOFF:
+            return 0;
+
+        case Q_GETFMT:
+            *(uint32_t *)addr = QFMT_VFS_V1;
+            return 0;
+
+        case Q_GETINFO:
+        {
+            struct if_dqinfo * info = (struct if_dqinfo *) addr;
+            memset(info, 0, sizeof(*info));
+            info->dqi_bgrace = 7*24*60*60;
+            info->dqi_igrace = 7*24*60*60;
+            info->dqi_valid = IIF_ALL;
+            return 0;
+        }
+
+        case Q_GETQUOTA:
+        case Q_GETNEXTQUOTA:
+        {
+            struct if_nextdqblk * dqb = (struct if_nextdqblk *) addr;
+
+            if (subcmd == Q_GETNEXTQUOTA)
+            {
+                int64_t next = qsim_next_id(qtype, id);
+                if (next < 0)
+                    return ENOENT;
+                id = next;
+            }
+            memset(dqb, 0, (subcmd == Q_GETNEXTQUOTA) ? sizeof(struct if_nextdqblk)
+                                                      : sizeof(struct if_dqblk));
+            /* missing entries are reported with all-zero values */
+            qsim_get_entry(qtype, id, &lim, &bcur, &icur, &btime, &itime);
+            dqb->dqb_bhardlimit = lim.bhard;
+            dqb->dqb_bsoftlimit = lim.bsoft;
+            dqb->dqb_curspace = bcur * 1024;
+            dqb->dqb_ihardlimit = lim.ihard;
+            dqb->dqb_isoftlimit = lim.isoft;
+            dqb->dqb_curinodes = icur;
+            dqb->dqb_btime = btime;
+            dqb->dqb_itime = itime;
+            dqb->dqb_valid = QIF_ALL;
+            if (subcmd == Q_GETNEXTQUOTA)
+                dqb->dqb_id = id;
+            return 0;
+        }
+
+        case Q_SETQUOTA:
+        {
+            const struct if_dqblk * dqb = (const struct if_dqblk *) addr;
+
+            qsim_get_entry(qtype, id, &lim, &bcur, &icur, &btime, &itime);
+            if (dqb->dqb_valid & QIF_BLIMITS)
+            {
+                lim.bhard = dqb->dqb_bhardlimit;
+                lim.bsoft = dqb->dqb_bsoftlimit;
+            }
+            if (dqb->dqb_valid & QIF_ILIMITS)
+            {
+                lim.ihard = dqb->dqb_ihardlimit;
+                lim.isoft = dqb->dqb_isoftlimit;
+            }
+            return qsim_set_limits(qtype, id, &lim);
+        }
+
+        default:
+            return EINVAL;
+    }
+}
+
+/*
+** Commands of the XFS quota interface; block values in 512 byte units
+*/
+static int qsim_xfs( int subcmd, int qtype, uint32_t id, caddr_t addr )
+{
+    T_QSIM_LIMITS lim;
+    uint64_t bcur, icur, btime, itime;
+
+    switch (subcmd)
+    {
+        case Q_XQUOTASYNC:
+        case Q_XQUOTAON:
+        case Q_XQUOTAOFF:
+            return 0;
+
+        case Q_XGETQSTAT:
+        {
+            fs_quota_stat_t * qs = (fs_quota_stat_t *) addr;
+            memset(qs, 0, sizeof(*qs));
+            qs->qs_version = FS_QSTAT_VERSION;
+            qs->qs_flags = FS_QUOTA_UDQ_ACCT | FS_QUOTA_UDQ_ENFD |
+                           FS_QUOTA_GDQ_ACCT | FS_QUOTA_GDQ_ENFD |
+                           FS_QUOTA_PDQ_ACCT | FS_QUOTA_PDQ_ENFD;
+            qs->qs_btimelimit = 7*24*60*60;
+            qs->qs_itimelimit = 7*24*60*60;
+            return 0;
+        }
+
+        case Q_XGETQUOTA:
+        case Q_XGETNEXTQUOTA:
+        {
+            fs_disk_quota_t * dq = (fs_disk_quota_t *) addr;
+
+            if (subcmd == Q_XGETNEXTQUOTA)
+            {
+                int64_t next = qsim_next_id(qtype, id);
+                if (next < 0)
+                    return ENOENT;
+                id = next;
+            }
+            if (!qsim_get_entry(qtype, id, &lim, &bcur, &icur, &btime, &itime))
+            {
+                /* unlike the generic interface, XFS reports missing entries */
+                return ENOENT;
+            }
+            memset(dq, 0, sizeof(*dq));
+            dq->d_version = FS_DQUOT_VERSION;
+            dq->d_flags = ((qtype == PRJQUOTA) ? FS_PROJ_QUOTA :
+                           ((qtype == GRPQUOTA) ? FS_GROUP_QUOTA : FS_USER_QUOTA));
+            dq->d_id = id;
+            dq->d_blk_hardlimit = lim.bhard * 2;
+            dq->d_blk_softlimit = lim.bsoft * 2;
+            dq->d_bcount = bcur * 2;
+            dq->d_ino_hardlimit = lim.ihard;
+            dq->d_ino_softlimit = lim.isoft;
+            dq->d_icount = icur;
+            dq->d_btimer = btime;
+            dq->d_itimer = itime;
+            return 0;
+        }
+
+        case Q_XSETQLIM:
+        {
+            const fs_disk_quota_t * dq = (const fs_disk_quota_t *) addr;
+
+            qsim_get_entry(qtype, id, &lim, &bcur, &icur, &btime, &itime);
+            if (dq->d_fieldmask & FS_DQ_BHARD)
+                lim.bhard = dq->d_blk_hardlimit / 2;
+            if (dq->d_fieldmask & FS_DQ_BSOFT)
+                lim.bsoft = dq->d_blk_softlimit / 2;
+            if (dq->d_fieldmask & FS_DQ_IHARD)
+                lim.ihard = dq->d_ino_hardlimit;
+            if (dq->d_fieldmask & FS_DQ_ISOFT)
+                lim.isoft = dq->d_ino_softlimit;
+            return qsim_set_limits(qtype, id, &lim);
+        }
+
+        default:
+            return EINVAL;
+    }
+}
+
+/*
+** Btrfs tree search in the quota tree: info and limit items of level 0
+** qgroups are generated from the project quota entries
+*/
+static int qsim_btrfs_search( struct btrfs_ioctl_search_args_v2 * args )
+{
+    struct btrfs_ioctl_search_key * sk = &args->key;
+    size_t pos = 0;
+    uint32_t found = 0;
+
+    if (sk->tree_id != BTRFS_QUOTA_TREE_OBJECTID)
+        return ENOENT;
+
+    for (uint32_t type = BTRFS_QGROUP_INFO_KEY; type <= BTRFS_QGROUP_LIMIT_KEY; type += 2)
+    {
+        if ((sk->min_objectid != 0) || (type < sk->min_type) || (type > sk->max_type))
+            continue;
+
+        uint64_t start = ((type == sk->min_type) ? sk->min_offset : 0);
+        uint64_t end = ((type == sk->max_type) ? sk->max_offset : UINT64_MAX);
+        int64_t id = ((start <= UINT32_MAX) ? qsim_next_id(PRJQUOTA, start) : -1);
+
+        for ( ; (id >= 0) && ((uint64_t)id <= end) && (found < sk->nr_items);
+              id = qsim_next_id(PRJQUOTA, id + 1))
+        {
+            struct btrfs_ioctl_search_header sh;
+            uint64_t item[5];
+            T_QSIM_LIMITS lim;
+            uint64_t bcur, icur, btime, itime;
+
+            if (pos + sizeof(sh) + sizeof(item) > args->buf_size)
+            {
+                if (found == 0)
+                {
+                    args->buf_size = sizeof(sh) + sizeof(item);
+                    return EOVERFLOW;
+                }
+                break;
+            }
+            qsim_get_entry(PRJQUOTA, id, &lim, &bcur, &icur, &btime, &itime);
+            memset(item, 0, sizeof(item));
+            if (type == BTRFS_QGROUP_INFO_KEY)
+            {
+                item[1] = htole64(bcur * 1024);             /* rfer */
+                item[3] = htole64(bcur * 512);              /* excl */
+            }
+            else if (lim.bhard != 0)
+            {
+                item[0] = htole64(BTRFS_QGROUP_LIMIT_MAX_RFER);
+                item[1] = htole64(lim.bhard * 1024);
+            }
+            sh.transid = 1;
+            sh.objectid = 0;
+            sh.offset = id;
+            sh.type = type;
+            sh.len = sizeof(item);
+            memcpy((char *)args->buf + pos, &sh, sizeof(sh));
+            memcpy((char *)args->buf + pos + sizeof(sh), item, sizeof(item));
+            pos += sizeof(sh) + sizeof(item);
+            found += 1;
+        }
+    }
+    sk->nr_items = found;
+    return 0;
+}
+
+/*
+** Btrfs ioctls on the simulated file system
+*/
+static int qsim_btrfs_ioctl( unsigned long request, void * arg )
+{
+    switch (request)
+    {
+        case BTRFS_IOC_TREE_SEARCH_V2:
+            return qsim_btrfs_search((struct btrfs_ioctl_search_args_v2 *) arg);
+
+        case BTRFS_IOC_QGROUP_LIMIT:
+        {
+            const struct btrfs_ioctl_qgroup_limit_args * la = arg;
+            uint64_t id = ((la->qgroupid != 0) ? la->qgroupid : BTRFS_FS_TREE_OBJECTID);
+            T_QSIM_LIMITS lim;
+            uint64_t bcur, icur, btime, itime;
+
+            if (id > UINT32_MAX)
+                return EINVAL;
+            qsim_get_entry(PRJQUOTA, id, &lim, &bcur, &icur, &btime, &itime);
+            if (la->lim.flags & BTRFS_QGROUP_LIMIT_MAX_RFER)
+                lim.bhard = ((la->lim.max_rfer != UINT64_MAX) ? (la->lim.max_rfer / 1024) : 0);
+            return qsim_set_limits(PRJQUOTA, id, &lim);
+        }
+
+        case BTRFS_IOC_INO_LOOKUP:
+        {
+            struct btrfs_ioctl_ino_lookup_args * lookup = arg;
+            if (lookup->treeid == 0)
+                lookup->treeid = BTRFS_FS_TREE_OBJECTID;
+            lookup->name[0] = 0;
+            return 0;
+        }
+
+        case BTRFS_IOC_FS_INFO:
+        {
+            struct btrfs_ioctl_fs_info_args * info = arg;
+            memset(info, 0, sizeof(*info));
+            info->num_devices = 1;
+            memcpy(info->fsid, "quotasim-fsid---", BTRFS_FSID_SIZE);
+            return 0;
+        }
+
+        case BTRFS_IOC_SYNC:
+            return 0;
+
+        default:
+            return ENOTTY;
+    }
+}
+
+/*
+** XFS bulkstat: inodes are distributed evenly across allocation groups;
+** inode numbers of AG N start at N << 32, plus an offset so that zero
+** never is a valid inode number. Owners and sizes are derived from the
+** inode index.
+*/
+#define QSIM_INO_OFFSET  128
+/* as for XFS, bulkstat counts blocks in units of the file system block size */
+#define QSIM_XFS_BLKSIZE 4096
+
+static int qsim_xfs_bulkstat( struct xfs_bulkstat_req * req )
+{
+    uint64_t per_ag = (qsim.inode_cnt + qsim.ag_cnt - 1) / qsim.ag_cnt;
+    uint64_t ids = ((qsim.id_cnt != 0) ? qsim.id_cnt : 1);
+    uint64_t agno = req->hdr.agno;
+    uint64_t idx = 0;
+    uint32_t found = 0;
+
+    if (!(req->hdr.flags & XFS_BULK_IREQ_AGNO))
+        return EINVAL;          /* only per-AG scans are simulated */
+    if (agno >= qsim.ag_cnt)
+        return EINVAL;
+
+    if ((req->hdr.ino >> 32) == agno)
+    {
+        uint64_t ag_ino = req->hdr.ino & 0xffffffffULL;
+        idx = ((ag_ino > QSIM_INO_OFFSET) ? (ag_ino - QSIM_INO_OFFSET) : 0);
+    }
+    else if (req->hdr.ino != 0)
+        idx = per_ag;
+
+    for ( ; (idx < per_ag) && (agno * per_ag + idx < qsim.inode_cnt) && (found < req->hdr.icount);
+          idx++, found++)
+    {
+        struct xfs_bulkstat * bs = &req->bulkstat[found];
+        uint64_t gidx = agno * per_ag + idx;
+        uint64_t h = qsim_hash(gidx);
+
+        memset(bs, 0, sizeof(*bs));
+        bs->bs_ino = (agno << 32) + QSIM_INO_OFFSET + idx;
+        bs->bs_blksize = QSIM_XFS_BLKSIZE;
+        bs->bs_blocks = (h >> 40) % 256;
+        bs->bs_size = bs->bs_blocks * QSIM_XFS_BLKSIZE;
+        bs->bs_uid = qsim.base + ((h & 0xffff) % ids) * qsim.stride;
+        bs->bs_gid = qsim.base + (((h >> 16) & 0xffff) % ids) * qsim.stride;
+        bs->bs_projectid = qsim.base + (((h >> 32) & 0xff) % ids) * qsim.stride;
+        bs->bs_nlink = 1;
+        bs->bs_mode = 0100644;
+        bs->bs_version = 5;
+    }
+    req->hdr.ocount = found;
+    req->hdr.ino = (agno << 32) + QSIM_INO_OFFSET + idx;
+    return 0;
+}
+
+/*
+** XFS ioctls on the simulated file system
+*/
+static int qsim_xfs_ioctl( unsigned long request, void * arg )
+{
+    switch (request)
+    {
+        case XFS_IOC_FSGEOMETRY_V1:
+        {
+            struct xfs_fsop_geom_v1 * geo = arg;
+            memset(geo, 0, sizeof(*geo));
+            geo->blocksize = 4096;
+            geo->agcount = qsim.ag_cnt;
+            geo->inodesize = 512;
+            return 0;
+        }
+
+        case XFS_IOC_BULKSTAT:
+            return qsim_xfs_bulkstat((struct xfs_bulkstat_req *) arg);
+
+        default:
+            return ENOTTY;
+    }
+}
+
+/*
+** Dispatch a command for the simulated device
+*/
+static int qsim_quotactl( int cmd, int id, caddr_t addr )
+{
+    int subcmd = ((unsigned)cmd >> SUBCMDSHIFT);
+    int qtype = (cmd & SUBCMDMASK);
+    int err;
+
+    qsim_delay();
+
+    if (qsim.is_btrfs)
+        err = ENOSYS;
+    else if ((qtype < 0) || (qtype >= QSIM_QTYPES))
+        err = EINVAL;
+    else if ((addr == NULL) &&
+             (subcmd != Q_SYNC) && (subcmd != Q_XQUOTASYNC) &&
+             (subcmd != Q_QUOTAOFF) && (subcmd != Q_QUOTAON))
+        err = EFAULT;
+    else if ((subcmd >> 8) == 'X')
+        err = qsim.is_xfs ? qsim_xfs(subcmd, qtype, id, addr) : ENOSYS;
+    else
+        err = qsim.is_xfs ? ENOSYS : qsim_generic(subcmd, qtype, id, addr);
+
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+** Interposed C library functions
+*/
+int quotactl( int cmd, const char * special, int id, caddr_t addr )
+{
+    if ((special != NULL) && (strcmp(special, qsim.dev) == 0))
+    {
+        return qsim_quotactl(cmd, id, addr);
+    }
+    /* Q_SYNC for all file systems */
+    if ((special == NULL) && (((unsigned)cmd >> SUBCMDSHIFT) == Q_SYNC))
+    {
+        qsim_delay();
+    }
+    if (real_quotactl == NULL)
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+    return real_quotactl(cmd, special, id, addr);
+}
+
+int quotactl_fd( unsigned int fd, unsigned int cmd, int id, caddr_t addr )
+{
+    struct stat st;
+
+    if (qsim.have_st_dev && (fstat(fd, &st) == 0) && (st.st_dev == qsim.st_dev))
+    {
+        return qsim_quotactl(cmd, id, addr);
+    }
+#ifdef SYS_quotactl_fd
+    return syscall(SYS_quotactl_fd, fd, cmd, id, addr);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int ioctl( int fd, unsigned long request, ... )
+{
+    struct stat st;
+    va_list ap;
+    void * arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if (((qsim.is_btrfs && (_IOC_TYPE(request) == BTRFS_IOCTL_MAGIC)) ||
+         (qsim.is_xfs && (_IOC_TYPE(request) == 'X'))) &&
+        qsim.have_st_dev && (fstat(fd, &st) == 0) && (st.st_dev == qsim.st_dev))
+    {
+        int err;
+
+        qsim_delay();
+        err = qsim.is_btrfs ? qsim_btrfs_ioctl(request, arg) : qsim_xfs_ioctl(request, arg);
+        if (err != 0)
+        {
+            errno = err;
+            return -1;
+        }
+        return 0;
+    }
+    if (real_ioctl == NULL)
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+    return real_ioctl(fd, request, arg);
+}
+
+/*
+** Mount table: the simulated file system is returned as first entry; the
+** table is written to a temporary file, so that the C library functions for
+** reading entries can be used unchanged.
+*/
+FILE * setmntent( const char * filename, const char * type )
+{
+    FILE * fp;
+
+    if ((strcmp(filename, MOUNTED) != 0) &&
+        (strcmp(filename, "/proc/mounts") != 0) &&
+        (strcmp(filename, "/proc/self/mounts") != 0))
+    {
+        return real_setmntent(filename, type);
+    }
+
+    fp = tmpfile();
+    if (fp != NULL)
+    {
+        fprintf(fp, "%s %s %s rw,usrquota,grpquota%s 0 0\n",
+                qsim.dev, qsim.mount, qsim.fstype,
+                (qsim.is_xfs ? ",prjquota" : ""));
+
+        if (qsim.keep_mounts)
+        {
+            FILE * real_fp = real_setmntent(filename, type);
+            if (real_fp != NULL)
+            {
+                char buf[4096];
+                size_t len;
+                while ((len = fread(buf, 1, sizeof(buf), real_fp)) > 0)
+                    fwrite(buf, 1, len, fp);
+                endmntent(real_fp);
+            }
+        }
+        rewind(fp);
+    }
+    return fp;
+}
@@ -3,7 +3,8 @@
 # Smoke-test for automated testing:
 # - iterate across mount table
 # - for each entry try creating a Quota class instance
-# - when successful, try sync and query UID twice, GID once
+# - when successful, try sync and query UID twice, GID once, then UID
+#   via bulk query
 # - note setqlim is omitted intentionally (usually will fail as no sane
 #   automation would run as root, but if so quotas would be corrupted)
 # - test may fail only upon crash or mismatch in repeated UID query;
@@ -74,5 +75,16 @@ for fsname, path, fstyp, opt in FsQuota.MntTab():
             print("- Quota.query GID %d: %s" % (my_gid, str(qtup)))
         except FsQuota.error as e:
             print("- Quota.query GID %d failed: %s" % (my_gid, e))
+
+        # bulk query without exceptions must match single queries
+        qlist = qObj.query_bulk([my_uid, my_uid], noraise=True)
+        print("- Quota.query_bulk UID %d: %s" % (my_uid, str(qlist[0])))
+        qtup = qObj.query(my_uid, noraise=True)
+        if isinstance(qtup, FsQuota.error):
+            qtup = str(qtup)
+            qlist = [str(x) for x in qlist]
+        if not qlist == [qtup, qtup]:
+            print("ERROR: mismatching bulk query results")
+            exit(1)
     except:
         print("- Quota::getqcarg: UNDEF")
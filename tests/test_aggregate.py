@@ -0,0 +1,65 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing aggregation of quota usage across file systems: entries of the
+# file systems containing the given paths are enumerated in parallel and
+# summed per ID. The result is compared with merging results of method
+# query_all() in Python. Note enumerating quota entries requires Linux 4.6
+# or later and usually admin privileges; without, use the quota simulator
+# (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+# the same path may be given repeatedly, e.g. for testing with the simulator
+paths    = [".", "/"]
+dogrp    = False
+# maximum number of IDs printed
+max_print = 10
+
+try:
+    qObjs = [FsQuota.Quota(path) for path in paths]
+
+    t_start = time.perf_counter()
+    agg = FsQuota.aggregate(qObjs, grpquota=dogrp)
+    print("Aggregated %d IDs of %d file systems in %.3f s"
+          % (len(agg["id"]), len(qObjs), time.perf_counter() - t_start))
+
+    for row in range(min(max_print, len(agg["id"]))):
+        print("ID %d: bcount %d icount %d on %d file systems: %s"
+              % (agg["id"][row], agg["bcount"][row], agg["icount"][row], agg["fs_count"][row],
+                 str([col[row] for col in agg["fs_bcount"]])))
+
+    t_start = time.perf_counter()
+    totals = {}
+    for fs_idx, qObj in enumerate(qObjs):
+        for uid, res in qObj.query_all(grpquota=dogrp):
+            ent = totals.setdefault(uid, [0, 0, [0] * len(qObjs)])
+            ent[0] += res.bcount
+            ent[1] += res.icount
+            ent[2][fs_idx] = res.bcount
+    print("Merged in Python in %.3f s" % (time.perf_counter() - t_start))
+
+    if list(agg["id"]) != sorted(totals):
+        print("ERROR: aggregated IDs differ", file=sys.stderr)
+    else:
+        for row, uid in enumerate(agg["id"]):
+            if ([agg["bcount"][row], agg["icount"][row],
+                 [col[row] for col in agg["fs_bcount"]]] != totals[uid]):
+                print("ERROR: aggregated usage differs for ID %d" % uid, file=sys.stderr)
+                break
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,95 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing assignment of project IDs to directory trees: a tree of
+# directories and files is created below the given path and assigned the
+# given project ID via method assign_project() with different numbers of
+# threads. Afterward the project ID and inherit flag are verified via ioctl
+# FS_IOC_FSGETXATTR in Python, and the returned usage is compared with the
+# result of method query(). Note setting project IDs other than zero
+# requires admin privileges and a file system supporting project quotas
+# (XFS, or ext4 with the "project" feature).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import fcntl
+import struct
+import tempfile
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+prjid    = 0
+tree_dirs  = 200
+tree_files = 50
+threads  = [ 1, 4, 16 ]
+
+FS_IOC_FSGETXATTR = 0x801c581f
+FS_XFLAG_PROJINHERIT = 0x200
+
+def py_fsxattr(path):
+    fd = os.open(path, os.O_RDONLY | os.O_NOFOLLOW)
+    try:
+        buf = bytearray(28)
+        fcntl.ioctl(fd, FS_IOC_FSGETXATTR, buf)
+        xflags, extsize, nextents, projid, cowextsize = struct.unpack("IIIII8x", bytes(buf))
+        return projid, xflags
+    finally:
+        os.close(fd)
+
+def strip_times(res):
+    return res[0:3] + res[4:7]
+
+def report(prog):
+    print("  ... %d directories, %d files" % (prog["dirs"], prog["files"]))
+
+try:
+    qObj = FsQuota.Quota(path)
+
+    with tempfile.TemporaryDirectory(dir=path) as tmpdir:
+        for idx in range(tree_dirs):
+            dname = os.path.join(tmpdir, "d%d" % (idx % 10), "d%d" % idx)
+            os.makedirs(dname)
+            for fidx in range(tree_files):
+                open(os.path.join(dname, "f%d" % fidx), "w").close()
+        os.symlink("d0", os.path.join(tmpdir, "link"))
+
+        for thr_cnt in threads:
+            t_start = time.perf_counter()
+            result = qObj.assign_project(tmpdir, prjid, threads=thr_cnt,
+                                         progress=report, interval=0.5)
+            print("%d threads: %d directories, %d files in %.3f s"
+                  % (thr_cnt, result["dirs"], result["files"], time.perf_counter() - t_start))
+
+            if result["errors"] != 0:
+                print("ERROR: %d errors, first: %s" % (result["errors"], str(result["first_error"])),
+                      file=sys.stderr)
+            if (result["dirs"] != 1 + 10 + tree_dirs) or (result["files"] != tree_dirs * tree_files + 1):
+                print("ERROR: unexpected number of entries: %s" % str(result), file=sys.stderr)
+            if (not isinstance(result["result"], FsQuota.error) and
+                    (strip_times(result["result"]) != strip_times(qObj.query(prjid, prjquota=True)))):
+                print("ERROR: returned usage differs from query()", file=sys.stderr)
+
+        for dirpath, dirnames, filenames in os.walk(tmpdir):
+            projid, xflags = py_fsxattr(dirpath)
+            if (projid != prjid) or not (xflags & FS_XFLAG_PROJINHERIT):
+                print("ERROR: directory %s has project %d, flags 0x%X" % (dirpath, projid, xflags),
+                      file=sys.stderr)
+            for fname in filenames:
+                fpath = os.path.join(dirpath, fname)
+                if not os.path.islink(fpath) and (py_fsxattr(fpath)[0] != prjid):
+                    print("ERROR: file %s has wrong project ID" % fpath, file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
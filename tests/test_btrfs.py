@@ -0,0 +1,66 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing Btrfs qgroups: qgroups of subvolumes on the file system containing
+# the given path are enumerated via method query_all(), which reads all of
+# them via a single tree search, and compared with the output of command
+# "btrfs qgroup show" (if installed) and with query() per subvolume ID.
+# Then the qgroup of the path is queried via query_path(). Note reading
+# qgroups requires admin privileges; without, use the quota simulator with
+# QUOTASIM_FSTYPE=btrfs (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import sys
+import time
+import shutil
+import subprocess
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+max_ids  = 1000
+
+try:
+    qObj = FsQuota.Quota(path)
+    print("Using %s" % repr(qObj))
+
+    t_start = time.perf_counter()
+    entries = qObj.query_all(prjquota=True)
+    print("query_all: %d qgroups in %.3f s" % (len(entries), time.perf_counter() - t_start))
+
+    for subvol, res in entries[:max_ids]:
+        if qObj.query(subvol, prjquota=True) != res:
+            print("ERROR: query() of qgroup 0/%d differs from query_all()" % subvol,
+                  file=sys.stderr)
+
+    if shutil.which("btrfs"):
+        t_start = time.perf_counter()
+        out = subprocess.run(["btrfs", "qgroup", "show", "--raw", "-r", qObj.dev],
+                             stdout=subprocess.PIPE, universal_newlines=True).stdout
+        print("btrfs qgroup show: %.3f s" % (time.perf_counter() - t_start))
+
+        expected = {}
+        for line in out.splitlines():
+            cols = line.split()
+            if (len(cols) >= 4) and cols[0].startswith("0/") and cols[1].isdigit():
+                max_rfer = int(cols[3]) if cols[3].isdigit() else 0
+                expected[int(cols[0][2:])] = (int(cols[1]) // 1024, max_rfer // 1024)
+
+        result = {subvol: (res.bcount, res.bhard) for subvol, res in entries}
+        if result != expected:
+            print("ERROR: qgroups differ from btrfs qgroup show", file=sys.stderr)
+
+    (subvol, res) = qObj.query_path(path, prjquota=True)
+    print("Subvolume of %s: %d %s" % (path, subvol, str(res)))
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
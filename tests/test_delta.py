@@ -0,0 +1,57 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing the incremental delta scanner: all quota entries of the file
+# system containing the given path are scanned repeatedly; changes reported
+# by each scan (e.g. caused by writing files meanwhile) are printed. The
+# scanner state is passed through serialization between scans, as would be
+# done by periodic jobs. Note enumerating quota entries requires Linux 4.6
+# or later and usually admin privileges; without, use the quota simulator
+# (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+dogrp    = False
+scans    = 3
+interval = 2.0
+# maximum number of changes printed per scan
+max_print = 10
+
+try:
+    qObj = FsQuota.Quota(path)
+    scanner = FsQuota.DeltaScanner(qObj, grpquota=dogrp)
+
+    for idx in range(scans):
+        if idx > 0:
+            time.sleep(interval)
+            scanner = FsQuota.DeltaScanner(qObj, grpquota=dogrp, state=scanner.state)
+
+        t_start = time.perf_counter()
+        changes, totals = scanner.scan()
+        print("Scan #%d in %.3f s: %s" % (idx, time.perf_counter() - t_start, str(totals)))
+        print("State: %d bytes" % len(scanner.state))
+
+        if len(changes) != totals["inserted"] + totals["changed"] + totals["removed"]:
+            print("ERROR: number of changes does not match totals", file=sys.stderr)
+        if [ent[0] for ent in changes] != sorted(set(ent[0] for ent in changes)):
+            print("ERROR: changes are not sorted by ID", file=sys.stderr)
+
+        for uid, old, new in changes[:max_print]:
+            print("ID %d: %s -> %s" % (uid, str(old), str(new)))
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,97 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing filters for quota entries: entries of the file system containing
+# the given path are enumerated with filters evaluated by the module, via
+# method query_all(), a snapshot and query_bulk(). Results are compared with
+# filtering of the complete table in Python. Note enumerating quota entries
+# requires Linux 4.6 or later and usually admin privileges; without, use the
+# quota simulator (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import tempfile
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+dogrp    = False
+filters  = [ { "min_ratio": 0.9 },
+             { "min_ratio": 1.0, "ratio_of": "ihard" },
+             { "grace_expired": True },
+             { "top": 10 },
+             { "top": 5, "top_by": "icount", "min_ratio": 0.5 } ]
+
+names    = ["bcount", "bsoft", "bhard", "btime", "icount", "isoft", "ihard", "itime"]
+
+def py_filter(entries, flt):
+    now = time.time()
+    lim_idx = names.index(flt.get("ratio_of", "bsoft"))
+    use_idx = 0 if lim_idx < 4 else 4
+    result = []
+    for uid, res in entries:
+        if ("min_ratio" in flt and
+                (res[lim_idx] == 0 or res[use_idx] < flt["min_ratio"] * res[lim_idx])):
+            continue
+        if (flt.get("grace_expired") and
+                not any(0 < res[idx] <= now for idx in (3, 7))):
+            continue
+        result.append((uid, res))
+    if "top" in flt:
+        key_idx = names.index(flt.get("top_by", "bcount"))
+        result = sorted(result, key=lambda ent: (-ent[1][key_idx], ent[0]))[:flt["top"]]
+    return result
+
+def strip_times(entries):
+    return [(uid, res[0:3] + res[4:7]) for uid, res in entries]
+
+try:
+    qObj = FsQuota.Quota(path)
+
+    t_start = time.perf_counter()
+    entries = qObj.query_all(grpquota=dogrp)
+    print("Enumerated %d entries in %.3f s" % (len(entries), time.perf_counter() - t_start))
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        snap_path = os.path.join(tmpdir, "quota.snap")
+        qObj.snapshot(snap_path, grpquota=dogrp)
+
+        with FsQuota.Snapshot.open(snap_path) as snap:
+            for flt in filters:
+                expected = strip_times(py_filter(entries, flt))
+
+                t_start = time.perf_counter()
+                result = qObj.query_all(grpquota=dogrp, filter=flt)
+                t_all = time.perf_counter() - t_start
+
+                t_start = time.perf_counter()
+                snap_result = snap.select(flt)
+                t_snap = time.perf_counter() - t_start
+
+                ids = [ent[0] for ent in entries[:1000]]
+                bulk_result = qObj.query_bulk(ids, grpquota=dogrp, filter=flt)
+
+                print("Filter %s: %d matches (query_all %.3f s, snapshot %.4f s)"
+                      % (str(flt), len(result), t_all, t_snap))
+
+                if strip_times(result) != expected:
+                    print("ERROR: query_all result differs from Python filter", file=sys.stderr)
+                if strip_times(snap_result) != expected:
+                    print("ERROR: Snapshot.select result differs from Python filter", file=sys.stderr)
+                if (strip_times(bulk_result) !=
+                        strip_times(py_filter([ent for ent in entries if ent[0] in set(ids)], flt))):
+                    print("ERROR: query_bulk result differs from Python filter", file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,95 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing streaming enumeration: entries of the file system containing the
+# given path are enumerated via method iter_all() with different chunk
+# sizes and queue depths, and compared with the result of query_all(). The
+# time for processing the entries with a given amount of work per entry is
+# reported for both, to show the overlap of work with prefetching. Finally,
+# closing an iterator whose filter skips all entries has to return without
+# waiting for the enumeration (with the simulator, set QUOTASIM_LATENCY_US
+# so that enumeration takes a while). Note enumerating quota entries
+# requires Linux 4.6 or later and usually admin privileges; without, use
+# the quota simulator (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+dogrp    = False
+configs  = [ (1, 1), (16, 2), (1024, 2), (4096, 8) ]
+work_us  = 20
+
+def strip_times(entries):
+    return [(uid, res[0:3] + res[4:7]) for uid, res in entries]
+
+def process(entry):
+    # simulated per-entry work, e.g. for formatting a report
+    t_end = time.perf_counter() + work_us / 1000000.0
+    while time.perf_counter() < t_end:
+        pass
+
+try:
+    qObj = FsQuota.Quota(path)
+
+    t_start = time.perf_counter()
+    entries = qObj.query_all(grpquota=dogrp)
+    for ent in entries:
+        process(ent)
+    t_list = time.perf_counter() - t_start
+    print("query_all: %d entries processed in %.3f s" % (len(entries), t_list))
+
+    for chunk_size, queue_depth in configs:
+        t_start = time.perf_counter()
+        result = []
+        with qObj.iter_all(grpquota=dogrp, chunk_size=chunk_size, queue_depth=queue_depth) as it:
+            for ent in it:
+                process(ent)
+                result.append(ent)
+        t_iter = time.perf_counter() - t_start
+        print("iter_all(chunk_size=%d, queue_depth=%d): processed in %.3f s"
+              % (chunk_size, queue_depth, t_iter))
+
+        if strip_times(result) != strip_times(entries):
+            print("ERROR: iter_all result differs from query_all", file=sys.stderr)
+
+    # filters are applied in the producer thread
+    flt = { "min_ratio": 0.9 }
+    if (strip_times(list(qObj.iter_all(grpquota=dogrp, filter=flt))) !=
+            strip_times(qObj.query_all(grpquota=dogrp, filter=flt))):
+        print("ERROR: iter_all result with filter differs from query_all", file=sys.stderr)
+
+    # abandoning iteration early has to stop the producer
+    it = qObj.iter_all(grpquota=dogrp, chunk_size=4, queue_depth=1)
+    first = next(it, None)
+    it.close()
+    if next(it, None) is not None:
+        print("ERROR: iterator returned entries after close()", file=sys.stderr)
+
+    # closing has to stop the producer also while the filter skips all entries
+    flt = { "min_ratio": 100.0, "ratio_of": "bhard" }
+    t_start = time.perf_counter()
+    list(qObj.iter_all(grpquota=dogrp, filter=flt))
+    t_full = time.perf_counter() - t_start
+    it = qObj.iter_all(grpquota=dogrp, filter=flt)
+    t_start = time.perf_counter()
+    it.close()
+    t_close = time.perf_counter() - t_start
+    print("iter_all with filter: complete in %.3f s, closed in %.3f s" % (t_full, t_close))
+    if t_close > max(0.1, t_full / 2):
+        print("ERROR: close() waited for the filtered enumeration", file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,73 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing the name column of quota results: entries of the file system
+# containing the given path are enumerated via method query_all() and
+# queried via query_bulk() with option names, and the names are compared
+# with those returned by the pwd and grp modules. The time is compared with
+# resolving names per entry in Python. Note enumerating quota entries
+# requires Linux 4.6 or later and usually admin privileges; without, use
+# the quota simulator (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import sys
+import time
+import pwd
+import grp
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+dogrp    = False
+prewarm  = True
+
+def py_name(uid):
+    try:
+        return grp.getgrgid(uid).gr_name if dogrp else pwd.getpwuid(uid).pw_name
+    except KeyError:
+        return None
+
+try:
+    qObj = FsQuota.Quota(path)
+
+    t_start = time.perf_counter()
+    entries = qObj.query_all(grpquota=dogrp)
+    expected = [py_name(uid) for uid, res in entries]
+    print("query_all and Python name lookup: %d entries in %.3f s"
+          % (len(entries), time.perf_counter() - t_start))
+
+    FsQuota.clear_names()
+    if prewarm:
+        count = FsQuota.prewarm_names(grpquota=dogrp)
+        print("Pre-warmed name cache with %d entries" % count)
+
+    t_start = time.perf_counter()
+    result = qObj.query_all(grpquota=dogrp, names=True)
+    print("query_all(names=True): %d entries in %.3f s"
+          % (len(result), time.perf_counter() - t_start))
+
+    if [ent[0] for ent in result] != [ent[0] for ent in entries]:
+        print("ERROR: query_all(names=True) returned different IDs", file=sys.stderr)
+    if [ent[2] for ent in result] != expected:
+        print("ERROR: query_all names differ from Python lookup", file=sys.stderr)
+
+    ids = [uid for uid, res in entries[:1000]]
+    bulk = qObj.query_bulk(ids, grpquota=dogrp, names=True)
+    if [ent[1] for ent in bulk] != expected[:len(ids)]:
+        print("ERROR: query_bulk names differ from Python lookup", file=sys.stderr)
+
+    bulk = qObj.query_bulk(ids, grpquota=dogrp, names=True, filter={"top": 10})
+    if [ent[2] for ent in bulk] != [py_name(ent[0]) for ent in bulk]:
+        print("ERROR: query_bulk names with filter differ from Python lookup", file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
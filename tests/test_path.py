@@ -0,0 +1,117 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing queries by path: for each of the given directories, the project
+# ID is determined via method query_path() and compared with the result of
+# ioctl FS_IOC_FSGETXATTR in Python, and the result is compared with that
+# of method query() for the same ID. Then the time for repeated lookups is
+# reported, which are served by the per-inode cache of project IDs. Note
+# project quotas require XFS or ext4 (or the quota simulator, see README.md).
+# On Btrfs, the ID is that of the subvolume containing the path, which is
+# compared with ioctl BTRFS_IOC_INO_LOOKUP instead, and queries by owner
+# are skipped as Btrfs only supports qgroups.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import fcntl
+import struct
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+dirs     = [ ".", "..", "tests", "src" ]
+rounds   = 1000
+
+FS_IOC_FSGETXATTR = 0x801c581f
+BTRFS_IOC_INO_LOOKUP = 0xd0009412
+
+def py_projid(path):
+    fd = os.open(path, os.O_RDONLY)
+    try:
+        buf = bytearray(28)
+        fcntl.ioctl(fd, FS_IOC_FSGETXATTR, buf)
+        return struct.unpack("IIIII8x", bytes(buf))[3]
+    finally:
+        os.close(fd)
+
+def py_subvol_id(path):
+    fd = os.open(path, os.O_RDONLY)
+    try:
+        # tree ID 0 and the object ID of the subvolume root directory (256)
+        # return the ID of the subvolume containing the descriptor
+        buf = bytearray(4096)
+        struct.pack_into("QQ", buf, 0, 0, 256)
+        fcntl.ioctl(fd, BTRFS_IOC_INO_LOOKUP, buf)
+        return struct.unpack_from("Q", buf)[0]
+    finally:
+        os.close(fd)
+
+def fs_type(path):
+    st_dev = os.stat(path).st_dev
+    for fsname, mnt_path, fstyp, opt in FsQuota.MntTab():
+        try:
+            if os.stat(mnt_path).st_dev == st_dev:
+                return fstyp
+        except OSError:
+            pass
+    return None
+
+def strip_times(res):
+    return res[0:3] + res[4:7]
+
+try:
+    qObj = FsQuota.Quota(path)
+    is_btrfs = (fs_type(path) == "btrfs")
+    py_id = (py_subvol_id if is_btrfs else py_projid)
+
+    for dname in dirs:
+        prjid, res = qObj.query_path(dname, prjquota=True)
+        if prjid != py_id(dname):
+            print("ERROR: query_path returned project ID %d for %s, expected %d"
+                  % (prjid, dname, py_id(dname)), file=sys.stderr)
+        if strip_times(res) != strip_times(qObj.query(prjid, prjquota=True)):
+            print("ERROR: query_path result differs from query() for %s" % dname, file=sys.stderr)
+
+        if not is_btrfs:
+            uid, res = qObj.query_path(dname)
+            if uid != os.stat(dname).st_uid:
+                print("ERROR: query_path returned owner %d for %s" % (uid, dname), file=sys.stderr)
+
+    t_start = time.perf_counter()
+    for idx in range(rounds):
+        results = qObj.query_paths(dirs, prjquota=True)
+    t_lib = time.perf_counter() - t_start
+
+    t_start = time.perf_counter()
+    for idx in range(rounds):
+        results = [qObj.query(py_id(dname), prjquota=True) for dname in dirs]
+    t_py = time.perf_counter() - t_start
+
+    print("%d queries by path: %.3f s (ioctl in Python: %.3f s)"
+          % (rounds * len(dirs), t_lib, t_py))
+
+    # errors are reported in place of the result in noraise mode
+    results = qObj.query_paths(["/nonexistent", "/proc"], prjquota=True, noraise=True)
+    if ((results[0][0] is not None) or not isinstance(results[0][1], FsQuota.error) or
+            (results[1][0] is not None) or not isinstance(results[1][1], FsQuota.error)):
+        print("ERROR: query_paths did not report path errors: %s" % str(results), file=sys.stderr)
+
+    try:
+        qObj.query_path("/nonexistent", prjquota=True)
+        print("ERROR: query_path did not raise for missing path", file=sys.stderr)
+    except FsQuota.error as e:
+        pass
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
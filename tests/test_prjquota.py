@@ -0,0 +1,75 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing project quotas on the given path: project quota entries are
+# enumerated via method query_all() and compared with the result of query()
+# for each ID; then the limits of the first entry are modified and restored
+# via setqlim(). On Linux this works also for ext4 and other file systems
+# using the generic quota interface, when the file system was created with
+# the "project" feature and mounted with option "prjquota". Modifying limits
+# requires admin privileges; without, use the quota simulator (see
+# README.md). On Btrfs, project IDs are qgroups of subvolumes, which only
+# support a hard block limit, so that only that limit is modified; qgroup
+# ID 0 is skipped, as it selects the subvolume of the mount point.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+max_ids  = 1000
+dosetqlim = True
+
+def fs_type(path):
+    st_dev = os.stat(path).st_dev
+    for fsname, mnt_path, fstyp, opt in FsQuota.MntTab():
+        try:
+            if os.stat(mnt_path).st_dev == st_dev:
+                return fstyp
+        except OSError:
+            pass
+    return None
+
+try:
+    qObj = FsQuota.Quota(path)
+    is_btrfs = (fs_type(path) == "btrfs")
+
+    entries = qObj.query_all(prjquota=True)
+    print("Enumerated %d project quota entries on %s" % (len(entries), qObj.dev))
+
+    for prjid, res in entries[:max_ids]:
+        if qObj.query(prjid, prjquota=True) != res:
+            print("ERROR: query() of project %d differs from query_all()" % prjid,
+                  file=sys.stderr)
+
+    if is_btrfs:
+        entries = [ent for ent in entries if ent[0] != 0]
+
+    if dosetqlim and entries:
+        prjid, res = entries[0]
+        if is_btrfs:
+            expect = (res.bsoft, res.bhard + 2, res.isoft, res.ihard)
+        else:
+            expect = (res.bsoft + 1, res.bhard + 2, res.isoft + 3, res.ihard + 4)
+        qObj.setqlim(prjid, *expect, prjquota=True)
+        mod = qObj.query(prjid, prjquota=True)
+        if (mod.bsoft, mod.bhard, mod.isoft, mod.ihard) != expect:
+            print("ERROR: setqlim() of project %d not reflected by query(): %s"
+                  % (prjid, mod), file=sys.stderr)
+
+        qObj.setqlim(prjid, res.bsoft, res.bhard, res.isoft, res.ihard, prjquota=True)
+        print("Modified and restored limits of project %d" % prjid)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
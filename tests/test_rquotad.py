@@ -0,0 +1,118 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing the embedded rquotad server: after checking that a stop request
+# preceding serve() is honored, the server is started in a thread, then
+# queried via RPC by a Quota instance in the same process, and the result
+# compared to that of a local query. In a second stage, a caching
+# proxy is started in front of the server and queried the same way.
+# Finally, queries for many distinct unknown paths are sent, which must be
+# rejected without changing the list of served file systems.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import threading
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path  = "/"
+dogrp = False
+ugid  = os.getgid() if dogrp else os.getuid()
+
+typnam = "GID" if dogrp else "UID"
+bogus_cnt = 200
+
+def query_via_rpc(port, qtup_local):
+    qRemote = FsQuota.Quota(path, rpc_host="localhost")
+    qRemote.rpc_opt(rpc_port=port, rpc_timeout=2000)
+
+    for idx in range(2):  # second query is answered from cache
+        try:
+            qtup_rpc = qRemote.query(ugid, grpquota=dogrp)
+            print("RPC query for %s %d: %s" % (typnam, ugid, str(qtup_rpc)))
+            if (qtup_local is not None) and (qtup_rpc.bcount != qtup_local.bcount):
+                print("ERROR: mismatching query results", file=sys.stderr)
+        except FsQuota.error as e:
+            print("RPC query for %s %d failed: %s" % (typnam, ugid, e))
+            if qtup_local is not None:
+                print("ERROR: RPC failed, but local query succeeded", file=sys.stderr)
+
+try:
+    qLocal = FsQuota.Quota(path)
+    try:
+        qtup_local = qLocal.query(ugid, grpquota=dogrp)
+        print("Local query for %s %d: %s" % (typnam, ugid, str(qtup_local)))
+    except FsQuota.error as e:
+        qtup_local = None
+        print("Local query for %s %d failed: %s" % (typnam, ugid, e))
+
+    # use an arbitrary free port; registration at the portmapper requires root
+    srv = FsQuota.RquotaServer(threads=2, register=False)
+    print("Server listening on UDP port %d" % srv.port)
+
+    # a stop request preceding serve() must not be discarded
+    srv.stop()
+    thr = threading.Thread(target=srv.serve)
+    thr.start()
+    thr.join(2.0)
+    if thr.is_alive():
+        print("ERROR: serve() ignored preceding stop()", file=sys.stderr)
+        srv.stop()
+        thr.join()
+
+    thr = threading.Thread(target=srv.serve)
+    thr.start()
+
+    try:
+        print(">>> stage 1: query server")
+        query_via_rpc(srv.port, qtup_local)
+        print("Server cache hits/misses/coalesced: %s" % str(srv.cache_stats()))
+
+        print(">>> stage 2: query via proxy")
+        proxy = FsQuota.RquotaServer(threads=2, register=False,
+                                     upstream="localhost", upstream_port=srv.port)
+        print("Proxy listening on UDP port %d" % proxy.port)
+
+        thr_proxy = threading.Thread(target=proxy.serve)
+        thr_proxy.start()
+        try:
+            query_via_rpc(proxy.port, qtup_local)
+            print("Proxy cache hits/misses/coalesced: %s" % str(proxy.cache_stats()))
+        finally:
+            proxy.stop()
+            thr_proxy.join()
+
+        print(">>> stage 3: query unknown paths")
+        exports = srv.exports()
+        print("Served file systems: %s" % str(exports))
+        answered = 0
+        for idx in range(bogus_cnt):
+            qBogus = FsQuota.Quota("/nonexistent/%d" % idx, rpc_host="localhost")
+            qBogus.rpc_opt(rpc_port=srv.port, rpc_timeout=2000)
+            try:
+                qBogus.query(ugid, grpquota=dogrp)
+                answered += 1
+            except FsQuota.error:
+                pass
+        if answered != 0:
+            print("ERROR: %d queries for unknown paths succeeded" % answered, file=sys.stderr)
+        if srv.exports() != exports:
+            print("ERROR: served file systems changed: %s" % str(srv.exports()), file=sys.stderr)
+
+    finally:
+        srv.stop()
+        thr.join()
+        print("Server stopped")
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
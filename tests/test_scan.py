@@ -0,0 +1,87 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing usage scan: usage per user, group and project of the XFS file
+# system containing the given path is determined via method scan_usage(),
+# which reads all inodes via bulkstat, with different numbers of threads.
+# Results are checked for consistency and, where quota accounting is
+# enabled, compared with the usage reported by query_all(). On a real file
+# system, a file assigned to an otherwise unused user ID is created, for
+# checking that its usage is reported in units of 1 kB. Note bulkstat
+# requires admin privileges; without, use the quota simulator with
+# QUOTASIM_FSTYPE=xfs (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import tempfile
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path        = "."
+thread_cnts = (1, 4, 8)
+test_uid    = 54321     # must not own files on the file system
+
+try:
+    qObj = FsQuota.Quota(path)
+    print("Using %s" % repr(qObj))
+
+    result = None
+    for threads in thread_cnts:
+        t_start = time.perf_counter()
+        usage = qObj.scan_usage(threads=threads)
+        print("scan_usage(threads=%d): %.3f s" % (threads, time.perf_counter() - t_start))
+
+        if result is None:
+            result = usage
+        elif usage != result:
+            print("ERROR: result with %d threads differs" % threads, file=sys.stderr)
+
+    inodes = [sum(res.icount for xid, res in result[kind])
+              for kind in ("user", "group", "project")]
+    print("%d inodes; %d users, %d groups, %d projects" %
+          (inodes[0], len(result["user"]), len(result["group"]), len(result["project"])))
+    if (inodes[1] != inodes[0]) or (inodes[2] != inodes[0]):
+        print("ERROR: inode counts per kind differ: %s" % str(inodes), file=sys.stderr)
+
+    for kind, opt in (("user", {}), ("group", {"grpquota": True}), ("project", {"prjquota": True})):
+        try:
+            accounted = {xid: (res.bcount, res.icount)
+                         for xid, res in qObj.query_all(**opt)
+                         if (res.bcount != 0) or (res.icount != 0)}
+        except FsQuota.error as e:
+            print("%s quota not available: %s" % (kind, e))
+            continue
+
+        scanned = {xid: (res.bcount, res.icount) for xid, res in result[kind]}
+        if scanned != accounted:
+            diff = [xid for xid in set(scanned) | set(accounted)
+                    if scanned.get(xid) != accounted.get(xid)]
+            print("%s usage differs from quota accounting for %d IDs" % (kind, len(diff)))
+
+    # inodes of the simulator do not exist as files
+    if "QUOTASIM_FSTYPE" not in os.environ:
+        with tempfile.NamedTemporaryFile(dir=path) as fh:
+            fh.write(b"x" * 1024 * 1024)
+            fh.flush()
+            os.fsync(fh.fileno())
+            os.chown(fh.name, test_uid, -1)
+            expected = os.stat(fh.name).st_blocks // 2
+
+            usage = dict(qObj.scan_usage()["user"])
+            if (test_uid not in usage) or (usage[test_uid].bcount != expected):
+                print("ERROR: usage of test file %s differs from %d kB" %
+                      (str(usage.get(test_uid)), expected), file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,99 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing usage scan by tree walk: usage per user, group and project of the
+# directory tree below the given path is determined via function
+# FsQuota.scan_tree() with different numbers of threads, and compared with
+# the result of a walk in Python via os.scandir() and os.lstat(), which
+# also counts hard-linked files only once. Timing of both is reported.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path        = "."
+thread_cnts = (1, 4, 8)
+prjquota    = False
+
+def walk_usage(root):
+    usage = ({}, {})
+    seen = set()
+    root_dev = os.lstat(root).st_dev
+
+    def account(st):
+        for kind, xid in enumerate((st.st_uid, st.st_gid)):
+            ent = usage[kind].setdefault(xid, [0, 0])
+            ent[0] += st.st_blocks
+            ent[1] += 1
+
+    account(os.lstat(root))
+    stack = [root]
+    while stack:
+        dirpath = stack.pop()
+        try:
+            entries = list(os.scandir(dirpath))
+        except OSError:
+            continue
+        for ent in entries:
+            try:
+                st = ent.stat(follow_symlinks=False)
+            except OSError:
+                continue
+            if ent.is_dir(follow_symlinks=False):
+                if st.st_dev == root_dev:
+                    account(st)
+                    stack.append(ent.path)
+            elif (st.st_nlink <= 1) or ((st.st_dev, st.st_ino) not in seen):
+                seen.add((st.st_dev, st.st_ino))
+                account(st)
+
+    return [{xid: (blocks // 2, inodes) for xid, (blocks, inodes) in tab.items()}
+            for tab in usage]
+
+try:
+    result = None
+    for threads in thread_cnts:
+        t_start = time.perf_counter()
+        scan = FsQuota.scan_tree(path, threads=threads, prjquota=prjquota)
+        print("scan_tree(threads=%d): %.3f s; %d dirs, %d files, %d hard links, %d errors" %
+              (threads, time.perf_counter() - t_start,
+               scan["dirs"], scan["files"], scan["hardlinks"], scan["errors"]))
+        if scan["first_error"]:
+            print("First error: %s" % str(scan["first_error"]))
+
+        usage = {kind: scan[kind] for kind in ("user", "group", "project") if kind in scan}
+        if result is None:
+            result = usage
+        elif usage != result:
+            print("ERROR: result with %d threads differs" % threads, file=sys.stderr)
+
+    t_start = time.perf_counter()
+    expected = walk_usage(path)
+    print("Python walk: %.3f s" % (time.perf_counter() - t_start))
+
+    for kind, tab in zip(("user", "group"), expected):
+        scanned = {xid: (res.bcount, res.icount) for xid, res in result[kind]}
+        if scanned != tab:
+            print("ERROR: %s usage differs from Python walk" % kind, file=sys.stderr)
+
+    if prjquota:
+        inodes = [sum(res.icount for xid, res in result[kind]) for kind in ("user", "project")]
+        if inodes[0] != inodes[1]:
+            print("ERROR: inode counts per kind differ: %s" % str(inodes), file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
+except OSError as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,68 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing quota snapshots: all quota entries of the file system containing
+# the given path are written to a snapshot file, which then is mapped via
+# FsQuota.Snapshot. Results of lookups are compared with those of queries,
+# and the columns are checked for consistency with the lookups. Note
+# enumerating quota entries requires Linux 4.6 or later and usually admin
+# privileges; without, use the quota simulator (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path      = "."
+dogrp     = False
+snap_file = "/tmp/fsquota_test.snap"
+# maximum number of entries compared with query() results
+max_check = 1000
+
+try:
+    qObj = FsQuota.Quota(path)
+
+    t_start = time.perf_counter()
+    cnt = qObj.snapshot(snap_file, grpquota=dogrp)
+    print("Wrote %d entries in %.3f s" % (cnt, time.perf_counter() - t_start))
+
+    t_start = time.perf_counter()
+    with FsQuota.Snapshot.open(snap_file) as snap:
+        print("Opened in %.6f s: %s" % (time.perf_counter() - t_start, repr(snap)))
+
+        if (len(snap) != cnt) or (snap.dev != qObj.dev):
+            print("ERROR: snapshot header does not match", file=sys.stderr)
+
+        ids = snap.column("id")
+        bcount = snap.column("bcount")
+        if list(ids) != sorted(ids):
+            print("ERROR: IDs are not sorted", file=sys.stderr)
+
+        errors = 0
+        for idx in range(min(len(ids), max_check)):
+            res = snap.lookup(ids[idx])
+            if (res is None) or (res.bcount != bcount[idx]):
+                errors += 1
+            else:
+                # mismatch is possible when usage changed meanwhile; grace
+                # times are not compared as these may be relative to now
+                cur = qObj.query(ids[idx], grpquota=dogrp)
+                if (res[0:3] + res[4:7]) != (cur[0:3] + cur[4:7]):
+                    print("Changed since snapshot: ID %d" % ids[idx])
+        if errors:
+            print("ERROR: %d lookups inconsistent with columns" % errors, file=sys.stderr)
+
+        del ids, bcount
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
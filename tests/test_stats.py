@@ -0,0 +1,62 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing the performance counters: a number of queries is done on the
+# file system containing the given path, then the counters of the object
+# and the process-wide counters are printed.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path  = "."
+ugid  = os.getuid()
+dogrp = False
+count = 100
+
+def print_lat(name, lat):
+    print("%-8s calls:%d errors:%d errno:%s avg:%.1f us" %
+          (name, lat["calls"], lat["errors"], str(lat["errno"]),
+           (lat["time_ns"] / lat["calls"] / 1000) if lat["calls"] else 0))
+    print("         histogram (< 2^N us): %s" % str(lat["histogram"]))
+
+try:
+    qObj = FsQuota.Quota(path)
+
+    for idx in range(count):
+        try:
+            qObj.query(ugid, grpquota=dogrp)
+        except FsQuota.error as e:
+            if idx == 0:
+                print("Query failed: %s" % e)
+
+    print(">>> object counters:")
+    stats = qObj.stats()
+    for key in ("query", "setqlim", "sync", "mntscan"):
+        print_lat(key, stats[key])
+    if stats["query"]["calls"] != count:
+        print("ERROR: unexpected query call count", file=sys.stderr)
+
+    print(">>> process-wide counters:")
+    stats = FsQuota.stats(reset=True)
+    for backend in ("vfs", "xfs", "btrfs", "rpc"):
+        print_lat(backend + ":query", stats[backend]["query"])
+    print("rpc: %s" % str(stats["rpc"]["rpc"]))
+    print_lat("mntscan", stats["mntscan"])
+
+    if FsQuota.stats()["mntscan"]["calls"] != 0:
+        print("ERROR: counters not reset", file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,89 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing summaries of usage distributions: quota entries of the file
+# system containing the given path are summarized by the module, both via
+# enumeration and from a snapshot. Results are compared with exact values
+# computed in Python from the complete table; quantiles are estimates with
+# a relative error of at most about 3%. Note enumerating quota entries
+# requires Linux 4.6 or later and usually admin privileges; without, use
+# the quota simulator (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import math
+import time
+import tempfile
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path      = "."
+dogrp     = False
+quantiles = (0.5, 0.9, 0.99)
+bounds    = (0.5, 0.9, 1.0)
+
+def check_dist(name, summ, values):
+    values = sorted(values)
+    if summ["sum"] != sum(values) or summ["min"] != values[0] or summ["max"] != values[-1]:
+        print("ERROR: %s: sum or extremes differ" % name, file=sys.stderr)
+    for q in quantiles:
+        exact = values[max(1, math.ceil(q * len(values))) - 1]
+        if abs(summ["quantiles"][q] - exact) > exact / 32 + 1:
+            print("ERROR: %s: quantile %g is %d, expected about %d"
+                  % (name, q, summ["quantiles"][q], exact), file=sys.stderr)
+
+def check_ratio(name, summ, entries, usage_idx):
+    counts = [0] * (len(bounds) + 1)
+    no_limit = 0
+    for uid, res in entries:
+        limit = res[usage_idx + 1] or res[usage_idx + 2]
+        if limit == 0:
+            no_limit += 1
+        else:
+            ratio = res[usage_idx] / limit
+            counts[sum(1 for bound in bounds if ratio >= bound)] += 1
+    if summ["counts"] != counts or summ["no_limit"] != no_limit:
+        print("ERROR: %s: histogram %s differs from %s"
+              % (name, str(summ), str((counts, no_limit))), file=sys.stderr)
+
+def check(label, summ, entries):
+    if summ["entries"] != len(entries):
+        print("ERROR: %s: number of entries differs" % label, file=sys.stderr)
+    if entries:
+        check_dist(label + " bcount", summ["bcount"], [res.bcount for uid, res in entries])
+        check_dist(label + " icount", summ["icount"], [res.icount for uid, res in entries])
+    check_ratio(label + " bratio", summ["bratio"], entries, 0)
+    check_ratio(label + " iratio", summ["iratio"], entries, 4)
+
+try:
+    qObj = FsQuota.Quota(path)
+
+    t_start = time.perf_counter()
+    summ = qObj.summary(grpquota=dogrp, quantiles=quantiles, ratio_bounds=bounds)
+    print("Summarized in %.3f s: %s" % (time.perf_counter() - t_start, str(summ)))
+
+    entries = qObj.query_all(grpquota=dogrp)
+    check("summary", summ, entries)
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        snap_path = os.path.join(tmpdir, "quota.snap")
+        qObj.snapshot(snap_path, grpquota=dogrp)
+
+        with FsQuota.Snapshot.open(snap_path) as snap:
+            t_start = time.perf_counter()
+            snap_summ = snap.summary(quantiles=quantiles, ratio_bounds=bounds)
+            print("Summarized snapshot in %.4f s" % (time.perf_counter() - t_start))
+            check("snapshot", snap_summ, entries)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
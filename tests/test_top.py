@@ -0,0 +1,73 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing the drill-down of quota usage: the largest files and directory
+# sub-trees owned by the given user below the given directory are
+# determined via method top_consumers() and printed, together with the
+# user's quota. The total is compared with the usage determined via
+# function FsQuota.scan_tree() for the same directory.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+uid      = os.getuid()
+top_n    = 10
+threads  = 8
+
+try:
+    qObj = FsQuota.Quota(path)
+    print("Using %s" % repr(qObj))
+
+    t_start = time.perf_counter()
+    result = qObj.top_consumers(uid, top_n, root=path, threads=threads)
+    print("top_consumers: %.3f s; %d dirs, %d files, %d errors" %
+          (time.perf_counter() - t_start, result["dirs"], result["files"], result["errors"]))
+    if result["first_error"]:
+        print("First error: %s" % str(result["first_error"]))
+
+    print("Usage of UID %d below %s: %d kB in %d inodes; quota: %s" %
+          (uid, path, result["bcount"], result["icount"], str(result["result"])))
+
+    print("Largest files:")
+    for fpath, blocks in result["top_files"]:
+        print("  %10d kB  %s" % (blocks, fpath))
+
+    print("Largest directories:")
+    for dpath, blocks, inodes in result["top_dirs"]:
+        print("  %10d kB  %8d inodes  %s" % (blocks, inodes, dpath))
+
+    if len(result["top_files"]) > top_n:
+        print("ERROR: more than %d files returned" % top_n, file=sys.stderr)
+
+    blocks = [ent[1] for ent in result["top_files"]]
+    if blocks != sorted(blocks, reverse=True):
+        print("ERROR: files are not in descending order", file=sys.stderr)
+
+    if result["top_dirs"] and (result["top_dirs"][0][0] != "."):
+        print("ERROR: root directory is not the largest sub-tree", file=sys.stderr)
+
+    usage = {xid: res for xid, res in FsQuota.scan_tree(path, threads=threads)["user"]}
+    if uid in usage:
+        if (usage[uid].bcount, usage[uid].icount) != (result["bcount"], result["icount"]):
+            print("ERROR: total differs from scan_tree(): %s" % str(usage[uid]), file=sys.stderr)
+    elif result["icount"] != 0:
+        print("ERROR: scan_tree() found no usage", file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
+except OSError as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,69 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing recording and replay of backend traffic: a workload of mount
+# table scans and queries on the file system containing the given path is
+# recorded to a trace file, then the same workload is replayed from the
+# trace. Results and elapsed time of both runs are compared.
+#
+# For replaying a trace recorded elsewhere, set "record" to False and
+# adapt the path and ID range to those used when recording.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path       = "."
+ugid_first = os.getuid()
+ugid_count = 100
+dogrp      = False
+trace_file = "/tmp/fsquota_test.trc"
+record     = True
+# factor applied to recorded latencies during replay; 0 for maximum speed
+latency_scale = 1.0
+
+def workload():
+    mnt = [tuple(ent) for ent in FsQuota.MntTab()]
+    qObj = FsQuota.Quota(path)
+    results = []
+    t_start = time.perf_counter()
+    for ugid in range(ugid_first, ugid_first + ugid_count):
+        try:
+            results.append(tuple(qObj.query(ugid, grpquota=dogrp)))
+        except FsQuota.error as e:
+            results.append(e.errno)
+    elapsed = time.perf_counter() - t_start
+    return mnt, str(qObj), results, elapsed
+
+try:
+    if record:
+        FsQuota.trace_record(trace_file)
+        rec = workload()
+        print("Recorded: %s" % str(FsQuota.trace_stop()))
+        print("Recorded elapsed: %.3f s" % rec[3])
+
+    FsQuota.trace_replay(trace_file, latency_scale=latency_scale)
+    rep = workload()
+    cnt = FsQuota.trace_stop()
+    print("Replayed: %s" % str(cnt))
+    print("Replayed elapsed: %.3f s" % rep[3])
+
+    if cnt["misses"] != 0:
+        print("ERROR: operations without matching record", file=sys.stderr)
+    if record and (rec[0:3] != rep[0:3]):
+        print("ERROR: replayed results differ from recorded ones", file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
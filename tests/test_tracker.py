@@ -0,0 +1,100 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing usage tracking via fanotify: usage of the complete file system
+# containing the given directory is seeded via method track_usage(), then
+# files are created below the directory, assigned to an otherwise unused
+# user ID, extended and deleted again. After each step, usage of that ID
+# returned by query() is compared with the expected value. Finally, tracked
+# usage of the current user is compared with the result of
+# FsQuota.scan_tree() of the directory. Note fanotify requires admin
+# privileges and Linux 5.9 or later; walking the whole file system may take
+# a while.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import os
+import sys
+import time
+import tempfile
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path       = "."
+test_uid   = 54321     # must not own files on the file system
+file_count = 100
+settle     = 0.5       # time for processing events, in seconds
+
+def check(qObj, step, files):
+    time.sleep(settle)
+    res = qObj.query(test_uid)
+    blocks = sum(os.lstat(f).st_blocks for f in files) // 2
+    print("%-8s %s" % (step, str(res)))
+    if (res.bcount, res.icount) != (blocks, len(files)):
+        print("ERROR: expected %d kB in %d inodes after %s" % (blocks, len(files), step),
+              file=sys.stderr)
+
+try:
+    qObj = FsQuota.Quota(path)
+    print("Using %s" % repr(qObj))
+
+    t_start = time.perf_counter()
+    result = qObj.track_usage()
+    print("track_usage: %.3f s; %d dirs, %d files, %d errors" %
+          (time.perf_counter() - t_start, result["dirs"], result["files"], result["errors"]))
+
+    if qObj.query(test_uid).icount != 0:
+        print("ERROR: UID %d already owns files; choose another" % test_uid, file=sys.stderr)
+
+    with tempfile.TemporaryDirectory(dir=path) as tmpdir:
+        files = []
+        for idx in range(file_count):
+            fname = os.path.join(tmpdir, "f%d" % idx)
+            with open(fname, "wb") as fh:
+                fh.write(b"x" * 4096 * (idx % 4))
+            os.chown(fname, test_uid, -1)
+            files.append(fname)
+        check(qObj, "create", files)
+
+        for fname in files[::2]:
+            with open(fname, "ab") as fh:
+                fh.write(b"y" * 65536)
+        check(qObj, "append", files)
+
+        os.link(files[0], os.path.join(tmpdir, "link"))
+        check(qObj, "link", files)
+
+        for fname in files[1::2]:
+            os.unlink(fname)
+        files = files[::2]
+        check(qObj, "unlink", files)
+
+        for fname in files:
+            os.chown(fname, os.getuid(), -1)
+        check(qObj, "chown", [])
+
+    print("Counters: %s" % str(qObj.track_stats()))
+
+    uid = os.getuid()
+    usage = {xid: res for xid, res in FsQuota.scan_tree(path)["user"]}
+    res = qObj.query(uid)
+    if (uid in usage) and ((res.bcount < usage[uid].bcount) or (res.icount < usage[uid].icount)):
+        print("ERROR: tracked usage %s less than scan_tree() %s" % (str(res), str(usage[uid])),
+              file=sys.stderr)
+
+    print("Final counters: %s" % str(qObj.track_stop()))
+    if qObj.track_stats() is not None:
+        print("ERROR: tracking still active after track_stop()", file=sys.stderr)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
+except OSError as e:
+    print("ERROR: %s" % e, file=sys.stderr)
@@ -0,0 +1,58 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing online verification of quota accounting: usage per ID of the
+# file system containing the given path is determined by a parallel walk
+# of the tree below the mount point via method verify_usage() and compared
+# with the usage reported by the kernel for user, group and project
+# quotas. IDs with a difference above the given thresholds are listed.
+# Note the walk has to be able to read all directories, i.e. usually
+# requires admin privileges. On a file system in use, small differences
+# are expected for files modified during the walk.
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path        = "."
+threads     = 8
+bthreshold  = 64        # in units of 1 kB
+ithreshold  = 2
+max_print   = 20
+
+try:
+    qObj = FsQuota.Quota(path)
+    print("Using %s" % repr(qObj))
+
+    for kind, opt in (("user", {}), ("group", {"grpquota": True}), ("project", {"prjquota": True})):
+        try:
+            t_start = time.perf_counter()
+            result = qObj.verify_usage(threads=threads, bthreshold=bthreshold,
+                                       ithreshold=ithreshold, **opt)
+        except FsQuota.error as e:
+            print("%s quota not available: %s" % (kind, e))
+            continue
+
+        print("%s: verified %d IDs in %.3f s; %d dirs, %d files, %d errors; %d IDs with drift" %
+              (kind, result["ids"], time.perf_counter() - t_start, result["dirs"],
+               result["files"], result["errors"], len(result["drift"])))
+        if result["first_error"]:
+            print("First error: %s" % str(result["first_error"]))
+
+        for xid, accounted, scanned in result["drift"][:max_print]:
+            print("  ID %d: accounted %d kB, %d inodes; scanned %d kB, %d inodes" %
+                  (xid, accounted.bcount, accounted.icount, scanned.bcount, scanned.icount))
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)
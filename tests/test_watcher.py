@@ -0,0 +1,101 @@
+#!/usr/bin/python3
+#
+# Author: T. Zoerner
+#
+# Testing the threshold watcher: entries of the file system containing the
+# given path are watched for usage reaching the soft block limit. Limits of
+# a test user are then modified, so that callbacks report the transitions.
+# An ID without quota entry is watched as well; on XFS querying it fails,
+# which must not fail the scan (e.g. run with QUOTASIM_FSTYPE=xfs).
+# Note modifying limits requires admin privileges and enumerating quota
+# entries requires Linux 4.6 or later; without, use the quota simulator
+# (see README.md).
+#
+# This program is in the public domain and can be used and
+# redistributed without restrictions.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+import sys
+import time
+import FsQuota
+
+##
+## insert your test case constants here:
+##
+path     = "."
+dogrp    = False
+# ID whose limits are modified; its limits are restored afterward
+# (default: the first enumerated entry other than root with block usage)
+test_id  = None
+# ID without quota entry, watched alongside the test ID
+unused_id = 4000000
+interval = 0.2
+
+events = []
+
+def callback(qObj, uid, matched, result):
+    events.append((uid, matched, result))
+
+def on_error(qObj, err):
+    print("ERROR: scan failed: %s" % err, file=sys.stderr)
+
+def wait_rounds(watcher, count):
+    target = watcher.rounds + count
+    while watcher.rounds < target:
+        time.sleep(interval / 10)
+
+def expect(label, expected):
+    got = [(uid, matched) for uid, matched, res in events if uid == test_id]
+    print("%s: %s" % (label, str(got)))
+    if got != expected:
+        print("ERROR: %s: expected %s" % (label, str(expected)), file=sys.stderr)
+    del events[:]
+
+try:
+    qObj = FsQuota.Quota(path)
+    if test_id is None:
+        test_id = next((uid for uid, res in qObj.query_all(grpquota=dogrp)
+                        if (uid != 0) and (res.bcount > 0)), None)
+        if test_id is None:
+            print("ERROR: no quota entry with block usage found", file=sys.stderr)
+            sys.exit(1)
+    print("Using ID %d" % test_id)
+    orig = qObj.query(test_id, grpquota=dogrp)
+    qObj.setqlim(test_id, 0, 0, orig.isoft, orig.ihard, grpquota=dogrp)
+
+    # synchronous mode, watching only the test ID and an ID without entry
+    watcher = FsQuota.Watcher(callback, on_error=on_error)
+    watcher.add(qObj, [test_id, unused_id], grpquota=dogrp)
+    watcher.poll()
+    expect("Initial poll", [])
+
+    qObj.setqlim(test_id, 1, 0, orig.isoft, orig.ihard, grpquota=dogrp)
+    watcher.poll()
+    expect("Poll after lowering the limit", [(test_id, True)] if orig.bcount >= 1 else [])
+    watcher.poll()
+    expect("Poll without change", [])
+
+    qObj.setqlim(test_id, 0, 0, orig.isoft, orig.ihard, grpquota=dogrp)
+    watcher.poll()
+    expect("Poll after removing the limit", [(test_id, False)] if orig.bcount >= 1 else [])
+
+    # background thread, watching all entries via enumeration
+    watcher = FsQuota.Watcher(callback, interval=interval, concurrency=2, on_error=on_error)
+    watcher.add(qObj, grpquota=dogrp)
+    with watcher:
+        wait_rounds(watcher, 1)
+        print("Initially matching entries: %d" % len(events))
+        del events[:]
+
+        qObj.setqlim(test_id, 1, 0, orig.isoft, orig.ihard, grpquota=dogrp)
+        wait_rounds(watcher, 2)
+        expect("Thread after lowering the limit", [(test_id, True)] if orig.bcount >= 1 else [])
+    print("Completed %d rounds" % watcher.rounds)
+
+    qObj.setqlim(test_id, orig.bsoft, orig.bhard, orig.isoft, orig.ihard, grpquota=dogrp)
+
+except FsQuota.error as e:
+    print("ERROR: %s" % e, file=sys.stderr)